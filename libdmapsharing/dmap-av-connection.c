@@ -20,7 +20,11 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <libdmapsharing/dmap-av-connection.h>
+#include <libdmapsharing/dmap-connection-private.h>
+#include <libdmapsharing/dmap-av-record.h>
 #include <libdmapsharing/dmap-structure.h>
 #include <libdmapsharing/test-dmap-db.h>
 
@@ -41,6 +45,13 @@ _get_query_metadata (G_GNUC_UNUSED DmapConnection * connection)
 			 "daap.sortartist,daap.sortalbum,com.apple.itunes.has-video");
 }
 
+/* The properties which an MLIT sets. */
+static const gchar *_mlit_properties[] = {
+	"year", "has-video", "track", "disc", "bitrate", "duration",
+	"filesize", "format", "title", "songalbum", "songartist",
+	"songgenre", "sort-artist", "sort-album", NULL
+};
+
 static DmapRecord *
 _handle_mlcl (DmapConnection * connection, DmapRecordFactory * factory,
 	      GNode * n, int *item_id)
@@ -55,6 +66,7 @@ _handle_mlcl (DmapConnection * connection, DmapRecordFactory * factory,
 	const gchar *genre = NULL;
 	const gchar *sort_artist = NULL;
 	const gchar *sort_album = NULL;
+	DmapAvRecordFields fields;
 	gint length = 0;
 	gint track_number = 0;
 	gint disc_number = 0;
@@ -136,22 +148,166 @@ _handle_mlcl (DmapConnection * connection, DmapRecordFactory * factory,
 	 * elements processed here.
 	 *
 	 * TODO: This could probably be made more clear.
+	 *
+	 * Fields the server did not send are set to zero, or NULL, as
+	 * they were before; they do not keep the record's defaults.
 	 */
-	g_object_set (record,
-		      "year", year,
-		      "has-video", has_video,
-		      "track", track_number,
-		      "disc", disc_number,
-		      "bitrate", bitrate,
-		      "duration", length / 1000,
-		      "filesize", (guint64) size,
-		      "format", format,
-		      "title", title,
-		      "songalbum", album,
-		      "songartist", artist,
-		      "songgenre", genre,
-		      "sort-artist", sort_artist,
-		      "sort-album", sort_album, NULL);
+	memset (&fields, 0, sizeof fields);
+	fields.year = year;
+	fields.has_video = has_video;
+	fields.track = track_number;
+	fields.disc = disc_number;
+	fields.bitrate = bitrate;
+	fields.duration = length / 1000;
+	fields.filesize = size;
+	fields.format = format;
+	fields.title = title;
+	fields.songalbum = album;
+	fields.songartist = artist;
+	fields.songgenre = genre;
+	fields.sort_artist = sort_artist;
+	fields.sort_album = sort_album;
+	dmap_av_record_set_some_fields (DMAP_AV_RECORD (record), &fields,
+	                                _mlit_properties);
+
+done:
+	return record;
+}
+
+/* String tags that _handle_mlit() copies into a record. */
+enum {
+	MLIT_TITLE,
+	MLIT_ALBUM,
+	MLIT_ARTIST,
+	MLIT_FORMAT,
+	MLIT_GENRE,
+	MLIT_SORT_ARTIST,
+	MLIT_SORT_ALBUM,
+	MLIT_NUM_STRINGS
+};
+
+static DmapRecord *
+_handle_mlit (DmapConnection * connection, DmapRecordFactory * factory,
+              const guint8 * buf, gsize buf_length, gint * item_id)
+{
+	DmapStructureCursor cursor;
+	GError *error = NULL;
+	DmapRecord *record = NULL;
+	const gchar *views[MLIT_NUM_STRINGS] = { NULL };
+	gsize sizes[MLIT_NUM_STRINGS] = { 0 };
+	gchar *strings[MLIT_NUM_STRINGS] = { NULL };
+	DmapAvRecordFields fields;
+	gint length = 0;
+	gint track_number = 0;
+	gint disc_number = 0;
+	gint year = 0;
+	gboolean has_video = FALSE;
+	gint size = 0;
+	gint bitrate = 0;
+	guint i;
+
+	dmap_structure_cursor_init (&cursor, buf, buf_length);
+	while (dmap_structure_cursor_next (&cursor, &error)) {
+		gint string = -1;
+
+		switch (cursor.content_code) {
+		case DMAP_CC_MIID:
+			*item_id = dmap_structure_cursor_get_int (&cursor);
+			break;
+		case DMAP_CC_MINM:
+			string = MLIT_TITLE;
+			break;
+		case DMAP_CC_ASAL:
+			string = MLIT_ALBUM;
+			break;
+		case DMAP_CC_ASAR:
+			string = MLIT_ARTIST;
+			break;
+		case DMAP_CC_ASFM:
+			string = MLIT_FORMAT;
+			break;
+		case DMAP_CC_ASGN:
+			string = MLIT_GENRE;
+			break;
+		case DMAP_CC_ASSA:
+			string = MLIT_SORT_ARTIST;
+			break;
+		case DMAP_CC_ASSU:
+			string = MLIT_SORT_ALBUM;
+			break;
+		case DMAP_CC_AEHV:
+			has_video = dmap_structure_cursor_get_int (&cursor);
+			break;
+		case DMAP_CC_ASTM:
+			length = dmap_structure_cursor_get_int (&cursor);
+			break;
+		case DMAP_CC_ASTN:
+			track_number = dmap_structure_cursor_get_int (&cursor);
+			break;
+		case DMAP_CC_ASDN:
+			disc_number = dmap_structure_cursor_get_int (&cursor);
+			break;
+		case DMAP_CC_ASYR:
+			year = dmap_structure_cursor_get_int (&cursor);
+			break;
+		case DMAP_CC_ASSZ:
+			size = dmap_structure_cursor_get_int (&cursor);
+			break;
+		case DMAP_CC_ASBR:
+			bitrate = dmap_structure_cursor_get_int (&cursor);
+			break;
+		default:
+			break;
+		}
+
+		if (string >= 0) {
+			views[string] = dmap_structure_cursor_get_string
+				(&cursor, &sizes[string]);
+		}
+	}
+
+	if (NULL != error) {
+		g_debug ("Could not read MLIT: %s", error->message);
+		g_clear_error (&error);
+		goto done;
+	}
+
+	record = dmap_record_factory_create (factory, NULL, &error);
+	if (NULL != error) {
+		g_signal_emit_by_name (connection, "error", error);
+		goto done;
+	}
+	g_assert(NULL != record);
+
+	/* The views are not NUL-terminated, so are copied. The record
+	 * copies them again, or interns them if it keeps them that way. */
+	for (i = 0; i < MLIT_NUM_STRINGS; i++) {
+		if (NULL != views[i]) {
+			strings[i] = g_strndup (views[i], sizes[i]);
+		}
+	}
+
+	memset (&fields, 0, sizeof fields);
+	fields.year = year;
+	fields.has_video = has_video;
+	fields.track = track_number;
+	fields.disc = disc_number;
+	fields.bitrate = bitrate;
+	fields.duration = length / 1000;
+	fields.filesize = size;
+	fields.format = strings[MLIT_FORMAT];
+	fields.title = strings[MLIT_TITLE];
+	fields.songalbum = strings[MLIT_ALBUM];
+	fields.songartist = strings[MLIT_ARTIST];
+	fields.songgenre = strings[MLIT_GENRE];
+	fields.sort_artist = strings[MLIT_SORT_ARTIST];
+	fields.sort_album = strings[MLIT_SORT_ALBUM];
+	dmap_av_record_set_some_fields (DMAP_AV_RECORD (record), &fields,
+	                                _mlit_properties);
+
+	for (i = 0; i < MLIT_NUM_STRINGS; i++) {
+		g_free (strings[i]);
+	}
 
 done:
 	return record;
@@ -167,6 +323,8 @@ dmap_av_connection_class_init (DmapAvConnectionClass * klass)
 	parent_class->get_protocol_version_cc = _get_protocol_version_cc;
 	parent_class->get_query_metadata = _get_query_metadata;
 	parent_class->handle_mlcl = _handle_mlcl;
+
+	dmap_connection_class_set_mlit_handler (parent_class, _handle_mlit);
 }
 
 DmapAvConnection *
@@ -402,6 +560,86 @@ START_TEST(_handle_mlcl_bad_code_test)
 }
 END_TEST
 
+START_TEST(_handle_mlit_test)
+{
+	TestDmapAvRecordFactory *factory;
+	DmapStructureBuilder *builder;
+	DmapRecord *record;
+	gchar *data;
+	guint length;
+	gchar *title = NULL, *artist = NULL, *genre = NULL, *album = NULL;
+	gint track = 0, year = 0, duration = 0;
+	gboolean has_video = FALSE;
+	gint item_id = 0;
+
+	/* Tags are read from the body of the MLIT, so it needs no header. */
+	builder = dmap_structure_builder_new (0);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_MIID, 70);
+	dmap_structure_builder_add_string (builder, DMAP_CC_MINM, "title");
+	dmap_structure_builder_add_string (builder, DMAP_CC_ASAR, "artist");
+	dmap_structure_builder_add_string (builder, DMAP_CC_ASGN, "");
+	dmap_structure_builder_add_int8 (builder, DMAP_CC_AEHV, TRUE);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_ASTM, 10000);
+	dmap_structure_builder_add_int16 (builder, DMAP_CC_ASTN, 20);
+	dmap_structure_builder_add_int16 (builder, DMAP_CC_ASYR, 1999);
+	data = dmap_structure_builder_finish (builder, &length);
+
+	factory = test_dmap_av_record_factory_new();
+	record  = _handle_mlit(NULL, DMAP_RECORD_FACTORY(factory),
+	                       (guint8 *) data, length, &item_id);
+	g_free (data);
+
+	ck_assert_int_eq(70, item_id);
+
+	g_object_get(record, "title", &title,
+	                     "songartist", &artist,
+	                     "songgenre", &genre,
+	                     "songalbum", &album,
+	                     "has-video", &has_video,
+	                     "duration", &duration,
+	                     "track", &track,
+	                     "year", &year, NULL);
+
+	ck_assert_str_eq("title", title);
+	ck_assert_str_eq("artist", artist);
+	ck_assert_str_eq("", genre);
+	ck_assert(NULL == album);
+	ck_assert(has_video);
+	ck_assert_int_eq(10, duration);
+	ck_assert_int_eq(20, track);
+	ck_assert_int_eq(1999, year);
+
+	g_free(title);
+	g_free(artist);
+	g_free(genre);
+	g_object_unref(record);
+	g_object_unref(factory);
+}
+END_TEST
+
+/* Skip tags this library does not know. */
+START_TEST(_handle_mlit_unknown_code_test)
+{
+	static const guint8 data[] = "xxxx\x00\x00\x00\x05value"
+	                             "minm\x00\x00\x00\x05title";
+	TestDmapAvRecordFactory *factory;
+	DmapRecord *record;
+	gchar *title = NULL;
+	gint item_id = 0;
+
+	factory = test_dmap_av_record_factory_new();
+	record  = _handle_mlit(NULL, DMAP_RECORD_FACTORY(factory),
+	                       data, sizeof data - 1, &item_id);
+
+	g_object_get(record, "title", &title, NULL);
+	ck_assert_str_eq("title", title);
+	g_free(title);
+
+	g_object_unref(record);
+	g_object_unref(factory);
+}
+END_TEST
+
 #include "dmap-av-connection-suite.c"
 
 #endif
@@ -20,6 +20,8 @@
 
 #include "config.h"
 
+#include <string.h>
+
 #include <libdmapsharing/dmap-av-record.h>
 #include <libdmapsharing/dmap-enums.h>
 
@@ -211,13 +213,292 @@ dmap_av_record_read (DmapAvRecord * record, GError ** err)
 	return DMAP_AV_RECORD_GET_INTERFACE (record)->read (record, err);
 }
 
+void
+dmap_av_record_get_fields (DmapAvRecord * record, DmapAvRecordFields * fields)
+{
+	DmapAvRecordInterface *iface = DMAP_AV_RECORD_GET_INTERFACE (record);
+	gchar **copies = fields->copies;
+
+	memset (fields, 0, sizeof *fields);
+
+	if (iface->get_fields) {
+		iface->get_fields (record, fields);
+		goto done;
+	}
+
+	/* Properties return copies, which fields keeps until cleared. */
+	g_object_get (record,
+	              "location", &copies[0],
+	              "title", &copies[1],
+	              "songalbum", &copies[2],
+	              "sort-album", &copies[3],
+	              "songartist", &copies[4],
+	              "sort-artist", &copies[5],
+	              "songgenre", &copies[6],
+	              "format", &copies[7],
+	              "songalbumid", &fields->songalbumid,
+	              "filesize", &fields->filesize,
+	              "mediakind", &fields->mediakind,
+	              "rating", &fields->rating,
+	              "duration", &fields->duration,
+	              "track", &fields->track,
+	              "year", &fields->year,
+	              "firstseen", &fields->firstseen,
+	              "mtime", &fields->mtime,
+	              "disc", &fields->disc,
+	              "bitrate", &fields->bitrate,
+	              "has-video", &fields->has_video,
+	              NULL);
+
+	fields->location = copies[0];
+	fields->title = copies[1];
+	fields->songalbum = copies[2];
+	fields->sort_album = copies[3];
+	fields->songartist = copies[4];
+	fields->sort_artist = copies[5];
+	fields->songgenre = copies[6];
+	fields->format = copies[7];
+
+done:
+	return;
+}
+
+/* Where each property is kept in DmapAvRecordFields. A string is read
+ * into copies[copy], which the member then points to. */
+static const struct {
+	const gchar *name;
+	gsize offset;
+	GType type;
+	gint copy;
+} _properties[] = {
+#define STRING(name, member, copy) \
+	{ name, G_STRUCT_OFFSET (DmapAvRecordFields, member), G_TYPE_STRING, copy }
+#define VALUE(name, member, type) \
+	{ name, G_STRUCT_OFFSET (DmapAvRecordFields, member), type, -1 }
+	STRING ("location", location, 0),
+	STRING ("title", title, 1),
+	STRING ("songalbum", songalbum, 2),
+	STRING ("sort-album", sort_album, 3),
+	STRING ("songartist", songartist, 4),
+	STRING ("sort-artist", sort_artist, 5),
+	STRING ("songgenre", songgenre, 6),
+	STRING ("format", format, 7),
+	VALUE ("songalbumid", songalbumid, G_TYPE_INT64),
+	VALUE ("filesize", filesize, G_TYPE_UINT64),
+	VALUE ("mediakind", mediakind, G_TYPE_ENUM),
+	VALUE ("rating", rating, G_TYPE_INT),
+	VALUE ("duration", duration, G_TYPE_INT),
+	VALUE ("track", track, G_TYPE_INT),
+	VALUE ("year", year, G_TYPE_INT),
+	VALUE ("firstseen", firstseen, G_TYPE_INT),
+	VALUE ("mtime", mtime, G_TYPE_INT),
+	VALUE ("disc", disc, G_TYPE_INT),
+	VALUE ("bitrate", bitrate, G_TYPE_INT),
+	VALUE ("has-video", has_video, G_TYPE_BOOLEAN),
+#undef STRING
+#undef VALUE
+};
+
+static gint
+_property_lookup (const gchar * name)
+{
+	gint i;
+
+	for (i = 0; i < (gint) G_N_ELEMENTS (_properties); i++) {
+		if (0 == strcmp (_properties[i].name, name)) {
+			goto done;
+		}
+	}
+
+	g_warning ("%s is not a field of DmapAvRecord", name);
+	i = -1;
+
+done:
+	return i;
+}
+
+static gsize
+_property_size (guint i)
+{
+	gsize size;
+
+	switch (_properties[i].type) {
+	case G_TYPE_STRING:
+		size = sizeof (const gchar *);
+		break;
+	case G_TYPE_INT64:
+	case G_TYPE_UINT64:
+		size = sizeof (gint64);
+		break;
+	default:
+		size = sizeof (gint);
+		break;
+	}
+
+	return size;
+}
+
+void
+dmap_av_record_get_some_fields (DmapAvRecord * record,
+                                DmapAvRecordFields * fields,
+                                const gchar * const *properties)
+{
+	DmapAvRecordInterface *iface = DMAP_AV_RECORD_GET_INTERFACE (record);
+	gchar **copies = fields->copies;
+
+	if (iface->get_fields) {
+		dmap_av_record_get_fields (record, fields);
+		goto done;
+	}
+
+	memset (fields, 0, sizeof *fields);
+
+	for (; *properties; properties++) {
+		gint i = _property_lookup (*properties);
+		gpointer member;
+
+		if (i < 0) {
+			continue;
+		}
+
+		member = G_STRUCT_MEMBER_P (fields, _properties[i].offset);
+		if (G_TYPE_STRING == _properties[i].type) {
+			gchar **copy = &copies[_properties[i].copy];
+
+			g_free (*copy);
+			g_object_get (record, *properties, copy, NULL);
+			*(const gchar **) member = *copy;
+		} else {
+			g_object_get (record, *properties, member, NULL);
+		}
+	}
+
+done:
+	return;
+}
+
+void
+dmap_av_record_set_some_fields (DmapAvRecord * record,
+                                const DmapAvRecordFields * fields,
+                                const gchar * const *properties)
+{
+	DmapAvRecordInterface *iface = DMAP_AV_RECORD_GET_INTERFACE (record);
+	DmapAvRecordFields all;
+
+	if (iface->get_fields && iface->set_fields) {
+		/* Cheaper than a property at a time: keep the rest. */
+		dmap_av_record_get_fields (record, &all);
+		for (; *properties; properties++) {
+			gint i = _property_lookup (*properties);
+			gsize offset;
+
+			if (i < 0) {
+				continue;
+			}
+
+			offset = _properties[i].offset;
+			memcpy (G_STRUCT_MEMBER_P (&all, offset),
+			        G_STRUCT_MEMBER_P (fields, offset),
+			        _property_size (i));
+		}
+		iface->set_fields (record, &all);
+		dmap_av_record_fields_clear (&all);
+		goto done;
+	}
+
+	g_object_freeze_notify (G_OBJECT (record));
+	for (; *properties; properties++) {
+		gint i = _property_lookup (*properties);
+		gconstpointer member;
+
+		if (i < 0) {
+			continue;
+		}
+
+		member = G_STRUCT_MEMBER_P (fields, _properties[i].offset);
+		switch (_properties[i].type) {
+		case G_TYPE_STRING:
+			g_object_set (record, *properties,
+			              *(const gchar * const *) member, NULL);
+			break;
+		case G_TYPE_INT64:
+			g_object_set (record, *properties,
+			              *(const gint64 *) member, NULL);
+			break;
+		case G_TYPE_UINT64:
+			g_object_set (record, *properties,
+			              *(const guint64 *) member, NULL);
+			break;
+		default:
+			g_object_set (record, *properties,
+			              *(const gint *) member, NULL);
+			break;
+		}
+	}
+	g_object_thaw_notify (G_OBJECT (record));
+
+done:
+	return;
+}
+
+void
+dmap_av_record_set_fields (DmapAvRecord * record,
+                           const DmapAvRecordFields * fields)
+{
+	DmapAvRecordInterface *iface = DMAP_AV_RECORD_GET_INTERFACE (record);
+
+	if (iface->set_fields) {
+		iface->set_fields (record, fields);
+		goto done;
+	}
+
+	g_object_set (record,
+	              "location", fields->location,
+	              "title", fields->title,
+	              "songalbum", fields->songalbum,
+	              "sort-album", fields->sort_album,
+	              "songartist", fields->songartist,
+	              "sort-artist", fields->sort_artist,
+	              "songgenre", fields->songgenre,
+	              "format", fields->format,
+	              "songalbumid", fields->songalbumid,
+	              "filesize", fields->filesize,
+	              "mediakind", fields->mediakind,
+	              "rating", fields->rating,
+	              "duration", fields->duration,
+	              "track", fields->track,
+	              "year", fields->year,
+	              "firstseen", fields->firstseen,
+	              "mtime", fields->mtime,
+	              "disc", fields->disc,
+	              "bitrate", fields->bitrate,
+	              "has-video", fields->has_video,
+	              NULL);
+
+done:
+	return;
+}
+
+void
+dmap_av_record_fields_clear (DmapAvRecordFields * fields)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (fields->copies); i++) {
+		g_clear_pointer (&fields->copies[i], g_free);
+	}
+}
+
+/* What an album sort reads from each record. */
+static const gchar *_album_properties[] = {
+	"sort-album", "songalbum", "track", NULL
+};
+
 gint
 dmap_av_record_cmp_by_album (gpointer a, gpointer b, DmapDb * db)
 {
 	DmapAvRecord *record_a, *record_b;
-	gchar *album_a, *album_b;
-	gchar *sort_album_a, *sort_album_b;
-	gint track_a, track_b;
+	DmapAvRecordFields fields_a, fields_b;
 	gint ret;
 
 	record_a =
@@ -228,31 +509,145 @@ dmap_av_record_cmp_by_album (gpointer a, gpointer b, DmapDb * db)
 	g_assert (record_a);
 	g_assert (record_b);
 
-	g_object_get (record_a, "songalbum", &album_a, "sort-album",
-		      &sort_album_a, "track", &track_a, NULL);
-	g_object_get (record_b, "songalbum", &album_b, "sort-album",
-		      &sort_album_b, "track", &track_b, NULL);
-	if (sort_album_a && sort_album_b) {
-		ret = g_strcmp0 (sort_album_a, sort_album_b);
+	dmap_av_record_get_some_fields (record_a, &fields_a, _album_properties);
+	dmap_av_record_get_some_fields (record_b, &fields_b, _album_properties);
+	if (fields_a.sort_album && fields_b.sort_album) {
+		ret = g_strcmp0 (fields_a.sort_album, fields_b.sort_album);
 	} else {
-		ret = g_strcmp0 (album_a, album_b);
+		ret = g_strcmp0 (fields_a.songalbum, fields_b.songalbum);
 	}
 	if (ret == 0) {
-		if (track_a < track_b) {
+		if (fields_a.track < fields_b.track) {
 			ret = -1;
 		} else {
-			ret = (track_a == track_b) ? 0 : 1;
+			ret = (fields_a.track == fields_b.track) ? 0 : 1;
 		}
 	}
+	dmap_av_record_fields_clear (&fields_a);
+	dmap_av_record_fields_clear (&fields_b);
 	g_object_unref (record_a);
 	g_object_unref (record_b);
-	g_free (album_a);
-	g_free (album_b);
-	g_free (sort_album_a);
-	g_free (sort_album_b);
 	return ret;
 }
 
+/* What an album sort compares, read once per record. Albums point into
+ * the string chunk of an AlbumKeys. */
+typedef struct {
+	const gchar *sort_album;
+	const gchar *album;
+	gint track;
+	guint id;
+} AlbumKey;
+
+typedef struct {
+	GStringChunk *chunk;
+	/* Each album seen, to what it is compared by. */
+	GHashTable *keys;
+	gboolean collate;
+} AlbumKeys;
+
+/* Albums repeat once per track, so each distinct one is stored, and
+ * collated, once. */
+static const gchar *
+_album_key (AlbumKeys * keys, const gchar * album)
+{
+	const gchar *key = NULL;
+
+	if (album == NULL) {
+		goto done;
+	}
+
+	key = g_hash_table_lookup (keys->keys, album);
+	if (key == NULL) {
+		const gchar *stored;
+
+		stored = g_string_chunk_insert_const (keys->chunk, album);
+		if (keys->collate) {
+			gchar *collated = g_utf8_collate_key (album, -1);
+
+			key = g_string_chunk_insert (keys->chunk, collated);
+			g_free (collated);
+		} else {
+			key = stored;
+		}
+		g_hash_table_insert (keys->keys, (gpointer) stored,
+		                     (gpointer) key);
+	}
+
+done:
+	return key;
+}
+
+static gint
+_album_key_cmp (const AlbumKey * a, const AlbumKey * b)
+{
+	gint ret;
+
+	if (a->sort_album && b->sort_album) {
+		ret = g_strcmp0 (a->sort_album, b->sort_album);
+	} else {
+		ret = g_strcmp0 (a->album, b->album);
+	}
+	if (ret == 0) {
+		if (a->track < b->track) {
+			ret = -1;
+		} else {
+			ret = (a->track == b->track) ? 0 : 1;
+		}
+	}
+
+	return ret;
+}
+
+GList *
+dmap_av_record_sort_by_album (GHashTable * records, gboolean collate)
+{
+	GHashTableIter iter;
+	gpointer id, record;
+	AlbumKeys keys;
+	GArray *sorted;
+	GList *ids = NULL;
+	guint i;
+
+	keys.chunk = g_string_chunk_new (4096);
+	keys.keys = g_hash_table_new (g_str_hash, g_str_equal);
+	keys.collate = collate;
+
+	sorted = g_array_sized_new (FALSE, FALSE, sizeof (AlbumKey),
+	                            g_hash_table_size (records));
+
+	g_hash_table_iter_init (&iter, records);
+	while (g_hash_table_iter_next (&iter, &id, &record)) {
+		DmapAvRecordFields fields;
+		AlbumKey key;
+
+		dmap_av_record_get_some_fields (DMAP_AV_RECORD (record),
+		                                &fields, _album_properties);
+		key.sort_album = _album_key (&keys, fields.sort_album);
+		key.album = _album_key (&keys, fields.songalbum);
+		key.track = fields.track;
+		key.id = GPOINTER_TO_UINT (id);
+		dmap_av_record_fields_clear (&fields);
+
+		g_array_append_val (sorted, key);
+	}
+
+	/* A stable sort, as g_list_sort() is. */
+	g_array_sort (sorted, (GCompareFunc) _album_key_cmp);
+
+	for (i = sorted->len; i > 0; i--) {
+		ids = g_list_prepend (ids, GUINT_TO_POINTER
+		                      (g_array_index (sorted, AlbumKey,
+		                                      i - 1).id));
+	}
+
+	g_array_unref (sorted);
+	g_hash_table_destroy (keys.keys);
+	g_string_chunk_free (keys.chunk);
+
+	return ids;
+}
+
 #ifdef HAVE_CHECK
 
 #include <check.h>
@@ -444,6 +839,138 @@ START_TEST(_cmp_by_album_test)
 }
 END_TEST
 
+/* TestDmapAvRecord has no get_fields or set_fields, so these use the
+ * properties. */
+START_TEST(_fields_fallback_test)
+{
+	DmapAvRecord *record;
+	DmapAvRecordFields fields;
+	gchar *album = NULL;
+	gint track = 0;
+
+	record = DMAP_AV_RECORD (test_dmap_av_record_new ());
+	g_object_set (record, "songalbum", "a", "track", 3,
+	              "mediakind", DMAP_MEDIA_KIND_MOVIE, NULL);
+
+	dmap_av_record_get_fields (record, &fields);
+	ck_assert_str_eq ("a", fields.songalbum);
+	ck_assert_int_eq (3, fields.track);
+	ck_assert_int_eq (DMAP_MEDIA_KIND_MOVIE, fields.mediakind);
+
+	fields.songalbum = "b";
+	fields.track = 4;
+	dmap_av_record_set_fields (record, &fields);
+	dmap_av_record_fields_clear (&fields);
+
+	g_object_get (record, "songalbum", &album, "track", &track, NULL);
+	ck_assert_str_eq ("b", album);
+	ck_assert_int_eq (4, track);
+
+	g_free (album);
+	g_object_unref (record);
+}
+END_TEST
+
+/* Without get_fields, only the named properties are read or written. */
+START_TEST(_some_fields_fallback_test)
+{
+	static const gchar *properties[] = { "songalbum", "track", NULL };
+	DmapAvRecord *record;
+	DmapAvRecordFields fields;
+	gchar *album = NULL, *artist = NULL;
+	gint track = 0;
+
+	record = DMAP_AV_RECORD (test_dmap_av_record_new ());
+	g_object_set (record, "songalbum", "a", "songartist", "b",
+	              "track", 3, "year", 2000, NULL);
+
+	dmap_av_record_get_some_fields (record, &fields, properties);
+	ck_assert_str_eq ("a", fields.songalbum);
+	ck_assert_int_eq (3, fields.track);
+	ck_assert (NULL == fields.songartist);
+	ck_assert_int_eq (0, fields.year);
+	dmap_av_record_fields_clear (&fields);
+
+	memset (&fields, 0, sizeof fields);
+	fields.songalbum = "c";
+	fields.track = 4;
+	dmap_av_record_set_some_fields (record, &fields, properties);
+
+	g_object_get (record, "songalbum", &album, "songartist", &artist,
+	              "track", &track, NULL);
+	ck_assert_str_eq ("c", album);
+	ck_assert_str_eq ("b", artist);
+	ck_assert_int_eq (4, track);
+
+	g_free (album);
+	g_free (artist);
+	g_object_unref (record);
+}
+END_TEST
+
+static GHashTable *
+_sort_by_album_records_test (void)
+{
+	GHashTable *records;
+	const gchar *albums[] = { "c", "a", "b", "a" };
+	const gchar *sort_albums[] = { NULL, "a", "b", "a" };
+	const gint tracks[] = { 1, 2, 1, 1 };
+	guint i;
+
+	records = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+	                                 NULL, g_object_unref);
+
+	for (i = 0; i < G_N_ELEMENTS (albums); i++) {
+		TestDmapAvRecord *record = test_dmap_av_record_new ();
+
+		g_object_set (record, "songalbum", albums[i],
+		                      "sort-album", sort_albums[i],
+		                      "track", tracks[i], NULL);
+		g_hash_table_insert (records, GUINT_TO_POINTER (i + 1), record);
+	}
+
+	return records;
+}
+
+START_TEST(_sort_by_album_test)
+{
+	GHashTable *records = _sort_by_album_records_test ();
+	GList *ids;
+
+	ids = dmap_av_record_sort_by_album (records, FALSE);
+
+	/* By album, then by track. */
+	ck_assert_int_eq (4, g_list_length (ids));
+	ck_assert_int_eq (4, GPOINTER_TO_UINT (g_list_nth_data (ids, 0)));
+	ck_assert_int_eq (2, GPOINTER_TO_UINT (g_list_nth_data (ids, 1)));
+	ck_assert_int_eq (3, GPOINTER_TO_UINT (g_list_nth_data (ids, 2)));
+	ck_assert_int_eq (1, GPOINTER_TO_UINT (g_list_nth_data (ids, 3)));
+
+	g_list_free (ids);
+	g_hash_table_destroy (records);
+}
+END_TEST
+
+START_TEST(_sort_by_album_collate_test)
+{
+	GHashTable *records = _sort_by_album_records_test ();
+	GList *plain, *collated, *a, *b;
+
+	plain = dmap_av_record_sort_by_album (records, FALSE);
+	collated = dmap_av_record_sort_by_album (records, TRUE);
+
+	/* Lower case ASCII collates as it compares, in any locale. */
+	for (a = plain, b = collated; a && b; a = a->next, b = b->next) {
+		ck_assert (a->data == b->data);
+	}
+	ck_assert (a == NULL && b == NULL);
+
+	g_list_free (plain);
+	g_list_free (collated);
+	g_hash_table_destroy (records);
+}
+END_TEST
+
 #include "dmap-av-record-suite.c"
 
 #endif
@@ -72,12 +72,69 @@ G_BEGIN_DECLS
 typedef struct _DmapAvRecord DmapAvRecord;
 typedef struct _DmapAvRecordInterface DmapAvRecordInterface;
 
+/**
+ * DmapAvRecordFields:
+ * @location: the "location" property.
+ * @title: the "title" property.
+ * @songalbum: the "songalbum" property.
+ * @sort_album: the "sort-album" property.
+ * @songartist: the "songartist" property.
+ * @sort_artist: the "sort-artist" property.
+ * @songgenre: the "songgenre" property.
+ * @format: the "format" property.
+ * @songalbumid: the "songalbumid" property.
+ * @filesize: the "filesize" property.
+ * @mediakind: the "mediakind" property.
+ * @rating: the "rating" property.
+ * @duration: the "duration" property.
+ * @track: the "track" property.
+ * @year: the "year" property.
+ * @firstseen: the "firstseen" property.
+ * @mtime: the "mtime" property.
+ * @disc: the "disc" property.
+ * @bitrate: the "bitrate" property.
+ * @has_video: the "has-video" property.
+ *
+ * Every property of a #DmapAvRecord but "hash", for reading or writing
+ * in one call. See dmap_av_record_get_fields().
+ */
+typedef struct {
+	const gchar *location;
+	const gchar *title;
+	const gchar *songalbum;
+	const gchar *sort_album;
+	const gchar *songartist;
+	const gchar *sort_artist;
+	const gchar *songgenre;
+	const gchar *format;
+	gint64 songalbumid;
+	guint64 filesize;
+	DmapMediaKind mediakind;
+	gint rating;
+	gint duration;
+	gint track;
+	gint year;
+	gint firstseen;
+	gint mtime;
+	gint disc;
+	gint bitrate;
+	gboolean has_video;
+
+	/*< private >*/
+	gchar *copies[8];
+} DmapAvRecordFields;
+
 struct _DmapAvRecordInterface
 {
 	GTypeInterface parent;
 
 	  gboolean (*itunes_compat) (DmapAvRecord * record);
 	GInputStream *(*read) (DmapAvRecord * record, GError ** err);
+
+	/* Optional; properties are used if these are NULL. */
+	void (*get_fields) (DmapAvRecord * record, DmapAvRecordFields * fields);
+	void (*set_fields) (DmapAvRecord * record,
+	                    const DmapAvRecordFields * fields);
 };
 
 GType dmap_av_record_get_type (void);
@@ -100,6 +157,70 @@ gboolean dmap_av_record_itunes_compat (DmapAvRecord * record);
  */
 GInputStream *dmap_av_record_read (DmapAvRecord * record, GError ** err);
 
+/**
+ * dmap_av_record_get_fields:
+ * @record: a DmapAvRecord.
+ * @fields: (out caller-allocates): the fields to fill in.
+ *
+ * Reads every property of @record but "hash" in one call, which costs
+ * much less than a g_object_get() of each when the record implements
+ * #DmapAvRecordInterface's get_fields. The strings in @fields belong to
+ * @record, and remain valid until @record is changed or finalized, or
+ * @fields is passed to dmap_av_record_fields_clear().
+ */
+void dmap_av_record_get_fields (DmapAvRecord * record,
+                                DmapAvRecordFields * fields);
+
+/**
+ * dmap_av_record_set_fields:
+ * @record: a DmapAvRecord.
+ * @fields: the fields to set.
+ *
+ * Sets every property of @record but "hash" in one call. To set only
+ * some, first read the others with dmap_av_record_get_fields().
+ */
+void dmap_av_record_set_fields (DmapAvRecord * record,
+                                const DmapAvRecordFields * fields);
+
+/**
+ * dmap_av_record_get_some_fields:
+ * @record: a DmapAvRecord.
+ * @fields: (out caller-allocates): the fields to fill in.
+ * @properties: (array zero-terminated=1): the names of the properties
+ * wanted.
+ *
+ * Like dmap_av_record_get_fields(), but if @record does not implement
+ * #DmapAvRecordInterface's get_fields, reads only the named properties
+ * and leaves the other members of @fields zero. Pass @fields to
+ * dmap_av_record_fields_clear() when done.
+ */
+void dmap_av_record_get_some_fields (DmapAvRecord * record,
+                                     DmapAvRecordFields * fields,
+                                     const gchar * const *properties);
+
+/**
+ * dmap_av_record_set_some_fields:
+ * @record: a DmapAvRecord.
+ * @fields: the fields to set.
+ * @properties: (array zero-terminated=1): the names of the properties
+ * to set from @fields.
+ *
+ * Sets the named properties of @record from @fields, and leaves the
+ * others as they are.
+ */
+void dmap_av_record_set_some_fields (DmapAvRecord * record,
+                                     const DmapAvRecordFields * fields,
+                                     const gchar * const *properties);
+
+/**
+ * dmap_av_record_fields_clear:
+ * @fields: fields filled in by dmap_av_record_get_fields().
+ *
+ * Frees any strings which dmap_av_record_get_fields() had to copy into
+ * @fields.
+ */
+void dmap_av_record_fields_clear (DmapAvRecordFields * fields);
+
 /**
  * dmap_av_record_cmp_by_album:
  * @a: first ID.
@@ -107,10 +228,26 @@ GInputStream *dmap_av_record_read (DmapAvRecord * record, GError ** err);
  * @db: A DmapDb for which a and b are valid ID's.
  *
  * Compares the two records associated with the provided keys according
- * to album. Suitable to sort lists of albums.
+ * to album. Suitable to sort lists of albums; dmap_av_record_sort_by_album()
+ * sorts a whole set of records faster.
  */
 gint dmap_av_record_cmp_by_album (gpointer a, gpointer b, DmapDb * db);
 
+/**
+ * dmap_av_record_sort_by_album:
+ * @records: (element-type guint DmapAvRecord): records by ID, such as
+ * those returned by dmap_db_apply_filter().
+ * @collate: whether to compare albums as g_utf8_collate() would, in the
+ * current locale, rather than byte by byte.
+ *
+ * Sorts @records in the order of dmap_av_record_cmp_by_album(), reading
+ * each record once rather than once per comparison.
+ *
+ * Returns: (element-type guint) (transfer container): the IDs of
+ * @records, sorted.
+ */
+GList *dmap_av_record_sort_by_album (GHashTable * records, gboolean collate);
+
 #endif /* _DMAP_AV_RECORD_H */
 
 G_END_DECLS
@@ -57,6 +57,7 @@ static void _databases_items_xxx (DmapShare * share,
                                   const char *path);
 static struct DmapMetaDataMap *_get_meta_data_map (DmapShare * share);
 static void _add_entry_to_mlcl (guint id, DmapRecord * record, gpointer mb);
+static void _set_emitters (DmapShareClass * klass);
 
 #define DAAP_TYPE_OF_SERVICE "_daap._tcp"
 #define DAAP_PORT 3689
@@ -77,6 +78,8 @@ dmap_av_share_class_init (DmapAvShareClass * klass)
 	parent_class->databases_browse_xxx = _databases_browse_xxx;
 	parent_class->databases_items_xxx = _databases_items_xxx;
 	parent_class->server_info = _server_info;
+
+	_set_emitters (parent_class);
 }
 
 static void
@@ -497,339 +500,538 @@ done:
 	return;
 }
 
+/* Emitters for _add_entry_to_mlcl, one per field a client may request.
+ * fields is the record's DmapAvRecordFields. */
+
 static void
-_add_entry_to_mlcl (guint id, DmapRecord * record, gpointer _mb)
+_emit_item_kind (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                 G_GNUC_UNUSED DmapRecord * record,
+                 G_GNUC_UNUSED gconstpointer fields)
 {
-	GNode *mlit;
-	gboolean has_video = 0;
-	struct DmapMlclBits *mb = (struct DmapMlclBits *) _mb;
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_MIKD,
+	                                 DAAP_ITEM_KIND_AUDIO);
+}
 
-	mlit = dmap_structure_add (mb->mlcl, DMAP_CC_MLIT);
-	g_object_get (record, "has-video", &has_video, NULL);
+static void
+_emit_item_id (DmapShareMlclBits *mb, guint id,
+               G_GNUC_UNUSED DmapRecord * record,
+               G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_MIID, id);
+}
 
-	if (dmap_share_client_requested (mb->bits, ITEM_KIND)) {
-		dmap_structure_add (mlit, DMAP_CC_MIKD,
-				    (gchar) DAAP_ITEM_KIND_AUDIO);
-	}
+static void
+_emit_item_name (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                 G_GNUC_UNUSED DmapRecord * record, gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-	if (dmap_share_client_requested (mb->bits, ITEM_ID)) {
-		dmap_structure_add (mlit, DMAP_CC_MIID, id);
+	if (f->title) {
+		dmap_structure_builder_add_string (mb->builder, DMAP_CC_MINM,
+		                                   f->title);
+	} else {
+		g_debug ("Title requested but not available");
 	}
+}
 
-	if (dmap_share_client_requested (mb->bits, ITEM_NAME)) {
-		gchar *title = NULL;
-
-		g_object_get (record, "title", &title, NULL);
-		if (title) {
-			dmap_structure_add (mlit, DMAP_CC_MINM, title);
-			g_free (title);
-		} else {
-			g_debug ("Title requested but not available");
-		}
-	}
+static void
+_emit_persistent_id (DmapShareMlclBits *mb, guint id,
+                     G_GNUC_UNUSED DmapRecord * record,
+                     G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int64 (mb->builder, DMAP_CC_MPER, id);
+}
 
-	if (dmap_share_client_requested (mb->bits, PERSISTENT_ID)) {
-		dmap_structure_add (mlit, DMAP_CC_MPER, id);
-	}
+static void
+_emit_container_item_id (DmapShareMlclBits *mb, guint id,
+                         G_GNUC_UNUSED DmapRecord * record,
+                         G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_MCTI, id);
+}
 
-	if (dmap_share_client_requested (mb->bits, CONTAINER_ITEM_ID)) {
-		dmap_structure_add (mlit, DMAP_CC_MCTI, id);
-	}
+static void
+_emit_song_data_kind (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                      G_GNUC_UNUSED DmapRecord * record,
+                      G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_ASDK,
+	                                 DAAP_SONG_DATA_KIND_NONE);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_DATA_KIND)) {
-		dmap_structure_add (mlit, DMAP_CC_ASDK,
-				    (gchar) DAAP_SONG_DATA_KIND_NONE);
-	}
+/* FIXME: Any use for SONG_DATA_URL?
+ * dmap_structure_add (mlit, DMAP_CC_ASUL, "daap://192.168.0.100:%u/databases/1/items/%d.%s?session-id=%s", data->port, *id, dmap_av_record_get_format (DMAP_AV_RECORD (record)), data->session_id);
+ */
 
-	/* FIXME: Any use for this?
-	 * if (dmap_share_client_requested (mb->bits, SONG_DATA_URL))
-	 * dmap_structure_add (mlit, DMAP_CC_ASUL, "daap://192.168.0.100:%u/databases/1/items/%d.%s?session-id=%s", data->port, *id, dmap_av_record_get_format (DMAP_AV_RECORD (record)), data->session_id);
-	 */
-	if (dmap_share_client_requested (mb->bits, SONG_ALBUM)) {
-		gchar *album = NULL;
+static void
+_emit_song_album (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                  G_GNUC_UNUSED DmapRecord * record, gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-		g_object_get (record, "songalbum", &album, NULL);
-		if (album) {
-			dmap_structure_add (mlit, DMAP_CC_ASAL, album);
-			g_free (album);
-		} else {
-			g_debug ("Album requested but not available");
-		}
+	if (f->songalbum) {
+		dmap_structure_builder_add_string (mb->builder, DMAP_CC_ASAL,
+		                                   f->songalbum);
+	} else {
+		g_debug ("Album requested but not available");
 	}
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_GROUPING)) {
-		dmap_structure_add (mlit, DMAP_CC_AGRP, "");
-	}
+static void
+_emit_song_grouping (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                     G_GNUC_UNUSED DmapRecord * record,
+                     G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_string (mb->builder, DMAP_CC_AGRP, "");
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_ARTIST)) {
-		gchar *artist = NULL;
+static void
+_emit_song_artist (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                   G_GNUC_UNUSED DmapRecord * record, gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-		g_object_get (record, "songartist", &artist, NULL);
-		if (artist) {
-			dmap_structure_add (mlit, DMAP_CC_ASAR, artist);
-			g_free (artist);
-		} else {
-			g_debug ("Artist requested but not available");
-		}
+	if (f->songartist) {
+		dmap_structure_builder_add_string (mb->builder, DMAP_CC_ASAR,
+		                                   f->songartist);
+	} else {
+		g_debug ("Artist requested but not available");
 	}
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_BITRATE)) {
-		gint32 bitrate = 0;
+static void
+_emit_song_bitrate (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                    G_GNUC_UNUSED DmapRecord * record, gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-		g_object_get (record, "bitrate", &bitrate, NULL);
-		if (bitrate != 0) {
-			dmap_structure_add (mlit, DMAP_CC_ASBR,
-					    (gint32) bitrate);
-		}
+	if (f->bitrate != 0) {
+		dmap_structure_builder_add_int16 (mb->builder, DMAP_CC_ASBR,
+		                                  f->bitrate);
 	}
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_BPM)) {
-		dmap_structure_add (mlit, DMAP_CC_ASBT, (gint32) 0);
-	}
+static void
+_emit_song_bpm (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                G_GNUC_UNUSED DmapRecord * record,
+                G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int16 (mb->builder, DMAP_CC_ASBT, 0);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_COMMENT)) {
-		dmap_structure_add (mlit, DMAP_CC_ASCM, "");
-	}
+static void
+_emit_song_comment (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                    G_GNUC_UNUSED DmapRecord * record,
+                    G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_string (mb->builder, DMAP_CC_ASCM, "");
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_COMPILATION)) {
-		dmap_structure_add (mlit, DMAP_CC_ASCO, (gchar) FALSE);
-	}
+static void
+_emit_song_compilation (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                        G_GNUC_UNUSED DmapRecord * record,
+                        G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_ASCO, FALSE);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_COMPOSER)) {
-		dmap_structure_add (mlit, DMAP_CC_ASCP, "");
-	}
+static void
+_emit_song_composer (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                     G_GNUC_UNUSED DmapRecord * record,
+                     G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_string (mb->builder, DMAP_CC_ASCP, "");
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_DATE_ADDED)) {
-		gint32 firstseen = 0;
+static void
+_emit_song_date_added (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                       G_GNUC_UNUSED DmapRecord * record,
+                       gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-		g_object_get (record, "firstseen", &firstseen, NULL);
-		dmap_structure_add (mlit, DMAP_CC_ASDA, firstseen);
-	}
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_ASDA,
+	                                  f->firstseen);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_DATE_MODIFIED)) {
-		gint32 mtime = 0;
+static void
+_emit_song_date_modified (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                          G_GNUC_UNUSED DmapRecord * record,
+                          gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-		g_object_get (record, "mtime", &mtime, NULL);
-		dmap_structure_add (mlit, DMAP_CC_ASDM, mtime);
-	}
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_ASDM, f->mtime);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_DISC_COUNT)) {
-		dmap_structure_add (mlit, DMAP_CC_ASDC, (gint32) 0);
-	}
+static void
+_emit_song_disc_count (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                       G_GNUC_UNUSED DmapRecord * record,
+                       G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int16 (mb->builder, DMAP_CC_ASDC, 0);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_DISC_NUMBER)) {
-		gint32 disc = 0;
+static void
+_emit_song_disc_number (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                        G_GNUC_UNUSED DmapRecord * record,
+                        gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-		g_object_get (record, "disc", &disc, NULL);
-		dmap_structure_add (mlit, DMAP_CC_ASDN, disc);
-	}
+	dmap_structure_builder_add_int16 (mb->builder, DMAP_CC_ASDN, f->disc);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_DISABLED)) {
-		dmap_structure_add (mlit, DMAP_CC_ASDB, (gchar) FALSE);
-	}
+static void
+_emit_song_disabled (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                     G_GNUC_UNUSED DmapRecord * record,
+                     G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_ASDB, FALSE);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_EQ_PRESET)) {
-		dmap_structure_add (mlit, DMAP_CC_ASEQ, "");
-	}
+static void
+_emit_song_eq_preset (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                      G_GNUC_UNUSED DmapRecord * record,
+                      G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_string (mb->builder, DMAP_CC_ASEQ, "");
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_FORMAT)) {
-		gchar *format = NULL;
-		gchar *transcode_mimetype = NULL;
+static void
+_emit_song_format (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                   G_GNUC_UNUSED DmapRecord * record, gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
+	gchar *transcode_format = NULL;
+	const gchar *format = f->format;
+	gchar *transcode_mimetype = NULL;
 
-		g_object_get (mb->share, "transcode-mimetype",
-			      &transcode_mimetype, NULL);
-		// Not presently transcoding videos (see also same comments elsewhere).
-		if (! has_video && transcode_mimetype) {
-			format = dmap_utils_mime_to_format (transcode_mimetype);
-			g_free (transcode_mimetype);
-		} else {
-			g_object_get (record, "format", &format, NULL);
-		}
-		if (format) {
-			dmap_structure_add (mlit, DMAP_CC_ASFM, format);
-			g_free (format);
-		} else {
-			g_debug ("Format requested but not available");
-		}
+	g_object_get (mb->parent.share, "transcode-mimetype",
+		      &transcode_mimetype, NULL);
+	// Not presently transcoding videos (see also same comments elsewhere).
+	if (! f->has_video && transcode_mimetype) {
+		transcode_format = dmap_utils_mime_to_format (transcode_mimetype);
+		format = transcode_format;
+	}
+	g_free (transcode_mimetype);
+	if (format) {
+		dmap_structure_builder_add_string (mb->builder,
+		                                   DMAP_CC_ASFM, format);
+	} else {
+		g_debug ("Format requested but not available");
 	}
+	g_free (transcode_format);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_GENRE)) {
-		gchar *genre = NULL;
-
-		g_object_get (record, "songgenre", &genre, NULL);
-		if (genre) {
-			dmap_structure_add (mlit, DMAP_CC_ASGN, genre);
-			g_free (genre);
-		} else {
-			g_debug ("Genre requested but not available");
-		}
-	}
+static void
+_emit_song_genre (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                  G_GNUC_UNUSED DmapRecord * record, gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-	if (dmap_share_client_requested (mb->bits, SONG_DESCRIPTION)) {
-		dmap_structure_add (mlit, DMAP_CC_ASDT, "");	/* FIXME: e.g., wav audio file */
+	if (f->songgenre) {
+		dmap_structure_builder_add_string (mb->builder, DMAP_CC_ASGN,
+		                                   f->songgenre);
+	} else {
+		g_debug ("Genre requested but not available");
 	}
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_RELATIVE_VOLUME)) {
-		dmap_structure_add (mlit, DMAP_CC_ASRV, 0);
-	}
+static void
+_emit_song_description (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                        G_GNUC_UNUSED DmapRecord * record,
+                        G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_string (mb->builder, DMAP_CC_ASDT, "");	/* FIXME: e.g., wav audio file */
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_SAMPLE_RATE)) {
-		dmap_structure_add (mlit, DMAP_CC_ASSR, 0);
-	}
+static void
+_emit_song_relative_volume (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                            G_GNUC_UNUSED DmapRecord * record,
+                            G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_ASRV, 0);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_SIZE)) {
-		guint64 filesize = 0;
+static void
+_emit_song_sample_rate (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                        G_GNUC_UNUSED DmapRecord * record,
+                        G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_ASSR, 0);
+}
 
-		g_object_get (record, "filesize", &filesize, NULL);
-		dmap_structure_add (mlit, DMAP_CC_ASSZ, (gint32) filesize);
-	}
+static void
+_emit_song_size (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                 G_GNUC_UNUSED DmapRecord * record, gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-	if (dmap_share_client_requested (mb->bits, SONG_START_TIME)) {
-		dmap_structure_add (mlit, DMAP_CC_ASST, 0);
-	}
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_ASSZ,
+	                                  (gint32) f->filesize);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_STOP_TIME)) {
-		dmap_structure_add (mlit, DMAP_CC_ASSP, 0);
-	}
+static void
+_emit_song_start_time (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                       G_GNUC_UNUSED DmapRecord * record,
+                       G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_ASST, 0);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_TIME)) {
-		gint32 duration;
+static void
+_emit_song_stop_time (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                      G_GNUC_UNUSED DmapRecord * record,
+                      G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_ASSP, 0);
+}
 
-		g_object_get (record, "duration", &duration, NULL);
-		dmap_structure_add (mlit, DMAP_CC_ASTM, (1000 * duration));
-	}
+static void
+_emit_song_time (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                 G_GNUC_UNUSED DmapRecord * record, gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-	if (dmap_share_client_requested (mb->bits, SONG_TRACK_COUNT)) {
-		dmap_structure_add (mlit, DMAP_CC_ASTC, 0);
-	}
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_ASTM,
+	                                  1000 * f->duration);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_TRACK_NUMBER)) {
-		gint32 track = 0;
+static void
+_emit_song_track_count (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                        G_GNUC_UNUSED DmapRecord * record,
+                        G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int16 (mb->builder, DMAP_CC_ASTC, 0);
+}
 
-		g_object_get (record, "track", &track, NULL);
-		dmap_structure_add (mlit, DMAP_CC_ASTN, track);
-	}
+static void
+_emit_song_track_number (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                         G_GNUC_UNUSED DmapRecord * record,
+                         gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-	if (dmap_share_client_requested (mb->bits, SONG_USER_RATING)) {
-		gint32 rating = 0;
+	dmap_structure_builder_add_int16 (mb->builder, DMAP_CC_ASTN, f->track);
+}
 
-		g_object_get (record, "rating", &rating, NULL);
-		dmap_structure_add (mlit, DMAP_CC_ASUR, rating);
-	}
+static void
+_emit_song_user_rating (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                        G_GNUC_UNUSED DmapRecord * record,
+                        gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-	if (dmap_share_client_requested (mb->bits, SONG_YEAR)) {
-		gint32 year = 0;
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_ASUR, f->rating);
+}
 
-		g_object_get (record, "year", &year, NULL);
-		dmap_structure_add (mlit, DMAP_CC_ASYR, year);
-	}
+static void
+_emit_song_year (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                 G_GNUC_UNUSED DmapRecord * record, gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-	if (dmap_share_client_requested (mb->bits, SONG_HAS_VIDEO)) {
-		dmap_structure_add (mlit, DMAP_CC_AEHV, has_video);
-	}
+	dmap_structure_builder_add_int16 (mb->builder, DMAP_CC_ASYR, f->year);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_SORT_ARTIST)) {
-		gchar *sort_artist = NULL;
+static void
+_emit_song_has_video (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                      G_GNUC_UNUSED DmapRecord * record,
+                      gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-		g_object_get (record, "sort-artist", &sort_artist, NULL);
-		if (sort_artist) {
-			dmap_structure_add (mlit, DMAP_CC_ASSA, sort_artist);
-			g_free (sort_artist);
-		} else {
-			g_debug ("Sort artist requested but not available");
-		}
-	}
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_AEHV,
+	                                 f->has_video);
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_SORT_ALBUM)) {
-		gchar *sort_album = NULL;
+static void
+_emit_song_sort_artist (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                        G_GNUC_UNUSED DmapRecord * record,
+                        gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-		g_object_get (record, "sort-album", &sort_album, NULL);
-		if (sort_album) {
-			dmap_structure_add (mlit, DMAP_CC_ASSU, sort_album);
-			g_free (sort_album);
-		} else {
-			g_debug ("Sort album requested but not available");
-		}
+	if (f->sort_artist) {
+		dmap_structure_builder_add_string (mb->builder, DMAP_CC_ASSA,
+		                                   f->sort_artist);
+	} else {
+		g_debug ("Sort artist requested but not available");
 	}
+}
 
-	if (dmap_share_client_requested (mb->bits, SONG_MEDIAKIND)) {
-		gint mediakind = 0;
+static void
+_emit_song_sort_album (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                       G_GNUC_UNUSED DmapRecord * record,
+                       gconstpointer fields)
+{
+	const DmapAvRecordFields *f = fields;
 
-		g_object_get (record, "mediakind", &mediakind, NULL);
-		dmap_structure_add (mlit, DMAP_CC_AEMK, mediakind);
+	if (f->sort_album) {
+		dmap_structure_builder_add_string (mb->builder, DMAP_CC_ASSU,
+		                                   f->sort_album);
+	} else {
+		g_debug ("Sort album requested but not available");
 	}
 }
 
 static void
-_genre_tabulator (G_GNUC_UNUSED gpointer id, DmapRecord *record, GHashTable *ht)
+_emit_song_mediakind (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                      G_GNUC_UNUSED DmapRecord * record,
+                      gconstpointer fields)
 {
-	const gchar *genre;
+	const DmapAvRecordFields *f = fields;
 
-	g_object_get (record, "songgenre", &genre, NULL);
-	if (!genre) {
-		return;
-	}
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_AEMK,
+	                                 f->mediakind);
+}
 
-	if (!g_hash_table_lookup (ht, genre)) {
-		gboolean ok;
+/* The fields of an MLIT, in the order they go on the wire. */
+static const DmapShareEmitter _emitters[] = {
+	{ ITEM_KIND, _emit_item_kind },
+	{ ITEM_ID, _emit_item_id },
+	{ ITEM_NAME, _emit_item_name, { "title" } },
+	{ PERSISTENT_ID, _emit_persistent_id },
+	{ CONTAINER_ITEM_ID, _emit_container_item_id },
+	{ SONG_DATA_KIND, _emit_song_data_kind },
+	{ SONG_ALBUM, _emit_song_album, { "songalbum" } },
+	{ SONG_GROUPING, _emit_song_grouping },
+	{ SONG_ARTIST, _emit_song_artist, { "songartist" } },
+	{ SONG_BITRATE, _emit_song_bitrate, { "bitrate" } },
+	{ SONG_BPM, _emit_song_bpm },
+	{ SONG_COMMENT, _emit_song_comment },
+	{ SONG_COMPILATION, _emit_song_compilation },
+	{ SONG_COMPOSER, _emit_song_composer },
+	{ SONG_DATE_ADDED, _emit_song_date_added, { "firstseen" } },
+	{ SONG_DATE_MODIFIED, _emit_song_date_modified, { "mtime" } },
+	{ SONG_DISC_COUNT, _emit_song_disc_count },
+	{ SONG_DISC_NUMBER, _emit_song_disc_number, { "disc" } },
+	{ SONG_DISABLED, _emit_song_disabled },
+	{ SONG_EQ_PRESET, _emit_song_eq_preset },
+	{ SONG_FORMAT, _emit_song_format, { "format", "has-video" } },
+	{ SONG_GENRE, _emit_song_genre, { "songgenre" } },
+	{ SONG_DESCRIPTION, _emit_song_description },
+	{ SONG_RELATIVE_VOLUME, _emit_song_relative_volume },
+	{ SONG_SAMPLE_RATE, _emit_song_sample_rate },
+	{ SONG_SIZE, _emit_song_size, { "filesize" } },
+	{ SONG_START_TIME, _emit_song_start_time },
+	{ SONG_STOP_TIME, _emit_song_stop_time },
+	{ SONG_TIME, _emit_song_time, { "duration" } },
+	{ SONG_TRACK_COUNT, _emit_song_track_count },
+	{ SONG_TRACK_NUMBER, _emit_song_track_number, { "track" } },
+	{ SONG_USER_RATING, _emit_song_user_rating, { "rating" } },
+	{ SONG_YEAR, _emit_song_year, { "year" } },
+	{ SONG_HAS_VIDEO, _emit_song_has_video, { "has-video" } },
+	{ SONG_SORT_ARTIST, _emit_song_sort_artist, { "sort-artist" } },
+	{ SONG_SORT_ALBUM, _emit_song_sort_album, { "sort-album" } },
+	{ SONG_MEDIAKIND, _emit_song_mediakind, { "mediakind" } },
+	{ 0, NULL }
+};
 
-		ok = g_hash_table_insert (ht, (gchar *) genre, NULL);
-		if (!ok) {
-			g_warning("error inserting %s", genre);
-		}
-	}
+static void
+_set_emitters (DmapShareClass * klass)
+{
+	dmap_share_class_set_emitters (klass, _emitters);
 }
 
 static void
-_artist_tabulator (G_GNUC_UNUSED gpointer id, DmapRecord * record, GHashTable * ht)
+_add_entry_to_mlcl (guint id, DmapRecord * record, gpointer _mb)
 {
-	const gchar *artist;
+	const DmapShareEmitter *emitter, *e;
+	const gchar *properties[G_N_ELEMENTS (_emitters) * 2 + 1];
+	DmapAvRecordFields fields;
+	DmapShareMlclBits *mb = (DmapShareMlclBits *) _mb;
+	guint i, n = 0;
+
+	emitter = mb->emitters;
+	if (emitter == NULL) {
+		emitter = (DmapShareEmitter *)
+		          dmap_share_get_emitters (mb->parent.share,
+		                                   mb->parent.bits)->data;
+	}
+
+	for (e = emitter; e->emit; e++) {
+		for (i = 0; i < G_N_ELEMENTS (e->properties); i++) {
+			if (e->properties[i]) {
+				properties[n++] = e->properties[i];
+			}
+		}
+	}
+	properties[n] = NULL;
+
+	dmap_structure_builder_begin (mb->builder, DMAP_CC_MLIT);
 
-	g_object_get (record, "songartist", &artist, NULL);
-	if (!artist) {
-		return;
+	/* One call for every field if the record can read them so, else a
+	 * property lookup and copy per requested field; then only the
+	 * requested fields are visited. */
+	dmap_av_record_get_some_fields (DMAP_AV_RECORD (record), &fields,
+	                                properties);
+	for (; emitter->emit; emitter++) {
+		emitter->emit (mb, id, record, &fields);
 	}
+	dmap_av_record_fields_clear (&fields);
 
-	if (!g_hash_table_lookup (ht, artist)) {
-		gboolean ok;
+	dmap_structure_builder_end (mb->builder);
+}
 
-		ok = g_hash_table_insert (ht, (gchar *) artist, NULL);
-		if (!ok) {
-			g_warning("error inserting %s", artist);
-		}
+/* Adds a copy of value to a set of strings. */
+static void
+_tabulate (GHashTable * ht, const gchar * value)
+{
+	if (value && !g_hash_table_contains (ht, value)) {
+		g_hash_table_add (ht, g_strdup (value));
 	}
 }
 
 static void
-_album_tabulator (G_GNUC_UNUSED gpointer id, DmapRecord * record, GHashTable * ht)
+_genre_tabulator (G_GNUC_UNUSED gpointer id, DmapRecord *record, GHashTable *ht)
 {
-	const gchar *album;
+	static const gchar *properties[] = { "songgenre", NULL };
+	DmapAvRecordFields fields;
 
-	g_object_get (record, "songalbum", &album, NULL);
-	if (!album) {
-		return;
-	}
+	dmap_av_record_get_some_fields (DMAP_AV_RECORD (record), &fields,
+	                                properties);
+	_tabulate (ht, fields.songgenre);
+	dmap_av_record_fields_clear (&fields);
+}
 
-	if (!g_hash_table_lookup (ht, album)) {
-		gboolean ok;
+static void
+_artist_tabulator (G_GNUC_UNUSED gpointer id, DmapRecord * record, GHashTable * ht)
+{
+	static const gchar *properties[] = { "songartist", NULL };
+	DmapAvRecordFields fields;
 
-		ok = g_hash_table_insert (ht, (gchar *) album, NULL);
-		if (!ok) {
-			g_warning("error inserting %s", album);
-		}
-	}
+	dmap_av_record_get_some_fields (DMAP_AV_RECORD (record), &fields,
+	                                properties);
+	_tabulate (ht, fields.songartist);
+	dmap_av_record_fields_clear (&fields);
 }
 
 static void
-_add_to_category_listing (gpointer key, gpointer user_data)
+_album_tabulator (G_GNUC_UNUSED gpointer id, DmapRecord * record, GHashTable * ht)
 {
-	GNode *mlit;
-	GNode *node = (GNode *) user_data;
+	static const gchar *properties[] = { "songalbum", NULL };
+	DmapAvRecordFields fields;
 
-	mlit = dmap_structure_add (node, DMAP_CC_MLIT);
-	dmap_structure_add (mlit, DMAP_RAW, (char *) key);
+	dmap_av_record_get_some_fields (DMAP_AV_RECORD (record), &fields,
+	                                properties);
+	_tabulate (ht, fields.songalbum);
+	dmap_av_record_fields_clear (&fields);
 }
 
+static gint
+_category_value_cmp (gconstpointer a, gconstpointer b)
+{
+	return g_ascii_strcasecmp (*(const gchar * const *) a,
+	                           *(const gchar * const *) b);
+}
+
+/* Filtered records fewer than the database's over this are tabulated
+ * one by one, rather than by looking for each of the database's values
+ * among them. */
+#define DMAP_AV_SHARE_TABULATE_RATIO 16
+
 static void
 _databases_browse_xxx (DmapShare * share,
                        SoupServerMessage * msg,
@@ -847,36 +1049,38 @@ _databases_browse_xxx (DmapShare * share,
 	 */
 	DmapDb *db;
 	const gchar *rest_of_path;
-	GNode *abro, *node;
+	DmapStructureBuilder *abro;
 	gchar *filter;
 	GSList *filter_def;
-	GHashTable *filtered;
-	guint num_genre;
+	GHashTable *filtered = NULL;
+	guint num_genre, i;
 	const gchar *browse_category;
+	const gchar *property;
+	GHFunc tabulator;
 	GHashTable *category_items;
 	DmapContentCode category_cc;
-	GList *values;
+	GPtrArray *values = NULL;
 
 	rest_of_path = strchr (path + 1, '/');
 	browse_category = rest_of_path + 10;
-	category_items = g_hash_table_new (g_str_hash, g_str_equal);
+	category_items = g_hash_table_new_full (g_str_hash, g_str_equal,
+	                                        g_free, NULL);
 
 	filter = g_hash_table_lookup (query, "filter");
 	filter_def = dmap_share_build_filter (filter);
 	g_object_get (share, "db", &db, NULL);
-	filtered = dmap_db_apply_filter (db, filter_def);
 
 	if (g_ascii_strcasecmp (browse_category, "genres") == 0) {
-		g_hash_table_foreach (filtered, (GHFunc) _genre_tabulator,
-				      category_items);
+		property = "songgenre";
+		tabulator = (GHFunc) _genre_tabulator;
 		category_cc = DMAP_CC_ABGN;
 	} else if (g_ascii_strcasecmp (browse_category, "artists") == 0) {
-		g_hash_table_foreach (filtered, (GHFunc) _artist_tabulator,
-				      category_items);
+		property = "songartist";
+		tabulator = (GHFunc) _artist_tabulator;
 		category_cc = DMAP_CC_ABAR;
 	} else if (g_ascii_strcasecmp (browse_category, "albums") == 0) {
-		g_hash_table_foreach (filtered, (GHFunc) _album_tabulator,
-				      category_items);
+		property = "songalbum";
+		tabulator = (GHFunc) _album_tabulator;
 		category_cc = DMAP_CC_ABAL;
 	} else {
 		dmap_share_emit_error(share, DMAP_STATUS_BAD_BROWSE_CATEGORY,
@@ -885,34 +1089,73 @@ _databases_browse_xxx (DmapShare * share,
 		goto _bad_category;
 	}
 
-	abro = dmap_structure_add (NULL, DMAP_CC_ABRO);
-	dmap_structure_add (abro, DMAP_CC_MSTT, (gint32) SOUP_STATUS_OK);
-	dmap_structure_add (abro, DMAP_CC_MUTY, 0);
+	/* A database which keeps the values of property lists them without
+	 * reading any records, and sorted. */
+	if (filter_def == NULL) {
+		values = dmap_db_lookup_values (db, property, NULL);
+	} else {
+		filtered = dmap_db_apply_filter (db, filter_def);
+		if (g_hash_table_size (filtered) * DMAP_AV_SHARE_TABULATE_RATIO
+		    >= dmap_db_count (db)) {
+			values = dmap_db_lookup_values (db, property, filtered);
+		}
+	}
+
+	if (values == NULL) {
+		GHashTableIter iter;
+		gpointer value;
+
+		if (filtered == NULL) {
+			filtered = dmap_db_apply_filter (db, filter_def);
+		}
+		g_hash_table_foreach (filtered, tabulator, category_items);
+
+		/* Points into category_items. */
+		values = g_ptr_array_sized_new (g_hash_table_size (category_items));
+		g_hash_table_iter_init (&iter, category_items);
+		while (g_hash_table_iter_next (&iter, &value, NULL)) {
+			g_ptr_array_add (values, value);
+		}
+
+		if (values->len > 0
+		 && g_hash_table_lookup (query, "include-sort-headers")) {
+			g_debug ("Sorting...");
+			g_ptr_array_sort (values, _category_value_cmp);
+		}
+	}
+
+	abro = dmap_structure_builder_new (0);
+	dmap_structure_builder_add (abro, DMAP_CC_ABRO);
+	dmap_structure_builder_add (abro, DMAP_CC_MSTT, (gint32) SOUP_STATUS_OK);
+	dmap_structure_builder_add (abro, DMAP_CC_MUTY, 0);
 
-	num_genre = g_hash_table_size (category_items);
-	dmap_structure_add (abro, DMAP_CC_MTCO, (gint32) num_genre);
-	dmap_structure_add (abro, DMAP_CC_MRCO, (gint32) num_genre);
+	num_genre = values->len;
+	dmap_structure_builder_add (abro, DMAP_CC_MTCO, (gint32) num_genre);
+	dmap_structure_builder_add (abro, DMAP_CC_MRCO, (gint32) num_genre);
 
-	node = dmap_structure_add (abro, category_cc);
+	dmap_structure_builder_add (abro, category_cc);
 
-	values = g_hash_table_get_keys (category_items);
-	if (values && g_hash_table_lookup (query, "include-sort-headers")) {
-		g_debug ("Sorting...");
-		values = g_list_sort (values,
-				      (GCompareFunc) g_ascii_strcasecmp);
+	for (i = 0; i < values->len; i++) {
+		dmap_structure_builder_add (abro, DMAP_CC_MLIT);
+		dmap_structure_builder_add (abro, DMAP_RAW,
+		                            (char *) g_ptr_array_index (values, i));
+		dmap_structure_builder_end (abro);
 	}
 
-	g_list_foreach (values, _add_to_category_listing, node);
+	g_ptr_array_unref (values);
 
-	g_list_free (values);
+	dmap_structure_builder_end (abro);	/* category_cc */
+	dmap_structure_builder_end (abro);	/* ABRO */
 
-	dmap_share_message_set_from_dmap_structure (share, msg, abro);
-	dmap_structure_destroy (abro);
+	dmap_share_message_set_from_dmap_builder (share, msg, abro);
       _bad_category:
 	dmap_share_free_filter (filter_def);
 	/* Free's hash table but not data (points into real DB): */
-	g_hash_table_destroy (filtered);
+	if (filtered) {
+		g_hash_table_destroy (filtered);
+	}
 	g_hash_table_destroy (category_items);
+	g_object_unref (db);
 }
 
 static void
@@ -1234,7 +1477,7 @@ _tabulator_test(char *property,
 
 	id2 = dmap_db_add(db, record2, NULL);
 
-	ht = g_hash_table_new (g_str_hash, g_str_equal);
+	ht = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
 
 	tabulator (GINT_TO_POINTER(id1), record1, ht);
 	tabulator (GINT_TO_POINTER(id2), record2, ht);
@@ -1720,6 +1963,85 @@ START_TEST(_databases_items_xxx_test_bad_id)
 }
 END_TEST
 
+static GNode *
+_browse_facets_test(DmapShare *share, const char *path, char *filter)
+{
+	SoupServerMessage *message;
+	GHashTable *query;
+	GBytes *buffer;
+	const guint8 *data;
+	gsize length;
+	GNode *root;
+
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	query = g_hash_table_new(g_str_hash, g_str_equal);
+	if (NULL != filter) {
+		g_hash_table_insert(query, "filter", filter);
+	}
+
+	_databases_browse_xxx(share, message, path, query);
+
+	buffer = soup_message_body_flatten(soup_server_message_get_response_body(message));
+	data = g_bytes_get_data(buffer, &length);
+	root = dmap_structure_parse(data, length, NULL);
+	ck_assert(NULL != root);
+
+	g_bytes_unref(buffer);
+	g_hash_table_destroy(query);
+	g_object_unref(message);
+
+	return root;
+}
+
+START_TEST(_databases_browse_xxx_facets_test)
+{
+	DmapDb *db;
+	DmapContainerRecord *container_record;
+	DmapContainerDb *container_db;
+	DmapShare *share;
+	GNode *root, *mlit;
+	const gchar *genres[] = { "b", "a", "b" };
+	const gchar *artists[] = { "artist1", "artist2", "artist2" };
+	guint i;
+
+	db = DMAP_DB(dmap_memory_db_new());
+	container_record = DMAP_CONTAINER_RECORD (test_dmap_container_record_new ());
+	container_db = DMAP_CONTAINER_DB(test_dmap_container_db_new(container_record));
+
+	for (i = 0; i < G_N_ELEMENTS(genres); i++) {
+		DmapRecord *record = DMAP_RECORD(test_dmap_av_record_new());
+
+		g_object_set(record, "songgenre", genres[i],
+		                     "songartist", artists[i], NULL);
+		dmap_db_add(db, record, NULL);
+		g_object_unref(record);
+	}
+
+	share = DMAP_SHARE(dmap_av_share_new("databases_browse_xxx_facets_test",
+	                                     NULL, db, container_db, NULL));
+
+	/* Unfiltered, straight from the facets, and sorted. */
+	root = _browse_facets_test(share, "/db/1/browse/genres", NULL);
+	ck_assert_int_eq(2, dmap_structure_find_item(root, DMAP_CC_MTCO)->content.data->v_int);
+	mlit = dmap_structure_find_node(root, DMAP_CC_MLIT);
+	ck_assert_str_eq("a", ((DmapStructureItem *) mlit->children->data)->content.data->v_pointer);
+	ck_assert_str_eq("b", ((DmapStructureItem *) mlit->next->children->data)->content.data->v_pointer);
+	dmap_structure_destroy(root);
+
+	/* Filtered, intersected with the facets. */
+	root = _browse_facets_test(share, "/db/1/browse/genres", "'daap.songartist:artist1'");
+	ck_assert_int_eq(1, dmap_structure_find_item(root, DMAP_CC_MTCO)->content.data->v_int);
+	mlit = dmap_structure_find_node(root, DMAP_CC_MLIT);
+	ck_assert_str_eq("b", ((DmapStructureItem *) mlit->children->data)->content.data->v_pointer);
+	dmap_structure_destroy(root);
+
+	g_object_unref(db);
+	g_object_unref(container_record);
+	g_object_unref(container_db);
+	g_object_unref(share);
+}
+END_TEST
+
 #include "dmap-av-share-suite.c"
 
 #endif
@@ -184,7 +184,10 @@ typedef enum {
 	DMAP_CC_CMRL,
 	DMAP_CC_CAHP,
 	DMAP_CC_CAIV,
-	DMAP_CC_CAVC
+	DMAP_CC_CAVC,
+
+	DMAP_CC_AGAR,
+	DMAP_CC_AGAC
 } DmapContentCode;
 
 #endif
@@ -0,0 +1,309 @@
+/*
+ * Journal of changed records, by revision
+ *
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "dmap-change-journal.h"
+
+typedef struct {
+	guint revision;
+	guint id;
+	gboolean deleted;
+} Entry;
+
+struct DmapChangeJournal {
+	guint capacity;
+	/* Entries, oldest first, so in order of revision. */
+	GArray *entries;
+	/* The changes through this revision are not known. */
+	guint horizon;
+};
+
+DmapChangeJournal *
+dmap_change_journal_new (guint capacity, guint revision)
+{
+	DmapChangeJournal *journal;
+
+	journal = g_new0 (DmapChangeJournal, 1);
+	journal->capacity = capacity;
+	journal->entries = g_array_new (FALSE, FALSE, sizeof (Entry));
+	journal->horizon = revision;
+
+	return journal;
+}
+
+void
+dmap_change_journal_free (DmapChangeJournal * journal)
+{
+	if (journal) {
+		g_array_unref (journal->entries);
+		g_free (journal);
+	}
+}
+
+/* Drops the oldest entries until at most size are left. */
+static void
+_shrink (DmapChangeJournal * journal, guint size)
+{
+	guint dropped;
+
+	if (journal->entries->len <= size) {
+		goto done;
+	}
+
+	dropped = journal->entries->len - size;
+	journal->horizon = MAX (journal->horizon,
+	                        g_array_index (journal->entries, Entry,
+	                                       dropped - 1).revision);
+	g_array_remove_range (journal->entries, 0, dropped);
+
+done:
+	return;
+}
+
+void
+dmap_change_journal_set_capacity (DmapChangeJournal * journal,
+                                  guint capacity, guint revision)
+{
+	/* Nothing was recorded while disabled. */
+	if (journal->capacity == 0) {
+		journal->horizon = MAX (journal->horizon, revision);
+	}
+
+	journal->capacity = capacity;
+	_shrink (journal, capacity);
+}
+
+guint
+dmap_change_journal_get_capacity (DmapChangeJournal * journal)
+{
+	return journal->capacity;
+}
+
+void
+dmap_change_journal_record (DmapChangeJournal * journal, guint revision,
+                            guint id, gboolean deleted)
+{
+	Entry entry = { revision, id, deleted };
+
+	if (journal->capacity == 0) {
+		goto done;
+	}
+
+	/* Drop a quarter at a time, rather than one entry per change. */
+	if (journal->entries->len >= journal->capacity) {
+		_shrink (journal, journal->capacity - 1
+		                  - (journal->capacity - 1) / 4);
+	}
+
+	g_array_append_val (journal->entries, entry);
+
+done:
+	return;
+}
+
+void
+dmap_change_journal_seal (DmapChangeJournal * journal, guint revision)
+{
+	guint len = journal->entries->len;
+
+	if (journal->capacity == 0 || len == 0
+	 || g_array_index (journal->entries, Entry, len - 1).revision
+	    != revision) {
+		journal->horizon = MAX (journal->horizon, revision);
+	}
+}
+
+static gint
+_id_cmp (gconstpointer a, gconstpointer b)
+{
+	guint x = *(const guint *) a;
+	guint y = *(const guint *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+gboolean
+dmap_change_journal_lookup (DmapChangeJournal * journal, guint since,
+                            guint current, GArray ** changed,
+                            GArray ** deleted)
+{
+	gboolean ok = FALSE;
+	GHashTable *latest;
+	GHashTableIter iter;
+	gpointer id, is_deleted;
+	guint lo, hi;
+
+	if (journal->capacity == 0 || since < journal->horizon
+	 || since > current) {
+		goto done;
+	}
+
+	/* The first entry after since. */
+	lo = 0;
+	hi = journal->entries->len;
+	while (lo < hi) {
+		guint mid = lo + (hi - lo) / 2;
+
+		if (g_array_index (journal->entries, Entry, mid).revision
+		    <= since) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	/* ID -> whether its last change deleted it. */
+	latest = g_hash_table_new (g_direct_hash, g_direct_equal);
+	for (; lo < journal->entries->len; lo++) {
+		Entry *entry = &g_array_index (journal->entries, Entry, lo);
+
+		g_hash_table_insert (latest, GUINT_TO_POINTER (entry->id),
+		                     GINT_TO_POINTER (entry->deleted));
+	}
+
+	*changed = g_array_new (FALSE, FALSE, sizeof (guint));
+	*deleted = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	g_hash_table_iter_init (&iter, latest);
+	while (g_hash_table_iter_next (&iter, &id, &is_deleted)) {
+		guint value = GPOINTER_TO_UINT (id);
+
+		g_array_append_val (GPOINTER_TO_INT (is_deleted) ? *deleted
+		                                                 : *changed,
+		                    value);
+	}
+
+	g_array_sort (*changed, _id_cmp);
+	g_array_sort (*deleted, _id_cmp);
+	g_hash_table_destroy (latest);
+
+	ok = TRUE;
+
+done:
+	return ok;
+}
+
+#ifdef HAVE_CHECK
+
+#include <check.h>
+
+static void
+_assert_ids_test (GArray *ids, guint n, ...)
+{
+	va_list ap;
+	guint i;
+
+	ck_assert_int_eq (n, ids->len);
+
+	va_start (ap, n);
+	for (i = 0; i < n; i++) {
+		ck_assert_int_eq (va_arg (ap, guint),
+		                  g_array_index (ids, guint, i));
+	}
+	va_end (ap);
+
+	g_array_unref (ids);
+}
+
+START_TEST(_lookup_test)
+{
+	DmapChangeJournal *journal;
+	GArray *changed, *deleted;
+
+	journal = dmap_change_journal_new (16, 5);
+
+	dmap_change_journal_record (journal, 6, 3, FALSE);
+	dmap_change_journal_record (journal, 6, 1, FALSE);
+	dmap_change_journal_seal (journal, 6);
+	dmap_change_journal_record (journal, 7, 3, TRUE);
+	dmap_change_journal_record (journal, 7, 2, FALSE);
+	dmap_change_journal_seal (journal, 7);
+
+	ck_assert (dmap_change_journal_lookup (journal, 5, 7, &changed,
+	                                       &deleted));
+	_assert_ids_test (changed, 2, 1, 2);
+	_assert_ids_test (deleted, 1, 3);
+
+	ck_assert (dmap_change_journal_lookup (journal, 6, 7, &changed,
+	                                       &deleted));
+	_assert_ids_test (changed, 1, 2);
+	_assert_ids_test (deleted, 1, 3);
+
+	ck_assert (dmap_change_journal_lookup (journal, 7, 7, &changed,
+	                                       &deleted));
+	_assert_ids_test (changed, 0);
+	_assert_ids_test (deleted, 0);
+
+	/* From before the journal began, or from the future. */
+	ck_assert (!dmap_change_journal_lookup (journal, 4, 7, &changed,
+	                                        &deleted));
+	ck_assert (!dmap_change_journal_lookup (journal, 8, 7, &changed,
+	                                        &deleted));
+
+	dmap_change_journal_free (journal);
+}
+END_TEST
+
+START_TEST(_horizon_test)
+{
+	DmapChangeJournal *journal;
+	GArray *changed, *deleted;
+	guint id;
+
+	journal = dmap_change_journal_new (4, 1);
+
+	/* A revision without recorded changes is not known. */
+	dmap_change_journal_seal (journal, 2);
+	ck_assert (!dmap_change_journal_lookup (journal, 1, 2, &changed,
+	                                        &deleted));
+
+	/* Nor are those whose changes were dropped. */
+	for (id = 1; id <= 5; id++) {
+		dmap_change_journal_record (journal, id + 2, id, FALSE);
+		dmap_change_journal_seal (journal, id + 2);
+	}
+	ck_assert (!dmap_change_journal_lookup (journal, 2, 7, &changed,
+	                                        &deleted));
+	ck_assert (dmap_change_journal_lookup (journal, 4, 7, &changed,
+	                                       &deleted));
+	_assert_ids_test (changed, 3, 3, 4, 5);
+	_assert_ids_test (deleted, 0);
+
+	/* Nothing is recorded while disabled. */
+	dmap_change_journal_set_capacity (journal, 0, 7);
+	ck_assert (!dmap_change_journal_lookup (journal, 7, 7, &changed,
+	                                        &deleted));
+	dmap_change_journal_record (journal, 8, 6, FALSE);
+	dmap_change_journal_set_capacity (journal, 4, 8);
+	ck_assert (!dmap_change_journal_lookup (journal, 7, 8, &changed,
+	                                        &deleted));
+	ck_assert (dmap_change_journal_lookup (journal, 8, 8, &changed,
+	                                       &deleted));
+	_assert_ids_test (changed, 0);
+	_assert_ids_test (deleted, 0);
+
+	dmap_change_journal_free (journal);
+}
+END_TEST
+
+#include "dmap-change-journal-suite.c"
+
+#endif
@@ -0,0 +1,63 @@
+/*
+ * Journal of changed records, by revision
+ *
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DMAP_CHANGE_JOURNAL_H
+#define _DMAP_CHANGE_JOURNAL_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A DmapChangeJournal records which record IDs changed, or were deleted,
+ * in each revision of a share, so that a client which has seen one
+ * revision can be sent only what has changed since. It holds at most its
+ * capacity of changes, dropping the oldest first; a capacity of 0
+ * disables the journal. Revisions from before the journal began, from
+ * before the changes it dropped and through which nothing was recorded
+ * are behind its horizon: the changes since them are not known. */
+typedef struct DmapChangeJournal DmapChangeJournal;
+
+/* Nothing is known of the changes through revision. */
+DmapChangeJournal *dmap_change_journal_new (guint capacity, guint revision);
+void dmap_change_journal_free (DmapChangeJournal * journal);
+
+void dmap_change_journal_set_capacity (DmapChangeJournal * journal,
+                                       guint capacity, guint revision);
+guint dmap_change_journal_get_capacity (DmapChangeJournal * journal);
+
+/* Records that id changed, or was deleted, in revision. Revisions must
+ * not decrease from one call to the next. */
+void dmap_change_journal_record (DmapChangeJournal * journal, guint revision,
+                                 guint id, gboolean deleted);
+
+/* Tells the journal that the share has moved on to revision. A revision
+ * in which no change was recorded is taken to have had changes which
+ * were not, and so moves the horizon on. */
+void dmap_change_journal_seal (DmapChangeJournal * journal, guint revision);
+
+/* Returns TRUE, and sets changed and deleted to new arrays of the IDs,
+ * in ascending order, which changed or were deleted after revision since
+ * and up to revision current; or FALSE if the journal does not know. */
+gboolean dmap_change_journal_lookup (DmapChangeJournal * journal,
+                                     guint since, guint current,
+                                     GArray ** changed, GArray ** deleted);
+
+G_END_DECLS
+#endif
@@ -37,4 +37,17 @@ gboolean dmap_connection_get (DmapConnection * self,
 
 void dmap_connection_setup (DmapConnection * connection);
 
+/* Like handle_mlcl, but reads the serialized tags of an MLIT in place. */
+typedef DmapRecord *(*DmapConnectionMlitHandler) (DmapConnection * connection,
+                                                  DmapRecordFactory * factory,
+                                                  const guint8 * buf,
+                                                  gsize length,
+                                                  gint * item_id);
+
+/* Sets the MLIT handler of klass and of the classes derived from it
+ * which keep its handle_mlcl. Without one, each MLIT is parsed and
+ * handed to handle_mlcl. */
+void dmap_connection_class_set_mlit_handler (DmapConnectionClass * klass,
+                                             DmapConnectionMlitHandler handler);
+
 #endif
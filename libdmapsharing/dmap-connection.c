@@ -24,13 +24,11 @@
 #include <string.h>
 #include <sys/types.h>
 #include <math.h>
-#ifdef HAVE_LIBZ
-#include <zlib.h>
-#endif
 
 #include <libsoup/soup.h>
 
 #include "dmap-md5.h"
+#include "dmap-private-utils.h"
 #include "dmap-connection.h"
 #include "dmap-connection-private.h"
 #include "dmap-error.h"
@@ -637,32 +635,6 @@ done:
 	return message;
 }
 
-#ifdef HAVE_LIBZ
-static void *
-_zalloc_wrapper (G_GNUC_UNUSED voidpf opaque, uInt items, uInt size)
-{
-	void *fnval = Z_NULL;
-
-	if ((items != 0) && (size >= G_MAXUINT / items)) {
-		goto done;
-	}
-	if ((size != 0) && (items >= G_MAXUINT / size)) {
-		goto done;
-	}
-
-	fnval = g_malloc0 (items * size);
-
-done:
-	return fnval;
-}
-
-static void
-_zfree_wrapper (G_GNUC_UNUSED voidpf opaque, voidpf address)
-{
-	g_free (address);
-}
-#endif
-
 static void
 _connection_set_error_message (DmapConnection * connection,
                                const char *message)
@@ -678,6 +650,8 @@ _connection_set_error_message (DmapConnection * connection,
 
 typedef struct {
 	GBytes *body;
+	/* The body is gzipped, and the session has not inflated it. */
+	gboolean gzipped;
 	int status;
 	DmapConnection *connection;
 
@@ -784,15 +758,12 @@ _actual_http_response_handler (DmapResponseData * data)
 {
 	DmapConnectionPrivate *priv;
 	GNode *structure;
-	guint8 *new_response = NULL;
 	const guint8 *response;
-	const char *encoding_header;
 	gsize response_length;
 	gboolean ok = FALSE;
 
 	priv = data->connection->priv;
 	structure = NULL;
-	encoding_header = NULL;
 
 	response = g_bytes_get_data(data->body, &response_length);
 
@@ -804,7 +775,6 @@ _actual_http_response_handler (DmapResponseData * data)
 	if (data->headers) {
 		const char *server;
 
-		encoding_header = soup_message_headers_get_one (data->headers, "Content-Encoding");
 		server = soup_message_headers_get_one (data->headers, "DAAP-Server");
 
 		if (server != NULL && strstr (server, ITUNES_7_SERVER) != NULL) {
@@ -817,84 +787,37 @@ _actual_http_response_handler (DmapResponseData * data)
 		}
 	}
 
-	if (SOUP_STATUS_IS_SUCCESSFUL (data->status) && encoding_header
-	    && strcmp (encoding_header, "gzip") == 0) {
-#ifdef HAVE_LIBZ
-		z_stream stream;
-		unsigned int factor = 4;
-		unsigned int unc_size = response_length * factor;
-
-		stream.next_in = (unsigned char *) response;
-		stream.avail_in = response_length;
-		stream.total_in = 0;
-
-		new_response = g_malloc (unc_size + 1);
-		stream.next_out = (unsigned char *) new_response;
-		stream.avail_out = unc_size;
-		stream.total_out = 0;
-		stream.zalloc = _zalloc_wrapper;
-		stream.zfree = _zfree_wrapper;
-		stream.opaque = NULL;
-
-		if (inflateInit2
-		    (&stream,
-		     32 /* auto-detect */  + 15 /* max */ ) != Z_OK) {
-			inflateEnd (&stream);
-			g_free (new_response);
-			new_response = NULL;
-			g_debug ("Unable to decompress response from %s",
-				 data->message_path);
+	if (SOUP_STATUS_IS_SUCCESSFUL (data->status) && data->gzipped) {
+		GConverter *decompressor;
+		GBytes *inflated;
+		GError *error = NULL;
+
+		/* The decompressor's output grows with what it produces,
+		 * so there is neither a guess at the inflated size nor a
+		 * ceiling on it. */
+		decompressor = G_CONVERTER (g_zlib_decompressor_new
+		                            (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+		inflated = dmap_private_utils_convert (decompressor, response,
+		                                       response_length,
+		                                       G_CONVERTER_INPUT_AT_END,
+		                                       &error);
+		g_object_unref (decompressor);
+
+		if (NULL == inflated) {
+			g_debug ("Unable to decompress response from %s: %s",
+				 data->message_path, error->message);
 			_connection_set_error_message (
 				data->connection,
 				"unable to decompress response"
 			);
+			g_error_free (error);
 			goto done;
-		} else {
-			do {
-				int z_res;
-
-				z_res = inflate (&stream, Z_FINISH);
-				if (z_res == Z_STREAM_END) {
-					break;
-				}
-				if ((z_res != Z_OK && z_res != Z_BUF_ERROR)
-				    || stream.avail_out != 0
-				    || unc_size > 40 * 1000 * 1000) {
-					inflateEnd (&stream);
-					g_free (new_response);
-					new_response = NULL;
-					break;
-				}
-
-				factor *= 4;
-				unc_size = (response_length * factor);
-				/* unc_size can't grow bigger than 40MB, so
-				 * unc_size can't overflow, and this realloc
-				 * call is safe
-				 */
-				new_response =
-					g_realloc (new_response,
-						   unc_size + 1);
-				stream.next_out =
-					(unsigned char *) (new_response +
-							   stream.total_out);
-				stream.avail_out =
-					unc_size - stream.total_out;
-			} while (1);
 		}
 
-		if (new_response) {
-			response = new_response;
-			response_length = stream.total_out;
-		}
-#else
-		g_debug ("Received compressed response from %s but can't handle it", data->message_path);
-		_connection_set_error_message (
-			data->connection,
-			"cannot handle compressed response"
-		);
-		goto done;
-#endif
+		/* Drop the compressed body as soon as it is inflated. */
+		g_bytes_unref (data->body);
+		data->body = inflated;
+		response = g_bytes_get_data (data->body, &response_length);
 	}
 
 	if (SOUP_STATUS_IS_SUCCESSFUL (data->status)) {
@@ -970,8 +893,6 @@ done:
 		dmap_structure_destroy (structure);
 	}
 
-	g_free (new_response);
-
 	_dmap_response_data_free(data);
 
 	return NULL;
@@ -986,7 +907,7 @@ _http_response_handler (G_GNUC_UNUSED GObject *source,
 	SoupSession *session = SOUP_SESSION(source);
 	DmapResponseData *data = user_data;
 	SoupMessage *message = NULL;
-	goffset response_length;
+	const char *encoding;
 	GError *error = NULL;
 
 	data->body = soup_session_send_and_read_finish (session, result, &error);
@@ -1004,15 +925,11 @@ _http_response_handler (G_GNUC_UNUSED GObject *source,
 	data->status = soup_message_get_status(message);
 	data->reason_phrase = g_strdup(soup_message_get_reason_phrase(message));
 	data->headers = soup_message_headers_ref(soup_message_get_response_headers(message));
-	response_length = g_bytes_get_size(data->body);
 
-	if (response_length >= G_MAXUINT / 4 - 1) {
-		/* If response_length is too big,
-		 * the g_malloc (unc_size + 1) below would overflow
-		 */
-		g_debug ("Response length exceeded limit");
-		goto done;
-	}
+	encoding = soup_message_headers_get_one (data->headers, "Content-Encoding");
+	data->gzipped = encoding && 0 == strcmp (encoding, "gzip")
+	             && !soup_session_has_feature (session,
+	                                           SOUP_TYPE_CONTENT_DECODER);
 
 	/* to avoid blocking the UI, handle big responses in a separate thread */
 	if (SOUP_STATUS_IS_SUCCESSFUL (data->status)
@@ -1245,133 +1162,544 @@ done:
 	return;
 }
 
+/* The MLIT handlers live outside DmapConnectionClass so that its layout
+ * stays as it was; see dmap_connection_class_set_mlit_handler. */
+static GQuark
+_mlit_handler_quark (void)
+{
+	return g_quark_from_static_string ("dmap-connection-mlit-handler");
+}
+
+void
+dmap_connection_class_set_mlit_handler (DmapConnectionClass * klass,
+                                        DmapConnectionMlitHandler handler)
+{
+	g_type_set_qdata (G_TYPE_FROM_CLASS (klass), _mlit_handler_quark (),
+	                  (gpointer) handler);
+}
+
+/* Returns the MLIT handler registered by the connection's class or the
+ * nearest ancestor with one, unless a class in between overrides
+ * handle_mlcl, which the handler would otherwise bypass. */
+static DmapConnectionMlitHandler
+_lookup_mlit_handler (DmapConnection * connection)
+{
+	DmapConnectionClass *klass = DMAP_CONNECTION_GET_CLASS (connection);
+	DmapConnectionMlitHandler handler = NULL;
+	GType type;
+
+	for (type = G_OBJECT_TYPE (connection);
+	     handler == NULL && type != G_TYPE_INVALID;
+	     type = g_type_parent (type)) {
+		DmapConnectionClass *registrant;
+
+		handler = (DmapConnectionMlitHandler)
+			g_type_get_qdata (type, _mlit_handler_quark ());
+		if (handler == NULL) {
+			continue;
+		}
+
+		registrant = g_type_class_peek (type);
+		if (registrant->handle_mlcl != klass->handle_mlcl) {
+			handler = NULL;
+			break;
+		}
+	}
+
+	return handler;
+}
+
+static DmapRecord *
+_handle_mlit (DmapConnection * connection, const DmapStructureCursor * mlit,
+              gint * item_id)
+{
+	DmapRecord *record = NULL;
+	DmapConnectionClass *klass = DMAP_CONNECTION_GET_CLASS (connection);
+	DmapConnectionMlitHandler handler;
+
+	handler = _lookup_mlit_handler (connection);
+	if (handler) {
+		record = handler (connection, connection->priv->record_factory,
+		                  mlit->data, mlit->size, item_id);
+	} else {
+		GNode *n;
+		GError *error = NULL;
+
+		/* The MLIT's own header precedes its data. */
+		n = dmap_structure_parse (mlit->data - 8, mlit->size + 8,
+		                          &error);
+		if (NULL != error) {
+			g_debug ("Could not parse MLIT: %s", error->message);
+			g_clear_error (&error);
+		}
+
+		if (n) {
+			record = klass->handle_mlcl (connection,
+			                             connection->priv->record_factory,
+			                             n, item_id);
+			dmap_structure_destroy (n);
+		}
+	}
+
+	return record;
+}
+
 static void
-_handle_song_listing (DmapConnection * connection, guint status,
-                      GNode * structure, G_GNUC_UNUSED gpointer user_data)
+_add_song (DmapConnection * connection, DmapRecord * record, gint item_id)
 {
-	gboolean ok = FALSE;
-	DmapConnectionPrivate *priv = connection->priv;
-	DmapStructureItem *item = NULL;
-	GNode *listing_node;
+	GError *error = NULL;
+	gchar *uri = NULL;
+	gchar *format = NULL;
+
+	g_object_get (record, "format", &format, NULL);
+	if (format == NULL) {
+		format = g_strdup ("Unknown");
+	}
+
+	/*if (connection->dmap_version == 3.0) { */
+	uri = g_strdup_printf
+		("%s/databases/%d/items/%d.%s?session-id=%u",
+		 connection->priv->daap_base_uri,
+		 connection->priv->database_id, item_id,
+		 format, connection->priv->session_id);
+	/*} else { */
+	/* uri should be
+	 * "/databases/%d/items/%d.%s?session-id=%u&revision-id=%d";
+	 * but its not going to work cause the other parts of the code
+	 * depend on the uri to have the ip address so that the
+	 * DAAPSource can be found to ++request_id
+	 * maybe just /dont/ support older itunes.  doesn't seem
+	 * unreasonable to me, honestly
+	 */
+	/*} */
+
+	g_object_set (record, "location", uri, NULL);
+	dmap_db_add (connection->priv->db, record, &error);
+	if (NULL != error) {
+		g_signal_emit (connection, _signals[ERROR], 0, error);
+	}
+	g_hash_table_insert (connection->priv->item_id_to_uri,
+			     GINT_TO_POINTER (item_id),
+			     g_strdup (uri));
+	g_free (uri);
+	g_free (format);
+}
+
+/* Reads /databases/N/items as it arrives: each MLIT becomes a record as
+ * soon as it is complete, so no more than one read and one partial MLIT
+ * are held at a time, whatever the size of the library. */
+#define DMAP_CONNECTION_READ_SIZE (64 * 1024)
+
+typedef enum {
+	LISTING_HEADER,
+	LISTING_PREAMBLE,
+	LISTING_ITEMS,
+	LISTING_DONE
+} ListingState;
+
+typedef struct {
+	DmapConnection *connection;
+	SoupMessage *message;
+	GInputStream *stream;
+
+	/* Bytes read but not yet consumed. */
+	GByteArray *buffer;
+
+	ListingState state;
+	/* Bytes of the ADBS and of its MLCL not yet consumed. */
+	gsize adbs_left;
+	gsize mlcl_left;
+
+	/* Tags seen so far, which a listing must have. */
+	gboolean have_mrco;
+	gboolean have_mtco;
+	gboolean have_muty;
+	gboolean have_mlcl;
 	gint returned_count;
-	gint i;
-	GNode *n;
 	gint commit_batch;
+	gint i;
+} ListingReader;
+
+static ListingReader *
+_listing_reader_new (DmapConnection * connection)
+{
+	ListingReader *reader = g_new0 (ListingReader, 1);
 
-	/* get the songs */
+	reader->connection = g_object_ref (connection);
+	reader->buffer = g_byte_array_sized_new (DMAP_CONNECTION_READ_SIZE);
+	reader->state = LISTING_HEADER;
 
-	if (structure == NULL || SOUP_STATUS_IS_SUCCESSFUL (status) == FALSE) {
-		goto done;
+	return reader;
+}
+
+static void
+_listing_reader_free (ListingReader * reader)
+{
+	if (reader->stream) {
+		g_object_unref (reader->stream);
+	}
+	if (reader->message) {
+		g_object_unref (reader->message);
 	}
+	g_byte_array_unref (reader->buffer);
+	g_object_unref (reader->connection);
+	g_free (reader);
+}
 
-	item = dmap_structure_find_item (structure, DMAP_CC_MRCO);
-	if (item == NULL) {
-		g_debug ("Could not find dmap.returnedcount item in /databases/%d/items", priv->database_id);
-		goto done;
+/* Tells the connection's "connecting" handlers how far the listing has
+ * got. They are called here rather than from an idle source, since the
+ * reads of a long listing would keep an idle source from running. */
+static void
+_listing_reader_progress (ListingReader * reader)
+{
+	DmapConnectionPrivate *priv = reader->connection->priv;
+
+	if (reader->returned_count > 0) {
+		priv->progress = (float) reader->i
+		               / (float) reader->returned_count;
+	}
+
+	if (priv->emit_progress_id != 0) {
+		g_source_remove (priv->emit_progress_id);
+		priv->emit_progress_id = 0;
 	}
-	returned_count = g_value_get_int (&(item->content));
-	if (returned_count > 20) {
-		commit_batch = returned_count / 20;
+
+	g_signal_emit (G_OBJECT (reader->connection), _signals[CONNECTING], 0,
+	               priv->state, priv->progress);
+}
+
+static void
+_listing_reader_begin_items (ListingReader * reader)
+{
+	DmapConnectionPrivate *priv = reader->connection->priv;
+
+	reader->have_mlcl = TRUE;
+
+	/* The count normally precedes the MLCL; if not, report progress
+	 * on every MLIT. */
+	if (reader->returned_count > 20) {
+		reader->commit_batch = reader->returned_count / 20;
 	} else {
-		commit_batch = 1;
+		reader->commit_batch = 1;
 	}
 
-	item = dmap_structure_find_item (structure, DMAP_CC_MTCO);
-	if (item == NULL) {
+	/* FIXME: refstring: */
+	priv->item_id_to_uri =
+		g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+				       (GDestroyNotify) g_free);
+
+	priv->progress = 0.0f;
+	_listing_reader_progress (reader);
+}
+
+/* Whether the listing had every tag it must; a missing one is logged. */
+static gboolean
+_listing_reader_check (ListingReader * reader)
+{
+	gboolean ok = FALSE;
+	DmapConnectionPrivate *priv = reader->connection->priv;
+
+	if (!reader->have_mrco) {
+		g_debug ("Could not find dmap.returnedcount item in /databases/%d/items", priv->database_id);
+		goto done;
+	}
+
+	if (!reader->have_mtco) {
 		g_debug ("Could not find dmap.specifiedtotalcount item in /databases/%d/items", priv->database_id);
 		goto done;
 	}
 
-	item = dmap_structure_find_item (structure, DMAP_CC_MUTY);
-	if (item == NULL) {
+	if (!reader->have_muty) {
 		g_debug ("Could not find dmap.updatetype item in /databases/%d/items", priv->database_id);
 		goto done;
 	}
 
-	listing_node = dmap_structure_find_node (structure, DMAP_CC_MLCL);
-	if (listing_node == NULL) {
+	if (!reader->have_mlcl) {
 		g_debug ("Could not find dmap.listing item in /databases/%d/items", priv->database_id);
 		goto done;
 	}
 
-	/* FIXME: refstring: */
-	priv->item_id_to_uri =
-		g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
-				       (GDestroyNotify) g_free);
+	ok = TRUE;
 
-	priv->progress = 0.0f;
-	if (priv->emit_progress_id != 0) {
-		g_source_remove (priv->emit_progress_id);
+done:
+	return ok;
+}
+
+static void
+_listing_reader_item (ListingReader * reader,
+                      const DmapStructureCursor * mlit)
+{
+	gint item_id = 0;
+	DmapRecord *record;
+
+	record = _handle_mlit (reader->connection, mlit, &item_id);
+	if (record) {
+		_add_song (reader->connection, record, item_id);
+		g_object_unref (record);
+	} else {
+		g_debug ("cannot create record for daap track");
 	}
-	priv->emit_progress_id =
-		g_idle_add ((GSourceFunc) _emit_progress_idle, connection);
 
-	for (i = 0, n = listing_node->children; n; i++, n = n->next) {
-		gint item_id = 0;
-		DmapRecord *record =
-			DMAP_CONNECTION_GET_CLASS (connection)->handle_mlcl
-			(connection, priv->record_factory, n,
-			 &item_id);
+	if (reader->i++ % reader->commit_batch == 0) {
+		_listing_reader_progress (reader);
+	}
+}
+
+/* Consumes every complete unit in the buffer; returns FALSE on error. */
+static gboolean
+_listing_reader_parse (ListingReader * reader, GError ** error)
+{
+	gboolean ok = FALSE;
+	const guint8 *buf = reader->buffer->data;
+	gsize len = reader->buffer->len;
+	gsize offset = 0;
 
-		if (record) {
-			GError *error = NULL;
-			gchar *uri = NULL;
-			gchar *format = NULL;
+	while (LISTING_DONE != reader->state) {
+		DmapStructureCursor cursor;
+		gsize *left;
+		guint32 size;
 
-			g_object_get (record, "format", &format, NULL);
-			if (format == NULL) {
-				format = g_strdup ("Unknown");
-			}
+		if (LISTING_PREAMBLE == reader->state && 0 == reader->adbs_left) {
+			reader->state = LISTING_DONE;
+			break;
+		}
+
+		if (LISTING_ITEMS == reader->state && 0 == reader->mlcl_left) {
+			reader->state = LISTING_PREAMBLE;
+			continue;
+		}
+
+		if (len - offset < 8) {
+			break;
+		}
+
+		size = DMAP_READ_UINT32_BE (buf + offset + 4);
+
+		left = LISTING_ITEMS == reader->state ? &reader->mlcl_left
+		     : LISTING_PREAMBLE == reader->state ? &reader->adbs_left
+		     : NULL;
+		if (left && (*left < 8 || size > *left - 8)) {
+			g_set_error (error, DMAP_ERROR,
+			             DMAP_STATUS_INVALID_CONTENT_CODE_SIZE,
+			             "Invalid codesize %u in listing", size);
+			goto done;
+		}
 
-			/*if (connection->dmap_version == 3.0) { */
-			uri = g_strdup_printf
-				("%s/databases/%d/items/%d.%s?session-id=%u",
-				 connection->priv->daap_base_uri,
-				 connection->priv->database_id, item_id,
-				 format, connection->priv->session_id);
-			/*} else { */
-			/* uri should be
-			 * "/databases/%d/items/%d.%s?session-id=%u&revision-id=%d";
-			 * but its not going to work cause the other parts of the code
-			 * depend on the uri to have the ip address so that the
-			 * DAAPSource can be found to ++request_id
-			 * maybe just /dont/ support older itunes.  doesn't seem
-			 * unreasonable to me, honestly
-			 */
-			/*} */
-
-			g_object_set (record, "location", uri, NULL);
-			dmap_db_add (connection->priv->db, record, &error);
-			if (NULL != error) {
-				g_signal_emit (connection, _signals[ERROR], 0, error);
+		if (LISTING_HEADER == reader->state
+		 || (LISTING_PREAMBLE == reader->state
+		  && 0 == memcmp (buf + offset, "mlcl", 4))) {
+			/* Only step into containers: their contents are
+			 * consumed as they arrive. */
+			if (LISTING_HEADER == reader->state) {
+				reader->adbs_left = size;
+				reader->state = LISTING_PREAMBLE;
+			} else {
+				reader->adbs_left -= 8 + size;
+				reader->mlcl_left = size;
+				reader->state = LISTING_ITEMS;
+				_listing_reader_begin_items (reader);
 			}
-			g_object_unref (record);
-			g_hash_table_insert (connection->priv->item_id_to_uri,
-					     GINT_TO_POINTER (item_id),
-					     g_strdup (uri));
-			g_free (uri);
-			g_free (format);
-		} else {
-			g_debug ("cannot create record for daap track");
+			offset += 8;
+			continue;
 		}
 
-		if (i % commit_batch == 0) {
-			priv->progress = ((float) i / (float) returned_count);
-			if (priv->emit_progress_id != 0) {
-				g_source_remove (connection->
-						 priv->emit_progress_id);
+		if (len - offset < 8 + (gsize) size) {
+			break;
+		}
+
+		dmap_structure_cursor_init (&cursor, buf + offset, 8 + size);
+		if (!dmap_structure_cursor_next (&cursor, error)) {
+			goto done;
+		}
+
+		if (LISTING_ITEMS == reader->state) {
+			if (DMAP_CC_MLIT == cursor.content_code) {
+				_listing_reader_item (reader, &cursor);
+			}
+		} else {
+			switch (cursor.content_code) {
+			case DMAP_CC_MSTT:
+				if (dmap_structure_cursor_get_int (&cursor) != 200) {
+					g_set_error (error, DMAP_ERROR,
+					             DMAP_STATUS_FAILED,
+					             "dmap.status is not 200");
+					goto done;
+				}
+				break;
+			case DMAP_CC_MRCO:
+				reader->returned_count =
+					dmap_structure_cursor_get_int (&cursor);
+				reader->have_mrco = TRUE;
+				break;
+			case DMAP_CC_MTCO:
+				reader->have_mtco = TRUE;
+				break;
+			case DMAP_CC_MUTY:
+				reader->have_muty = TRUE;
+				break;
+			default:
+				break;
 			}
-			priv->emit_progress_id =
-				g_idle_add ((GSourceFunc) _emit_progress_idle,
-					    connection);
 		}
+
+		*left -= 8 + size;
+		offset += 8 + size;
 	}
 
 	ok = TRUE;
 
 done:
-	_state_done (connection, ok);
+	/* Keep only the partial unit, if any. */
+	g_byte_array_remove_range (reader->buffer, 0, offset);
+
+	return ok;
+}
+
+static void
+_listing_reader_finish (ListingReader * reader, GError * error)
+{
+	gboolean ok = FALSE;
+
+	if (NULL != error) {
+		dmap_connection_emit_error (reader->connection, error->code,
+		                            "Error reading /databases/%d/items response: %s\n",
+		                            reader->connection->priv->database_id,
+		                            error->message);
+		goto done;
+	}
+
+	if (LISTING_DONE != reader->state) {
+		dmap_connection_emit_error (reader->connection,
+		                            DMAP_STATUS_RESPONSE_TOO_SHORT,
+		                            "Truncated /databases/%d/items response\n",
+		                            reader->connection->priv->database_id);
+		goto done;
+	}
+
+	ok = _listing_reader_check (reader);
+
+done:
+	_state_done (reader->connection, ok);
+	_listing_reader_free (reader);
+}
+
+static void
+_listing_reader_read_cb (GObject * source, GAsyncResult * result,
+                         gpointer user_data)
+{
+	ListingReader *reader = user_data;
+	GBytes *bytes;
+	GError *error = NULL;
+
+	bytes = g_input_stream_read_bytes_finish (G_INPUT_STREAM (source),
+	                                          result, &error);
+	if (NULL == bytes) {
+		goto done;
+	}
+
+	if (0 == g_bytes_get_size (bytes)) {
+		/* End of stream. */
+		g_bytes_unref (bytes);
+		goto done;
+	}
+
+	g_byte_array_append (reader->buffer, g_bytes_get_data (bytes, NULL),
+	                     g_bytes_get_size (bytes));
+	g_bytes_unref (bytes);
+
+	if (!_listing_reader_parse (reader, &error)) {
+		goto done;
+	}
+
+	g_input_stream_read_bytes_async (reader->stream,
+	                                 DMAP_CONNECTION_READ_SIZE,
+	                                 G_PRIORITY_DEFAULT, NULL,
+	                                 _listing_reader_read_cb, reader);
+	return;
+
+done:
+	_listing_reader_finish (reader, error);
+	g_clear_error (&error);
+}
+
+static void
+_listing_reader_send_cb (GObject * source, GAsyncResult * result,
+                         gpointer user_data)
+{
+	ListingReader *reader = user_data;
+	SoupMessageHeaders *headers;
+	const char *encoding;
+	GError *error = NULL;
+
+	reader->stream = soup_session_send_finish (SOUP_SESSION (source),
+	                                           result, &error);
+	if (NULL == reader->stream) {
+		goto done;
+	}
+
+	if (!SOUP_STATUS_IS_SUCCESSFUL (soup_message_get_status (reader->message))) {
+		g_debug ("Error getting song listing: %d, %s",
+		         soup_message_get_status (reader->message),
+		         soup_message_get_reason_phrase (reader->message));
+		_connection_set_error_message (reader->connection,
+		                               soup_message_get_reason_phrase (reader->message));
+		_state_done (reader->connection, FALSE);
+		_listing_reader_free (reader);
+		return;
+	}
+
+	headers = soup_message_get_response_headers (reader->message);
+	encoding = soup_message_headers_get_one (headers, "Content-Encoding");
+	if (encoding && 0 == strcmp (encoding, "gzip")
+	 && !soup_session_has_feature (SOUP_SESSION (source),
+	                               SOUP_TYPE_CONTENT_DECODER)) {
+		GConverter *decompressor;
+		GInputStream *stream;
+
+		decompressor = G_CONVERTER (g_zlib_decompressor_new
+		                            (G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+		stream = g_converter_input_stream_new (reader->stream,
+		                                       decompressor);
+		g_object_unref (decompressor);
+		g_object_unref (reader->stream);
+		reader->stream = stream;
+	}
+
+	g_input_stream_read_bytes_async (reader->stream,
+	                                 DMAP_CONNECTION_READ_SIZE,
+	                                 G_PRIORITY_DEFAULT, NULL,
+	                                 _listing_reader_read_cb, reader);
 	return;
+
+done:
+	_listing_reader_finish (reader, error);
+	g_clear_error (&error);
+}
+
+static gboolean
+_http_get_listing (DmapConnection * connection, const char *path)
+{
+	gboolean ok = FALSE;
+	ListingReader *reader;
+	SoupMessage *message;
+
+	message = _build_message (connection, path);
+	if (message == NULL) {
+		g_debug ("Error building message for %s", path);
+		goto done;
+	}
+
+	reader = _listing_reader_new (connection);
+	reader->message = message;
+
+	soup_session_send_async (connection->priv->session, message,
+	                         G_PRIORITY_DEFAULT, NULL,
+	                         _listing_reader_send_cb, reader);
+
+	ok = TRUE;
+
+done:
+	return ok;
 }
 
 static int
@@ -1612,9 +1940,7 @@ _do_something (DmapConnection * connection)
 			("/databases/%i/items?session-id=%u&revision-number=%i"
 			 "&meta=%s", priv->database_id, priv->session_id,
 			 priv->revision_number, meta);
-		if (!_http_get
-		    (connection, path,
-		     (DmapResponseHandler) _handle_song_listing, NULL, TRUE)) {
+		if (!_http_get_listing (connection, path)) {
 			g_debug ("Could not get DMAP song listing");
 			_state_done (connection, FALSE);
 		}
@@ -1930,6 +2256,8 @@ dmap_connection_emit_error(DmapConnection *connection, gint code,
 
 #include <check.h>
 #include <libdmapsharing/dmap-av-connection.h>
+#include <libdmapsharing/test-dmap-db.h>
+#include <libdmapsharing/test-dmap-av-record-factory.h>
 
 static int _status = DMAP_STATUS_OK;
 
@@ -1985,6 +2313,372 @@ _ACTUAL_HTTP_RESPONSE_HANDLER_TEST("minm\x00\x00\x00\x99Hello, world!",
                                     DMAP_STATUS_INVALID_CONTENT_CODE_SIZE);
 END_TEST
 
+static gchar *
+_build_listing (guint num_items, guint * length)
+{
+	DmapStructureBuilder *builder;
+	guint i;
+
+	builder = dmap_structure_builder_new (0);
+
+	dmap_structure_builder_begin (builder, DMAP_CC_ADBS);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_MSTT, 200);
+	dmap_structure_builder_add_int8 (builder, DMAP_CC_MUTY, 0);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_MTCO, num_items);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_MRCO, num_items);
+	dmap_structure_builder_begin (builder, DMAP_CC_MLCL);
+
+	for (i = 0; i < num_items; i++) {
+		dmap_structure_builder_begin (builder, DMAP_CC_MLIT);
+		dmap_structure_builder_add_int32 (builder, DMAP_CC_MIID, i + 1);
+		dmap_structure_builder_add_string (builder, DMAP_CC_MINM, "title");
+		dmap_structure_builder_add_string (builder, DMAP_CC_ASFM, "mp3");
+		dmap_structure_builder_end (builder);
+	}
+
+	dmap_structure_builder_end (builder);
+	dmap_structure_builder_end (builder);
+
+	return dmap_structure_builder_finish (builder, length);
+}
+
+/* Feed a listing to the reader a few bytes at a time, as if it arrived
+ * over a slow connection; every MLIT must be added exactly once. */
+static void
+_listing_reader_chunked_test (gsize chunk)
+{
+	DmapConnection *connection;
+	DmapDb *db;
+	TestDmapAvRecordFactory *factory;
+	ListingReader *reader;
+	gchar *data;
+	guint length;
+	gsize offset;
+	GError *error = NULL;
+
+	db = DMAP_DB (test_dmap_db_new ());
+	factory = test_dmap_av_record_factory_new ();
+	connection = g_object_new (DMAP_TYPE_AV_CONNECTION, "db", db,
+	                           "factory", factory, NULL);
+
+	data = _build_listing (50, &length);
+	reader = _listing_reader_new (connection);
+
+	for (offset = 0; offset < length; offset += chunk) {
+		g_byte_array_append (reader->buffer, (guint8 *) data + offset,
+		                     MIN (chunk, length - offset));
+		ck_assert (_listing_reader_parse (reader, &error));
+		ck_assert (NULL == error);
+		/* Only ever a partial unit is left over. */
+		ck_assert (reader->buffer->len < 64);
+	}
+
+	ck_assert_int_eq (LISTING_DONE, reader->state);
+	ck_assert_int_eq (50, dmap_db_count (db));
+	ck_assert_int_eq (50, g_hash_table_size (connection->priv->item_id_to_uri));
+
+	_listing_reader_free (reader);
+	g_free (data);
+	g_object_unref (connection);
+	g_object_unref (factory);
+	g_object_unref (db);
+}
+
+START_TEST(_listing_reader_one_byte_test)
+{
+	_listing_reader_chunked_test (1);
+}
+END_TEST
+
+START_TEST(_listing_reader_whole_test)
+{
+	_listing_reader_chunked_test (G_MAXUINT);
+}
+END_TEST
+
+START_TEST(_listing_reader_bad_len_test)
+{
+	DmapConnection *connection;
+	ListingReader *reader;
+	GError *error = NULL;
+	/* The MSTT claims more bytes than the ADBS holds. */
+	const guint8 bytes[] = "adbs\x00\x00\x00\x0cmstt\x00\x00\x00\x99\x00\x00\x00\xc8";
+
+	connection = g_object_new (DMAP_TYPE_AV_CONNECTION, NULL);
+	reader = _listing_reader_new (connection);
+
+	g_byte_array_append (reader->buffer, bytes, sizeof bytes - 1);
+	ck_assert (!_listing_reader_parse (reader, &error));
+	ck_assert_int_eq (DMAP_STATUS_INVALID_CONTENT_CODE_SIZE, error->code);
+
+	g_clear_error (&error);
+	_listing_reader_free (reader);
+	g_object_unref (connection);
+}
+END_TEST
+
+static void
+_connecting_test (G_GNUC_UNUSED DmapConnection *connection,
+                  G_GNUC_UNUSED gulong state, gfloat progress,
+                  gfloat *last)
+{
+	ck_assert (progress >= *last);
+	*last = progress;
+}
+
+/* Progress is reported as MLIT's are added, not only once the listing
+ * is read, and the listing is checked for the tags it must have. */
+START_TEST(_listing_reader_progress_test)
+{
+	DmapConnection *connection;
+	DmapDb *db;
+	TestDmapAvRecordFactory *factory;
+	ListingReader *reader;
+	gchar *data;
+	guint length;
+	gfloat last = -1.0f;
+	GError *error = NULL;
+
+	db = DMAP_DB (test_dmap_db_new ());
+	factory = test_dmap_av_record_factory_new ();
+	connection = g_object_new (DMAP_TYPE_AV_CONNECTION, "db", db,
+	                           "factory", factory, NULL);
+	g_signal_connect (connection, "connecting",
+	                  G_CALLBACK (_connecting_test), &last);
+
+	data = _build_listing (100, &length);
+	reader = _listing_reader_new (connection);
+
+	/* Half the listing. */
+	g_byte_array_append (reader->buffer, (guint8 *) data, length / 2);
+	ck_assert (_listing_reader_parse (reader, &error));
+	ck_assert (last > 0.0f && last < 1.0f);
+
+	g_byte_array_append (reader->buffer, (guint8 *) data + length / 2,
+	                     length - length / 2);
+	ck_assert (_listing_reader_parse (reader, &error));
+	ck_assert (last > 0.9f);
+	ck_assert (_listing_reader_check (reader));
+
+	_listing_reader_free (reader);
+	g_free (data);
+	g_object_unref (connection);
+	g_object_unref (factory);
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_listing_reader_no_mlcl_test)
+{
+	DmapConnection *connection;
+	DmapStructureBuilder *builder;
+	ListingReader *reader;
+	gchar *data;
+	guint length;
+	GError *error = NULL;
+
+	builder = dmap_structure_builder_new (0);
+	dmap_structure_builder_begin (builder, DMAP_CC_ADBS);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_MSTT, 200);
+	dmap_structure_builder_add_int8 (builder, DMAP_CC_MUTY, 0);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_MTCO, 0);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_MRCO, 0);
+	dmap_structure_builder_end (builder);
+	data = dmap_structure_builder_finish (builder, &length);
+
+	connection = g_object_new (DMAP_TYPE_AV_CONNECTION, NULL);
+	reader = _listing_reader_new (connection);
+
+	g_byte_array_append (reader->buffer, (guint8 *) data, length);
+	ck_assert (_listing_reader_parse (reader, &error));
+	ck_assert_int_eq (LISTING_DONE, reader->state);
+	ck_assert (!_listing_reader_check (reader));
+
+	_listing_reader_free (reader);
+	g_free (data);
+	g_object_unref (connection);
+}
+END_TEST
+
+static GBytes *
+_gzip_test (gconstpointer data, gsize length)
+{
+	GConverter *compressor;
+	GBytes *bytes;
+
+	compressor = G_CONVERTER (g_zlib_compressor_new
+		(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+	bytes = dmap_private_utils_convert (compressor, data, length,
+	                                    G_CONVERTER_INPUT_AT_END, NULL);
+	ck_assert (NULL != bytes);
+
+	g_object_unref (compressor);
+
+	return bytes;
+}
+
+START_TEST(_actual_http_response_handler_gzip_test)
+{
+	DmapConnection *connection;
+	DmapResponseData *data;
+	const guint8 bytes[] = "minm\x00\x00\x00\x0eHello, world!";
+
+	_status = DMAP_STATUS_OK;
+
+	connection = g_object_new (DMAP_TYPE_AV_CONNECTION, NULL);
+	g_signal_connect (connection, "error", G_CALLBACK (_error_cb), NULL);
+
+	data = g_new0 (DmapResponseData, 1);
+	data->body = _gzip_test (bytes, sizeof bytes - 1);
+	data->gzipped = TRUE;
+	data->status = SOUP_STATUS_OK;
+	/* Released along with data. */
+	data->connection = g_object_ref (connection);
+	data->message_path = g_strdup ("/");
+
+	_actual_http_response_handler (data);
+
+	ck_assert (_status == DMAP_STATUS_OK);
+
+	g_object_unref (connection);
+}
+END_TEST
+
+static void
+_gzip_handler_test (G_GNUC_UNUSED SoupServer *server,
+                    SoupServerMessage *message,
+                    G_GNUC_UNUSED const char *path,
+                    G_GNUC_UNUSED GHashTable *query,
+                    GBytes *gzipped)
+{
+	soup_message_headers_append (soup_server_message_get_response_headers
+	                             (message), "Content-Encoding", "gzip");
+	soup_server_message_set_response (message, "application/x-dmap-tagged",
+	                                  SOUP_MEMORY_COPY,
+	                                  g_bytes_get_data (gzipped, NULL),
+	                                  g_bytes_get_size (gzipped));
+	soup_server_message_set_status (message, SOUP_STATUS_OK, NULL);
+}
+
+/* Fetch a large gzipped listing from a server, through a session which
+ * does not decode it, so that the reader inflates it a read at a time;
+ * the inflated listing never needs to be held whole. */
+START_TEST(_listing_reader_gzip_test)
+{
+	const guint num_items = 200000;
+	DmapConnection *connection;
+	DmapDb *db;
+	TestDmapAvRecordFactory *factory;
+	ListingReader *reader;
+	SoupServer *server;
+	SoupSession *session;
+	GSList *uris;
+	GBytes *gzipped;
+	gchar *data;
+	guint length;
+	GError *error = NULL;
+
+	_status = DMAP_STATUS_OK;
+
+	db = DMAP_DB (test_dmap_db_new ());
+	factory = test_dmap_av_record_factory_new ();
+	connection = g_object_new (DMAP_TYPE_AV_CONNECTION, "db", db,
+	                           "factory", factory, NULL);
+	g_signal_connect (connection, "error", G_CALLBACK (_error_cb), NULL);
+
+	data = _build_listing (num_items, &length);
+	gzipped = _gzip_test (data, length);
+	g_free (data);
+	ck_assert (g_bytes_get_size (gzipped) < length);
+
+	server = soup_server_new (NULL, NULL);
+	soup_server_add_handler (server, NULL,
+	                         (SoupServerCallback) _gzip_handler_test,
+	                         gzipped, NULL);
+	ck_assert (soup_server_listen_local (server, 0, 0, &error));
+	uris = soup_server_get_uris (server);
+	ck_assert (NULL != uris);
+
+	session = soup_session_new ();
+	soup_session_remove_feature_by_type (session,
+	                                     SOUP_TYPE_CONTENT_DECODER);
+
+	reader = _listing_reader_new (connection);
+	reader->message = soup_message_new_from_uri (SOUP_METHOD_GET,
+	                                             uris->data);
+	soup_session_send_async (session, reader->message, G_PRIORITY_DEFAULT,
+	                         NULL, _listing_reader_send_cb, reader);
+
+	/* The reader frees itself once done, and moves the connection on
+	 * to its next state, which is not run here. */
+	while (0 == connection->priv->do_something_id) {
+		g_main_context_iteration (NULL, TRUE);
+	}
+
+	ck_assert (_status == DMAP_STATUS_OK);
+	ck_assert (DMAP_DONE != connection->priv->state);
+	ck_assert_int_eq (num_items, dmap_db_count (db));
+
+	g_slist_free_full (uris, (GDestroyNotify) g_uri_unref);
+	g_object_unref (session);
+	soup_server_disconnect (server);
+	g_object_unref (server);
+	g_bytes_unref (gzipped);
+	g_object_unref (connection);
+	g_object_unref (factory);
+	g_object_unref (db);
+}
+END_TEST
+
+/* A connection which parses records its own way. */
+typedef struct {
+	DmapAvConnection parent;
+} TestParsingConnection;
+
+typedef struct {
+	DmapAvConnectionClass parent;
+} TestParsingConnectionClass;
+
+GType test_parsing_connection_get_type (void);
+
+G_DEFINE_TYPE (TestParsingConnection, test_parsing_connection,
+               DMAP_TYPE_AV_CONNECTION)
+
+static DmapRecord *
+_test_parsing_handle_mlcl (G_GNUC_UNUSED DmapConnection * connection,
+                           G_GNUC_UNUSED DmapRecordFactory * factory,
+                           G_GNUC_UNUSED GNode * mlcl,
+                           G_GNUC_UNUSED gint * item_id)
+{
+	return NULL;
+}
+
+static void
+test_parsing_connection_init (G_GNUC_UNUSED TestParsingConnection * connection)
+{
+}
+
+static void
+test_parsing_connection_class_init (TestParsingConnectionClass * klass)
+{
+	DMAP_CONNECTION_CLASS (klass)->handle_mlcl = _test_parsing_handle_mlcl;
+}
+
+START_TEST(_lookup_mlit_handler_override_test)
+{
+	DmapConnection *connection;
+
+	connection = g_object_new (DMAP_TYPE_AV_CONNECTION, NULL);
+	ck_assert (NULL != _lookup_mlit_handler (connection));
+	g_object_unref (connection);
+
+	/* The inherited handler would bypass the override. */
+	connection = g_object_new (test_parsing_connection_get_type (), NULL);
+	ck_assert (NULL == _lookup_mlit_handler (connection));
+	g_object_unref (connection);
+}
+END_TEST
+
 #include "dmap-connection-suite.c"
 
 #endif
@@ -909,24 +909,32 @@ dmap_control_share_ctrl_int (DmapShare * share,
 			GList *sorted_records;
 			GSList *filter_def;
 			DmapDb *db;
+			gboolean collate;
 			gint index =
 				atoi (g_hash_table_lookup (query, "index"));
 
-			g_object_get (share, "db", &db, NULL);
+			g_object_get (share, "db", &db,
+			                     "collate-sort", &collate, NULL);
 			record_query = g_hash_table_lookup (query, "query");
 			filter_def = dmap_share_build_filter (record_query);
 			records = dmap_db_apply_filter (db, filter_def);
-			sorted_records = g_hash_table_get_values (records);
 			sort_by = g_hash_table_lookup (query, "sort");
 			if (g_strcmp0 (sort_by, "album") == 0) {
-				sorted_records =
-					g_list_sort_with_data (sorted_records,
-							       (GCompareDataFunc)
-							       dmap_av_record_cmp_by_album,
-							       db);
-			} else if (sort_by != NULL) {
-				g_warning ("Unknown sort column: %s",
-					   sort_by);
+				GList *id;
+
+				/* Sort the IDs, then swap in their records. */
+				sorted_records = dmap_av_record_sort_by_album
+					(records, collate);
+				for (id = sorted_records; id; id = id->next) {
+					id->data = g_hash_table_lookup
+						(records, id->data);
+				}
+			} else {
+				if (sort_by != NULL) {
+					g_warning ("Unknown sort column: %s",
+						   sort_by);
+				}
+				sorted_records = g_hash_table_get_values (records);
 			}
 
 			dmap_control_player_cue_play (dmap_control_share->priv->player,
@@ -18,16 +18,14 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
  */
 
+#include "config.h"
+
 #include <stdlib.h>
 #include <string.h>
 #include <libdmapsharing/dmap-db.h>
+#include <libdmapsharing/dmap-av-record.h>
+#include <libdmapsharing/dmap-utils.h>
 
-typedef struct FilterData
-{
-	DmapDb *db;
-	GSList *filter_def;
-	GHashTable *ht;
-} FilterData;
 
 static void
 dmap_db_default_init (G_GNUC_UNUSED DmapDbInterface * iface)
@@ -79,183 +77,1802 @@ dmap_db_count (const DmapDb * db)
 	return DMAP_DB_GET_INTERFACE (db)->count (db);
 }
 
+/* How a clause reads the property it compares, decided once per record
+ * class rather than once per record. */
+typedef enum {
+	FILTER_MISSING,
+	FILTER_UNHANDLED,
+	FILTER_STRING,
+	FILTER_BOOLEAN,
+	FILTER_LONG,
+	FILTER_TRANSFORM_LONG,
+	FILTER_TRANSFORM_STRING
+} FilterKind;
+
+typedef struct {
+	/* Property name: the part of the key after the last dot. */
+	const gchar *property_name;
+	/* The query value, pre-parsed into each form a comparison needs. */
+	const gchar *value;
+	gchar *folded;
+	glong number;
+	gulong item_id;
+	gboolean is_item_id;
+	gboolean negate;
+	/* Clauses are ORed until one which ends a group; groups are ANDed. */
+	gboolean ends_group;
+
+	/* Resolved for records of class_type. */
+	GType class_type;
+	GParamSpec *pspec;
+	FilterKind kind;
+} FilterClause;
+
+typedef struct {
+	GArray *clauses;
+} FilterProgram;
+
+static FilterProgram *
+_filter_program_compile (GSList * filter_def)
+{
+	FilterProgram *program;
+	GSList *list, *filter;
+
+	program = g_new0 (FilterProgram, 1);
+	program->clauses = g_array_new (FALSE, TRUE, sizeof (FilterClause));
+
+	for (list = filter_def; list != NULL; list = list->next) {
+		for (filter = list->data; filter != NULL;
+		     filter = filter->next) {
+			DmapDbFilterDefinition *def = filter->data;
+			FilterClause clause = { 0, };
+
+			// Use only the part after the last dot.
+			// For instance, dmap.songgenre becomes songgenre.
+			clause.property_name = strrchr (def->key, '.');
+			if (clause.property_name == NULL) {
+				clause.property_name = def->key;
+			} else {
+				//Don't include the dot in the property name.
+				clause.property_name++;
+			}
+
+			clause.value = def->value;
+			clause.negate = def->negate;
+			clause.is_item_id = g_strcmp0 (def->key, "dmap.itemid") == 0;
+			clause.class_type = G_TYPE_INVALID;
+
+			if (def->value != NULL) {
+				clause.folded = g_ascii_strdown (def->value, -1);
+				clause.number = strtol (def->value, NULL, 10);
+				clause.item_id = strtoul (def->value, NULL, 10);
+			}
+
+			g_array_append_val (program->clauses, clause);
+		}
+
+		if (program->clauses->len > 0) {
+			g_array_index (program->clauses, FilterClause,
+			               program->clauses->len - 1).ends_group = TRUE;
+		}
+	}
+
+	return program;
+}
+
+static void
+_filter_program_free (FilterProgram * program)
+{
+	guint i;
+
+	for (i = 0; i < program->clauses->len; i++) {
+		g_free (g_array_index (program->clauses, FilterClause, i).folded);
+	}
+
+	g_array_free (program->clauses, TRUE);
+	g_free (program);
+}
+
+static FilterKind
+_filter_kind (GParamSpec * pspec)
+{
+	FilterKind kind;
+	GType type = G_PARAM_SPEC_VALUE_TYPE (pspec);
+
+	switch (G_TYPE_FUNDAMENTAL (type)) {
+	case G_TYPE_STRING:
+		kind = FILTER_STRING;
+		break;
+	case G_TYPE_BOOLEAN:
+		kind = FILTER_BOOLEAN;
+		break;
+	case G_TYPE_CHAR:
+	case G_TYPE_UCHAR:
+	case G_TYPE_INT:
+	case G_TYPE_UINT:
+	case G_TYPE_LONG:
+	case G_TYPE_ULONG:
+	case G_TYPE_INT64:
+	case G_TYPE_UINT64:
+	case G_TYPE_ENUM:
+		kind = FILTER_LONG;
+		break;
+	default:
+		// Prefer integer conversion.
+		if (g_value_type_transformable (type, G_TYPE_LONG)) {
+			kind = FILTER_TRANSFORM_LONG;
+		} else if (g_value_type_transformable (type, G_TYPE_STRING)) {
+			kind = FILTER_TRANSFORM_STRING;
+		} else {
+			kind = FILTER_UNHANDLED;
+		}
+		break;
+	}
+
+	return kind;
+}
+
+static void
+_filter_clause_resolve (FilterClause * clause, DmapRecord * record)
+{
+	clause->class_type = G_OBJECT_TYPE (record);
+	clause->pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (record),
+	                                              clause->property_name);
+	if (clause->pspec == NULL) {
+		// Can't find the property in this record, so don't accept it.
+		clause->kind = FILTER_MISSING;
+		goto done;
+	}
+
+	clause->kind = _filter_kind (clause->pspec);
+	if (clause->kind == FILTER_UNHANDLED) {
+		g_warning ("Attempt to compare unhandled type");
+	}
+
+done:
+	return;
+}
+
+static glong
+_value_get_long (const GValue * value)
+{
+	glong fnval = 0;
+
+	switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value))) {
+	case G_TYPE_CHAR:
+		fnval = g_value_get_schar (value);
+		break;
+	case G_TYPE_UCHAR:
+		fnval = g_value_get_uchar (value);
+		break;
+	case G_TYPE_INT:
+		fnval = g_value_get_int (value);
+		break;
+	case G_TYPE_UINT:
+		fnval = g_value_get_uint (value);
+		break;
+	case G_TYPE_LONG:
+		fnval = g_value_get_long (value);
+		break;
+	case G_TYPE_ULONG:
+		fnval = g_value_get_ulong (value);
+		break;
+	case G_TYPE_INT64:
+		fnval = g_value_get_int64 (value);
+		break;
+	case G_TYPE_UINT64:
+		fnval = g_value_get_uint64 (value);
+		break;
+	case G_TYPE_ENUM:
+		fnval = g_value_get_enum (value);
+		break;
+	default:
+		g_assert_not_reached ();
+	}
+
+	return fnval;
+}
+
+/* Equivalent to g_ascii_strcasecmp (str, folded) == 0, with folded
+ * already in lower case. */
+static gboolean
+_ascii_caseeq (const gchar * str, const gchar * folded)
+{
+	while (*str && g_ascii_tolower (*str) == *folded) {
+		str++;
+		folded++;
+	}
+
+	return *str == *folded;
+}
+
 static gboolean
-_compare_record_property (DmapRecord * record, const gchar * property_name,
-                          const gchar * property_value)
+_filter_clause_compare_string (const FilterClause * clause,
+                               const gchar * str_value)
 {
 	gboolean accept = FALSE;
-	GParamSpec *pspec;
-	GValue value = { 0, };
-	/* Note that this string belongs to value and will not be freed explicitely. */
-	const gchar *str_value;
 
-	pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (record),
-					      property_name);
+	if (str_value != NULL && clause->folded != NULL) {
+		accept = _ascii_caseeq (str_value, clause->folded);
+	} else if (str_value == NULL && clause->value == NULL) {
+		accept = TRUE;
+	}
 
-	if (pspec == NULL) {
-		// Can't find the property in this record, so don't accept it.
+	return accept;
+}
+
+static gboolean
+_filter_clause_compare (FilterClause * clause, DmapRecord * record)
+{
+	gboolean accept = FALSE;
+	GValue value = G_VALUE_INIT;
+	GValue dest = G_VALUE_INIT;
+
+	if (G_OBJECT_TYPE (record) != clause->class_type) {
+		_filter_clause_resolve (clause, record);
+	}
+
+	if (clause->kind == FILTER_MISSING || clause->kind == FILTER_UNHANDLED) {
 		goto done;
 	}
 
-	// Get the property value as a GValue set to the type of this
-	// property.
-	g_value_init (&value, G_PARAM_SPEC_VALUE_TYPE (pspec));
-	g_object_get_property (G_OBJECT (record), property_name, &value);
+	g_value_init (&value, G_PARAM_SPEC_VALUE_TYPE (clause->pspec));
+	g_object_get_property (G_OBJECT (record), clause->pspec->name, &value);
 
-	if (G_VALUE_HOLDS_STRING (&value)) {
-		str_value = g_value_get_string (&value);
-	} else if (G_VALUE_HOLDS_BOOLEAN (&value)) {
-		g_debug ("Compare %s (boolean): %d %s", property_name, g_value_get_boolean (&value), property_value);
+	switch (clause->kind) {
+	case FILTER_STRING:
+		accept = _filter_clause_compare_string (clause,
+		                                        g_value_get_string (&value));
+		break;
+	case FILTER_BOOLEAN:
 		accept = (g_value_get_boolean (&value) &&
-			  g_strcmp0 (property_value, "1") == 0);
-		g_value_unset (&value);
-		goto done;
-	} else if (g_value_type_transformable
-		   (G_VALUE_TYPE (&value), G_TYPE_LONG)) {
-		// Prefer integer conversion.
-		GValue dest = { 0, };
+			  g_strcmp0 (clause->value, "1") == 0);
+		break;
+	case FILTER_LONG:
+		accept = _value_get_long (&value) == clause->number;
+		break;
+	case FILTER_TRANSFORM_LONG:
 		g_value_init (&dest, G_TYPE_LONG);
 		if (!g_value_transform (&value, &dest)) {
 			g_warning
 				("Failed to convert value into long for property %s",
-				 property_name);
-			g_value_unset (&value);
-			goto done;
-		}
-		g_debug ("Compare %s (long): %ld %s", property_name, g_value_get_long (&dest), property_value);
-		accept = (g_value_get_long (&dest) ==
-			  strtol (property_value, NULL, 10));
-		g_value_unset (&value);
-		goto done;
-	} else if (g_value_type_transformable
-		   (G_VALUE_TYPE (&value), G_TYPE_STRING)) {
+				 clause->property_name);
+			break;
+		}
+		accept = g_value_get_long (&dest) == clause->number;
+		break;
+	case FILTER_TRANSFORM_STRING:
 		// Use standard transform functions from GLib (note that these
 		// functions are unreliable and known cases should be handled
 		// above).
-		GValue dest;
-
 		g_value_init (&dest, G_TYPE_STRING);
 		if (!g_value_transform (&value, &dest)) {
 			g_warning
 				("Failed to convert value into string for property %s",
-				 property_name);
-			g_value_unset (&value);
-			goto done;
-		}
-		str_value = g_value_dup_string (&dest);
-		g_value_reset (&value);
-		//Sets the string to value so that it will be freed later.
-		g_value_take_string (&value, (gchar *) str_value);
-		g_value_unset (&dest);
-	} else {
-		g_warning ("Attempt to compare unhandled type");
-		g_value_unset (&value);
-		goto done;
+				 clause->property_name);
+			break;
+		}
+		accept = _filter_clause_compare_string (clause,
+		                                        g_value_get_string (&dest));
+		break;
+	default:
+		g_assert_not_reached ();
 	}
 
-	// Only arrive here if we are handling strings.
-	g_debug ("Compare %s (string): %s %s", property_name, str_value, property_value);
-	if (str_value != NULL && property_value != NULL &&
-	    g_ascii_strcasecmp (str_value, property_value) == 0) {
-		accept = TRUE;
-	} else if (str_value == NULL && property_value == NULL) {
-		accept = TRUE;
+	if (G_IS_VALUE (&dest)) {
+		g_value_unset (&dest);
 	}
-
-	// This will destroy str_value since it belongs to value.
 	g_value_unset (&value);
 
 done:
 	return accept;
 }
 
+static gboolean
+_filter_program_run (FilterProgram * program, guint id, DmapRecord * record)
+{
+	gboolean accept = TRUE;
+	gboolean group_accept = FALSE;
+	guint i;
+
+	for (i = 0; i < program->clauses->len; i++) {
+		FilterClause *clause = &g_array_index (program->clauses,
+		                                       FilterClause, i);
+
+		// Once a clause accepts, skip the rest of its group
+		// (groups are always OR).
+		if (!group_accept) {
+			if (clause->is_item_id && id == clause->item_id) {
+				group_accept = TRUE;
+			} else {
+				group_accept = _filter_clause_compare (clause, record);
+				if (clause->negate) {
+					group_accept = !group_accept;
+				}
+			}
+		}
+
+		if (clause->ends_group) {
+			// Don't look any further, because groups are AND
+			// between each other, the first FALSE means FALSE
+			// at the end.
+			if (!group_accept) {
+				accept = FALSE;
+				break;
+			}
+			group_accept = FALSE;
+		}
+	}
+
+	return accept;
+}
+
+typedef struct {
+	/* The set of IDs of the records indexed under the value. */
+	GHashTable *ids;
+	/* The same IDs in order; NULL once one comes or goes, until the
+	 * next lookup. */
+	GArray *sorted;
+} IndexSet;
+
+typedef struct {
+	gchar *name;
+	/* FILTER_MISSING until a record with this property is added. */
+	FilterKind kind;
+	/* Normalized value -> IndexSet. */
+	GHashTable *sets;
+} IndexProperty;
+
+struct _DmapDbIndex {
+	GArray *properties;
+};
+
 static void
-_apply_filter (guint id, DmapRecord * record, gpointer data)
+_index_set_free (IndexSet * set)
 {
-	g_assert(DMAP_IS_RECORD (record));
+	g_hash_table_destroy (set->ids);
+	g_clear_pointer (&set->sorted, g_array_unref);
+	g_free (set);
+}
 
-	FilterData *fd;
-	gboolean accept = FALSE;
+static gint
+_id_cmp (gconstpointer a, gconstpointer b)
+{
+	guint x = *(const guint *) a;
+	guint y = *(const guint *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+DmapDbIndex *
+dmap_db_index_new (const gchar * const *properties)
+{
+	DmapDbIndex *index;
+	guint i;
+
+	index = g_new0 (DmapDbIndex, 1);
+	index->properties = g_array_new (FALSE, TRUE, sizeof (IndexProperty));
+
+	for (i = 0; properties[i] != NULL; i++) {
+		IndexProperty property = { 0, };
+
+		property.name = g_strdup (properties[i]);
+		property.kind = FILTER_MISSING;
+		property.sets = g_hash_table_new_full (g_str_hash, g_str_equal,
+		                                       g_free,
+		                                       (GDestroyNotify) _index_set_free);
+
+		g_array_append_val (index->properties, property);
+	}
+
+	return index;
+}
+
+void
+dmap_db_index_free (DmapDbIndex * index)
+{
+	guint i;
+
+	for (i = 0; i < index->properties->len; i++) {
+		IndexProperty *property = &g_array_index (index->properties,
+		                                          IndexProperty, i);
+
+		g_free (property->name);
+		g_hash_table_destroy (property->sets);
+	}
+
+	g_array_free (index->properties, TRUE);
+	g_free (index);
+}
+
+static IndexProperty *
+_index_find (DmapDbIndex * index, const gchar * name)
+{
+	IndexProperty *property = NULL;
+	guint i;
+
+	for (i = 0; i < index->properties->len; i++) {
+		if (strcmp (g_array_index (index->properties,
+		                           IndexProperty, i).name, name) == 0) {
+			property = &g_array_index (index->properties,
+			                           IndexProperty, i);
+			break;
+		}
+	}
+
+	return property;
+}
+
+/* Returns the key under which record is indexed for property, or NULL. */
+static gchar *
+_index_record_key (IndexProperty * property, DmapRecord * record)
+{
+	gchar *key = NULL;
+	GParamSpec *pspec;
+	GValue value = G_VALUE_INIT;
+
+	pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (record),
+	                                      property->name);
+	if (pspec == NULL) {
+		goto done;
+	}
 
-	const gchar *query_key;
-	const gchar *query_value;
+	if (property->kind == FILTER_MISSING) {
+		property->kind = _filter_kind (pspec);
+		if (property->kind != FILTER_STRING
+		 && property->kind != FILTER_LONG) {
+			g_warning ("Cannot index property %s", property->name);
+		}
+	}
 
-	fd = data;
-	if (fd->filter_def == NULL) {
-		g_hash_table_insert (fd->ht, GUINT_TO_POINTER(id), g_object_ref (record));
+	if (property->kind != _filter_kind (pspec)) {
 		goto done;
 	}
 
-	GSList *list, *filter;
+	g_value_init (&value, G_PARAM_SPEC_VALUE_TYPE (pspec));
+	g_object_get_property (G_OBJECT (record), pspec->name, &value);
 
-	for (list = fd->filter_def; list != NULL; list = list->next) {
-		for (filter = list->data; filter != NULL;
-		     filter = filter->next) {
-			DmapDbFilterDefinition *def = filter->data;
-			const gchar *property_name;
+	if (property->kind == FILTER_STRING) {
+		if (g_value_get_string (&value) != NULL) {
+			key = g_ascii_strdown (g_value_get_string (&value), -1);
+		}
+	} else if (property->kind == FILTER_LONG) {
+		key = g_strdup_printf ("%ld", _value_get_long (&value));
+	}
 
-			query_key = def->key;
-			query_value = def->value;
+	g_value_unset (&value);
 
-			if (g_strcmp0 (query_key, "dmap.itemid") == 0) {
-				if (id == strtoul (query_value, NULL, 10)) {
-					accept = TRUE;
-					break;
-				}
-			};
+done:
+	return key;
+}
 
-			// Use only the part after the last dot.
-			// For instance, dmap.songgenre becomes songgenre.
-			property_name = strrchr (query_key, '.');
-			if (property_name == NULL) {
-				property_name = query_key;
-			} else {
-				//Don't include the dot in the property name.
-				property_name++;
-			}
+/* Returns the key under which records equal to value are indexed. */
+static gchar *
+_index_value_key (IndexProperty * property, const gchar * value)
+{
+	gchar *key = NULL;
+
+	if (property->kind == FILTER_STRING) {
+		key = g_ascii_strdown (value, -1);
+	} else if (property->kind == FILTER_LONG) {
+		key = g_strdup_printf ("%ld", strtol (value, NULL, 10));
+	}
+
+	return key;
+}
+
+void
+dmap_db_index_add (DmapDbIndex * index, guint id, DmapRecord * record)
+{
+	guint i;
+
+	for (i = 0; i < index->properties->len; i++) {
+		IndexProperty *property = &g_array_index (index->properties,
+		                                          IndexProperty, i);
+		IndexSet *set;
+		gchar *key;
+
+		key = _index_record_key (property, record);
+		if (key == NULL) {
+			continue;
+		}
+
+		set = g_hash_table_lookup (property->sets, key);
+		if (set == NULL) {
+			set = g_new0 (IndexSet, 1);
+			set->ids = g_hash_table_new (g_direct_hash,
+			                             g_direct_equal);
+			g_hash_table_insert (property->sets, key, set);
+		} else {
+			g_free (key);
+		}
+
+		/* Sorting is put off until a lookup, so that bulk loads and
+		 * edits in any order cost no more than a set insertion. */
+		g_hash_table_add (set->ids, GUINT_TO_POINTER (id));
+		g_clear_pointer (&set->sorted, g_array_unref);
+	}
+}
+
+void
+dmap_db_index_remove (DmapDbIndex * index, guint id, DmapRecord * record)
+{
+	guint i;
 
-			accept = _compare_record_property (record,
-							  property_name,
-							  query_value);
+	for (i = 0; i < index->properties->len; i++) {
+		IndexProperty *property = &g_array_index (index->properties,
+		                                          IndexProperty, i);
+		IndexSet *set;
+		gchar *key;
 
-			if (def->negate) {
-				accept = !accept;
+		key = _index_record_key (property, record);
+		if (key == NULL) {
+			continue;
+		}
+
+		set = g_hash_table_lookup (property->sets, key);
+		if (set != NULL) {
+			if (g_hash_table_remove (set->ids,
+			                         GUINT_TO_POINTER (id))) {
+				g_clear_pointer (&set->sorted, g_array_unref);
 			}
 
-			// If we accept this value, then quit looking at this 
-			// group (groups are always OR)
-			if (accept) {
-				break;
+			if (g_hash_table_size (set->ids) == 0) {
+				g_hash_table_remove (property->sets, key);
 			}
 		}
-		// Don't look any further, because groups are AND between 
-		// each other, the first FALSE means FALSE at the end.
-		if (!accept) {
-			break;
-		}
+
+		g_free (key);
 	}
-	if (accept) {
-		g_hash_table_insert (fd->ht, GUINT_TO_POINTER(id),
-				     g_object_ref (record));
+}
+
+GArray *
+dmap_db_index_lookup (DmapDbIndex * index, const gchar * property_name,
+                      const gchar * value)
+{
+	GArray *ids = NULL;
+	IndexProperty *property;
+	IndexSet *set = NULL;
+	gchar *key;
+
+	property = _index_find (index, property_name);
+	if (property == NULL || value == NULL) {
+		goto done;
+	}
+
+	ids = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	key = _index_value_key (property, value);
+	if (key != NULL) {
+		set = g_hash_table_lookup (property->sets, key);
+		g_free (key);
+	}
+
+	if (set != NULL) {
+		if (set->sorted == NULL) {
+			GHashTableIter iter;
+			gpointer id;
+
+			set->sorted = g_array_sized_new
+				(FALSE, FALSE, sizeof (guint),
+				 g_hash_table_size (set->ids));
+			g_hash_table_iter_init (&iter, set->ids);
+			while (g_hash_table_iter_next (&iter, &id, NULL)) {
+				guint value = GPOINTER_TO_UINT (id);
+
+				g_array_append_val (set->sorted, value);
+			}
+			g_array_sort (set->sorted, _id_cmp);
+		}
+		g_array_append_vals (ids, set->sorted->data, set->sorted->len);
 	}
 
 done:
-	return;
+	return ids;
 }
 
-GHashTable *
-dmap_db_apply_filter (DmapDb * db, GSList * filter_def)
+typedef struct {
+	/* Interned. */
+	const gchar *value;
+	/* The set of IDs of the records holding value. */
+	GHashTable *ids;
+} FacetValue;
+
+typedef struct {
+	gchar *name;
+	/* Value -> FacetValue. */
+	GHashTable *values;
+	/* The FacetValues in order; NULL once a value comes or goes, until
+	 * the next lookup. */
+	GPtrArray *sorted;
+} FacetProperty;
+
+struct _DmapDbFacets {
+	GArray *properties;
+};
+
+static void
+_facet_value_free (FacetValue * facet_value)
 {
-	GHashTable *ht;
-	FilterData data;
+	dmap_utils_intern_unref (facet_value->value);
+	g_hash_table_destroy (facet_value->ids);
+	g_free (facet_value);
+}
 
-	ht = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
-				    g_object_unref);
-	data.db = db;
-	data.filter_def = filter_def;
-	data.ht = ht;
+static gint
+_facet_value_cmp (gconstpointer a, gconstpointer b)
+{
+	const FacetValue *x = *(FacetValue * const *) a;
+	const FacetValue *y = *(FacetValue * const *) b;
+	gint ret;
 
-	dmap_db_foreach (db, (DmapIdRecordFunc) _apply_filter, &data);
+	ret = g_ascii_strcasecmp (x->value, y->value);
+	if (ret == 0) {
+		ret = strcmp (x->value, y->value);
+	}
 
-	return data.ht;
+	return ret;
+}
+
+DmapDbFacets *
+dmap_db_facets_new (const gchar * const *properties)
+{
+	DmapDbFacets *facets;
+	guint i;
+
+	facets = g_new0 (DmapDbFacets, 1);
+	facets->properties = g_array_new (FALSE, TRUE, sizeof (FacetProperty));
+
+	for (i = 0; properties[i] != NULL; i++) {
+		FacetProperty property = { 0, };
+
+		property.name = g_strdup (properties[i]);
+		property.values = g_hash_table_new_full (g_str_hash, g_str_equal,
+		                                         NULL,
+		                                         (GDestroyNotify) _facet_value_free);
+
+		g_array_append_val (facets->properties, property);
+	}
+
+	return facets;
 }
+
+void
+dmap_db_facets_free (DmapDbFacets * facets)
+{
+	guint i;
+
+	for (i = 0; i < facets->properties->len; i++) {
+		FacetProperty *property = &g_array_index (facets->properties,
+		                                          FacetProperty, i);
+
+		g_free (property->name);
+		g_clear_pointer (&property->sorted, g_ptr_array_unref);
+		g_hash_table_destroy (property->values);
+	}
+
+	g_array_free (facets->properties, TRUE);
+	g_free (facets);
+}
+
+static FacetProperty *
+_facets_find (DmapDbFacets * facets, const gchar * name)
+{
+	FacetProperty *property = NULL;
+	guint i;
+
+	for (i = 0; i < facets->properties->len; i++) {
+		if (strcmp (g_array_index (facets->properties,
+		                           FacetProperty, i).name, name) == 0) {
+			property = &g_array_index (facets->properties,
+			                           FacetProperty, i);
+			break;
+		}
+	}
+
+	return property;
+}
+
+/* Returns the value record holds for property, or NULL. */
+static gchar *
+_facet_record_value (FacetProperty * property, DmapRecord * record)
+{
+	gchar *value = NULL;
+	GParamSpec *pspec;
+
+	pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (record),
+	                                      property->name);
+	if (pspec != NULL && G_PARAM_SPEC_VALUE_TYPE (pspec) == G_TYPE_STRING) {
+		g_object_get (record, property->name, &value, NULL);
+	}
+
+	return value;
+}
+
+void
+dmap_db_facets_add (DmapDbFacets * facets, guint id, DmapRecord * record)
+{
+	guint i;
+
+	for (i = 0; i < facets->properties->len; i++) {
+		FacetProperty *property = &g_array_index (facets->properties,
+		                                          FacetProperty, i);
+		FacetValue *facet_value;
+		gchar *value;
+
+		value = _facet_record_value (property, record);
+		if (value == NULL) {
+			continue;
+		}
+
+		facet_value = g_hash_table_lookup (property->values, value);
+		if (facet_value == NULL) {
+			facet_value = g_new0 (FacetValue, 1);
+			facet_value->value = dmap_utils_intern_ref (value);
+			facet_value->ids = g_hash_table_new (g_direct_hash,
+			                                     g_direct_equal);
+			g_hash_table_insert (property->values,
+			                     (gpointer) facet_value->value,
+			                     facet_value);
+			g_clear_pointer (&property->sorted, g_ptr_array_unref);
+		}
+		g_hash_table_add (facet_value->ids, GUINT_TO_POINTER (id));
+
+		g_free (value);
+	}
+}
+
+void
+dmap_db_facets_remove (DmapDbFacets * facets, guint id, DmapRecord * record)
+{
+	guint i;
+
+	for (i = 0; i < facets->properties->len; i++) {
+		FacetProperty *property = &g_array_index (facets->properties,
+		                                          FacetProperty, i);
+		FacetValue *facet_value;
+		gchar *value;
+
+		value = _facet_record_value (property, record);
+		if (value == NULL) {
+			continue;
+		}
+
+		facet_value = g_hash_table_lookup (property->values, value);
+		if (facet_value != NULL) {
+			g_hash_table_remove (facet_value->ids,
+			                     GUINT_TO_POINTER (id));
+
+			if (g_hash_table_size (facet_value->ids) == 0) {
+				g_clear_pointer (&property->sorted,
+				                 g_ptr_array_unref);
+				g_hash_table_remove (property->values, value);
+			}
+		}
+
+		g_free (value);
+	}
+}
+
+/* Whether any record holding facet_value is in ids. Walks the smaller
+ * of the two, which usually stops at one of the first few, as a filter
+ * which leaves out most records leaves out most values too. */
+static gboolean
+_facet_value_held (FacetValue * facet_value, GHashTable * ids)
+{
+	gboolean held = FALSE;
+	GHashTable *walked, *probed;
+	GHashTableIter iter;
+	gpointer id;
+
+	if (g_hash_table_size (facet_value->ids) <= g_hash_table_size (ids)) {
+		walked = facet_value->ids;
+		probed = ids;
+	} else {
+		walked = ids;
+		probed = facet_value->ids;
+	}
+
+	g_hash_table_iter_init (&iter, walked);
+	while (g_hash_table_iter_next (&iter, &id, NULL)) {
+		if (g_hash_table_contains (probed, id)) {
+			held = TRUE;
+			break;
+		}
+	}
+
+	return held;
+}
+
+GPtrArray *
+dmap_db_facets_lookup (DmapDbFacets * facets, const gchar * property_name,
+                       GHashTable * ids)
+{
+	GPtrArray *values = NULL;
+	FacetProperty *property;
+	guint i;
+
+	property = _facets_find (facets, property_name);
+	if (property == NULL) {
+		goto done;
+	}
+
+	if (property->sorted == NULL) {
+		GHashTableIter iter;
+		gpointer facet_value;
+
+		property->sorted = g_ptr_array_sized_new
+			(g_hash_table_size (property->values));
+		g_hash_table_iter_init (&iter, property->values);
+		while (g_hash_table_iter_next (&iter, NULL, &facet_value)) {
+			g_ptr_array_add (property->sorted, facet_value);
+		}
+		g_ptr_array_sort (property->sorted, _facet_value_cmp);
+	}
+
+	values = g_ptr_array_new_with_free_func (g_free);
+	for (i = 0; i < property->sorted->len; i++) {
+		FacetValue *facet_value = g_ptr_array_index (property->sorted, i);
+
+		if (ids == NULL || _facet_value_held (facet_value, ids)) {
+			g_ptr_array_add (values, g_strdup (facet_value->value));
+		}
+	}
+
+done:
+	return values;
+}
+
+/* A group, and what keeping its aggregates up to date needs. The
+ * group's artist, sort name and ID are those of its representative
+ * record. Once that is removed they are kept until another record
+ * joins, which then takes its place; a record which changes is removed
+ * and added again, so its new values are taken up at once. */
+typedef struct {
+	DmapDbGroup group;
+	guint representative;
+	/* Artists only: album group name -> the artist's records on it. */
+	GHashTable *albums;
+} GroupEntry;
+
+/* The groups a record was added to. */
+typedef struct {
+	GroupEntry *album;
+	GroupEntry *artist;
+} GroupMembership;
+
+struct _DmapDbGroups {
+	/* Name -> GroupEntry, by DmapDbGroupType. */
+	GHashTable *groups[2];
+	/* ID -> GroupMembership. */
+	GHashTable *members;
+	/* The GroupEntry's in order, by DmapDbGroupType; NULL once a group
+	 * comes or goes or is renamed, until the next lookup. */
+	GPtrArray *sorted[2];
+};
+
+static void
+_intern_replace (const gchar ** slot, const gchar * value)
+{
+	const gchar *old = *slot;
+
+	*slot = dmap_utils_intern_ref (value);
+	if (old) {
+		dmap_utils_intern_unref (old);
+	}
+}
+
+static void
+_group_clear (DmapDbGroup * group)
+{
+	dmap_utils_intern_unref (group->name);
+	if (group->artist) {
+		dmap_utils_intern_unref (group->artist);
+	}
+	if (group->sort_name) {
+		dmap_utils_intern_unref (group->sort_name);
+	}
+}
+
+static void
+_group_entry_free (GroupEntry * entry)
+{
+	_group_clear (&entry->group);
+	if (entry->albums) {
+		g_hash_table_destroy (entry->albums);
+	}
+	g_free (entry);
+}
+
+static gint
+_group_entry_cmp (gconstpointer a, gconstpointer b)
+{
+	const DmapDbGroup *x = &(*(GroupEntry * const *) a)->group;
+	const DmapDbGroup *y = &(*(GroupEntry * const *) b)->group;
+	gint ret;
+
+	ret = g_ascii_strcasecmp (x->sort_name ? x->sort_name : x->name,
+	                          y->sort_name ? y->sort_name : y->name);
+	if (ret == 0) {
+		ret = strcmp (x->name, y->name);
+	}
+
+	return ret;
+}
+
+DmapDbGroups *
+dmap_db_groups_new (void)
+{
+	DmapDbGroups *groups;
+	guint type;
+
+	groups = g_new0 (DmapDbGroups, 1);
+	for (type = 0; type < G_N_ELEMENTS (groups->groups); type++) {
+		groups->groups[type] = g_hash_table_new_full
+			(g_str_hash, g_str_equal, NULL,
+			 (GDestroyNotify) _group_entry_free);
+	}
+	groups->members = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+	                                         NULL, g_free);
+
+	return groups;
+}
+
+void
+dmap_db_groups_free (DmapDbGroups * groups)
+{
+	guint type;
+
+	/* Artists borrow the names of albums. */
+	g_hash_table_destroy (groups->members);
+	for (type = G_N_ELEMENTS (groups->groups); type > 0; type--) {
+		g_clear_pointer (&groups->sorted[type - 1], g_ptr_array_unref);
+		g_hash_table_destroy (groups->groups[type - 1]);
+	}
+	g_free (groups);
+}
+
+static GroupEntry *
+_groups_join (DmapDbGroups * groups, DmapDbGroupType type, guint id,
+              const gchar * name, const gchar * artist,
+              const gchar * sort_name, gint64 group_id)
+{
+	GroupEntry *entry;
+
+	entry = g_hash_table_lookup (groups->groups[type], name);
+	if (entry == NULL) {
+		entry = g_new0 (GroupEntry, 1);
+		entry->group.name = dmap_utils_intern_ref (name);
+		if (type == DMAP_DB_GROUP_ARTISTS) {
+			entry->albums = g_hash_table_new (g_direct_hash,
+			                                  g_direct_equal);
+		}
+		g_hash_table_insert (groups->groups[type],
+		                     (gpointer) entry->group.name, entry);
+	}
+
+	if (entry->representative == 0) {
+		entry->representative = id;
+		_intern_replace (&entry->group.artist, artist);
+		_intern_replace (&entry->group.sort_name, sort_name);
+		entry->group.group_id = group_id;
+		g_clear_pointer (&groups->sorted[type], g_ptr_array_unref);
+	}
+
+	entry->group.count++;
+
+	return entry;
+}
+
+static void
+_groups_leave (DmapDbGroups * groups, DmapDbGroupType type,
+               GroupEntry * entry, guint id)
+{
+	if (entry == NULL) {
+		goto done;
+	}
+
+	if (--entry->group.count == 0) {
+		g_clear_pointer (&groups->sorted[type], g_ptr_array_unref);
+		g_hash_table_remove (groups->groups[type], entry->group.name);
+	} else if (entry->representative == id) {
+		entry->representative = 0;
+	}
+
+done:
+	return;
+}
+
+void
+dmap_db_groups_add (DmapDbGroups * groups, guint id, DmapRecord * record)
+{
+	static const gchar *properties[] = {
+		"songalbum", "songartist", "sort-album", "sort-artist",
+		"songalbumid", NULL
+	};
+	DmapAvRecordFields fields;
+	GroupMembership *membership;
+
+	if (!DMAP_IS_AV_RECORD (record)) {
+		goto done;
+	}
+
+	dmap_db_groups_remove (groups, id);
+
+	dmap_av_record_get_some_fields (DMAP_AV_RECORD (record), &fields,
+	                                properties);
+	membership = g_new0 (GroupMembership, 1);
+
+	if (fields.songalbum) {
+		membership->album = _groups_join (groups, DMAP_DB_GROUP_ALBUMS,
+		                                  id, fields.songalbum,
+		                                  fields.songartist,
+		                                  fields.sort_album,
+		                                  fields.songalbumid);
+	}
+
+	if (fields.songartist) {
+		membership->artist = _groups_join (groups, DMAP_DB_GROUP_ARTISTS,
+		                                   id, fields.songartist, NULL,
+		                                   fields.sort_artist,
+		                                   g_str_hash (fields.songartist));
+
+		if (membership->album) {
+			GHashTable *albums = membership->artist->albums;
+			gpointer album = (gpointer) membership->album->group.name;
+
+			g_hash_table_insert (albums, album, GUINT_TO_POINTER
+			                     (GPOINTER_TO_UINT (g_hash_table_lookup
+			                                        (albums, album)) + 1));
+			membership->artist->group.album_count
+				= g_hash_table_size (albums);
+		}
+	}
+
+	g_hash_table_insert (groups->members, GUINT_TO_POINTER (id),
+	                     membership);
+	dmap_av_record_fields_clear (&fields);
+
+done:
+	return;
+}
+
+void
+dmap_db_groups_remove (DmapDbGroups * groups, guint id)
+{
+	GroupMembership *membership;
+
+	membership = g_hash_table_lookup (groups->members, GUINT_TO_POINTER (id));
+	if (membership == NULL) {
+		goto done;
+	}
+
+	if (membership->artist && membership->album) {
+		GHashTable *albums = membership->artist->albums;
+		gpointer album = (gpointer) membership->album->group.name;
+		guint count = GPOINTER_TO_UINT (g_hash_table_lookup (albums,
+		                                                     album));
+
+		if (count > 1) {
+			g_hash_table_insert (albums, album,
+			                     GUINT_TO_POINTER (count - 1));
+		} else {
+			g_hash_table_remove (albums, album);
+		}
+		membership->artist->group.album_count
+			= g_hash_table_size (albums);
+	}
+
+	/* The artist first, as it borrows the album's name. */
+	_groups_leave (groups, DMAP_DB_GROUP_ARTISTS, membership->artist, id);
+	_groups_leave (groups, DMAP_DB_GROUP_ALBUMS, membership->album, id);
+
+	g_hash_table_remove (groups->members, GUINT_TO_POINTER (id));
+
+done:
+	return;
+}
+
+static void
+_groups_append (GArray * result, const DmapDbGroup * group)
+{
+	DmapDbGroup copy = *group;
+
+	copy.name = dmap_utils_intern_ref (group->name);
+	copy.artist = dmap_utils_intern_ref (group->artist);
+	copy.sort_name = dmap_utils_intern_ref (group->sort_name);
+
+	g_array_append_val (result, copy);
+}
+
+/* Counts only the records in ids, which need not be read: their groups
+ * are known by ID. */
+static void
+_groups_lookup_filtered (DmapDbGroups * groups, DmapDbGroupType type,
+                         GHashTable * ids, GArray * result)
+{
+	GHashTable *counts;
+	GHashTable *albums;
+	GPtrArray *entries;
+	GHashTableIter iter;
+	gpointer id;
+	guint i;
+
+	/* GroupEntry -> records in ids, and for artists, GroupEntry ->
+	 * set of their albums among them. */
+	counts = g_hash_table_new (g_direct_hash, g_direct_equal);
+	albums = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+	                                (GDestroyNotify) g_hash_table_destroy);
+	entries = g_ptr_array_new ();
+
+	g_hash_table_iter_init (&iter, ids);
+	while (g_hash_table_iter_next (&iter, &id, NULL)) {
+		GroupMembership *membership;
+		GroupEntry *entry;
+		guint count;
+
+		membership = g_hash_table_lookup (groups->members, id);
+		if (membership == NULL) {
+			continue;
+		}
+
+		entry = type == DMAP_DB_GROUP_ALBUMS ? membership->album
+		                                     : membership->artist;
+		if (entry == NULL) {
+			continue;
+		}
+
+		count = GPOINTER_TO_UINT (g_hash_table_lookup (counts, entry));
+		if (count == 0) {
+			g_ptr_array_add (entries, entry);
+		}
+		g_hash_table_insert (counts, entry, GUINT_TO_POINTER (count + 1));
+
+		if (type == DMAP_DB_GROUP_ARTISTS && membership->album) {
+			GHashTable *set = g_hash_table_lookup (albums, entry);
+
+			if (set == NULL) {
+				set = g_hash_table_new (g_direct_hash,
+				                        g_direct_equal);
+				g_hash_table_insert (albums, entry, set);
+			}
+			g_hash_table_add (set, membership->album);
+		}
+	}
+
+	g_ptr_array_sort (entries, _group_entry_cmp);
+
+	for (i = 0; i < entries->len; i++) {
+		GroupEntry *entry = g_ptr_array_index (entries, i);
+		GHashTable *set = g_hash_table_lookup (albums, entry);
+
+		_groups_append (result, &entry->group);
+		g_array_index (result, DmapDbGroup, result->len - 1).count
+			= GPOINTER_TO_UINT (g_hash_table_lookup (counts, entry));
+		g_array_index (result, DmapDbGroup, result->len - 1).album_count
+			= set ? g_hash_table_size (set) : 0;
+	}
+
+	g_ptr_array_unref (entries);
+	g_hash_table_destroy (albums);
+	g_hash_table_destroy (counts);
+}
+
+GArray *
+dmap_db_groups_lookup (DmapDbGroups * groups, DmapDbGroupType type,
+                       GHashTable * ids)
+{
+	GArray *result;
+	guint i;
+
+	result = g_array_new (FALSE, FALSE, sizeof (DmapDbGroup));
+	g_array_set_clear_func (result, (GDestroyNotify) _group_clear);
+
+	if (ids != NULL) {
+		_groups_lookup_filtered (groups, type, ids, result);
+		goto done;
+	}
+
+	if (groups->sorted[type] == NULL) {
+		GHashTableIter iter;
+		gpointer entry;
+
+		groups->sorted[type] = g_ptr_array_sized_new
+			(g_hash_table_size (groups->groups[type]));
+		g_hash_table_iter_init (&iter, groups->groups[type]);
+		while (g_hash_table_iter_next (&iter, NULL, &entry)) {
+			g_ptr_array_add (groups->sorted[type], entry);
+		}
+		g_ptr_array_sort (groups->sorted[type], _group_entry_cmp);
+	}
+
+	for (i = 0; i < groups->sorted[type]->len; i++) {
+		GroupEntry *entry = g_ptr_array_index (groups->sorted[type], i);
+
+		_groups_append (result, &entry->group);
+	}
+
+done:
+	return result;
+}
+
+GArray *
+dmap_db_lookup_ids (const DmapDb * db, const gchar * property,
+                    const gchar * value)
+{
+	GArray *ids = NULL;
+	DmapDbInterface *iface = DMAP_DB_GET_INTERFACE (db);
+
+	if (iface->lookup_ids != NULL) {
+		ids = iface->lookup_ids (db, property, value);
+	}
+
+	return ids;
+}
+
+gboolean
+dmap_db_is_thread_safe (const DmapDb * db)
+{
+	gboolean thread_safe = FALSE;
+	DmapDbInterface *iface = DMAP_DB_GET_INTERFACE (db);
+
+	if (iface->is_thread_safe != NULL) {
+		thread_safe = iface->is_thread_safe (db);
+	}
+
+	return thread_safe;
+}
+
+GPtrArray *
+dmap_db_lookup_values (const DmapDb * db, const gchar * property,
+                       GHashTable * ids)
+{
+	GPtrArray *values = NULL;
+	DmapDbInterface *iface = DMAP_DB_GET_INTERFACE (db);
+
+	if (iface->lookup_values != NULL) {
+		values = iface->lookup_values (db, property, ids);
+	}
+
+	return values;
+}
+
+GArray *
+dmap_db_lookup_groups (const DmapDb * db, DmapDbGroupType type,
+                       GHashTable * ids)
+{
+	GArray *groups = NULL;
+	DmapDbInterface *iface = DMAP_DB_GET_INTERFACE (db);
+
+	if (iface->lookup_groups != NULL) {
+		groups = iface->lookup_groups (db, type, ids);
+	}
+
+	return groups;
+}
+
+static GArray *
+_ids_union (GArray * a, GArray * b)
+{
+	GArray *ids;
+	guint i = 0, j = 0;
+
+	ids = g_array_sized_new (FALSE, FALSE, sizeof (guint), a->len + b->len);
+
+	while (i < a->len || j < b->len) {
+		guint x = i < a->len ? g_array_index (a, guint, i) : G_MAXUINT;
+		guint y = j < b->len ? g_array_index (b, guint, j) : G_MAXUINT;
+
+		if (j >= b->len || (i < a->len && x <= y)) {
+			g_array_append_val (ids, x);
+			i++;
+			if (j < b->len && x == y) {
+				j++;
+			}
+		} else {
+			g_array_append_val (ids, y);
+			j++;
+		}
+	}
+
+	return ids;
+}
+
+static GArray *
+_ids_intersect (GArray * a, GArray * b)
+{
+	GArray *ids;
+	guint i = 0, j = 0;
+
+	ids = g_array_new (FALSE, FALSE, sizeof (guint));
+
+	while (i < a->len && j < b->len) {
+		guint x = g_array_index (a, guint, i);
+		guint y = g_array_index (b, guint, j);
+
+		if (x < y) {
+			i++;
+		} else if (y < x) {
+			j++;
+		} else {
+			g_array_append_val (ids, x);
+			i++;
+			j++;
+		}
+	}
+
+	return ids;
+}
+
+/* Narrows the records a filter might accept using the indexes of db:
+ * a group of plain equality clauses on indexed properties yields the
+ * union of their ID sets, and such groups are intersected. Returns NULL
+ * if no group could be narrowed, in which case every record is a
+ * candidate. */
+static GArray *
+_filter_program_candidates (FilterProgram * program, DmapDb * db)
+{
+	GArray *candidates = NULL;
+	GArray *group = NULL;
+	gboolean usable = TRUE;
+	guint i;
+
+	for (i = 0; i < program->clauses->len; i++) {
+		FilterClause *clause = &g_array_index (program->clauses,
+		                                       FilterClause, i);
+
+		if (usable) {
+			GArray *ids = NULL;
+
+			/* An item ID clause may also match an "itemid"
+			 * property, so it is left to the scan. */
+			if (!clause->negate && !clause->is_item_id
+			 && clause->value != NULL) {
+				ids = dmap_db_lookup_ids (db, clause->property_name,
+				                          clause->value);
+			}
+
+			if (ids == NULL) {
+				usable = FALSE;
+				g_clear_pointer (&group, g_array_unref);
+			} else if (group == NULL) {
+				group = ids;
+			} else {
+				GArray *merged = _ids_union (group, ids);
+
+				g_array_unref (group);
+				g_array_unref (ids);
+				group = merged;
+			}
+		}
+
+		if (clause->ends_group) {
+			if (group != NULL) {
+				if (candidates == NULL) {
+					candidates = group;
+				} else {
+					GArray *merged = _ids_intersect (candidates, group);
+
+					g_array_unref (candidates);
+					g_array_unref (group);
+					candidates = merged;
+				}
+				group = NULL;
+			}
+			usable = TRUE;
+		}
+	}
+
+	return candidates;
+}
+
+typedef struct FilterData
+{
+	DmapDb *db;
+	FilterProgram *program;
+	GHashTable *ht;
+} FilterData;
+
+static void
+_apply_filter (guint id, DmapRecord * record, gpointer data)
+{
+	g_assert(DMAP_IS_RECORD (record));
+
+	FilterData *fd = data;
+
+	if (_filter_program_run (fd->program, id, record)) {
+		g_hash_table_insert (fd->ht, GUINT_TO_POINTER(id),
+				     g_object_ref (record));
+	}
+}
+
+GHashTable *
+dmap_db_apply_filter (DmapDb * db, GSList * filter_def)
+{
+	GHashTable *ht;
+	GArray *candidates;
+	FilterData data;
+
+	ht = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+				    g_object_unref);
+	data.db = db;
+	data.program = _filter_program_compile (filter_def);
+	data.ht = ht;
+
+	candidates = _filter_program_candidates (data.program, db);
+	if (candidates != NULL) {
+		guint i;
+
+		/* Candidates still go through the whole program, so indexes
+		 * need only ever narrow the search. */
+		for (i = 0; i < candidates->len; i++) {
+			guint id = g_array_index (candidates, guint, i);
+			DmapRecord *record = dmap_db_lookup_by_id (db, id);
+
+			if (record != NULL) {
+				_apply_filter (id, record, &data);
+				g_object_unref (record);
+			}
+		}
+
+		g_array_unref (candidates);
+	} else {
+		dmap_db_foreach (db, (DmapIdRecordFunc) _apply_filter, &data);
+	}
+
+	_filter_program_free (data.program);
+
+	return data.ht;
+}
+
+#ifdef HAVE_CHECK
+
+#include <check.h>
+#include <libdmapsharing/test-dmap-av-record.h>
+#include <libdmapsharing/test-dmap-db.h>
+
+static DmapDb *
+_filter_test_db (void)
+{
+	DmapDb *db = DMAP_DB (test_dmap_db_new ());
+	const gchar *artists[] = { "Foo", "foo", "Bar" };
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (artists); i++) {
+		DmapRecord *record = DMAP_RECORD (test_dmap_av_record_new ());
+
+		g_object_set (record, "songartist", artists[i],
+		                      "year", 2000 + i,
+		                      "has-video", i == 2, NULL);
+		dmap_db_add (db, record, NULL);
+		g_object_unref (record);
+	}
+
+	return db;
+}
+
+static DmapDbFilterDefinition *
+_filter_test_def (const gchar *key, const gchar *value, gboolean negate)
+{
+	DmapDbFilterDefinition *def = g_new0 (DmapDbFilterDefinition, 1);
+
+	def->key = g_strdup (key);
+	def->value = g_strdup (value);
+	def->negate = negate;
+
+	return def;
+}
+
+static void
+_filter_test_def_free (DmapDbFilterDefinition *def)
+{
+	g_free (def->key);
+	g_free (def->value);
+	g_free (def);
+}
+
+static void
+_filter_test_free (GSList *filter_def)
+{
+	GSList *list;
+
+	for (list = filter_def; list != NULL; list = list->next) {
+		g_slist_free_full (list->data,
+		                   (GDestroyNotify) _filter_test_def_free);
+	}
+
+	g_slist_free (filter_def);
+}
+
+static guint
+_filter_test_count (DmapDb *db, GSList *filter_def)
+{
+	GHashTable *ht;
+	guint count;
+
+	ht = dmap_db_apply_filter (db, filter_def);
+	count = g_hash_table_size (ht);
+	g_hash_table_destroy (ht);
+
+	_filter_test_free (filter_def);
+
+	return count;
+}
+
+START_TEST(_apply_filter_none_test)
+{
+	DmapDb *db = _filter_test_db ();
+
+	ck_assert_int_eq (3, _filter_test_count (db, NULL));
+
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_apply_filter_string_test)
+{
+	DmapDb *db = _filter_test_db ();
+	GSList *group;
+
+	/* String comparisons ignore case. */
+	group = g_slist_append (NULL, _filter_test_def ("daap.songartist", "FOO", FALSE));
+	ck_assert_int_eq (2, _filter_test_count (db, g_slist_append (NULL, group)));
+
+	group = g_slist_append (NULL, _filter_test_def ("daap.songartist", "FOO", TRUE));
+	ck_assert_int_eq (1, _filter_test_count (db, g_slist_append (NULL, group)));
+
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_apply_filter_long_test)
+{
+	DmapDb *db = _filter_test_db ();
+	GSList *group;
+
+	group = g_slist_append (NULL, _filter_test_def ("daap.songyear", "2001", FALSE));
+	ck_assert_int_eq (1, _filter_test_count (db, g_slist_append (NULL, group)));
+
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_apply_filter_boolean_test)
+{
+	DmapDb *db = _filter_test_db ();
+	GSList *group;
+
+	group = g_slist_append (NULL, _filter_test_def ("daap.has-video", "1", FALSE));
+	ck_assert_int_eq (1, _filter_test_count (db, g_slist_append (NULL, group)));
+
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_apply_filter_missing_test)
+{
+	DmapDb *db = _filter_test_db ();
+	GSList *group;
+
+	group = g_slist_append (NULL, _filter_test_def ("daap.nosuchproperty", "1", FALSE));
+	ck_assert_int_eq (0, _filter_test_count (db, g_slist_append (NULL, group)));
+
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_apply_filter_and_or_test)
+{
+	DmapDb *db = _filter_test_db ();
+	GSList *filter_def = NULL, *group;
+
+	/* (artist is Bar OR year is 2000) AND NOT has-video. */
+	group = g_slist_append (NULL, _filter_test_def ("daap.songartist", "Bar", FALSE));
+	group = g_slist_append (group, _filter_test_def ("daap.songyear", "2000", FALSE));
+	filter_def = g_slist_append (filter_def, group);
+
+	group = g_slist_append (NULL, _filter_test_def ("daap.has-video", "1", TRUE));
+	filter_def = g_slist_append (filter_def, group);
+
+	ck_assert_int_eq (1, _filter_test_count (db, filter_def));
+
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_lookup_ids_test)
+{
+	DmapDb *db = _filter_test_db ();
+	GArray *ids;
+
+	ids = dmap_db_lookup_ids (db, "songartist", "FOO");
+	ck_assert (NULL != ids);
+	ck_assert_int_eq (2, ids->len);
+	ck_assert (g_array_index (ids, guint, 0) < g_array_index (ids, guint, 1));
+	g_array_unref (ids);
+
+	ids = dmap_db_lookup_ids (db, "songartist", "Baz");
+	ck_assert (NULL != ids);
+	ck_assert_int_eq (0, ids->len);
+	g_array_unref (ids);
+
+	/* Not indexed, so the filter must scan. */
+	ck_assert (NULL == dmap_db_lookup_ids (db, "year", "2000"));
+
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_is_thread_safe_default_test)
+{
+	DmapDb *db = DMAP_DB (test_dmap_db_new ());
+
+	/* Not implemented, so read from one thread only. */
+	ck_assert (!dmap_db_is_thread_safe (db));
+
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_index_remove_test)
+{
+	DmapDbIndex *index;
+	DmapRecord *record;
+	const gchar *properties[] = { "songartist", "year", NULL };
+	GArray *ids;
+
+	index = dmap_db_index_new (properties);
+	record = DMAP_RECORD (test_dmap_av_record_new ());
+	g_object_set (record, "songartist", "Foo", "year", 1999, NULL);
+
+	dmap_db_index_add (index, 7, record);
+
+	ids = dmap_db_index_lookup (index, "year", "1999");
+	ck_assert_int_eq (1, ids->len);
+	ck_assert_int_eq (7, g_array_index (ids, guint, 0));
+	g_array_unref (ids);
+
+	dmap_db_index_remove (index, 7, record);
+
+	ids = dmap_db_index_lookup (index, "songartist", "foo");
+	ck_assert_int_eq (0, ids->len);
+	g_array_unref (ids);
+
+	g_object_unref (record);
+	dmap_db_index_free (index);
+}
+END_TEST
+
+START_TEST(_facets_test)
+{
+	DmapDbFacets *facets;
+	DmapRecord *records[3];
+	const gchar *properties[] = { "songartist", NULL };
+	const gchar *artists[] = { "foo", "Bar", "foo" };
+	GHashTable *ids;
+	GPtrArray *values;
+	guint i;
+
+	facets = dmap_db_facets_new (properties);
+
+	for (i = 0; i < G_N_ELEMENTS (records); i++) {
+		records[i] = DMAP_RECORD (test_dmap_av_record_new ());
+		g_object_set (records[i], "songartist", artists[i], NULL);
+		dmap_db_facets_add (facets, i + 1, records[i]);
+	}
+
+	/* Distinct and sorted. */
+	values = dmap_db_facets_lookup (facets, "songartist", NULL);
+	ck_assert_int_eq (2, values->len);
+	ck_assert_str_eq ("Bar", g_ptr_array_index (values, 0));
+	ck_assert_str_eq ("foo", g_ptr_array_index (values, 1));
+	g_ptr_array_unref (values);
+
+	/* Only the values the given records hold. */
+	ids = g_hash_table_new (g_direct_hash, g_direct_equal);
+	g_hash_table_add (ids, GUINT_TO_POINTER (3));
+	values = dmap_db_facets_lookup (facets, "songartist", ids);
+	ck_assert_int_eq (1, values->len);
+	ck_assert_str_eq ("foo", g_ptr_array_index (values, 0));
+	g_ptr_array_unref (values);
+	g_hash_table_destroy (ids);
+
+	/* A value goes with the last record holding it. */
+	dmap_db_facets_remove (facets, 2, records[1]);
+	values = dmap_db_facets_lookup (facets, "songartist", NULL);
+	ck_assert_int_eq (1, values->len);
+	ck_assert_str_eq ("foo", g_ptr_array_index (values, 0));
+	g_ptr_array_unref (values);
+
+	ck_assert (NULL == dmap_db_facets_lookup (facets, "songgenre", NULL));
+
+	for (i = 0; i < G_N_ELEMENTS (records); i++) {
+		g_object_unref (records[i]);
+	}
+	dmap_db_facets_free (facets);
+}
+END_TEST
+
+START_TEST(_groups_test)
+{
+	DmapDbGroups *groups;
+	DmapRecord *records[3];
+	const gchar *albums[] = { "Zed", "Alpha", "Zed" };
+	const gchar *artists[] = { "Foo", "Foo", "Bar" };
+	GHashTable *ids;
+	GArray *result;
+	guint i;
+
+	groups = dmap_db_groups_new ();
+
+	for (i = 0; i < G_N_ELEMENTS (records); i++) {
+		records[i] = DMAP_RECORD (test_dmap_av_record_new ());
+		g_object_set (records[i], "songalbum", albums[i],
+		              "songartist", artists[i],
+		              "songalbumid", (gint64) i + 100, NULL);
+		dmap_db_groups_add (groups, i + 1, records[i]);
+	}
+
+	/* Sorted by name, with the first record's values. */
+	result = dmap_db_groups_lookup (groups, DMAP_DB_GROUP_ALBUMS, NULL);
+	ck_assert_int_eq (2, result->len);
+	ck_assert_str_eq ("Alpha", g_array_index (result, DmapDbGroup, 0).name);
+	ck_assert_int_eq (1, g_array_index (result, DmapDbGroup, 0).count);
+	ck_assert_str_eq ("Zed", g_array_index (result, DmapDbGroup, 1).name);
+	ck_assert_int_eq (2, g_array_index (result, DmapDbGroup, 1).count);
+	ck_assert_str_eq ("Foo", g_array_index (result, DmapDbGroup, 1).artist);
+	ck_assert_int_eq (100, g_array_index (result, DmapDbGroup, 1).group_id);
+	g_array_unref (result);
+
+	result = dmap_db_groups_lookup (groups, DMAP_DB_GROUP_ARTISTS, NULL);
+	ck_assert_int_eq (2, result->len);
+	ck_assert_str_eq ("Bar", g_array_index (result, DmapDbGroup, 0).name);
+	ck_assert_int_eq (1, g_array_index (result, DmapDbGroup, 0).album_count);
+	ck_assert_str_eq ("Foo", g_array_index (result, DmapDbGroup, 1).name);
+	ck_assert_int_eq (2, g_array_index (result, DmapDbGroup, 1).count);
+	ck_assert_int_eq (2, g_array_index (result, DmapDbGroup, 1).album_count);
+	g_array_unref (result);
+
+	/* Counted over the given records only. */
+	ids = g_hash_table_new (g_direct_hash, g_direct_equal);
+	g_hash_table_add (ids, GUINT_TO_POINTER (1));
+	result = dmap_db_groups_lookup (groups, DMAP_DB_GROUP_ARTISTS, ids);
+	ck_assert_int_eq (1, result->len);
+	ck_assert_str_eq ("Foo", g_array_index (result, DmapDbGroup, 0).name);
+	ck_assert_int_eq (1, g_array_index (result, DmapDbGroup, 0).count);
+	ck_assert_int_eq (1, g_array_index (result, DmapDbGroup, 0).album_count);
+	g_array_unref (result);
+	g_hash_table_destroy (ids);
+
+	/* The next record takes the place of one removed. */
+	dmap_db_groups_remove (groups, 1);
+	dmap_db_groups_add (groups, 4, records[0]);
+	result = dmap_db_groups_lookup (groups, DMAP_DB_GROUP_ALBUMS, NULL);
+	ck_assert_int_eq (2, result->len);
+	ck_assert_str_eq ("Zed", g_array_index (result, DmapDbGroup, 1).name);
+	ck_assert_int_eq (2, g_array_index (result, DmapDbGroup, 1).count);
+	ck_assert_str_eq ("Foo", g_array_index (result, DmapDbGroup, 1).artist);
+	g_array_unref (result);
+
+	/* A group goes with its last record. */
+	dmap_db_groups_remove (groups, 2);
+	result = dmap_db_groups_lookup (groups, DMAP_DB_GROUP_ARTISTS, NULL);
+	ck_assert_int_eq (2, result->len);
+	ck_assert_int_eq (1, g_array_index (result, DmapDbGroup, 1).count);
+	ck_assert_int_eq (1, g_array_index (result, DmapDbGroup, 1).album_count);
+	g_array_unref (result);
+
+	result = dmap_db_groups_lookup (groups, DMAP_DB_GROUP_ALBUMS, NULL);
+	ck_assert_int_eq (1, result->len);
+	g_array_unref (result);
+
+	for (i = 0; i < G_N_ELEMENTS (records); i++) {
+		g_object_unref (records[i]);
+	}
+	dmap_db_groups_free (groups);
+}
+END_TEST
+
+#include "dmap-db-suite.c"
+
+#endif
@@ -82,6 +82,43 @@ typedef enum
 typedef struct _DmapDb DmapDb;
 typedef struct _DmapDbInterface DmapDbInterface;
 
+/**
+ * DmapDbGroupType:
+ * @DMAP_DB_GROUP_ALBUMS: records grouped by album.
+ * @DMAP_DB_GROUP_ARTISTS: records grouped by artist.
+ *
+ * What dmap_db_lookup_groups() groups records by.
+ */
+typedef enum
+{
+	DMAP_DB_GROUP_ALBUMS,
+	DMAP_DB_GROUP_ARTISTS
+} DmapDbGroupType;
+
+/**
+ * DmapDbGroup:
+ * @name: the album, or artist, which the records in the group share.
+ * @artist: for an album, the artist of one of its records.
+ * @sort_name: the sort-album, or sort-artist, of one of the records, or
+ * NULL.
+ * @group_id: for an album, the songalbumid of one of its records; for
+ * an artist, which has no ID of its own, a hash of @name.
+ * @count: the number of records in the group.
+ * @album_count: for an artist, the number of albums among its records.
+ *
+ * Aggregates of a group of audio records. The strings are interned; see
+ * dmap_utils_intern_ref().
+ */
+typedef struct
+{
+	const gchar *name;
+	const gchar *artist;
+	const gchar *sort_name;
+	gint64 group_id;
+	guint count;
+	guint album_count;
+} DmapDbGroup;
+
 /**
  * DmapIdRecordFunc:
  * @id: a DMAP record ID
@@ -104,8 +141,50 @@ struct _DmapDbInterface
 				  const gchar * location);
 	void (*foreach) (const DmapDb * db, DmapIdRecordFunc func, gpointer data);
 	gint64 (*count) (const DmapDb * db);
+
+	/* Optional; see dmap_db_lookup_ids. */
+	GArray *(*lookup_ids) (const DmapDb * db, const gchar * property,
+	                       const gchar * value);
+
+	/* Optional; see dmap_db_is_thread_safe. */
+	gboolean (*is_thread_safe) (const DmapDb * db);
+
+	/* Optional; see dmap_db_lookup_values. */
+	GPtrArray *(*lookup_values) (const DmapDb * db, const gchar * property,
+	                             GHashTable * ids);
+
+	/* Optional; see dmap_db_lookup_groups. */
+	GArray *(*lookup_groups) (const DmapDb * db, DmapDbGroupType type,
+	                          GHashTable * ids);
 };
 
+/**
+ * DmapDbIndex:
+ *
+ * An inverted index from (property, value) to the IDs of the records
+ * holding that value, which a #DmapDb implementation may keep up to date
+ * and consult to implement lookup_ids.
+ */
+typedef struct _DmapDbIndex DmapDbIndex;
+
+/**
+ * DmapDbFacets:
+ *
+ * The distinct values of some string properties, each with the IDs of
+ * the records holding it, which a #DmapDb implementation may keep up to
+ * date and consult to implement lookup_values.
+ */
+typedef struct _DmapDbFacets DmapDbFacets;
+
+/**
+ * DmapDbGroups:
+ *
+ * Audio records grouped by album and by artist, with each group's
+ * aggregates, which a #DmapDb implementation may keep up to date and
+ * consult to implement lookup_groups.
+ */
+typedef struct _DmapDbGroups DmapDbGroups;
+
 typedef struct DmapDbFilterDefinition
 {
 	gchar *key;
@@ -221,6 +300,231 @@ gulong dmap_db_count (const DmapDb * db);
  */
 GHashTable *dmap_db_apply_filter (DmapDb * db, GSList * filter_def);
 
+/**
+ * dmap_db_lookup_ids:
+ * @db: A media database.
+ * @property: A record property name, such as "songartist".
+ * @value: A value, as it would appear in a filter definition.
+ *
+ * Look up the records whose @property equals @value, as compared by
+ * dmap_db_apply_filter: strings ignore ASCII case and integers are
+ * compared numerically. dmap_db_apply_filter uses this to avoid a full
+ * scan of databases which index the properties a filter refers to.
+ *
+ * Returns: (element-type guint) (transfer full) (nullable): the sorted IDs
+ * of the matching records, or NULL if @db does not index @property.
+ */
+GArray *dmap_db_lookup_ids (const DmapDb * db, const gchar * property,
+                            const gchar * value);
+
+/**
+ * dmap_db_is_thread_safe:
+ * @db: A media database.
+ *
+ * Whether @db may be read from several threads at once. A database which
+ * says so promises that, for as long as nothing adds to or changes it,
+ * any number of threads may call dmap_db_lookup_by_id and read the
+ * records it returns, including by dmap_av_record_get_fields, at the same
+ * time. A #DmapShare uses this to encode large listings on its encoder
+ * threads while the main loop goes on, so an application which gives a
+ * share encoder threads must not change @db while it serves listings.
+ *
+ * Databases which do not implement is_thread_safe are read from one
+ * thread only.
+ *
+ * Returns: TRUE if @db may be read from several threads at once.
+ */
+gboolean dmap_db_is_thread_safe (const DmapDb * db);
+
+/**
+ * dmap_db_lookup_values:
+ * @db: A media database.
+ * @property: A string record property name, such as "songgenre".
+ * @ids: (element-type guint DmapRecord) (nullable): records by ID, such as
+ * those returned by dmap_db_apply_filter(), or NULL for every record.
+ *
+ * Look up the distinct values of @property held by the records in @ids,
+ * without reading the records, in databases which keep them. Values
+ * differing only in case are distinct.
+ *
+ * Returns: (element-type utf8) (transfer full) (nullable): the values,
+ * sorted by g_ascii_strcasecmp(), or NULL if @db does not keep the values
+ * of @property.
+ */
+GPtrArray *dmap_db_lookup_values (const DmapDb * db, const gchar * property,
+                                  GHashTable * ids);
+
+/**
+ * dmap_db_lookup_groups:
+ * @db: A media database.
+ * @type: What to group records by.
+ * @ids: (element-type guint DmapRecord) (nullable): records by ID, such as
+ * those returned by dmap_db_apply_filter(), or NULL for every record.
+ *
+ * Look up the groups into which the audio records in @ids fall, and
+ * their aggregates over those records, in databases which keep them.
+ *
+ * Returns: (element-type DmapDbGroup) (transfer full) (nullable): the
+ * groups, sorted by g_ascii_strcasecmp() of their sort names, or of
+ * their names where they have none; or NULL if @db does not keep groups.
+ */
+GArray *dmap_db_lookup_groups (const DmapDb * db, DmapDbGroupType type,
+                               GHashTable * ids);
+
+/**
+ * dmap_db_index_new:
+ * @properties: (array zero-terminated=1): The names of the properties to index.
+ *
+ * Returns: (transfer full): a new, empty index on @properties. Only
+ * string, integer and enumeration properties may be indexed.
+ */
+DmapDbIndex *dmap_db_index_new (const gchar * const *properties);
+
+/**
+ * dmap_db_index_free:
+ * @index: A #DmapDbIndex.
+ *
+ * Free an index.
+ */
+void dmap_db_index_free (DmapDbIndex * index);
+
+/**
+ * dmap_db_index_add:
+ * @index: A #DmapDbIndex.
+ * @id: The ID of @record.
+ * @record: A database record.
+ *
+ * Index @record under the values its indexed properties now hold. A
+ * record whose properties change must be removed and added again.
+ */
+void dmap_db_index_add (DmapDbIndex * index, guint id, DmapRecord * record);
+
+/**
+ * dmap_db_index_remove:
+ * @index: A #DmapDbIndex.
+ * @id: The ID of @record.
+ * @record: A database record, holding the values it was added with.
+ *
+ * Remove @record from the index.
+ */
+void dmap_db_index_remove (DmapDbIndex * index, guint id, DmapRecord * record);
+
+/**
+ * dmap_db_index_lookup:
+ * @index: A #DmapDbIndex.
+ * @property: A record property name.
+ * @value: A value, as it would appear in a filter definition.
+ *
+ * Returns: (element-type guint) (transfer full) (nullable): the sorted IDs
+ * of the records whose @property equals @value, or NULL if @property is
+ * not indexed. Suitable for implementing lookup_ids.
+ */
+GArray *dmap_db_index_lookup (DmapDbIndex * index, const gchar * property,
+                              const gchar * value);
+
+/**
+ * dmap_db_facets_new:
+ * @properties: (array zero-terminated=1): The names of the string
+ * properties to keep the values of.
+ *
+ * Returns: (transfer full): new, empty facets on @properties.
+ */
+DmapDbFacets *dmap_db_facets_new (const gchar * const *properties);
+
+/**
+ * dmap_db_facets_free:
+ * @facets: A #DmapDbFacets.
+ *
+ * Free facets.
+ */
+void dmap_db_facets_free (DmapDbFacets * facets);
+
+/**
+ * dmap_db_facets_add:
+ * @facets: A #DmapDbFacets.
+ * @id: The ID of @record.
+ * @record: A database record.
+ *
+ * Count @record under the values its properties now hold. As with
+ * dmap_db_index_add, a record whose properties change must be removed
+ * and added again.
+ */
+void dmap_db_facets_add (DmapDbFacets * facets, guint id, DmapRecord * record);
+
+/**
+ * dmap_db_facets_remove:
+ * @facets: A #DmapDbFacets.
+ * @id: The ID of @record.
+ * @record: A database record, holding the values it was added with.
+ *
+ * Remove @record from the facets. A value no record holds any more is
+ * dropped.
+ */
+void dmap_db_facets_remove (DmapDbFacets * facets, guint id, DmapRecord * record);
+
+/**
+ * dmap_db_facets_lookup:
+ * @facets: A #DmapDbFacets.
+ * @property: A record property name.
+ * @ids: (element-type guint DmapRecord) (nullable): records by ID, or NULL.
+ *
+ * Returns: (element-type utf8) (transfer full) (nullable): the sorted
+ * values of @property held by the records in @ids, or by any record if
+ * @ids is NULL, or NULL if @property is not kept. Suitable for
+ * implementing lookup_values.
+ */
+GPtrArray *dmap_db_facets_lookup (DmapDbFacets * facets, const gchar * property,
+                                  GHashTable * ids);
+
+/**
+ * dmap_db_groups_new:
+ *
+ * Returns: (transfer full): new, empty groups.
+ */
+DmapDbGroups *dmap_db_groups_new (void);
+
+/**
+ * dmap_db_groups_free:
+ * @groups: A #DmapDbGroups.
+ *
+ * Free groups.
+ */
+void dmap_db_groups_free (DmapDbGroups * groups);
+
+/**
+ * dmap_db_groups_add:
+ * @groups: A #DmapDbGroups.
+ * @id: The ID of @record.
+ * @record: A database record; records which are not #DmapAvRecord's are
+ * not grouped.
+ *
+ * Add @record to the groups of its album and artist. A record added
+ * again, after its properties change, moves to its new groups.
+ */
+void dmap_db_groups_add (DmapDbGroups * groups, guint id, DmapRecord * record);
+
+/**
+ * dmap_db_groups_remove:
+ * @groups: A #DmapDbGroups.
+ * @id: The ID of a record added to @groups.
+ *
+ * Remove the record from its groups. A group left empty is dropped.
+ */
+void dmap_db_groups_remove (DmapDbGroups * groups, guint id);
+
+/**
+ * dmap_db_groups_lookup:
+ * @groups: A #DmapDbGroups.
+ * @type: What to group records by.
+ * @ids: (element-type guint DmapRecord) (nullable): records by ID, or NULL.
+ *
+ * Returns: (element-type DmapDbGroup) (transfer full): the groups of the
+ * records in @ids, or of every record if @ids is NULL, as for
+ * dmap_db_lookup_groups(). Suitable for implementing lookup_groups.
+ */
+GArray *dmap_db_groups_lookup (DmapDbGroups * groups, DmapDbGroupType type,
+                               GHashTable * ids);
+
 #endif /* _DMAP_DB_H */
 
 G_END_DECLS
@@ -99,11 +99,6 @@ static struct DmapMetaDataMap _meta_data_map[] = {
 
 #define DPAP_ITEM_KIND_PHOTO 3	/* This is the constant that dpap-sharp uses. */
 
-/* Mmap'ed full image file. Global so that it may be free'ed in a different
- * function call that the one that set it up.
- */
-static GMappedFile *_mapped_file = NULL;
-
 G_DEFINE_TYPE_WITH_PRIVATE (DmapImageShare,
                             dmap_image_share,
                             DMAP_TYPE_SHARE);
@@ -146,177 +141,289 @@ done:
 	return mapped_file;
 }
 
+/* Emitters for _add_entry_to_mlcl, one per field a client may request.
+ * They read the record's properties; fields is NULL. */
+
 static void
-_add_entry_to_mlcl (guint id, DmapRecord * record, gpointer _mb)
+_emit_item_kind (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                 G_GNUC_UNUSED DmapRecord * record,
+                 G_GNUC_UNUSED gconstpointer fields)
 {
-	GNode *mlit;
-	struct DmapMlclBits *mb = (struct DmapMlclBits *) _mb;
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_MIKD,
+	                                 DPAP_ITEM_KIND_PHOTO);
+}
 
-	mlit = dmap_structure_add (mb->mlcl, DMAP_CC_MLIT);
+static void
+_emit_item_id (DmapShareMlclBits *mb, guint id,
+               G_GNUC_UNUSED DmapRecord * record,
+               G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_MIID, id);
+}
 
-	if (dmap_share_client_requested (mb->bits, ITEM_KIND)) {
-		dmap_structure_add (mlit, DMAP_CC_MIKD,
-				    (gchar) DPAP_ITEM_KIND_PHOTO);
+static void
+_emit_item_name (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                 DmapRecord * record,
+                 G_GNUC_UNUSED gconstpointer fields)
+{
+	gchar *filename = NULL;
+
+	g_object_get (record, "filename", &filename, NULL);
+	if (filename) {
+		dmap_structure_builder_add_string (mb->builder,
+		                                   DMAP_CC_MINM, filename);
+		g_free (filename);
+	} else {
+		g_debug ("Filename requested but not available");
 	}
+}
 
-	if (dmap_share_client_requested (mb->bits, ITEM_ID)) {
-		dmap_structure_add (mlit, DMAP_CC_MIID, id);
+static void
+_emit_persistent_id (DmapShareMlclBits *mb, guint id,
+                     G_GNUC_UNUSED DmapRecord * record,
+                     G_GNUC_UNUSED gconstpointer fields)
+{
+	dmap_structure_builder_add_int64 (mb->builder, DMAP_CC_MPER, id);
+}
+
+static void
+_emit_aspect_ratio (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                    DmapRecord * record,
+                    G_GNUC_UNUSED gconstpointer fields)
+{
+	/* dpap-sharp claims iPhoto '08 will not show thumbnails without PASP
+	 * and this does seem to be the case when testing. */
+	gchar *aspect_ratio = NULL;
+
+	g_object_get (record, "aspect-ratio", &aspect_ratio, NULL);
+	if (aspect_ratio) {
+		dmap_structure_builder_add_string (mb->builder,
+		                                   DMAP_CC_PASP,
+		                                   aspect_ratio);
+		g_free (aspect_ratio);
+	} else {
+		g_debug
+			("Aspect ratio requested but not available");
 	}
+}
 
-	if (dmap_share_client_requested (mb->bits, ITEM_NAME)) {
-		gchar *filename = NULL;
+static void
+_emit_photo_creationdate (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                          DmapRecord * record,
+                          G_GNUC_UNUSED gconstpointer fields)
+{
+	gint creation_date = 0;
 
-		g_object_get (record, "filename", &filename, NULL);
-		if (filename) {
-			dmap_structure_add (mlit, DMAP_CC_MINM, filename);
-			g_free (filename);
-		} else {
-			g_debug ("Filename requested but not available");
-		}
-	}
+	g_object_get (record, "creation-date", &creation_date, NULL);
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_PICD,
+	                                  creation_date);
+}
 
-	if (dmap_share_client_requested (mb->bits, PERSISTENT_ID)) {
-		dmap_structure_add (mlit, DMAP_CC_MPER, id);
+static void
+_emit_photo_imagefilename (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                           DmapRecord * record,
+                           G_GNUC_UNUSED gconstpointer fields)
+{
+	gchar *filename = NULL;
+
+	g_object_get (record, "filename", &filename, NULL);
+	if (filename) {
+		dmap_structure_builder_add_string (mb->builder,
+		                                   DMAP_CC_PIMF, filename);
+		g_free (filename);
+	} else {
+		g_debug ("Filename requested but not available");
 	}
+}
 
-	if (TRUE) {
-		/* dpap-sharp claims iPhoto '08 will not show thumbnails without PASP
-		 * and this does seem to be the case when testing. */
-		gchar *aspect_ratio = NULL;
+static void
+_emit_photo_imageformat (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                         DmapRecord * record,
+                         G_GNUC_UNUSED gconstpointer fields)
+{
+	gchar *format = NULL;
+
+	g_object_get (record, "format", &format, NULL);
+	if (format) {
+		dmap_structure_builder_add_string (mb->builder,
+		                                   DMAP_CC_PFMT, format);
+		g_free (format);
+	} else {
+		g_debug ("Format requested but not available");
+	}
+}
 
-		g_object_get (record, "aspect-ratio", &aspect_ratio, NULL);
-		if (aspect_ratio) {
-			dmap_structure_add (mlit, DMAP_CC_PASP, aspect_ratio);
-			g_free (aspect_ratio);
-		} else {
-			g_debug
-				("Aspect ratio requested but not available");
-		}
+static void
+_emit_photo_imagefilesize (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                           DmapRecord * record,
+                           G_GNUC_UNUSED gconstpointer fields)
+{
+	GArray *thumbnail = NULL;
+
+	g_object_get (record, "thumbnail", &thumbnail, NULL);
+	if (thumbnail) {
+		dmap_structure_builder_add_int32 (mb->builder,
+		                                  DMAP_CC_PIFS,
+		                                  thumbnail->len);
+		g_array_unref(thumbnail);
+	} else {
+		dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_PIFS, 0);
 	}
+}
 
-	if (dmap_share_client_requested (mb->bits, PHOTO_CREATIONDATE)) {
-		gint creation_date = 0;
+static void
+_emit_photo_imagelargefilesize (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                                DmapRecord * record,
+                                G_GNUC_UNUSED gconstpointer fields)
+{
+	gint large_filesize = 0;
 
-		g_object_get (record, "creation-date", &creation_date, NULL);
-		dmap_structure_add (mlit, DMAP_CC_PICD, creation_date);
-	}
+	g_object_get (record, "large-filesize", &large_filesize,
+		      NULL);
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_PLSZ,
+	                                  large_filesize);
+}
 
-	if (dmap_share_client_requested (mb->bits, PHOTO_IMAGEFILENAME)) {
-		gchar *filename = NULL;
+static void
+_emit_photo_imagepixelheight (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                              DmapRecord * record,
+                              G_GNUC_UNUSED gconstpointer fields)
+{
+	gint pixel_height = 0;
 
-		g_object_get (record, "filename", &filename, NULL);
-		if (filename) {
-			dmap_structure_add (mlit, DMAP_CC_PIMF, filename);
-			g_free (filename);
-		} else {
-			g_debug ("Filename requested but not available");
-		}
-	}
+	g_object_get (record, "pixel-height", &pixel_height, NULL);
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_PHGT,
+	                                  pixel_height);
+}
 
-	if (dmap_share_client_requested (mb->bits, PHOTO_IMAGEFORMAT)) {
-		gchar *format = NULL;
+static void
+_emit_photo_imagepixelwidth (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                             DmapRecord * record,
+                             G_GNUC_UNUSED gconstpointer fields)
+{
+	gint pixel_width = 0;
 
-		g_object_get (record, "format", &format, NULL);
-		if (format) {
-			dmap_structure_add (mlit, DMAP_CC_PFMT, format);
-			g_free (format);
-		} else {
-			g_debug ("Format requested but not available");
-		}
+	g_object_get (record, "pixel-width", &pixel_width, NULL);
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_PWTH,
+	                                  pixel_width);
+}
+
+static void
+_emit_photo_imagerating (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                         DmapRecord * record,
+                         G_GNUC_UNUSED gconstpointer fields)
+{
+	gint rating = 0;
+
+	g_object_get (record, "rating", &rating, NULL);
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_PRAT, rating);
+}
+
+static void
+_emit_photo_imagecomments (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                           DmapRecord * record,
+                           G_GNUC_UNUSED gconstpointer fields)
+{
+	gchar *comments = NULL;
+
+	g_object_get (record, "comments", &comments, NULL);
+	if (comments) {
+		dmap_structure_builder_add_string (mb->builder,
+		                                   DMAP_CC_PCMT, comments);
+		g_free (comments);
+	} else {
+		g_debug ("Comments requested but not available");
 	}
+}
 
-	if (dmap_share_client_requested (mb->bits, PHOTO_IMAGEFILESIZE)) {
-		GArray *thumbnail = NULL;
+static void
+_emit_photo_filedata (DmapShareMlclBits *mb, G_GNUC_UNUSED guint id,
+                      DmapRecord * record,
+                      G_GNUC_UNUSED gconstpointer fields)
+{
+	size_t size = 0;
+	char *data = NULL;
+	GArray *thumbnail = NULL;
+	GMappedFile *mapped_file = NULL;
 
+	if (dmap_share_client_requested (mb->parent.bits, PHOTO_THUMB)) {
 		g_object_get (record, "thumbnail", &thumbnail, NULL);
 		if (thumbnail) {
-			dmap_structure_add (mlit, DMAP_CC_PIFS, thumbnail->len);
-			g_array_unref(thumbnail);
+			data = thumbnail->data;
+			size = thumbnail->len;
 		} else {
-			dmap_structure_add (mlit, DMAP_CC_PIFS, 0);
+			data = NULL;
+			size = 0;
 		}
+	} else {
+		/* Should be PHOTO_HIRES */
+		char *location = NULL;
+
+		g_object_get (record, "location", &location, NULL);
+		mapped_file = _file_to_mmap (location);
+		if (mapped_file == NULL) {
+			g_warning ("Error opening %s", location);
+			data = NULL;
+			size = 0;
+		} else {
+			data = (char *)
+				g_mapped_file_get_contents (mapped_file);
+			size = g_mapped_file_get_length (mapped_file);
+		}
+		g_free (location);
 	}
-
-	if (dmap_share_client_requested (mb->bits, PHOTO_IMAGELARGEFILESIZE)) {
-		gint large_filesize = 0;
-
-		g_object_get (record, "large-filesize", &large_filesize,
-			      NULL);
-		dmap_structure_add (mlit, DMAP_CC_PLSZ, large_filesize);
-	}
-
-	if (dmap_share_client_requested (mb->bits, PHOTO_IMAGEPIXELHEIGHT)) {
-		gint pixel_height = 0;
-
-		g_object_get (record, "pixel-height", &pixel_height, NULL);
-		dmap_structure_add (mlit, DMAP_CC_PHGT, pixel_height);
+	/* The data is copied, so the thumbnail or image may be released,
+	 * and the encoder threads may run this at once. */
+	dmap_structure_builder_add_data (mb->builder, DMAP_CC_PFDT,
+	                                 data, size);
+	if (thumbnail) {
+		g_array_unref (thumbnail);
 	}
-
-	if (dmap_share_client_requested (mb->bits, PHOTO_IMAGEPIXELWIDTH)) {
-		gint pixel_width = 0;
-
-		g_object_get (record, "pixel-width", &pixel_width, NULL);
-		dmap_structure_add (mlit, DMAP_CC_PWTH, pixel_width);
+	if (mapped_file) {
+		g_mapped_file_unref (mapped_file);
 	}
+}
 
-	if (dmap_share_client_requested (mb->bits, PHOTO_IMAGERATING)) {
-		gint rating = 0;
+/* The fields of an MLIT, in the order they go on the wire. */
+static const DmapShareEmitter _emitters[] = {
+	{ ITEM_KIND, _emit_item_kind },
+	{ ITEM_ID, _emit_item_id },
+	{ ITEM_NAME, _emit_item_name },
+	{ PERSISTENT_ID, _emit_persistent_id },
+	{ -1, _emit_aspect_ratio },
+	{ PHOTO_CREATIONDATE, _emit_photo_creationdate },
+	{ PHOTO_IMAGEFILENAME, _emit_photo_imagefilename },
+	{ PHOTO_IMAGEFORMAT, _emit_photo_imageformat },
+	{ PHOTO_IMAGEFILESIZE, _emit_photo_imagefilesize },
+	{ PHOTO_IMAGELARGEFILESIZE, _emit_photo_imagelargefilesize },
+	{ PHOTO_IMAGEPIXELHEIGHT, _emit_photo_imagepixelheight },
+	{ PHOTO_IMAGEPIXELWIDTH, _emit_photo_imagepixelwidth },
+	{ PHOTO_IMAGERATING, _emit_photo_imagerating },
+	{ PHOTO_IMAGECOMMENTS, _emit_photo_imagecomments },
+	{ PHOTO_FILEDATA, _emit_photo_filedata },
+	{ 0, NULL }
+};
 
-		g_object_get (record, "rating", &rating, NULL);
-		dmap_structure_add (mlit, DMAP_CC_PRAT, rating);
+static void
+_add_entry_to_mlcl (guint id, DmapRecord * record, gpointer _mb)
+{
+	const DmapShareEmitter *emitter;
+	DmapShareMlclBits *mb = (DmapShareMlclBits *) _mb;
+
+	emitter = mb->emitters;
+	if (emitter == NULL) {
+		emitter = (DmapShareEmitter *)
+		          dmap_share_get_emitters (mb->parent.share,
+		                                   mb->parent.bits)->data;
 	}
 
-	if (dmap_share_client_requested (mb->bits, PHOTO_IMAGECOMMENTS)) {
-		gchar *comments = NULL;
+	dmap_structure_builder_begin (mb->builder, DMAP_CC_MLIT);
 
-		g_object_get (record, "comments", &comments, NULL);
-		if (comments) {
-			dmap_structure_add (mlit, DMAP_CC_PCMT, comments);
-			g_free (comments);
-		} else {
-			g_debug ("Comments requested but not available");
-		}
+	for (; emitter->emit; emitter++) {
+		emitter->emit (mb, id, record, NULL);
 	}
 
-	if (dmap_share_client_requested (mb->bits, PHOTO_FILEDATA)) {
-		size_t size = 0;
-		char *data = NULL;
-		GArray *thumbnail = NULL;
-
-		if (dmap_share_client_requested (mb->bits, PHOTO_THUMB)) {
-			g_object_get (record, "thumbnail", &thumbnail, NULL);
-			if (thumbnail) {
-				data = thumbnail->data;
-				size = thumbnail->len;
-			} else {
-				data = NULL;
-				size = 0;
-			}
-		} else {
-			/* Should be PHOTO_HIRES */
-			char *location = NULL;
-
-			g_object_get (record, "location", &location, NULL);
-			if (_mapped_file) {
-				/* Free any previously mapped image */
-				g_mapped_file_unref (_mapped_file);
-				_mapped_file = NULL;
-			}
-
-			_mapped_file = _file_to_mmap (location);
-			if (_mapped_file == NULL) {
-				g_warning ("Error opening %s", location);
-				data = NULL;
-				size = 0;
-			} else {
-				data = (char *)
-					g_mapped_file_get_contents (_mapped_file);
-				size = g_mapped_file_get_length (_mapped_file);
-			}
-			g_free (location);
-		}
-		dmap_structure_add (mlit, DMAP_CC_PFDT, data, size);
-	}
+	dmap_structure_builder_end (mb->builder);
 }
 
 static void
@@ -425,6 +532,8 @@ dmap_image_share_class_init (DmapImageShareClass * klass)
 	parent_class->databases_browse_xxx = _databases_browse_xxx;
 	parent_class->databases_items_xxx = _databases_items_xxx;
 	parent_class->server_info = _server_info;
+
+	dmap_share_class_set_emitters (parent_class, _emitters);
 }
 
 static void
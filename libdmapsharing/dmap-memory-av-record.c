@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <libdmapsharing/dmap-memory-db-private.h>
+
+static void _dmap_av_record_iface_init (gpointer iface);
+static void _dmap_record_iface_init (gpointer iface);
+
+G_DEFINE_TYPE_WITH_CODE (DmapMemoryAvRecord, dmap_memory_av_record,
+                         G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (DMAP_TYPE_AV_RECORD,
+                                                _dmap_av_record_iface_init)
+                         G_IMPLEMENT_INTERFACE (DMAP_TYPE_RECORD,
+                                                _dmap_record_iface_init)
+                         G_ADD_PRIVATE (DmapMemoryAvRecord))
+
+static void
+_set_property (GObject * object, guint prop_id, const GValue * value,
+               GParamSpec * pspec)
+{
+	DmapMemoryAvRecord *record = DMAP_MEMORY_AV_RECORD (object);
+
+	if (prop_id == 0 || prop_id > dmap_memory_db_n_columns ()) {
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		goto done;
+	}
+
+	if (record->priv->values) {
+		dmap_memory_db_values_set (record->priv->values, prop_id - 1,
+		                           value);
+	} else {
+		dmap_memory_db_set_value (record->priv->db, record->priv->id,
+		                          prop_id - 1, value,
+		                          DMAP_RECORD (record));
+	}
+
+done:
+	return;
+}
+
+static void
+_get_property (GObject * object, guint prop_id, GValue * value,
+               GParamSpec * pspec)
+{
+	DmapMemoryAvRecord *record = DMAP_MEMORY_AV_RECORD (object);
+
+	if (prop_id == 0 || prop_id > dmap_memory_db_n_columns ()) {
+		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+		goto done;
+	}
+
+	if (record->priv->values) {
+		dmap_memory_db_values_get (record->priv->values, prop_id - 1,
+		                           value);
+	} else {
+		dmap_memory_db_get_value (record->priv->db, record->priv->id,
+		                          prop_id - 1, value);
+	}
+
+done:
+	return;
+}
+
+static gboolean
+_itunes_compat (DmapAvRecord * record)
+{
+	gboolean compat;
+	gchar *format = NULL;
+
+	g_object_get (record, "format", &format, NULL);
+	compat = 0 == g_strcmp0 (format, "mp3");
+	g_free (format);
+
+	return compat;
+}
+
+static GInputStream *
+_read (DmapAvRecord * record, GError ** error)
+{
+	GFile *file;
+	GInputStream *stream;
+	gchar *location = NULL;
+
+	g_object_get (record, "location", &location, NULL);
+
+	file = g_file_new_for_uri (location);
+	stream = G_INPUT_STREAM (g_file_read (file, NULL, error));
+
+	g_object_unref (file);
+	g_free (location);
+
+	return stream;
+}
+
+static void
+_get_fields (DmapAvRecord * record, DmapAvRecordFields * fields)
+{
+	DmapMemoryAvRecordPrivate *priv = DMAP_MEMORY_AV_RECORD (record)->priv;
+
+	if (priv->values) {
+		/* Copies no strings, so leaves nothing to clear. */
+		*fields = priv->values->fields;
+	} else {
+		dmap_memory_db_get_fields (priv->db, priv->id, fields);
+	}
+}
+
+static void
+_set_fields (DmapAvRecord * record, const DmapAvRecordFields * fields)
+{
+	DmapMemoryAvRecordPrivate *priv = DMAP_MEMORY_AV_RECORD (record)->priv;
+
+	if (priv->values) {
+		dmap_memory_db_values_set_fields (priv->values, fields);
+	} else {
+		dmap_memory_db_set_fields (priv->db, priv->id, fields,
+		                           DMAP_RECORD (record));
+	}
+}
+
+static void
+_dmap_av_record_iface_init (gpointer iface)
+{
+	DmapAvRecordInterface *dmap_av_record = iface;
+
+	g_assert (G_TYPE_FROM_INTERFACE (dmap_av_record) == DMAP_TYPE_AV_RECORD);
+
+	dmap_av_record->itunes_compat = _itunes_compat;
+	dmap_av_record->read = _read;
+	dmap_av_record->get_fields = _get_fields;
+	dmap_av_record->set_fields = _set_fields;
+}
+
+static void
+_dmap_record_iface_init (gpointer iface)
+{
+	DmapRecordInterface *dmap_record = iface;
+
+	g_assert (G_TYPE_FROM_INTERFACE (dmap_record) == DMAP_TYPE_RECORD);
+}
+
+static void
+dmap_memory_av_record_init (DmapMemoryAvRecord * record)
+{
+	record->priv = dmap_memory_av_record_get_instance_private (record);
+}
+
+static void
+_dispose (GObject * object)
+{
+	DmapMemoryAvRecord *record = DMAP_MEMORY_AV_RECORD (object);
+
+	g_clear_object (&record->priv->db);
+
+	G_OBJECT_CLASS (dmap_memory_av_record_parent_class)->dispose (object);
+}
+
+static void
+_finalize (GObject * object)
+{
+	DmapMemoryAvRecord *record = DMAP_MEMORY_AV_RECORD (object);
+
+	g_clear_pointer (&record->priv->values, dmap_memory_db_values_free);
+
+	G_OBJECT_CLASS (dmap_memory_av_record_parent_class)->finalize (object);
+}
+
+static void
+dmap_memory_av_record_class_init (DmapMemoryAvRecordClass * klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	guint column;
+
+	object_class->set_property = _set_property;
+	object_class->get_property = _get_property;
+	object_class->dispose = _dispose;
+	object_class->finalize = _finalize;
+
+	for (column = 0; column < dmap_memory_db_n_columns (); column++) {
+		g_object_class_override_property (object_class, column + 1,
+		                                  dmap_memory_db_column_name
+		                                  (column));
+	}
+}
+
+DmapMemoryAvRecord *
+dmap_memory_av_record_new_view (DmapMemoryDb * db, guint id)
+{
+	DmapMemoryAvRecord *record;
+
+	record = g_object_new (DMAP_TYPE_MEMORY_AV_RECORD, NULL);
+	record->priv->db = g_object_ref (db);
+	record->priv->id = id;
+
+	return record;
+}
+
+DmapMemoryAvRecord *
+dmap_memory_av_record_new (void)
+{
+	DmapMemoryAvRecord *record;
+
+	record = g_object_new (DMAP_TYPE_MEMORY_AV_RECORD, NULL);
+	record->priv->values = dmap_memory_db_values_new ();
+
+	return record;
+}
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DMAP_MEMORY_AV_RECORD_H
+#define _DMAP_MEMORY_AV_RECORD_H
+
+#include <glib-object.h>
+
+#include <libdmapsharing/dmap-av-record.h>
+
+G_BEGIN_DECLS
+/**
+ * SECTION: dmap-memory-av-record
+ * @short_description: A view of a record in a #DmapMemoryDb.
+ *
+ * #DmapMemoryAvRecord objects are the #DmapAvRecord's which
+ * #DmapMemoryDb returns. Their properties read and write the
+ * database's columns.
+ */
+
+/**
+ * DMAP_TYPE_MEMORY_AV_RECORD:
+ *
+ * The type for #DmapMemoryAvRecord.
+ */
+#define DMAP_TYPE_MEMORY_AV_RECORD         (dmap_memory_av_record_get_type ())
+/**
+ * DMAP_MEMORY_AV_RECORD:
+ * @o: Object which is subject to casting.
+ *
+ * Casts a #DmapMemoryAvRecord or derived pointer into a
+ * (DmapMemoryAvRecord *) pointer. Depending on the current debugging
+ * level, this function may invoke certain runtime checks to identify
+ * invalid casts.
+ */
+#define DMAP_MEMORY_AV_RECORD(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), \
+					    DMAP_TYPE_MEMORY_AV_RECORD, DmapMemoryAvRecord))
+/**
+ * DMAP_MEMORY_AV_RECORD_CLASS:
+ * @k: a valid #DmapMemoryAvRecordClass
+ *
+ * Casts a derived #DmapMemoryAvRecordClass structure into a
+ * #DmapMemoryAvRecordClass structure.
+ */
+#define DMAP_MEMORY_AV_RECORD_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST ((k), \
+					    DMAP_TYPE_MEMORY_AV_RECORD, DmapMemoryAvRecordClass))
+/**
+ * DMAP_IS_MEMORY_AV_RECORD:
+ * @o: Instance to check for being a %DMAP_TYPE_MEMORY_AV_RECORD.
+ *
+ * Checks whether a valid #GTypeInstance pointer is of type
+ * %DMAP_TYPE_MEMORY_AV_RECORD.
+ */
+#define DMAP_IS_MEMORY_AV_RECORD(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), \
+					    DMAP_TYPE_MEMORY_AV_RECORD))
+/**
+ * DMAP_IS_MEMORY_AV_RECORD_CLASS:
+ * @k: a #DmapMemoryAvRecordClass
+ *
+ * Checks whether @k "is a" valid #DmapMemoryAvRecordClass structure of
+ * type %DMAP_MEMORY_AV_RECORD or derived.
+ */
+#define DMAP_IS_MEMORY_AV_RECORD_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), \
+					    DMAP_TYPE_MEMORY_AV_RECORD))
+/**
+ * DMAP_MEMORY_AV_RECORD_GET_CLASS:
+ * @o: a #DmapMemoryAvRecord instance.
+ *
+ * Get the class structure associated to a #DmapMemoryAvRecord instance.
+ *
+ * Returns: pointer to object class structure.
+ */
+#define DMAP_MEMORY_AV_RECORD_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), \
+					    DMAP_TYPE_MEMORY_AV_RECORD, DmapMemoryAvRecordClass))
+
+typedef struct DmapMemoryAvRecordPrivate DmapMemoryAvRecordPrivate;
+
+typedef struct {
+	GObject parent;
+	DmapMemoryAvRecordPrivate *priv;
+} DmapMemoryAvRecord;
+
+typedef struct {
+	GObjectClass parent;
+} DmapMemoryAvRecordClass;
+
+GType dmap_memory_av_record_get_type (void);
+
+/**
+ * dmap_memory_av_record_new:
+ *
+ * Creates a record which belongs to no database, for filling in and then
+ * adding to a #DmapMemoryDb (or any other #DmapDb).
+ *
+ * Returns: a pointer to a DmapMemoryAvRecord.
+ */
+DmapMemoryAvRecord *dmap_memory_av_record_new (void);
+
+#endif /* _DMAP_MEMORY_AV_RECORD_H */
+
+G_END_DECLS
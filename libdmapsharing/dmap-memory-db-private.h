@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DMAP_MEMORY_DB_PRIVATE_H
+#define _DMAP_MEMORY_DB_PRIVATE_H
+
+#include <libdmapsharing/dmap-memory-db.h>
+#include <libdmapsharing/dmap-memory-av-record.h>
+
+G_BEGIN_DECLS
+
+/* The values of a record not yet added to a database, whose strings
+ * and hash it owns. */
+typedef struct {
+	DmapAvRecordFields fields;
+	GArray *hash;
+} DmapMemoryDbValues;
+
+struct DmapMemoryAvRecordPrivate {
+	/* Either a view of row id of db, or, for a record not yet added
+	 * to a database, values of its own. */
+	DmapMemoryDb *db;
+	guint id;
+	DmapMemoryDbValues *values;
+};
+
+/* Columns are numbered from 0; a DmapMemoryAvRecord uses column + 1 as
+ * the ID of the property of the same name. */
+guint dmap_memory_db_n_columns (void);
+const gchar *dmap_memory_db_column_name (guint column);
+
+void dmap_memory_db_get_value (DmapMemoryDb * db, guint id, guint column,
+                               GValue * value);
+
+/* view is the record whose column changes, which the database needs to
+ * keep its index up to date. */
+void dmap_memory_db_set_value (DmapMemoryDb * db, guint id, guint column,
+                               const GValue * value, DmapRecord * view);
+
+/* The strings filled in are the database's own. */
+void dmap_memory_db_get_fields (DmapMemoryDb * db, guint id,
+                                DmapAvRecordFields * fields);
+void dmap_memory_db_set_fields (DmapMemoryDb * db, guint id,
+                                const DmapAvRecordFields * fields,
+                                DmapRecord * view);
+
+/* Values start out as the properties' defaults. The strings in
+ * fields are copied. */
+DmapMemoryDbValues *dmap_memory_db_values_new (void);
+void dmap_memory_db_values_free (DmapMemoryDbValues * values);
+void dmap_memory_db_values_get (const DmapMemoryDbValues * values,
+                                guint column, GValue * value);
+void dmap_memory_db_values_set (DmapMemoryDbValues * values, guint column,
+                                const GValue * value);
+void dmap_memory_db_values_set_fields (DmapMemoryDbValues * values,
+                                       const DmapAvRecordFields * fields);
+
+DmapMemoryAvRecord *dmap_memory_av_record_new_view (DmapMemoryDb * db,
+                                                    guint id);
+
+G_END_DECLS
+
+#endif /* _DMAP_MEMORY_DB_PRIVATE_H */
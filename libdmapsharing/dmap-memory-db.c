@@ -0,0 +1,1335 @@
+/*
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include <libdmapsharing/dmap-error.h>
+#include <libdmapsharing/dmap-utils.h>
+#include <libdmapsharing/dmap-memory-db-private.h>
+
+typedef enum {
+	COLUMN_STRING,
+	COLUMN_INT,
+	COLUMN_BOOLEAN,
+	COLUMN_INT64,
+	COLUMN_UINT64,
+	COLUMN_ENUM,
+	COLUMN_HASH
+} ColumnKind;
+
+typedef struct {
+	const gchar *property;
+	ColumnKind kind;
+	/* Of the field in DmapAvRecordFields, or -1 for none. */
+	glong offset;
+} Column;
+
+#define FIELD(member) G_STRUCT_OFFSET (DmapAvRecordFields, member)
+
+/* Every DmapAvRecord property. The names must match those installed by
+ * dmap_av_record_default_init. */
+static const Column _columns[] = {
+	{ "location",    COLUMN_STRING,  FIELD (location) },
+	{ "title",       COLUMN_STRING,  FIELD (title) },
+	{ "songalbum",   COLUMN_STRING,  FIELD (songalbum) },
+	{ "sort-album",  COLUMN_STRING,  FIELD (sort_album) },
+	{ "songartist",  COLUMN_STRING,  FIELD (songartist) },
+	{ "sort-artist", COLUMN_STRING,  FIELD (sort_artist) },
+	{ "songgenre",   COLUMN_STRING,  FIELD (songgenre) },
+	{ "format",      COLUMN_STRING,  FIELD (format) },
+	{ "rating",      COLUMN_INT,     FIELD (rating) },
+	{ "filesize",    COLUMN_UINT64,  FIELD (filesize) },
+	{ "duration",    COLUMN_INT,     FIELD (duration) },
+	{ "track",       COLUMN_INT,     FIELD (track) },
+	{ "year",        COLUMN_INT,     FIELD (year) },
+	{ "firstseen",   COLUMN_INT,     FIELD (firstseen) },
+	{ "mtime",       COLUMN_INT,     FIELD (mtime) },
+	{ "disc",        COLUMN_INT,     FIELD (disc) },
+	{ "bitrate",     COLUMN_INT,     FIELD (bitrate) },
+	{ "has-video",   COLUMN_BOOLEAN, FIELD (has_video) },
+	{ "songalbumid", COLUMN_INT64,   FIELD (songalbumid) },
+	{ "mediakind",   COLUMN_ENUM,    FIELD (mediakind) },
+	{ "hash",        COLUMN_HASH,    -1 },
+};
+
+#define N_COLUMNS G_N_ELEMENTS (_columns)
+#define COLUMN_LOCATION 0
+
+/* The same properties that test-dmap-db.c indexes: those which clients
+ * filter on when browsing. */
+static const gchar *_indexed[] = {
+	"songgenre", "songartist", "songalbum", "mediakind", NULL
+};
+
+/* The properties clients browse by; all of them are indexed too. */
+static const gchar *_faceted[] = {
+	"songgenre", "songartist", "songalbum", NULL
+};
+
+/* The properties album and artist groups are made of. */
+static const gchar *_grouped[] = {
+	"songalbum", "sort-album", "songartist", "sort-artist", "songalbumid",
+	NULL
+};
+
+/* The interface's property specifications, for default values. */
+static GParamSpec *_pspecs[N_COLUMNS];
+
+struct DmapMemoryDbPrivate {
+	/* One array per column, indexed by ID - 1. The hash column is
+	 * NULL: nearly every record has no hash, so hashes are kept in
+	 * a table by ID instead. */
+	GArray *columns[N_COLUMNS];
+	GHashTable *hashes;
+	guint rows;
+
+	/* Interned location to ID. */
+	GHashTable *locations;
+
+	/* Whether each column is indexed, and so possibly faceted. */
+	gboolean indexed[N_COLUMNS];
+	DmapDbIndex *index;
+	DmapDbFacets *facets;
+
+	/* Whether each column is one groups are made of. */
+	gboolean grouped[N_COLUMNS];
+	DmapDbGroups *groups;
+};
+
+static void _dmap_db_iface_init (gpointer iface);
+
+G_DEFINE_TYPE_WITH_CODE (DmapMemoryDb, dmap_memory_db, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (DMAP_TYPE_DB,
+                                                _dmap_db_iface_init)
+                         G_ADD_PRIVATE (DmapMemoryDb))
+
+static gsize
+_column_element_size (ColumnKind kind)
+{
+	gsize size = 0;
+
+	switch (kind) {
+	case COLUMN_STRING:
+		size = sizeof (const gchar *);
+		break;
+	case COLUMN_INT:
+	case COLUMN_ENUM:
+		size = sizeof (gint32);
+		break;
+	case COLUMN_BOOLEAN:
+		size = sizeof (guint8);
+		break;
+	case COLUMN_INT64:
+	case COLUMN_UINT64:
+		size = sizeof (gint64);
+		break;
+	case COLUMN_HASH:
+		g_assert_not_reached ();
+	}
+
+	return size;
+}
+
+static void
+_set_string (DmapMemoryDb * db, guint row, guint column, const gchar * str)
+{
+	const gchar **cell;
+	const gchar *old;
+
+	cell = &g_array_index (db->priv->columns[column], const gchar *, row);
+	old = *cell;
+
+	/* String cells hold references to interned strings, so equal
+	 * strings are equal pointers. */
+	*cell = dmap_utils_intern_ref (str);
+	dmap_utils_intern_unref (old);
+}
+
+static void
+_set_cell (DmapMemoryDb * db, guint row, guint column, const GValue * value)
+{
+	GArray *array = db->priv->columns[column];
+
+	switch (_columns[column].kind) {
+	case COLUMN_STRING:
+		_set_string (db, row, column, g_value_get_string (value));
+		break;
+	case COLUMN_INT:
+		g_array_index (array, gint32, row) = g_value_get_int (value);
+		break;
+	case COLUMN_ENUM:
+		g_array_index (array, gint32, row) = g_value_get_enum (value);
+		break;
+	case COLUMN_BOOLEAN:
+		g_array_index (array, guint8, row) = g_value_get_boolean (value);
+		break;
+	case COLUMN_INT64:
+		g_array_index (array, gint64, row) = g_value_get_int64 (value);
+		break;
+	case COLUMN_UINT64:
+		g_array_index (array, guint64, row) = g_value_get_uint64 (value);
+		break;
+	case COLUMN_HASH: {
+		GArray *hash = g_value_get_boxed (value);
+
+		if (hash) {
+			g_hash_table_insert (db->priv->hashes,
+			                     GUINT_TO_POINTER (row),
+			                     g_array_ref (hash));
+		} else {
+			g_hash_table_remove (db->priv->hashes,
+			                     GUINT_TO_POINTER (row));
+		}
+		break;
+	}
+	}
+}
+
+static void
+_get_cell (DmapMemoryDb * db, guint row, guint column, GValue * value)
+{
+	GArray *array = db->priv->columns[column];
+
+	switch (_columns[column].kind) {
+	case COLUMN_STRING:
+		g_value_set_string (value, g_array_index (array, const gchar *,
+		                                          row));
+		break;
+	case COLUMN_INT:
+		g_value_set_int (value, g_array_index (array, gint32, row));
+		break;
+	case COLUMN_ENUM:
+		g_value_set_enum (value, g_array_index (array, gint32, row));
+		break;
+	case COLUMN_BOOLEAN:
+		g_value_set_boolean (value, g_array_index (array, guint8, row));
+		break;
+	case COLUMN_INT64:
+		g_value_set_int64 (value, g_array_index (array, gint64, row));
+		break;
+	case COLUMN_UINT64:
+		g_value_set_uint64 (value, g_array_index (array, guint64, row));
+		break;
+	case COLUMN_HASH:
+		g_value_set_boxed (value, g_hash_table_lookup
+		                          (db->priv->hashes,
+		                           GUINT_TO_POINTER (row)));
+		break;
+	}
+}
+
+static void
+_set_location (DmapMemoryDb * db, guint id, const gchar * location)
+{
+	const gchar *old;
+
+	old = g_array_index (db->priv->columns[COLUMN_LOCATION],
+	                     const gchar *, id - 1);
+	if (old) {
+		g_hash_table_remove (db->priv->locations, old);
+	}
+
+	_set_string (db, id - 1, COLUMN_LOCATION, location);
+
+	if (location) {
+		g_hash_table_insert (db->priv->locations,
+		                     (gpointer) g_array_index
+		                     (db->priv->columns[COLUMN_LOCATION],
+		                      const gchar *, id - 1),
+		                     GUINT_TO_POINTER (id));
+	}
+}
+
+static void
+_get_fields (DmapMemoryDb * db, guint row, DmapAvRecordFields * fields)
+{
+	guint column;
+
+	for (column = 0; column < N_COLUMNS; column++) {
+		GArray *array = db->priv->columns[column];
+		gpointer field;
+
+		if (_columns[column].offset < 0) {
+			continue;
+		}
+
+		field = G_STRUCT_MEMBER_P (fields, _columns[column].offset);
+
+		switch (_columns[column].kind) {
+		case COLUMN_STRING:
+			*(const gchar **) field
+				= g_array_index (array, const gchar *, row);
+			break;
+		case COLUMN_INT:
+			*(gint *) field = g_array_index (array, gint32, row);
+			break;
+		case COLUMN_ENUM:
+			*(DmapMediaKind *) field
+				= g_array_index (array, gint32, row);
+			break;
+		case COLUMN_BOOLEAN:
+			*(gboolean *) field = g_array_index (array, guint8, row);
+			break;
+		case COLUMN_INT64:
+			*(gint64 *) field = g_array_index (array, gint64, row);
+			break;
+		case COLUMN_UINT64:
+			*(guint64 *) field = g_array_index (array, guint64, row);
+			break;
+		case COLUMN_HASH:
+			break;
+		}
+	}
+}
+
+static void
+_set_fields (DmapMemoryDb * db, guint id, const DmapAvRecordFields * fields)
+{
+	/* Released only once every new string is held, since fields may
+	 * hold strings from this very row, as from _get_fields. */
+	const gchar *old[N_COLUMNS] = { NULL };
+	const gchar *location;
+	guint column, row = id - 1;
+
+	for (column = 0; column < N_COLUMNS; column++) {
+		GArray *array = db->priv->columns[column];
+		gconstpointer field;
+
+		if (_columns[column].offset < 0) {
+			continue;
+		}
+
+		field = G_STRUCT_MEMBER_P (fields, _columns[column].offset);
+
+		switch (_columns[column].kind) {
+		case COLUMN_STRING: {
+			const gchar **cell = &g_array_index (array,
+			                                     const gchar *,
+			                                     row);
+
+			old[column] = *cell;
+			*cell = dmap_utils_intern_ref
+				(*(const gchar * const *) field);
+			break;
+		}
+		case COLUMN_INT:
+			g_array_index (array, gint32, row) = *(const gint *) field;
+			break;
+		case COLUMN_ENUM:
+			g_array_index (array, gint32, row)
+				= *(const DmapMediaKind *) field;
+			break;
+		case COLUMN_BOOLEAN:
+			g_array_index (array, guint8, row)
+				= *(const gboolean *) field;
+			break;
+		case COLUMN_INT64:
+			g_array_index (array, gint64, row) = *(const gint64 *) field;
+			break;
+		case COLUMN_UINT64:
+			g_array_index (array, guint64, row)
+				= *(const guint64 *) field;
+			break;
+		case COLUMN_HASH:
+			break;
+		}
+	}
+
+	if (old[COLUMN_LOCATION]) {
+		g_hash_table_remove (db->priv->locations, old[COLUMN_LOCATION]);
+	}
+
+	location = g_array_index (db->priv->columns[COLUMN_LOCATION],
+	                          const gchar *, row);
+	if (location) {
+		g_hash_table_insert (db->priv->locations, (gpointer) location,
+		                     GUINT_TO_POINTER (id));
+	}
+
+	for (column = 0; column < N_COLUMNS; column++) {
+		dmap_utils_intern_unref (old[column]);
+	}
+}
+
+guint
+dmap_memory_db_n_columns (void)
+{
+	return N_COLUMNS;
+}
+
+const gchar *
+dmap_memory_db_column_name (guint column)
+{
+	g_assert (column < N_COLUMNS);
+
+	return _columns[column].property;
+}
+
+/* Appends a record with default values, but without indexing it, and
+ * returns its ID. */
+static guint
+_append (DmapMemoryDb * db)
+{
+	guint column, row = db->priv->rows++;
+
+	for (column = 0; column < N_COLUMNS; column++) {
+		if (db->priv->columns[column] == NULL) {
+			continue;
+		}
+
+		/* Zeroed, so that string cells start out NULL. */
+		g_array_set_size (db->priv->columns[column], db->priv->rows);
+
+		if (_pspecs[column] != NULL) {
+			_set_cell (db, row, column,
+			           g_param_spec_get_default_value (_pspecs[column]));
+		}
+	}
+
+	return row + 1;
+}
+
+void
+dmap_memory_db_get_value (DmapMemoryDb * db, guint id, guint column,
+                          GValue * value)
+{
+	g_assert (id > 0 && id <= db->priv->rows);
+	g_assert (column < N_COLUMNS);
+
+	_get_cell (db, id - 1, column, value);
+}
+
+/* view must hold the values it was indexed with. */
+static void
+_unindex (DmapMemoryDb * db, guint id, DmapRecord * view)
+{
+	dmap_db_index_remove (db->priv->index, id, view);
+	dmap_db_facets_remove (db->priv->facets, id, view);
+}
+
+static void
+_reindex (DmapMemoryDb * db, guint id, DmapRecord * view)
+{
+	dmap_db_index_add (db->priv->index, id, view);
+	dmap_db_facets_add (db->priv->facets, id, view);
+}
+
+void
+dmap_memory_db_set_value (DmapMemoryDb * db, guint id, guint column,
+                          const GValue * value, DmapRecord * view)
+{
+	gboolean indexed, grouped;
+
+	g_assert (id > 0 && id <= db->priv->rows);
+	g_assert (column < N_COLUMNS);
+
+	indexed = view != NULL && db->priv->indexed[column];
+	grouped = view != NULL && db->priv->grouped[column];
+
+	if (indexed) {
+		_unindex (db, id, view);
+	}
+
+	if (COLUMN_LOCATION == column) {
+		_set_location (db, id, g_value_get_string (value));
+	} else {
+		_set_cell (db, id - 1, column, value);
+	}
+
+	if (indexed) {
+		_reindex (db, id, view);
+	}
+
+	/* Groups are kept by ID, so need not be told the old values. */
+	if (grouped) {
+		dmap_db_groups_add (db->priv->groups, id, view);
+	}
+}
+
+void
+dmap_memory_db_get_fields (DmapMemoryDb * db, guint id,
+                           DmapAvRecordFields * fields)
+{
+	g_assert (id > 0 && id <= db->priv->rows);
+
+	_get_fields (db, id - 1, fields);
+}
+
+void
+dmap_memory_db_set_fields (DmapMemoryDb * db, guint id,
+                           const DmapAvRecordFields * fields,
+                           DmapRecord * view)
+{
+	g_assert (id > 0 && id <= db->priv->rows);
+
+	/* One removal and one addition, rather than one per indexed
+	 * column. */
+	if (view) {
+		_unindex (db, id, view);
+	}
+
+	_set_fields (db, id, fields);
+
+	if (view) {
+		_reindex (db, id, view);
+		dmap_db_groups_add (db->priv->groups, id, view);
+	}
+}
+
+static void
+_get_value (const DmapMemoryDbValues * values, guint column, GValue * value)
+{
+	gconstpointer field;
+
+	if (COLUMN_HASH == _columns[column].kind) {
+		g_value_set_boxed (value, values->hash);
+		goto done;
+	}
+
+	field = G_STRUCT_MEMBER_P (&values->fields, _columns[column].offset);
+
+	switch (_columns[column].kind) {
+	case COLUMN_STRING:
+		g_value_set_string (value, *(const gchar * const *) field);
+		break;
+	case COLUMN_INT:
+		g_value_set_int (value, *(const gint *) field);
+		break;
+	case COLUMN_ENUM:
+		g_value_set_enum (value, *(const DmapMediaKind *) field);
+		break;
+	case COLUMN_BOOLEAN:
+		g_value_set_boolean (value, *(const gboolean *) field);
+		break;
+	case COLUMN_INT64:
+		g_value_set_int64 (value, *(const gint64 *) field);
+		break;
+	case COLUMN_UINT64:
+		g_value_set_uint64 (value, *(const guint64 *) field);
+		break;
+	case COLUMN_HASH:
+		g_assert_not_reached ();
+	}
+
+done:
+	return;
+}
+
+static void
+_set_value (DmapMemoryDbValues * values, guint column, const GValue * value)
+{
+	gpointer field;
+
+	if (COLUMN_HASH == _columns[column].kind) {
+		if (values->hash) {
+			g_array_unref (values->hash);
+		}
+		values->hash = g_value_dup_boxed (value);
+		goto done;
+	}
+
+	field = G_STRUCT_MEMBER_P (&values->fields, _columns[column].offset);
+
+	switch (_columns[column].kind) {
+	case COLUMN_STRING: {
+		/* Duplicated first, in case value holds the old string. */
+		gchar *old = (gchar *) *(const gchar **) field;
+
+		*(const gchar **) field = g_value_dup_string (value);
+		g_free (old);
+		break;
+	}
+	case COLUMN_INT:
+		*(gint *) field = g_value_get_int (value);
+		break;
+	case COLUMN_ENUM:
+		*(DmapMediaKind *) field = g_value_get_enum (value);
+		break;
+	case COLUMN_BOOLEAN:
+		*(gboolean *) field = g_value_get_boolean (value);
+		break;
+	case COLUMN_INT64:
+		*(gint64 *) field = g_value_get_int64 (value);
+		break;
+	case COLUMN_UINT64:
+		*(guint64 *) field = g_value_get_uint64 (value);
+		break;
+	case COLUMN_HASH:
+		g_assert_not_reached ();
+	}
+
+done:
+	return;
+}
+
+DmapMemoryDbValues *
+dmap_memory_db_values_new (void)
+{
+	DmapMemoryDbValues *values;
+	gpointer klass;
+	guint column;
+
+	/* Whose initialization looks up the default values. */
+	klass = g_type_class_ref (DMAP_TYPE_MEMORY_DB);
+
+	values = g_new0 (DmapMemoryDbValues, 1);
+	for (column = 0; column < N_COLUMNS; column++) {
+		_set_value (values, column,
+		            g_param_spec_get_default_value (_pspecs[column]));
+	}
+
+	g_type_class_unref (klass);
+
+	return values;
+}
+
+void
+dmap_memory_db_values_free (DmapMemoryDbValues * values)
+{
+	guint column;
+
+	for (column = 0; column < N_COLUMNS; column++) {
+		if (COLUMN_STRING == _columns[column].kind) {
+			g_free (G_STRUCT_MEMBER (gchar *, &values->fields,
+			                         _columns[column].offset));
+		}
+	}
+
+	if (values->hash) {
+		g_array_unref (values->hash);
+	}
+
+	g_free (values);
+}
+
+void
+dmap_memory_db_values_get (const DmapMemoryDbValues * values, guint column,
+                           GValue * value)
+{
+	g_assert (column < N_COLUMNS);
+
+	_get_value (values, column, value);
+}
+
+void
+dmap_memory_db_values_set (DmapMemoryDbValues * values, guint column,
+                           const GValue * value)
+{
+	g_assert (column < N_COLUMNS);
+
+	_set_value (values, column, value);
+}
+
+void
+dmap_memory_db_values_set_fields (DmapMemoryDbValues * values,
+                                  const DmapAvRecordFields * fields)
+{
+	/* Freed only once every new string is copied, as in
+	 * _set_fields. */
+	gchar *old[N_COLUMNS] = { NULL };
+	guint column;
+
+	for (column = 0; column < N_COLUMNS; column++) {
+		gconstpointer field;
+		gpointer member;
+
+		if (_columns[column].offset < 0) {
+			continue;
+		}
+
+		field = G_STRUCT_MEMBER_P (fields, _columns[column].offset);
+		member = G_STRUCT_MEMBER_P (&values->fields,
+		                            _columns[column].offset);
+
+		switch (_columns[column].kind) {
+		case COLUMN_STRING:
+			old[column] = (gchar *) *(const gchar **) member;
+			*(const gchar **) member
+				= g_strdup (*(const gchar * const *) field);
+			break;
+		case COLUMN_INT:
+			*(gint *) member = *(const gint *) field;
+			break;
+		case COLUMN_ENUM:
+			*(DmapMediaKind *) member = *(const DmapMediaKind *) field;
+			break;
+		case COLUMN_BOOLEAN:
+			*(gboolean *) member = *(const gboolean *) field;
+			break;
+		case COLUMN_INT64:
+			*(gint64 *) member = *(const gint64 *) field;
+			break;
+		case COLUMN_UINT64:
+			*(guint64 *) member = *(const guint64 *) field;
+			break;
+		case COLUMN_HASH:
+			break;
+		}
+	}
+
+	for (column = 0; column < N_COLUMNS; column++) {
+		g_free (old[column]);
+	}
+}
+
+static guint
+_add (DmapDb * db, DmapRecord * record, G_GNUC_UNUSED GError ** error)
+{
+	DmapMemoryDb *memory_db = DMAP_MEMORY_DB (db);
+	DmapAvRecordFields fields;
+	GArray *hash = NULL;
+	guint id;
+
+	id = _append (memory_db);
+
+	dmap_av_record_get_fields (DMAP_AV_RECORD (record), &fields);
+	_set_fields (memory_db, id, &fields);
+	dmap_av_record_fields_clear (&fields);
+
+	/* Returned with a reference, which the table takes. */
+	g_object_get (record, "hash", &hash, NULL);
+	if (hash) {
+		g_hash_table_insert (memory_db->priv->hashes,
+		                     GUINT_TO_POINTER (id - 1), hash);
+	}
+
+	/* The record holds the same values as the new row. */
+	_reindex (memory_db, id, record);
+	dmap_db_groups_add (memory_db->priv->groups, id, record);
+
+	return id;
+}
+
+static guint
+_add_with_id (DmapDb * db, DmapRecord * record, guint id, GError ** error)
+{
+	guint added = DMAP_DB_ID_BAD;
+
+	/* ID's are positions in the columns, so only the next may be
+	 * chosen. */
+	if (id != DMAP_MEMORY_DB (db)->priv->rows + 1) {
+		g_set_error (error, DMAP_ERROR, DMAP_STATUS_DB_BAD_ID,
+		             "Cannot add record with ID %u", id);
+		goto done;
+	}
+
+	added = _add (db, record, error);
+
+done:
+	return added;
+}
+
+static DmapRecord *
+_lookup_by_id (const DmapDb * db, guint id)
+{
+	DmapMemoryDb *memory_db = DMAP_MEMORY_DB (db);
+	DmapRecord *record = NULL;
+
+	if (id == DMAP_DB_ID_BAD || id > memory_db->priv->rows) {
+		goto done;
+	}
+
+	record = DMAP_RECORD (dmap_memory_av_record_new_view (memory_db, id));
+
+done:
+	return record;
+}
+
+static guint
+_lookup_id_by_location (const DmapDb * db, const gchar * location)
+{
+	return GPOINTER_TO_UINT (g_hash_table_lookup
+	                         (DMAP_MEMORY_DB (db)->priv->locations,
+	                          location));
+}
+
+static void
+_foreach (const DmapDb * db, DmapIdRecordFunc func, gpointer data)
+{
+	DmapMemoryDb *memory_db = DMAP_MEMORY_DB (db);
+	guint id;
+
+	for (id = 1; id <= memory_db->priv->rows; id++) {
+		DmapMemoryAvRecord *view;
+
+		/* A view of its own, since func may keep it, or hand it to
+		 * another thread. */
+		view = dmap_memory_av_record_new_view (memory_db, id);
+		func (id, DMAP_RECORD (view), data);
+		g_object_unref (view);
+	}
+}
+
+static gint64
+_count (const DmapDb * db)
+{
+	return DMAP_MEMORY_DB (db)->priv->rows;
+}
+
+static GArray *
+_lookup_ids (const DmapDb * db, const gchar * property, const gchar * value)
+{
+	return dmap_db_index_lookup (DMAP_MEMORY_DB (db)->priv->index,
+	                             property, value);
+}
+
+static GPtrArray *
+_lookup_values (const DmapDb * db, const gchar * property, GHashTable * ids)
+{
+	return dmap_db_facets_lookup (DMAP_MEMORY_DB (db)->priv->facets,
+	                              property, ids);
+}
+
+static GArray *
+_lookup_groups (const DmapDb * db, DmapDbGroupType type, GHashTable * ids)
+{
+	return dmap_db_groups_lookup (DMAP_MEMORY_DB (db)->priv->groups,
+	                              type, ids);
+}
+
+/* Reads touch nothing but the columns, and strings are interned, so
+ * they may overlap as long as nothing writes. */
+static gboolean
+_is_thread_safe (G_GNUC_UNUSED const DmapDb * db)
+{
+	return TRUE;
+}
+
+static void
+_dmap_db_iface_init (gpointer iface)
+{
+	DmapDbInterface *dmap_db = iface;
+
+	g_assert (G_TYPE_FROM_INTERFACE (dmap_db) == DMAP_TYPE_DB);
+
+	dmap_db->add = _add;
+	dmap_db->add_with_id = _add_with_id;
+	dmap_db->lookup_by_id = _lookup_by_id;
+	dmap_db->lookup_id_by_location = _lookup_id_by_location;
+	dmap_db->foreach = _foreach;
+	dmap_db->count = _count;
+	dmap_db->lookup_ids = _lookup_ids;
+	dmap_db->is_thread_safe = _is_thread_safe;
+	dmap_db->lookup_values = _lookup_values;
+	dmap_db->lookup_groups = _lookup_groups;
+}
+
+static void
+dmap_memory_db_init (DmapMemoryDb * db)
+{
+	guint column;
+
+	db->priv = dmap_memory_db_get_instance_private (db);
+
+	for (column = 0; column < N_COLUMNS; column++) {
+		guint i;
+
+		if (COLUMN_HASH != _columns[column].kind) {
+			db->priv->columns[column] = g_array_new
+				(FALSE, TRUE,
+				 _column_element_size (_columns[column].kind));
+		}
+
+		for (i = 0; _indexed[i] != NULL; i++) {
+			if (0 == strcmp (_indexed[i], _columns[column].property)) {
+				db->priv->indexed[column] = TRUE;
+			}
+		}
+
+		for (i = 0; _grouped[i] != NULL; i++) {
+			if (0 == strcmp (_grouped[i], _columns[column].property)) {
+				db->priv->grouped[column] = TRUE;
+			}
+		}
+	}
+
+	db->priv->hashes = g_hash_table_new_full (g_direct_hash,
+	                                          g_direct_equal, NULL,
+	                                          (GDestroyNotify) g_array_unref);
+	db->priv->locations = g_hash_table_new (g_str_hash, g_str_equal);
+	db->priv->index = dmap_db_index_new (_indexed);
+	db->priv->facets = dmap_db_facets_new (_faceted);
+	db->priv->groups = dmap_db_groups_new ();
+}
+
+static void
+_finalize (GObject * object)
+{
+	DmapMemoryDb *db = DMAP_MEMORY_DB (object);
+	guint column, row;
+
+	for (column = 0; column < N_COLUMNS; column++) {
+		if (_columns[column].kind == COLUMN_STRING) {
+			for (row = 0; row < db->priv->rows; row++) {
+				dmap_utils_intern_unref (g_array_index
+					(db->priv->columns[column],
+					 const gchar *, row));
+			}
+		}
+		if (db->priv->columns[column]) {
+			g_array_unref (db->priv->columns[column]);
+		}
+	}
+
+	g_hash_table_destroy (db->priv->hashes);
+	g_hash_table_destroy (db->priv->locations);
+	dmap_db_index_free (db->priv->index);
+	dmap_db_facets_free (db->priv->facets);
+	dmap_db_groups_free (db->priv->groups);
+
+	G_OBJECT_CLASS (dmap_memory_db_parent_class)->finalize (object);
+}
+
+static void
+dmap_memory_db_class_init (DmapMemoryDbClass * klass)
+{
+	GObjectClass *object_class = G_OBJECT_CLASS (klass);
+	gpointer iface;
+	guint column;
+
+	object_class->finalize = _finalize;
+
+	iface = g_type_default_interface_ref (DMAP_TYPE_AV_RECORD);
+	for (column = 0; column < N_COLUMNS; column++) {
+		_pspecs[column] = g_object_interface_find_property
+			(iface, _columns[column].property);
+		g_assert (_pspecs[column] != NULL);
+	}
+	/* Kept, so that _pspecs remain valid. */
+}
+
+DmapMemoryDb *
+dmap_memory_db_new (void)
+{
+	return DMAP_MEMORY_DB (g_object_new (DMAP_TYPE_MEMORY_DB, NULL));
+}
+
+#ifdef HAVE_CHECK
+
+#include <check.h>
+#include <libdmapsharing/test-dmap-av-record.h>
+
+static DmapMemoryDb *
+_build_db_test (guint num_records)
+{
+	DmapMemoryDb *db;
+	guint i;
+
+	db = dmap_memory_db_new ();
+
+	for (i = 0; i < num_records; i++) {
+		DmapRecord *record;
+		gchar *title, *location;
+
+		title = g_strdup_printf ("title%u", i);
+		location = g_strdup_printf ("file:///%u.mp3", i);
+
+		record = DMAP_RECORD (test_dmap_av_record_new ());
+		g_object_set (record, "title", title,
+		                      "location", location,
+		                      "songgenre", i % 2 ? "genre1" : "genre2",
+		                      "songartist", "artist1",
+		                      "track", i + 1, NULL);
+
+		ck_assert_int_eq (i + 1, dmap_db_add (DMAP_DB (db), record, NULL));
+
+		g_object_unref (record);
+		g_free (title);
+		g_free (location);
+	}
+
+	return db;
+}
+
+START_TEST(_add_lookup_test)
+{
+	DmapMemoryDb *db;
+	DmapRecord *record;
+	gchar *title = NULL, *artist = NULL, *format = NULL;
+	gint track = 0;
+
+	db = _build_db_test (3);
+	ck_assert_int_eq (3, dmap_db_count (DMAP_DB (db)));
+
+	record = dmap_db_lookup_by_id (DMAP_DB (db), 2);
+	ck_assert (DMAP_IS_AV_RECORD (record));
+
+	g_object_get (record, "title", &title,
+	                      "songartist", &artist,
+	                      "format", &format,
+	                      "track", &track, NULL);
+	ck_assert_str_eq ("title1", title);
+	ck_assert_str_eq ("artist1", artist);
+	ck_assert_str_eq ("mp3", format);
+	ck_assert_int_eq (2, track);
+	ck_assert (dmap_av_record_itunes_compat (DMAP_AV_RECORD (record)));
+
+	ck_assert (NULL == dmap_db_lookup_by_id (DMAP_DB (db), 4));
+	ck_assert_int_eq (3, dmap_db_lookup_id_by_location (DMAP_DB (db), "file:///2.mp3"));
+	ck_assert (dmap_db_is_thread_safe (DMAP_DB (db)));
+
+	g_object_unref (record);
+	g_free (title);
+	g_free (artist);
+	g_free (format);
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_strings_shared_test)
+{
+	DmapMemoryDb *db;
+	GArray *artists;
+	const gchar *interned;
+
+	db = _build_db_test (10);
+
+	/* Ten records, but one artist. */
+	artists = db->priv->columns[4];
+	ck_assert_str_eq ("songartist", _columns[4].property);
+	ck_assert (g_array_index (artists, const gchar *, 0)
+	        == g_array_index (artists, const gchar *, 9));
+	interned = dmap_utils_intern_ref ("artist1");
+	ck_assert_ptr_eq (interned, g_array_index (artists, const gchar *, 0));
+	dmap_utils_intern_unref (interned);
+
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_set_through_view_test)
+{
+	DmapMemoryDb *db;
+	DmapRecord *record;
+	GArray *ids;
+	gchar *genre = NULL;
+	const gchar *interned;
+
+	db = _build_db_test (4);
+
+	record = dmap_db_lookup_by_id (DMAP_DB (db), 1);
+	g_object_set (record, "songgenre", "genre3", "location", "file:///x.mp3", NULL);
+	g_object_unref (record);
+
+	/* Another view sees the change, as does the index. */
+	record = dmap_db_lookup_by_id (DMAP_DB (db), 1);
+	g_object_get (record, "songgenre", &genre, NULL);
+	ck_assert_str_eq ("genre3", genre);
+	g_object_unref (record);
+
+	ids = dmap_db_lookup_ids (DMAP_DB (db), "songgenre", "genre3");
+	ck_assert_int_eq (1, ids->len);
+	ck_assert_int_eq (1, g_array_index (ids, guint, 0));
+	g_array_unref (ids);
+
+	ids = dmap_db_lookup_ids (DMAP_DB (db), "songgenre", "genre2");
+	ck_assert_int_eq (1, ids->len);
+	g_array_unref (ids);
+
+	ck_assert_int_eq (1, dmap_db_lookup_id_by_location (DMAP_DB (db), "file:///x.mp3"));
+	ck_assert_int_eq (0, dmap_db_lookup_id_by_location (DMAP_DB (db), "file:///0.mp3"));
+
+	/* The cell now refers to the interned new genre. */
+	ck_assert_str_eq ("songgenre", _columns[6].property);
+	interned = dmap_utils_intern_ref ("genre3");
+	ck_assert_ptr_eq (interned, g_array_index (db->priv->columns[6],
+	                                           const gchar *, 0));
+	dmap_utils_intern_unref (interned);
+
+	g_free (genre);
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_fields_test)
+{
+	DmapMemoryDb *db;
+	DmapRecord *record;
+	DmapAvRecordFields fields;
+	GArray *ids;
+	gchar *genre = NULL;
+
+	db = _build_db_test (4);
+
+	record = dmap_db_lookup_by_id (DMAP_DB (db), 2);
+	dmap_av_record_get_fields (DMAP_AV_RECORD (record), &fields);
+
+	/* The cells themselves, not copies. */
+	ck_assert_str_eq ("title1", fields.title);
+	ck_assert_ptr_eq (g_array_index (db->priv->columns[4],
+	                                 const gchar *, 1), fields.songartist);
+	ck_assert_int_eq (2, fields.track);
+
+	fields.songgenre = "genre3";
+	fields.location = "file:///y.mp3";
+	dmap_av_record_set_fields (DMAP_AV_RECORD (record), &fields);
+	dmap_av_record_fields_clear (&fields);
+	g_object_unref (record);
+
+	record = dmap_db_lookup_by_id (DMAP_DB (db), 2);
+	g_object_get (record, "songgenre", &genre, NULL);
+	ck_assert_str_eq ("genre3", genre);
+	g_object_unref (record);
+
+	ids = dmap_db_lookup_ids (DMAP_DB (db), "songgenre", "genre3");
+	ck_assert_int_eq (1, ids->len);
+	ck_assert_int_eq (2, g_array_index (ids, guint, 0));
+	g_array_unref (ids);
+
+	ck_assert_int_eq (2, dmap_db_lookup_id_by_location (DMAP_DB (db), "file:///y.mp3"));
+	ck_assert_int_eq (0, dmap_db_lookup_id_by_location (DMAP_DB (db), "file:///1.mp3"));
+
+	g_free (genre);
+	g_object_unref (db);
+}
+END_TEST
+
+/* Swaps the title and album of record, and sorts it by its old title,
+ * all from strings the record itself holds. */
+static void
+_swap_fields_test (DmapRecord * record)
+{
+	DmapAvRecordFields fields;
+	const gchar *title;
+	gchar *new_title = NULL, *album = NULL, *sort_album = NULL;
+
+	dmap_av_record_get_fields (DMAP_AV_RECORD (record), &fields);
+	title = fields.title;
+	fields.title = fields.songalbum;
+	fields.songalbum = title;
+	fields.sort_album = title;
+	dmap_av_record_set_fields (DMAP_AV_RECORD (record), &fields);
+	dmap_av_record_fields_clear (&fields);
+
+	g_object_get (record, "title", &new_title, "songalbum", &album,
+	              "sort-album", &sort_album, NULL);
+	ck_assert_str_eq ("album1", new_title);
+	ck_assert_str_eq ("swapped", album);
+	ck_assert_str_eq ("swapped", sort_album);
+
+	g_free (new_title);
+	g_free (album);
+	g_free (sort_album);
+}
+
+START_TEST(_set_fields_own_strings_test)
+{
+	DmapMemoryDb *db;
+	DmapMemoryAvRecord *record;
+	DmapRecord *view;
+	guint id;
+
+	db = dmap_memory_db_new ();
+
+	record = dmap_memory_av_record_new ();
+	g_object_set (record, "title", "swapped", "songalbum", "album1", NULL);
+	_swap_fields_test (DMAP_RECORD (record));
+	g_object_set (record, "title", "swapped", "songalbum", "album1", NULL);
+
+	id = dmap_db_add (DMAP_DB (db), DMAP_RECORD (record), NULL);
+	g_object_unref (record);
+
+	/* The row holds the only reference to "swapped". */
+	view = dmap_db_lookup_by_id (DMAP_DB (db), id);
+	_swap_fields_test (view);
+	g_object_unref (view);
+
+	g_object_unref (db);
+}
+END_TEST
+
+static void
+_keep_record (guint id, DmapRecord * record, GHashTable * kept)
+{
+	if (id % 2) {
+		g_hash_table_insert (kept, GUINT_TO_POINTER (id),
+		                     g_object_ref (record));
+	}
+}
+
+START_TEST(_lookup_values_test)
+{
+	DmapMemoryDb *db;
+	DmapRecord *record;
+	GPtrArray *values;
+
+	db = _build_db_test (3);
+
+	values = dmap_db_lookup_values (DMAP_DB (db), "songgenre", NULL);
+	ck_assert_int_eq (2, values->len);
+	ck_assert_str_eq ("genre1", g_ptr_array_index (values, 0));
+	ck_assert_str_eq ("genre2", g_ptr_array_index (values, 1));
+	g_ptr_array_unref (values);
+
+	/* Kept up to date as records change. */
+	record = dmap_db_lookup_by_id (DMAP_DB (db), 2);
+	g_object_set (record, "songgenre", "genre0", NULL);
+	values = dmap_db_lookup_values (DMAP_DB (db), "songgenre", NULL);
+	ck_assert_int_eq (2, values->len);
+	ck_assert_str_eq ("genre0", g_ptr_array_index (values, 0));
+	ck_assert_str_eq ("genre2", g_ptr_array_index (values, 1));
+	g_ptr_array_unref (values);
+
+	g_object_unref (record);
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_lookup_groups_test)
+{
+	DmapMemoryDb *db;
+	DmapRecord *record;
+	GArray *groups;
+
+	db = _build_db_test (3);
+
+	groups = dmap_db_lookup_groups (DMAP_DB (db), DMAP_DB_GROUP_ARTISTS,
+	                                NULL);
+	ck_assert_int_eq (1, groups->len);
+	ck_assert_str_eq ("artist1", g_array_index (groups, DmapDbGroup, 0).name);
+	ck_assert_int_eq (3, g_array_index (groups, DmapDbGroup, 0).count);
+	g_array_unref (groups);
+
+	/* Kept up to date as records change. */
+	record = dmap_db_lookup_by_id (DMAP_DB (db), 2);
+	g_object_set (record, "songartist", "artist0", "songalbum", "album0",
+	              NULL);
+
+	groups = dmap_db_lookup_groups (DMAP_DB (db), DMAP_DB_GROUP_ARTISTS,
+	                                NULL);
+	ck_assert_int_eq (2, groups->len);
+	ck_assert_str_eq ("artist0", g_array_index (groups, DmapDbGroup, 0).name);
+	ck_assert_int_eq (1, g_array_index (groups, DmapDbGroup, 0).count);
+	ck_assert_int_eq (1, g_array_index (groups, DmapDbGroup, 0).album_count);
+	ck_assert_int_eq (2, g_array_index (groups, DmapDbGroup, 1).count);
+	g_array_unref (groups);
+
+	groups = dmap_db_lookup_groups (DMAP_DB (db), DMAP_DB_GROUP_ALBUMS,
+	                                NULL);
+	ck_assert_int_eq (1, groups->len);
+	ck_assert_str_eq ("album0", g_array_index (groups, DmapDbGroup, 0).name);
+	ck_assert_str_eq ("artist0", g_array_index (groups, DmapDbGroup, 0).artist);
+	g_array_unref (groups);
+
+	g_object_unref (record);
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_foreach_test)
+{
+	DmapMemoryDb *db;
+	GHashTable *kept;
+	guint id;
+
+	db = _build_db_test (6);
+	kept = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+	                              g_object_unref);
+
+	dmap_db_foreach (DMAP_DB (db), (DmapIdRecordFunc) _keep_record, kept);
+	ck_assert_int_eq (3, g_hash_table_size (kept));
+
+	/* A view kept by the callback still shows its own record. */
+	for (id = 1; id <= 6; id += 2) {
+		DmapRecord *record;
+		gint track = 0;
+
+		record = g_hash_table_lookup (kept, GUINT_TO_POINTER (id));
+		g_object_get (record, "track", &track, NULL);
+		ck_assert_int_eq (id, track);
+	}
+
+	g_hash_table_destroy (kept);
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_apply_filter_test)
+{
+	DmapMemoryDb *db;
+	GSList *filter = NULL, *group = NULL;
+	DmapDbFilterDefinition def = { "daap.songgenre", "genre1", FALSE };
+	GHashTable *result;
+
+	db = _build_db_test (10);
+
+	group = g_slist_append (group, &def);
+	filter = g_slist_append (filter, group);
+
+	result = dmap_db_apply_filter (DMAP_DB (db), filter);
+	ck_assert_int_eq (5, g_hash_table_size (result));
+
+	g_hash_table_destroy (result);
+	g_slist_free (group);
+	g_slist_free (filter);
+	g_object_unref (db);
+}
+END_TEST
+
+START_TEST(_add_detached_test)
+{
+	DmapMemoryDb *db;
+	DmapMemoryAvRecord *record;
+	DmapRecord *view;
+	DmapAvRecordFields fields;
+	gchar *title = NULL, *album = NULL, *artist = NULL;
+	gint year = 0;
+	guint id;
+	GError *error = NULL;
+
+	db = dmap_memory_db_new ();
+
+	record = dmap_memory_av_record_new ();
+	g_object_set (record, "title", "detached", "year", 1999, NULL);
+
+	/* The record keeps copies of the strings it is given. */
+	dmap_av_record_get_fields (DMAP_AV_RECORD (record), &fields);
+	artist = g_strdup ("artist1");
+	fields.songartist = artist;
+	dmap_av_record_set_fields (DMAP_AV_RECORD (record), &fields);
+	dmap_av_record_fields_clear (&fields);
+	g_free (artist);
+
+	id = dmap_db_add (DMAP_DB (db), DMAP_RECORD (record), NULL);
+	g_object_unref (record);
+
+	view = dmap_db_lookup_by_id (DMAP_DB (db), id);
+	g_object_get (view, "title", &title, "songalbum", &album,
+	              "songartist", &artist, "year", &year, NULL);
+	ck_assert_str_eq ("detached", title);
+	ck_assert_str_eq ("Unknown", album);
+	ck_assert_str_eq ("artist1", artist);
+	ck_assert_int_eq (1999, year);
+
+	ck_assert_int_eq (DMAP_DB_ID_BAD, dmap_db_add_with_id (DMAP_DB (db), view, 7, &error));
+	ck_assert_int_eq (DMAP_STATUS_DB_BAD_ID, error->code);
+	g_object_unref (view);
+
+	g_clear_error (&error);
+	g_free (title);
+	g_free (album);
+	g_free (artist);
+	g_object_unref (db);
+}
+END_TEST
+
+#include "dmap-memory-db-suite.c"
+
+#endif
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DMAP_MEMORY_DB_H
+#define _DMAP_MEMORY_DB_H
+
+#include <glib-object.h>
+
+#include <libdmapsharing/dmap-db.h>
+
+G_BEGIN_DECLS
+/**
+ * SECTION: dmap-memory-db
+ * @short_description: An in-memory media database.
+ *
+ * #DmapMemoryDb is a ready-made #DmapDb for DAAP records. Rather than
+ * keeping an object per record, it stores each field in a column array,
+ * and interns strings with dmap_utils_intern_ref(), so that a library of
+ * many tracks by few artists costs little heap. Looking up a record
+ * returns a #DmapMemoryAvRecord which reads and writes the database's
+ * columns; the view holds no fields of its own.
+ *
+ * Any #DmapAvRecord may be added; its fields are copied into the
+ * columns.
+ */
+
+/**
+ * DMAP_TYPE_MEMORY_DB:
+ *
+ * The type for #DmapMemoryDb.
+ */
+#define DMAP_TYPE_MEMORY_DB         (dmap_memory_db_get_type ())
+/**
+ * DMAP_MEMORY_DB:
+ * @o: Object which is subject to casting.
+ *
+ * Casts a #DmapMemoryDb or derived pointer into a (DmapMemoryDb *) pointer.
+ * Depending on the current debugging level, this function may invoke
+ * certain runtime checks to identify invalid casts.
+ */
+#define DMAP_MEMORY_DB(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), \
+				     DMAP_TYPE_MEMORY_DB, DmapMemoryDb))
+/**
+ * DMAP_MEMORY_DB_CLASS:
+ * @k: a valid #DmapMemoryDbClass
+ *
+ * Casts a derived #DmapMemoryDbClass structure into a #DmapMemoryDbClass
+ * structure.
+ */
+#define DMAP_MEMORY_DB_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST ((k), \
+				     DMAP_TYPE_MEMORY_DB, DmapMemoryDbClass))
+/**
+ * DMAP_IS_MEMORY_DB:
+ * @o: Instance to check for being a %DMAP_TYPE_MEMORY_DB.
+ *
+ * Checks whether a valid #GTypeInstance pointer is of type %DMAP_TYPE_MEMORY_DB.
+ */
+#define DMAP_IS_MEMORY_DB(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), \
+				     DMAP_TYPE_MEMORY_DB))
+/**
+ * DMAP_IS_MEMORY_DB_CLASS:
+ * @k: a #DmapMemoryDbClass
+ *
+ * Checks whether @k "is a" valid #DmapMemoryDbClass structure of type
+ * %DMAP_MEMORY_DB or derived.
+ */
+#define DMAP_IS_MEMORY_DB_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), \
+				     DMAP_TYPE_MEMORY_DB))
+/**
+ * DMAP_MEMORY_DB_GET_CLASS:
+ * @o: a #DmapMemoryDb instance.
+ *
+ * Get the class structure associated to a #DmapMemoryDb instance.
+ *
+ * Returns: pointer to object class structure.
+ */
+#define DMAP_MEMORY_DB_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), \
+				     DMAP_TYPE_MEMORY_DB, DmapMemoryDbClass))
+
+typedef struct DmapMemoryDbPrivate DmapMemoryDbPrivate;
+
+typedef struct {
+	GObject parent;
+	DmapMemoryDbPrivate *priv;
+} DmapMemoryDb;
+
+typedef struct {
+	GObjectClass parent;
+} DmapMemoryDbClass;
+
+GType dmap_memory_db_get_type (void);
+
+/**
+ * dmap_memory_db_new:
+ *
+ * Creates an empty in-memory media database.
+ *
+ * Returns: a pointer to a DmapMemoryDb.
+ */
+DmapMemoryDb *dmap_memory_db_new (void);
+
+#endif /* _DMAP_MEMORY_DB_H */
+
+G_END_DECLS
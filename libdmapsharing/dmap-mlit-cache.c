@@ -0,0 +1,308 @@
+/*
+ * Cache of serialized MLIT's
+ *
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include <string.h>
+
+#include "dmap-mlit-cache.h"
+
+/* Approximate cost of an entry beyond its bytes: hash node and GBytes. */
+#define DMAP_MLIT_CACHE_ENTRY_OVERHEAD 64
+
+typedef struct {
+	DmapBits bits;
+	/* Record ID -> GBytes holding its MLIT. */
+	GHashTable *mlits;
+	gsize size;
+	guint64 last_used;
+} MaskCache;
+
+struct DmapMlitCache {
+	gsize budget;
+	gsize size;
+	guint revision;
+	guint64 clock;
+	/* DmapBits -> MaskCache. */
+	GHashTable *masks;
+};
+
+static void
+_mask_cache_free (MaskCache * mask)
+{
+	g_hash_table_destroy (mask->mlits);
+	g_free (mask);
+}
+
+DmapMlitCache *
+dmap_mlit_cache_new (gsize budget)
+{
+	DmapMlitCache *cache;
+
+	cache = g_new0 (DmapMlitCache, 1);
+	cache->budget = budget;
+	cache->masks = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+	                                      NULL,
+	                                      (GDestroyNotify) _mask_cache_free);
+
+	return cache;
+}
+
+void
+dmap_mlit_cache_free (DmapMlitCache * cache)
+{
+	if (cache) {
+		g_hash_table_destroy (cache->masks);
+		g_free (cache);
+	}
+}
+
+static void
+_clear (DmapMlitCache * cache)
+{
+	g_hash_table_remove_all (cache->masks);
+	cache->size = 0;
+}
+
+static void
+_check_revision (DmapMlitCache * cache, guint revision)
+{
+	if (revision != cache->revision) {
+		_clear (cache);
+		cache->revision = revision;
+	}
+}
+
+/* Drops the least recently used mask other than keep; returns FALSE if
+ * there was none. */
+static gboolean
+_evict (DmapMlitCache * cache, DmapBits keep)
+{
+	GHashTableIter iter;
+	MaskCache *mask, *oldest = NULL;
+
+	g_hash_table_iter_init (&iter, cache->masks);
+	while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &mask)) {
+		if (mask->bits != keep
+		 && (oldest == NULL || mask->last_used < oldest->last_used)) {
+			oldest = mask;
+		}
+	}
+
+	if (oldest != NULL) {
+		cache->size -= oldest->size;
+		g_hash_table_remove (cache->masks, &oldest->bits);
+	}
+
+	return oldest != NULL;
+}
+
+void
+dmap_mlit_cache_set_budget (DmapMlitCache * cache, gsize budget)
+{
+	cache->budget = budget;
+
+	while (cache->size > cache->budget && _evict (cache, 0)) {
+		;
+	}
+
+	if (cache->size > cache->budget) {
+		_clear (cache);
+	}
+}
+
+gsize
+dmap_mlit_cache_get_budget (DmapMlitCache * cache)
+{
+	return cache->budget;
+}
+
+gsize
+dmap_mlit_cache_get_size (DmapMlitCache * cache)
+{
+	return cache->size;
+}
+
+gboolean
+dmap_mlit_cache_lookup (DmapMlitCache * cache, guint revision, DmapBits bits,
+                        guint id, const guint8 ** data, gsize * length)
+{
+	gboolean found = FALSE;
+	MaskCache *mask;
+	GBytes *bytes;
+
+	_check_revision (cache, revision);
+
+	mask = g_hash_table_lookup (cache->masks, &bits);
+	if (mask == NULL) {
+		goto done;
+	}
+
+	mask->last_used = ++cache->clock;
+
+	bytes = g_hash_table_lookup (mask->mlits, GUINT_TO_POINTER (id));
+	if (bytes == NULL) {
+		goto done;
+	}
+
+	*data = g_bytes_get_data (bytes, length);
+	found = TRUE;
+
+done:
+	return found;
+}
+
+void
+dmap_mlit_cache_insert (DmapMlitCache * cache, guint revision, DmapBits bits,
+                        guint id, const guint8 * data, gsize length)
+{
+	MaskCache *mask;
+	gsize cost = length + DMAP_MLIT_CACHE_ENTRY_OVERHEAD;
+
+	_check_revision (cache, revision);
+
+	if (cost > cache->budget) {
+		goto done;
+	}
+
+	while (cache->size + cost > cache->budget && _evict (cache, bits)) {
+		;
+	}
+
+	if (cache->size + cost > cache->budget) {
+		/* This mask alone fills the budget. */
+		goto done;
+	}
+
+	mask = g_hash_table_lookup (cache->masks, &bits);
+	if (mask == NULL) {
+		mask = g_new0 (MaskCache, 1);
+		mask->bits = bits;
+		mask->mlits = g_hash_table_new_full (g_direct_hash,
+		                                     g_direct_equal, NULL,
+		                                     (GDestroyNotify) g_bytes_unref);
+		g_hash_table_insert (cache->masks, &mask->bits, mask);
+	}
+
+	mask->last_used = ++cache->clock;
+
+	if (g_hash_table_contains (mask->mlits, GUINT_TO_POINTER (id))) {
+		goto done;
+	}
+
+	g_hash_table_insert (mask->mlits, GUINT_TO_POINTER (id),
+	                     g_bytes_new (data, length));
+	mask->size += cost;
+	cache->size += cost;
+
+done:
+	return;
+}
+
+#ifdef HAVE_CHECK
+
+#include <check.h>
+
+START_TEST(_lookup_test)
+{
+	DmapMlitCache *cache;
+	const guint8 *data = NULL;
+	gsize length = 0;
+
+	cache = dmap_mlit_cache_new (1024);
+
+	ck_assert (!dmap_mlit_cache_lookup (cache, 1, 0x3, 7, &data, &length));
+
+	dmap_mlit_cache_insert (cache, 1, 0x3, 7, (guint8 *) "mlit", 4);
+
+	ck_assert (dmap_mlit_cache_lookup (cache, 1, 0x3, 7, &data, &length));
+	ck_assert_int_eq (4, length);
+	ck_assert (0 == memcmp ("mlit", data, 4));
+
+	/* Another mask is another entry. */
+	ck_assert (!dmap_mlit_cache_lookup (cache, 1, 0x1, 7, &data, &length));
+
+	dmap_mlit_cache_free (cache);
+}
+END_TEST
+
+START_TEST(_revision_test)
+{
+	DmapMlitCache *cache;
+	const guint8 *data;
+	gsize length;
+
+	cache = dmap_mlit_cache_new (1024);
+
+	dmap_mlit_cache_insert (cache, 1, 0x3, 7, (guint8 *) "mlit", 4);
+	ck_assert (!dmap_mlit_cache_lookup (cache, 2, 0x3, 7, &data, &length));
+	ck_assert_int_eq (0, dmap_mlit_cache_get_size (cache));
+
+	dmap_mlit_cache_free (cache);
+}
+END_TEST
+
+START_TEST(_budget_test)
+{
+	DmapMlitCache *cache;
+	const guint8 *data;
+	gsize length;
+	guint8 mlit[100] = { 0 };
+
+	/* Room for two entries. */
+	cache = dmap_mlit_cache_new (2 * (sizeof mlit + DMAP_MLIT_CACHE_ENTRY_OVERHEAD));
+
+	dmap_mlit_cache_insert (cache, 1, 0x1, 1, mlit, sizeof mlit);
+	dmap_mlit_cache_insert (cache, 1, 0x2, 1, mlit, sizeof mlit);
+
+	/* Mask 0x1 is now the least recently used, so it makes room. */
+	dmap_mlit_cache_insert (cache, 1, 0x2, 2, mlit, sizeof mlit);
+	ck_assert (!dmap_mlit_cache_lookup (cache, 1, 0x1, 1, &data, &length));
+	ck_assert (dmap_mlit_cache_lookup (cache, 1, 0x2, 1, &data, &length));
+	ck_assert (dmap_mlit_cache_lookup (cache, 1, 0x2, 2, &data, &length));
+
+	/* Mask 0x2 fills the budget alone, so further entries are dropped. */
+	dmap_mlit_cache_insert (cache, 1, 0x2, 3, mlit, sizeof mlit);
+	ck_assert (!dmap_mlit_cache_lookup (cache, 1, 0x2, 3, &data, &length));
+	ck_assert (dmap_mlit_cache_get_size (cache)
+	        <= dmap_mlit_cache_get_budget (cache));
+
+	dmap_mlit_cache_free (cache);
+}
+END_TEST
+
+START_TEST(_disabled_test)
+{
+	DmapMlitCache *cache;
+	const guint8 *data;
+	gsize length;
+
+	cache = dmap_mlit_cache_new (0);
+
+	dmap_mlit_cache_insert (cache, 1, 0x3, 7, (guint8 *) "mlit", 4);
+	ck_assert (!dmap_mlit_cache_lookup (cache, 1, 0x3, 7, &data, &length));
+
+	dmap_mlit_cache_free (cache);
+}
+END_TEST
+
+#include "dmap-mlit-cache-suite.c"
+
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Cache of serialized MLIT's
+ *
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DMAP_MLIT_CACHE_H
+#define _DMAP_MLIT_CACHE_H
+
+#include <glib.h>
+
+#include <libdmapsharing/dmap-share.h>
+
+G_BEGIN_DECLS
+
+/* A DmapMlitCache keeps the wire format of each record's MLIT, as
+ * add_entry_to_mlcl wrote it, for each meta mask that clients request.
+ * Everything cached belongs to one revision of the share: a lookup or
+ * insert with another revision first empties the cache. The cache never
+ * holds more than its budget; when full, the meta mask used least
+ * recently is dropped as a whole. A budget of 0 disables the cache. */
+typedef struct DmapMlitCache DmapMlitCache;
+
+DmapMlitCache *dmap_mlit_cache_new (gsize budget);
+void dmap_mlit_cache_free (DmapMlitCache * cache);
+
+void dmap_mlit_cache_set_budget (DmapMlitCache * cache, gsize budget);
+gsize dmap_mlit_cache_get_budget (DmapMlitCache * cache);
+gsize dmap_mlit_cache_get_size (DmapMlitCache * cache);
+
+/* Returns TRUE and sets data and length if the MLIT of id is cached for
+ * bits; data remains valid until the next call to insert. */
+gboolean dmap_mlit_cache_lookup (DmapMlitCache * cache, guint revision,
+                                 DmapBits bits, guint id,
+                                 const guint8 ** data, gsize * length);
+void dmap_mlit_cache_insert (DmapMlitCache * cache, guint revision,
+                             DmapBits bits, guint id,
+                             const guint8 * data, gsize length);
+
+G_END_DECLS
+#endif
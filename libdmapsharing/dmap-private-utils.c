@@ -62,3 +62,76 @@ dmap_private_utils_chunked_message_finished (G_GNUC_UNUSED SoupServerMessage * m
 
 	g_free (cd);
 }
+
+/* Runs length bytes of data through converter, returning all of the
+ * output that it gives back. With G_CONVERTER_FLUSH or
+ * G_CONVERTER_INPUT_AT_END in flags, this includes everything the
+ * converter was holding back. */
+GBytes *
+dmap_private_utils_convert (GConverter * converter, gconstpointer data,
+                            gsize length, GConverterFlags flags,
+                            GError ** error)
+{
+	GByteArray *out;
+	const guint8 *in = data;
+	gsize room = MAX (length, DMAP_SHARE_CHUNK_SIZE);
+	GBytes *bytes = NULL;
+
+	out = g_byte_array_new ();
+
+	for (;;) {
+		GConverterResult result;
+		gsize nread = 0, nwritten = 0;
+		guint used = out->len;
+		GError *convert_error = NULL;
+
+		g_byte_array_set_size (out, used + room);
+		result = g_converter_convert (converter, in, length,
+		                              out->data + used, room, flags,
+		                              &nread, &nwritten,
+		                              &convert_error);
+		g_byte_array_set_size (out, used + nwritten);
+
+		if (G_CONVERTER_ERROR == result) {
+			/* Having filled the output exactly, nothing was left. */
+			if (0 == length && 0 == (flags & (G_CONVERTER_FLUSH
+			                                | G_CONVERTER_INPUT_AT_END))
+			 && (g_error_matches (convert_error, G_IO_ERROR,
+			                      G_IO_ERROR_NO_SPACE)
+			  || g_error_matches (convert_error, G_IO_ERROR,
+			                      G_IO_ERROR_PARTIAL_INPUT))) {
+				g_error_free (convert_error);
+				break;
+			}
+			if (g_error_matches (convert_error, G_IO_ERROR,
+			                     G_IO_ERROR_NO_SPACE)) {
+				g_error_free (convert_error);
+				room *= 2;
+				continue;
+			}
+			g_propagate_error (error, convert_error);
+			g_byte_array_unref (out);
+			goto done;
+		}
+
+		in += nread;
+		length -= nread;
+
+		if (G_CONVERTER_FINISHED == result
+		 || G_CONVERTER_FLUSHED == result) {
+			break;
+		}
+
+		/* Without a flush, stop once the input is used up and the
+		 * converter had output space to spare. */
+		if (0 == (flags & (G_CONVERTER_FLUSH | G_CONVERTER_INPUT_AT_END))
+		 && 0 == length && nwritten < room) {
+			break;
+		}
+	}
+
+	bytes = g_byte_array_free_to_bytes (out);
+
+done:
+	return bytes;
+}
@@ -68,5 +68,11 @@ G_BEGIN_DECLS
 void   dmap_private_utils_write_next_chunk (SoupServerMessage * message, ChunkData * cd);
 void   dmap_private_utils_chunked_message_finished (SoupServerMessage * message, ChunkData * cd);
 
+GBytes *dmap_private_utils_convert (GConverter * converter,
+                                    gconstpointer data,
+                                    gsize length,
+                                    GConverterFlags flags,
+                                    GError ** error);
+
 G_END_DECLS
 #endif
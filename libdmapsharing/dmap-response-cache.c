@@ -0,0 +1,271 @@
+/*
+ * Cache of whole DMAP responses
+ *
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+
+#include "dmap-response-cache.h"
+
+/* Approximate cost of an entry beyond its bytes. */
+#define DMAP_RESPONSE_CACHE_ENTRY_OVERHEAD 256
+
+typedef struct {
+	gchar *key;
+	GPtrArray *parts;
+	gsize size;
+	/* Position in lru. */
+	GList *link;
+} Entry;
+
+struct DmapResponseCache {
+	gsize budget;
+	gsize size;
+	guint revision;
+	/* Key -> Entry. */
+	GHashTable *entries;
+	/* Entries, most recently used first. */
+	GQueue lru;
+};
+
+static void
+_entry_free (Entry * entry)
+{
+	g_free (entry->key);
+	g_ptr_array_unref (entry->parts);
+	g_free (entry);
+}
+
+DmapResponseCache *
+dmap_response_cache_new (gsize budget)
+{
+	DmapResponseCache *cache;
+
+	cache = g_new0 (DmapResponseCache, 1);
+	cache->budget = budget;
+	cache->entries = g_hash_table_new_full (g_str_hash, g_str_equal,
+	                                        NULL,
+	                                        (GDestroyNotify) _entry_free);
+	g_queue_init (&cache->lru);
+
+	return cache;
+}
+
+void
+dmap_response_cache_free (DmapResponseCache * cache)
+{
+	if (cache) {
+		g_queue_clear (&cache->lru);
+		g_hash_table_destroy (cache->entries);
+		g_free (cache);
+	}
+}
+
+static void
+_clear (DmapResponseCache * cache)
+{
+	g_queue_clear (&cache->lru);
+	g_hash_table_remove_all (cache->entries);
+	cache->size = 0;
+}
+
+static void
+_check_revision (DmapResponseCache * cache, guint revision)
+{
+	if (revision != cache->revision) {
+		_clear (cache);
+		cache->revision = revision;
+	}
+}
+
+static void
+_remove (DmapResponseCache * cache, Entry * entry)
+{
+	cache->size -= entry->size;
+	g_queue_delete_link (&cache->lru, entry->link);
+	g_hash_table_remove (cache->entries, entry->key);
+}
+
+static void
+_shrink (DmapResponseCache * cache, gsize size)
+{
+	while (cache->size > size && !g_queue_is_empty (&cache->lru)) {
+		_remove (cache, g_queue_peek_tail (&cache->lru));
+	}
+}
+
+void
+dmap_response_cache_set_budget (DmapResponseCache * cache, gsize budget)
+{
+	cache->budget = budget;
+	_shrink (cache, budget);
+}
+
+gsize
+dmap_response_cache_get_budget (DmapResponseCache * cache)
+{
+	return cache->budget;
+}
+
+gsize
+dmap_response_cache_get_size (DmapResponseCache * cache)
+{
+	return cache->size;
+}
+
+void
+dmap_response_cache_clear (DmapResponseCache * cache)
+{
+	_clear (cache);
+}
+
+GPtrArray *
+dmap_response_cache_lookup (DmapResponseCache * cache, guint revision,
+                            const gchar * key)
+{
+	GPtrArray *parts = NULL;
+	Entry *entry;
+
+	_check_revision (cache, revision);
+
+	entry = g_hash_table_lookup (cache->entries, key);
+	if (entry == NULL) {
+		goto done;
+	}
+
+	g_queue_unlink (&cache->lru, entry->link);
+	g_queue_push_head_link (&cache->lru, entry->link);
+
+	parts = entry->parts;
+
+done:
+	return parts;
+}
+
+void
+dmap_response_cache_insert (DmapResponseCache * cache, guint revision,
+                            const gchar * key, GPtrArray * parts)
+{
+	Entry *entry;
+	gsize size = DMAP_RESPONSE_CACHE_ENTRY_OVERHEAD;
+	guint i;
+
+	_check_revision (cache, revision);
+
+	for (i = 0; i < parts->len; i++) {
+		size += g_bytes_get_size (g_ptr_array_index (parts, i));
+	}
+
+	if (size > cache->budget) {
+		goto done;
+	}
+
+	entry = g_hash_table_lookup (cache->entries, key);
+	if (entry != NULL) {
+		_remove (cache, entry);
+	}
+
+	_shrink (cache, cache->budget - size);
+
+	entry = g_new0 (Entry, 1);
+	entry->key = g_strdup (key);
+	entry->parts = g_ptr_array_ref (parts);
+	entry->size = size;
+
+	g_queue_push_head (&cache->lru, entry);
+	entry->link = g_queue_peek_head_link (&cache->lru);
+	g_hash_table_insert (cache->entries, entry->key, entry);
+	cache->size += size;
+
+done:
+	return;
+}
+
+#ifdef HAVE_CHECK
+
+#include <check.h>
+
+static GPtrArray *
+_parts_test (gsize size)
+{
+	GPtrArray *parts;
+
+	parts = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+	g_ptr_array_add (parts, g_bytes_new_take (g_malloc0 (size), size));
+
+	return parts;
+}
+
+START_TEST(_lookup_test)
+{
+	DmapResponseCache *cache;
+	GPtrArray *parts;
+
+	cache = dmap_response_cache_new (4096);
+
+	ck_assert (NULL == dmap_response_cache_lookup (cache, 1, "/databases"));
+
+	parts = _parts_test (100);
+	dmap_response_cache_insert (cache, 1, "/databases", parts);
+	ck_assert (parts == dmap_response_cache_lookup (cache, 1, "/databases"));
+	g_ptr_array_unref (parts);
+
+	/* A new revision invalidates the response. */
+	ck_assert (NULL == dmap_response_cache_lookup (cache, 2, "/databases"));
+	ck_assert_int_eq (0, dmap_response_cache_get_size (cache));
+
+	dmap_response_cache_free (cache);
+}
+END_TEST
+
+START_TEST(_budget_test)
+{
+	DmapResponseCache *cache;
+	GPtrArray *parts;
+	gsize size = 100 + DMAP_RESPONSE_CACHE_ENTRY_OVERHEAD;
+
+	/* Room for two responses. */
+	cache = dmap_response_cache_new (2 * size);
+
+	parts = _parts_test (100);
+	dmap_response_cache_insert (cache, 1, "a", parts);
+	dmap_response_cache_insert (cache, 1, "b", parts);
+
+	/* Using a makes b the least recently used. */
+	ck_assert (NULL != dmap_response_cache_lookup (cache, 1, "a"));
+	dmap_response_cache_insert (cache, 1, "c", parts);
+
+	ck_assert (NULL != dmap_response_cache_lookup (cache, 1, "a"));
+	ck_assert (NULL == dmap_response_cache_lookup (cache, 1, "b"));
+	ck_assert (NULL != dmap_response_cache_lookup (cache, 1, "c"));
+	ck_assert_int_eq (2 * size, dmap_response_cache_get_size (cache));
+	g_ptr_array_unref (parts);
+
+	/* Too big to cache at all. */
+	parts = _parts_test (2 * size);
+	dmap_response_cache_insert (cache, 1, "d", parts);
+	ck_assert (NULL == dmap_response_cache_lookup (cache, 1, "d"));
+	g_ptr_array_unref (parts);
+
+	dmap_response_cache_free (cache);
+}
+END_TEST
+
+#include "dmap-response-cache-suite.c"
+
+#endif
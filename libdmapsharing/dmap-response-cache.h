@@ -0,0 +1,57 @@
+/*
+ * Cache of whole DMAP responses
+ *
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef _DMAP_RESPONSE_CACHE_H
+#define _DMAP_RESPONSE_CACHE_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* A DmapResponseCache keeps response bodies, each as the array of GBytes
+ * that made it up, under a key naming the request. As with
+ * DmapMlitCache, everything cached belongs to one revision of the share,
+ * and a lookup or insert with another revision first empties the cache.
+ * When the budget is reached, the least recently used responses are
+ * dropped. A budget of 0 disables the cache. */
+typedef struct DmapResponseCache DmapResponseCache;
+
+DmapResponseCache *dmap_response_cache_new (gsize budget);
+void dmap_response_cache_free (DmapResponseCache * cache);
+
+void dmap_response_cache_set_budget (DmapResponseCache * cache, gsize budget);
+gsize dmap_response_cache_get_budget (DmapResponseCache * cache);
+gsize dmap_response_cache_get_size (DmapResponseCache * cache);
+
+/* Drops every response, for when something they hold but which has no
+ * revision of its own changes. */
+void dmap_response_cache_clear (DmapResponseCache * cache);
+
+/* Returns the GBytes making up the body cached under key, or NULL. The
+ * array remains valid until the next call to insert. */
+GPtrArray *dmap_response_cache_lookup (DmapResponseCache * cache,
+                                       guint revision, const gchar * key);
+
+/* Takes a reference to parts, which must not be changed afterwards. */
+void dmap_response_cache_insert (DmapResponseCache * cache, guint revision,
+                                 const gchar * key, GPtrArray * parts);
+
+G_END_DECLS
+#endif
@@ -30,6 +30,7 @@
 #include <libdmapsharing/dmap-share.h>
 #include <libdmapsharing/dmap-mdns-publisher.h>
 #include <libdmapsharing/dmap-container-record.h>
+#include <libdmapsharing/dmap-structure.h>
 
 G_BEGIN_DECLS
 
@@ -43,10 +44,60 @@ gboolean dmap_share_session_id_validate (DmapShare * share,
 
 gboolean dmap_share_client_requested (DmapBits bits, gint field);
 
+typedef struct _DmapShareMlclBits DmapShareMlclBits;
+
+/* Writes one field of the MLIT of record id to mb->builder. fields is
+ * whatever the share read from the record once for all of its
+ * emitters, or NULL. */
+typedef void (*DmapShareEmitFunc) (DmapShareMlclBits * mb, guint id,
+                                   DmapRecord * record,
+                                   gconstpointer fields);
+
+/* An entry in a share's table of MLIT fields, which lists them in wire
+ * order and ends with a NULL emit. field is the meta bit which requests
+ * the field, or -1 if it is always sent. properties names the record
+ * properties which emit reads from fields, so that a record which cannot
+ * read them all at once need only read those requested. */
+typedef struct {
+	gint field;
+	DmapShareEmitFunc emit;
+	const gchar *properties[2];
+} DmapShareEmitter;
+
+/* What the share passes to add_entry_to_mlcl: the public DmapMlclBits,
+ * then the builder to which each MLIT is written, in wire format (or a
+ * sizer). The share's own subclasses write to builder; others add their
+ * MLIT's to parent.mlcl, as they always have, and the share serializes
+ * them to builder after each call. */
+struct _DmapShareMlclBits {
+	struct DmapMlclBits parent;
+	DmapStructureBuilder *builder;
+	/* The writers of the fields which parent.bits requests, compiled
+	 * once per meta mask by dmap_share_get_emitters, or NULL. */
+	const DmapShareEmitter *emitters;
+};
+
+/* Registers the emitter table of a DmapShare subclass, from its
+ * class_init. Large listings run the emitters in several threads at
+ * once, so they must keep no state of their own. */
+void dmap_share_class_set_emitters (DmapShareClass * klass,
+                                    const DmapShareEmitter * table);
+
+/* Returns the entries of the share's emitter table which bits requests,
+ * in table order and ending with a NULL emit, or NULL if the share has
+ * no table. Lists are compiled once per meta mask and cached; take a
+ * reference to keep one beyond the current main loop iteration. */
+GArray *dmap_share_get_emitters (DmapShare * share, DmapBits bits);
+
 void dmap_share_message_set_from_dmap_structure (DmapShare * share,
 						  SoupServerMessage * message,
 						  GNode * structure);
 
+/* Takes ownership of builder. */
+void dmap_share_message_set_from_dmap_builder (DmapShare * share,
+						SoupServerMessage * message,
+						DmapStructureBuilder * builder);
+
 GSList *dmap_share_build_filter (gchar * filterstr);
 
 void dmap_share_login (DmapShare * share,
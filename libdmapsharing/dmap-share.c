@@ -32,6 +32,10 @@
 #include <libdmapsharing/dmap.h>
 #include <libdmapsharing/dmap-share-private.h>
 #include <libdmapsharing/dmap-structure.h>
+#include <libdmapsharing/dmap-change-journal.h>
+#include <libdmapsharing/dmap-mlit-cache.h>
+#include <libdmapsharing/dmap-response-cache.h>
+#include <libdmapsharing/dmap-private-utils.h>
 
 #define TYPE_OF_SERVICE "_daap._tcp"
 #define STANDARD_DAAP_PORT 3689
@@ -40,6 +44,29 @@
 #define DAAP_VERSION 3.0
 #define DMAP_TIMEOUT 1800
 
+/* Target size of each chunk of MLIT's sent by _write_next_mlit(). */
+#define DMAP_SHARE_MLIT_CHUNK_SIZE (64 * 1024)
+
+/* Responses smaller than this are not worth compressing. */
+#define DMAP_SHARE_GZIP_MIN_SIZE 1024
+
+/* Listings with fewer records than this are encoded on the main thread
+ * even when the share has encoder threads: handing them out would cost
+ * more than it saves. */
+#define DMAP_SHARE_PARALLEL_MIN_ITEMS 1024
+
+/* Records per segment handed to an encoder thread, at least. */
+#define DMAP_SHARE_PARALLEL_MIN_SEGMENT 256
+
+/* Distinct meta strings, and emitter lists, to keep compiled; clients
+ * use a handful. */
+#define DMAP_SHARE_META_CACHE_SIZE 64
+
+/* By default, an /update request waits no longer than the timeout the
+ * server advertises, and no more than this many wait at once. */
+#define DMAP_SHARE_UPDATE_TIMEOUT DMAP_TIMEOUT
+#define DMAP_SHARE_MAX_UPDATE_WAITERS 256
+
 enum
 {
 	PROP_0,
@@ -51,7 +78,19 @@ enum
 	PROP_DB,
 	PROP_CONTAINER_DB,
 	PROP_TRANSCODE_MIMETYPE,
-	PROP_TXT_RECORDS
+	PROP_TXT_RECORDS,
+	PROP_MLIT_CACHE_SIZE,
+	PROP_RESPONSE_CACHE_SIZE,
+	PROP_COMPRESS_RESPONSES,
+	PROP_ENCODER_THREADS,
+	PROP_COLLATE_SORT,
+	PROP_JOURNAL_SIZE,
+	PROP_UPDATE_TIMEOUT,
+	PROP_MAX_UPDATE_WAITERS,
+	PROP_UPDATE_WAITERS,
+	PROP_UPDATE_WAKEUPS,
+	PROP_UPDATE_TIMEOUTS,
+	PROP_UPDATE_REJECTIONS
 };
 
 enum
@@ -62,13 +101,6 @@ enum
 
 static guint _signals[LAST_SIGNAL] = { 0, };
 
-typedef struct {
-	gchar *name;
-	gint64 group_id;
-	gchar *artist;
-	int count;
-} GroupInfo;
-
 struct DmapSharePrivate
 {
 	gchar *name;
@@ -99,6 +131,49 @@ struct DmapSharePrivate
 	gchar **txt_records;
 
 	GHashTable *session_ids;
+
+	/* Serialized MLIT's of earlier listings. */
+	DmapMlitCache *mlit_cache;
+
+	/* Whole responses to earlier listing requests. */
+	DmapResponseCache *response_cache;
+
+	/* Gzip responses for clients which accept it. */
+	gboolean compress_responses;
+
+	/* Meta strings already parsed, to their DmapBits. */
+	GHashTable *meta_bits;
+
+	/* Emitter lists already compiled, by DmapBits. */
+	GHashTable *emitters;
+
+	/* Threads which encode large listings while the main loop goes
+	 * on; 0 encodes on the main thread. The pool holds them, and is
+	 * created when first needed. */
+	guint encoder_threads;
+	GThreadPool *encoder_pool;
+
+	/* Sort albums for the current locale rather than byte by byte. */
+	gboolean collate_sort;
+
+	/* The records changed in each revision, for delta listings. */
+	DmapChangeJournal *journal;
+
+	/* /update requests waiting for the next revision, each held with
+	 * a reference, to the second (of g_get_monotonic_time) by which it
+	 * is answered anyway, or 0 for none. The timer fires at the
+	 * earliest deadline. */
+	GHashTable *update_waiters;
+	guint update_timeout;
+	guint max_update_waiters;
+	guint update_timer_id;
+	guint update_timer_deadline;
+
+	/* Waiters answered by a new revision, answered by their deadline,
+	 * and refused for want of room, since the share began. */
+	guint update_wakeups;
+	guint update_timeouts;
+	guint update_rejections;
 };
 
 typedef void (*ShareBitwiseDestroyFunc) (void *);
@@ -108,9 +183,39 @@ typedef DmapRecord *(*ShareBitwiseLookupByIdFunc) (void *db, guint id);
 struct share_bitwise_t
 {
 	DmapShare *share;
-	struct DmapMlclBits mb;
-	GSList *id_list;
+	DmapShareMlclBits mb;
+	/* Holds mb.emitters while the listing is sent. */
+	GArray *emitters;
+
+	/* IDs to send, in order; cursor indexes the next one. */
+	GArray *ids;
+	guint cursor;
+
 	guint32 size;
+	DmapStructureBuilder *sizer;
+	/* Holds MLIT's encoded while sizing, so that they can be cached. */
+	DmapStructureBuilder *scratch;
+
+	/* The serialized preamble, ending with the MLCL header. */
+	GBytes *preamble;
+
+	/* If not NULL, the MLIT's were encoded up front, by the encoder
+	 * threads, into these parts; cursor then indexes the next part. */
+	GPtrArray *encoded;
+
+	/* If not NULL, sent after the MLCL, such as a delta listing's
+	 * MUDL. */
+	GBytes *trailer;
+
+	/* If not NULL, the body is gzipped as it is written. */
+	GConverter *compressor;
+
+	/* If not NULL, the body is collected in parts and, once complete,
+	 * stored in the response cache under cache_key. */
+	gchar *cache_key;
+	guint revision;
+	GPtrArray *parts;
+	gboolean complete;
 
 	/* FIXME: ick, void * is DMAPDDb * or GHashTable * 
 	 * in next two fields:*/
@@ -146,6 +251,154 @@ _soup_auth_callback (G_GNUC_UNUSED SoupAuthDomain * auth_domain,
 	return allowed;
 }
 
+static gboolean
+_accepts_gzip (SoupServerMessage * message)
+{
+	gboolean accepts = FALSE;
+	const char *value;
+	GSList *acceptable, *l;
+
+	value = soup_message_headers_get_list
+		(soup_server_message_get_request_headers (message),
+		 "Accept-Encoding");
+	if (value == NULL) {
+		goto done;
+	}
+
+	acceptable = soup_header_parse_quality_list (value, NULL);
+	for (l = acceptable; l != NULL; l = l->next) {
+		if (0 == g_ascii_strcasecmp (l->data, "gzip")) {
+			accepts = TRUE;
+			break;
+		}
+	}
+	soup_header_free_list (acceptable);
+
+done:
+	return accepts;
+}
+
+/* Decides whether a response of length bytes to message is gzipped. */
+static gboolean
+_should_gzip (DmapShare * share, SoupServerMessage * message, gsize length)
+{
+	return share->priv->compress_responses
+	    && length >= DMAP_SHARE_GZIP_MIN_SIZE
+	    && _accepts_gzip (message);
+}
+
+static void
+_set_gzip_headers (SoupServerMessage * message)
+{
+	SoupMessageHeaders *headers;
+
+	headers = soup_server_message_get_response_headers (message);
+	soup_message_headers_replace (headers, "Content-Encoding", "gzip");
+	soup_message_headers_append (headers, "Vary", "Accept-Encoding");
+}
+
+/* Gzipped responses are cached apart from plain ones. */
+static gchar *
+_response_cache_variant (const gchar * key, gboolean gzip)
+{
+	return gzip ? g_strconcat (key, "|gzip", NULL) : g_strdup (key);
+}
+
+/* Answers message from the response cache, preferring a gzipped body if
+ * the client accepts one; returns FALSE if nothing is cached under key. */
+static gboolean
+_response_cache_serve (DmapShare * share, SoupServerMessage * message,
+                       const gchar * key)
+{
+	gboolean served = FALSE;
+	GPtrArray *parts = NULL;
+	SoupMessageHeaders *headers;
+	SoupMessageBody *body;
+	goffset length = 0;
+	guint i;
+
+	headers = soup_server_message_get_response_headers (message);
+	body = soup_server_message_get_response_body (message);
+
+	if (share->priv->compress_responses && _accepts_gzip (message)) {
+		gchar *variant = _response_cache_variant (key, TRUE);
+
+		parts = dmap_response_cache_lookup (share->priv->response_cache,
+		                                    share->priv->revision_number,
+		                                    variant);
+		g_free (variant);
+
+		if (parts != NULL) {
+			_set_gzip_headers (message);
+		}
+	}
+
+	if (parts == NULL) {
+		parts = dmap_response_cache_lookup (share->priv->response_cache,
+		                                    share->priv->revision_number,
+		                                    key);
+	}
+
+	if (parts == NULL) {
+		goto done;
+	}
+
+	g_debug ("Serving %s from the response cache.", key);
+
+	for (i = 0; i < parts->len; i++) {
+		GBytes *bytes = g_ptr_array_index (parts, i);
+
+		soup_message_body_append_bytes (body, bytes);
+		length += g_bytes_get_size (bytes);
+	}
+
+	soup_message_headers_set_content_type (headers,
+	                                       "application/x-dmap-tagged",
+	                                       NULL);
+	soup_message_headers_set_content_length (headers, length);
+	DMAP_SHARE_GET_CLASS (share)->message_add_standard_headers (share,
+								    message);
+	soup_server_message_set_status (message, SOUP_STATUS_OK, NULL);
+
+	served = TRUE;
+
+done:
+	return served;
+}
+
+/* Stores the response just set on message under key. */
+static void
+_response_cache_store (DmapShare * share, SoupServerMessage * message,
+                       const gchar * key, guint revision)
+{
+	GPtrArray *parts;
+	gchar *variant;
+	const char *encoding;
+
+	if (0 == dmap_response_cache_get_budget (share->priv->response_cache)
+	 || SOUP_STATUS_OK != soup_server_message_get_status (message)) {
+		goto done;
+	}
+
+	encoding = soup_message_headers_get_one
+		(soup_server_message_get_response_headers (message),
+		 "Content-Encoding");
+	variant = _response_cache_variant (key, encoding != NULL);
+
+	parts = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+	g_ptr_array_add (parts, soup_message_body_flatten
+	                        (soup_server_message_get_response_body (message)));
+
+	dmap_response_cache_insert (share->priv->response_cache, revision,
+	                            variant, parts);
+
+	g_ptr_array_unref (parts);
+	g_free (variant);
+
+done:
+	return;
+}
+
 static void
 _server_info_adapter (G_GNUC_UNUSED SoupServer * server,
                       SoupServerMessage * message,
@@ -153,7 +406,12 @@ _server_info_adapter (G_GNUC_UNUSED SoupServer * server,
                       G_GNUC_UNUSED GHashTable * query,
                       DmapShare * share)
 {
-	DMAP_SHARE_GET_CLASS (share)->server_info (share, message, path);
+	guint revision = share->priv->revision_number;
+
+	if (!_response_cache_serve (share, message, path)) {
+		DMAP_SHARE_GET_CLASS (share)->server_info (share, message, path);
+		_response_cache_store (share, message, path, revision);
+	}
 }
 
 static void
@@ -204,9 +462,14 @@ _content_codes_adapter (G_GNUC_UNUSED SoupServer * server,
                         G_GNUC_UNUSED GHashTable * query,
                         DmapShare * share)
 {
-	DMAP_SHARE_GET_CLASS (share)->content_codes (share,
-						     message,
-						     path);
+	guint revision = share->priv->revision_number;
+
+	if (!_response_cache_serve (share, message, path)) {
+		DMAP_SHARE_GET_CLASS (share)->content_codes (share,
+							     message,
+							     path);
+		_response_cache_store (share, message, path, revision);
+	}
 }
 
 static void
@@ -265,6 +528,27 @@ _get_revision_number (DmapShare * share)
 	return share->priv->revision_number;
 }
 
+static void _update_waiters_wake (DmapShare * share);
+
+void
+dmap_share_bump_revision_number (DmapShare * share)
+{
+	share->priv->revision_number++;
+	dmap_change_journal_seal (share->priv->journal,
+	                          share->priv->revision_number);
+	_update_waiters_wake (share);
+}
+
+void
+dmap_share_record_changed (DmapShare * share, guint id,
+                           DmapShareChange change)
+{
+	/* Published by the next bump. */
+	dmap_change_journal_record (share->priv->journal,
+	                            share->priv->revision_number + 1, id,
+	                            change == DMAP_SHARE_CHANGE_DELETED);
+}
+
 static gboolean
 _get_revision_number_from_query (GHashTable * query,
                                  guint * number)
@@ -291,6 +575,191 @@ done:
 	return ok;
 }
 
+/* MUPD update response
+ *      MSTT status
+ *      MUSR server revision
+ */
+static void
+_update_respond (DmapShare * share, SoupServerMessage * message)
+{
+	GNode *mupd;
+
+	mupd = dmap_structure_add (NULL, DMAP_CC_MUPD);
+	dmap_structure_add (mupd, DMAP_CC_MSTT, (gint32) SOUP_STATUS_OK);
+	dmap_structure_add (mupd, DMAP_CC_MUSR,
+	                    (gint32) _get_revision_number (share));
+
+	dmap_share_message_set_from_dmap_structure (share, message, mupd);
+	dmap_structure_destroy (mupd);
+}
+
+static guint
+_now_seconds (void)
+{
+	return g_get_monotonic_time () / G_USEC_PER_SEC;
+}
+
+static gboolean _update_waiters_timeout (DmapShare * share);
+
+/* Makes sure that the timer fires by deadline. */
+static void
+_update_waiters_schedule (DmapShare * share, guint deadline)
+{
+	DmapSharePrivate *priv = share->priv;
+	guint now;
+
+	if (priv->update_timer_id != 0) {
+		if (priv->update_timer_deadline <= deadline) {
+			goto done;
+		}
+		g_source_remove (priv->update_timer_id);
+	}
+
+	now = _now_seconds ();
+	priv->update_timer_deadline = deadline;
+	priv->update_timer_id = g_timeout_add_seconds
+		(deadline > now ? deadline - now : 0,
+		 (GSourceFunc) _update_waiters_timeout, share);
+
+done:
+	return;
+}
+
+/* Answers the waiters whose deadlines are no later than now, and
+ * schedules the timer for the rest. */
+static void
+_update_waiters_expire (DmapShare * share, guint now)
+{
+	DmapSharePrivate *priv = share->priv;
+	GPtrArray *expired;
+	GHashTableIter iter;
+	gpointer message, deadline;
+	guint next = 0;
+	guint i;
+
+	expired = g_ptr_array_new_with_free_func (g_object_unref);
+
+	g_hash_table_iter_init (&iter, priv->update_waiters);
+	while (g_hash_table_iter_next (&iter, &message, &deadline)) {
+		guint seconds = GPOINTER_TO_UINT (deadline);
+
+		if (seconds == 0) {
+			continue;
+		}
+
+		if (seconds <= now) {
+			/* The reference goes with it. */
+			g_hash_table_iter_steal (&iter);
+			g_ptr_array_add (expired, message);
+		} else if (next == 0 || seconds < next) {
+			next = seconds;
+		}
+	}
+
+	for (i = 0; i < expired->len; i++) {
+		message = g_ptr_array_index (expired, i);
+
+		_update_respond (share, message);
+		soup_server_message_unpause (message);
+		priv->update_timeouts++;
+	}
+
+	if (expired->len > 0) {
+		g_debug ("%u update waiters timed out", expired->len);
+	}
+	g_ptr_array_unref (expired);
+
+	if (next != 0) {
+		_update_waiters_schedule (share, next);
+	}
+}
+
+static gboolean
+_update_waiters_timeout (DmapShare * share)
+{
+	share->priv->update_timer_id = 0;
+	_update_waiters_expire (share, _now_seconds ());
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Answers every waiter with the new revision. */
+static void
+_update_waiters_wake (DmapShare * share)
+{
+	DmapSharePrivate *priv = share->priv;
+	GHashTable *waiters = priv->update_waiters;
+	GHashTableIter iter;
+	gpointer message;
+
+	if (g_hash_table_size (waiters) == 0) {
+		goto done;
+	}
+
+	/* Those that finish while being answered are no longer found. */
+	priv->update_waiters = g_hash_table_new_full (g_direct_hash,
+	                                              g_direct_equal,
+	                                              g_object_unref, NULL);
+	if (priv->update_timer_id != 0) {
+		g_source_remove (priv->update_timer_id);
+		priv->update_timer_id = 0;
+	}
+
+	g_hash_table_iter_init (&iter, waiters);
+	while (g_hash_table_iter_next (&iter, &message, NULL)) {
+		_update_respond (share, message);
+		soup_server_message_unpause (message);
+	}
+
+	g_debug ("Woke %u update waiters", g_hash_table_size (waiters));
+	priv->update_wakeups += g_hash_table_size (waiters);
+	g_hash_table_destroy (waiters);
+
+done:
+	return;
+}
+
+static void
+_update_waiter_finished (SoupServerMessage * message, DmapShare * share)
+{
+	/* Unless it was answered, the client went away. */
+	g_hash_table_remove (share->priv->update_waiters, message);
+}
+
+/* Holds message until the next revision or its deadline. */
+static void
+_update_wait (DmapShare * share, SoupServerMessage * message)
+{
+	DmapSharePrivate *priv = share->priv;
+	guint deadline = 0;
+
+	if (priv->max_update_waiters > 0
+	 && g_hash_table_size (priv->update_waiters)
+	    >= priv->max_update_waiters) {
+		g_debug ("Too many clients waiting for updates");
+		priv->update_rejections++;
+		soup_server_message_set_status (message,
+		                                SOUP_STATUS_SERVICE_UNAVAILABLE,
+		                                NULL);
+		goto done;
+	}
+
+	if (priv->update_timeout > 0) {
+		deadline = _now_seconds () + priv->update_timeout;
+		_update_waiters_schedule (share, deadline);
+	}
+
+	g_hash_table_insert (priv->update_waiters, g_object_ref (message),
+	                     GUINT_TO_POINTER (deadline));
+	g_signal_connect_object (message, "finished",
+	                         G_CALLBACK (_update_waiter_finished),
+	                         share, 0);
+	soup_server_message_pause (message);
+
+done:
+	return;
+}
+
 static void
 _update (DmapShare * share,
          SoupServerMessage * message,
@@ -305,28 +774,9 @@ _update (DmapShare * share,
 	res = _get_revision_number_from_query (query, &revision_number);
 
 	if (res && revision_number != _get_revision_number (share)) {
-		/* MUPD update response
-		 *      MSTT status
-		 *      MUSR server revision
-		 */
-		GNode *mupd;
-
-		mupd = dmap_structure_add (NULL, DMAP_CC_MUPD);
-		dmap_structure_add (mupd, DMAP_CC_MSTT,
-				    (gint32) SOUP_STATUS_OK);
-		dmap_structure_add (mupd, DMAP_CC_MUSR,
-				    (gint32)
-				    _get_revision_number (share));
-
-		dmap_share_message_set_from_dmap_structure (share, message,
-							     mupd);
-		dmap_structure_destroy (mupd);
+		_update_respond (share, message);
 	} else {
-		/* FIXME: This seems like a bug. It just leaks the
-		 * message (and socket) without ever replying.
-		 */
-		g_object_ref (message);
-		soup_server_message_pause (message);
+		_update_wait (share, message);
 	}
 }
 
@@ -358,10 +808,9 @@ _add_playlist_to_mlcl (G_GNUC_UNUSED guint id,
 	 * MINM item name
 	 * MIMC item count
 	 */
-	GNode *mlit;
 	guint num_songs;
 	gchar *name;
-	struct DmapMlclBits *mb = (struct DmapMlclBits *) _mb;
+	DmapShareMlclBits *mb = (DmapShareMlclBits *) _mb;
 
 	num_songs = dmap_container_record_get_entry_count (record);
 	g_object_get (record, "name", &name, NULL);
@@ -370,155 +819,726 @@ _add_playlist_to_mlcl (G_GNUC_UNUSED guint id,
 	 * with dmap_share_client_requested() here (see add_entry_to_mlcl())
 	 */
 
-	mlit = dmap_structure_add (mb->mlcl, DMAP_CC_MLIT);
-	dmap_structure_add (mlit, DMAP_CC_MIID,
-			    dmap_container_record_get_id (record));
+	dmap_structure_builder_begin (mb->builder, DMAP_CC_MLIT);
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_MIID,
+	                                  dmap_container_record_get_id (record));
 	/* we don't have a persistant ID for playlists, unfortunately */
-	dmap_structure_add (mlit, DMAP_CC_MPER,
-			    (gint64) dmap_container_record_get_id (record));
-	dmap_structure_add (mlit, DMAP_CC_MINM, name);
-	dmap_structure_add (mlit, DMAP_CC_MIMC, (gint32) num_songs);
+	dmap_structure_builder_add_int64 (mb->builder, DMAP_CC_MPER,
+	                                  dmap_container_record_get_id (record));
+	dmap_structure_builder_add_string (mb->builder, DMAP_CC_MINM, name);
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_MIMC, num_songs);
 
 	/* FIXME: Is this getting music-specific? */
-	dmap_structure_add (mlit, DMAP_CC_FQUESCH, 0);
-	dmap_structure_add (mlit, DMAP_CC_MPCO, 0);
-	dmap_structure_add (mlit, DMAP_CC_AESP, 0);
-	dmap_structure_add (mlit, DMAP_CC_AEPP, 0);
-	dmap_structure_add (mlit, DMAP_CC_AEPS, 0);
-	dmap_structure_add (mlit, DMAP_CC_AESG, 0);
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_FQUESCH, 0);
+	dmap_structure_builder_add_int32 (mb->builder, DMAP_CC_MPCO, 0);
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_AESP, 0);
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_AEPP, 0);
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_AEPS, 0);
+	dmap_structure_builder_add_int8 (mb->builder, DMAP_CC_AESG, 0);
+	dmap_structure_builder_end (mb->builder);
 
 	g_free (name);
 
 	return;
 }
 
+/* Sends bytes, through the compressor if there is one. flags are passed
+ * to the compressor; G_CONVERTER_FLUSH makes sure that every part sends
+ * something, so that "wrote_chunk" keeps on coming. */
 static void
-_write_dmap_preamble (SoupServerMessage * message, GNode * node)
+_append_part (SoupServerMessage * message,
+              struct share_bitwise_t *share_bitwise, GBytes * bytes,
+              GConverterFlags flags)
 {
-	guint length;
-	gchar *data = dmap_structure_serialize (node, &length);
+	GBytes *compressed = NULL;
+
+	if (share_bitwise->compressor) {
+		GError *error = NULL;
+		gconstpointer data;
+		gsize length;
+
+		data = g_bytes_get_data (bytes, &length);
+		compressed = dmap_private_utils_convert (share_bitwise->compressor,
+		                                         data, length, flags,
+		                                         &error);
+		if (compressed == NULL) {
+			g_warning ("Error compressing response: %s",
+			           error->message);
+			g_error_free (error);
+			goto done;
+		}
+		bytes = compressed;
+	}
+
+	soup_message_body_append_bytes (soup_server_message_get_response_body(message),
+	                                bytes);
+
+	if (share_bitwise->parts) {
+		g_ptr_array_add (share_bitwise->parts, g_bytes_ref (bytes));
+	}
 
-	soup_message_body_append (soup_server_message_get_response_body(message),
-				  SOUP_MEMORY_TAKE, data, length);
-	dmap_structure_destroy (node);
+done:
+	if (compressed) {
+		g_bytes_unref (compressed);
+	}
 }
 
 static void
-_write_next_mlit (SoupServerMessage * message, struct share_bitwise_t *share_bitwise)
+_write_dmap_preamble (SoupServerMessage * message,
+                      struct share_bitwise_t *share_bitwise)
 {
-	if (share_bitwise->id_list == NULL) {
-		g_debug ("No more ID's, sending message complete.");
-		soup_message_body_complete (soup_server_message_get_response_body(message));
-	} else {
-		gchar *data = NULL;
-		guint length;
-		DmapRecord *record;
-		struct DmapMlclBits mb = { NULL, 0, NULL };
-
-		record = share_bitwise->lookup_by_id (share_bitwise->db,
-						      GPOINTER_TO_UINT
-						      (share_bitwise->
-						       id_list->data));
-
-		mb.bits = share_bitwise->mb.bits;
-		mb.mlcl = dmap_structure_add (NULL, DMAP_CC_MLCL);
-		mb.share = share_bitwise->mb.share;
-
-		DMAP_SHARE_GET_CLASS (share_bitwise->mb.share)->
-			add_entry_to_mlcl (GPOINTER_TO_UINT(share_bitwise->id_list->data), record, &mb);
-		data = dmap_structure_serialize (g_node_first_child (mb.mlcl),
-						 &length);
+	_append_part (message, share_bitwise, share_bitwise->preamble,
+	              G_CONVERTER_FLUSH);
+}
 
-		soup_message_body_append (soup_server_message_get_response_body(message),
-					  SOUP_MEMORY_TAKE, data, length);
-		g_debug ("Sending ID %u.",
-			 GPOINTER_TO_UINT (share_bitwise->id_list->data));
-		dmap_structure_destroy (mb.mlcl);
+/* Writes the MLIT of record id to mb->builder. Subclasses which know
+ * nothing of the builder leave their MLIT's in mb->parent.mlcl instead,
+ * so serialize whatever they put there. */
+static void
+_add_entry (DmapShareMlclBits * mb, guint id, DmapRecord * record)
+{
+	GNode *mlit;
 
-		share_bitwise->id_list =
-			g_slist_remove (share_bitwise->id_list,
-					share_bitwise->id_list->data);
+	DMAP_SHARE_GET_CLASS (mb->parent.share)->add_entry_to_mlcl (id, record,
+	                                                            mb);
 
-		g_object_unref (record);
+	while ((mlit = mb->parent.mlcl->children) != NULL) {
+		g_node_unlink (mlit);
+		dmap_structure_builder_add_node (mb->builder, mlit);
+		dmap_structure_destroy (mlit);
 	}
+}
 
-	soup_server_message_unpause (message);
+static void
+_add_entry_adapter (guint id, DmapRecord * record, DmapShareMlclBits * mb)
+{
+	_add_entry (mb, id, record);
 }
 
+/* Writes the MLIT of the record with the given ID to builder, copying it
+ * from the MLIT cache if an earlier listing left it there. record may be
+ * NULL, in which case it is only looked up if the MLIT is not cached. */
 static void
-_group_items (G_GNUC_UNUSED gpointer key, DmapRecord * record, GHashTable * groups)
+_add_mlit (struct share_bitwise_t *share_bitwise, guint id,
+           DmapRecord * record, DmapStructureBuilder * builder)
 {
-	gchar *album, *artist;
-	GroupInfo *group_info;
-	gint64 group_id;
+	DmapSharePrivate *priv = share_bitwise->share->priv;
+	DmapShareMlclBits mb = share_bitwise->mb;
+	DmapStructureBuilder *target = builder;
+	DmapRecord *looked_up = NULL;
+	const guint8 *data;
+	gsize length, offset;
+
+	if (dmap_mlit_cache_lookup (priv->mlit_cache, priv->revision_number,
+	                            mb.parent.bits, id, &data, &length)) {
+		dmap_structure_builder_append (builder, data, length);
+		goto done;
+	}
 
-	g_object_get (record, "songartist", &artist, "songalbum", &album,
-		      "songalbumid", &group_id, NULL);
-	if (!album) {
-		g_free (artist);
-		return;
+	if (record == NULL) {
+		looked_up = share_bitwise->lookup_by_id (share_bitwise->db, id);
+		record = looked_up;
 	}
-	group_info = g_hash_table_lookup (groups, album);
-	if (!group_info) {
-		group_info = g_new0 (GroupInfo, 1);
-		g_hash_table_insert (groups, album, group_info);
-		// They will be freed when the hash table is freed.
-		group_info->name = album;
-		group_info->artist = artist;
-		group_info->group_id = group_id;
-	} else {
-		g_free (album);
-		g_free (artist);
+
+	if (0 == dmap_mlit_cache_get_budget (priv->mlit_cache)) {
+		mb.builder = builder;
+		_add_entry (&mb, id, record);
+		goto done;
 	}
-	(group_info->count)++;
-}
 
-static gint
-_group_info_cmp (gconstpointer group1, gconstpointer group2)
-{
-	return g_ascii_strcasecmp (((GroupInfo *) group1)->name,
-				   ((GroupInfo *) group2)->name);
-}
+	/* A sizer keeps no bytes to cache, so encode to scratch space. */
+	if (builder == share_bitwise->sizer) {
+		if (share_bitwise->scratch == NULL) {
+			share_bitwise->scratch = dmap_structure_builder_new
+				(DMAP_SHARE_MLIT_CHUNK_SIZE);
+		}
+		target = share_bitwise->scratch;
+	}
 
-static DmapRecord *
-_lookup_adapter (GHashTable * ht, guint id)
-{
-	/* NOTE: each time this is called by _write_next_mlit(), the
-	 * returned value will be unref'ed by _write_next_mlit(). We
-	 * also need to destroy the GHashTable, so bump up the reference
-	 * count so that both can happen. */
-	return g_object_ref (g_hash_table_lookup (ht, GUINT_TO_POINTER (id)));
-}
+	offset = dmap_structure_builder_get_length (target);
 
-static void
-_accumulate_mlcl_size_and_ids (guint id,
-                               DmapRecord * record,
-                               struct share_bitwise_t *share_bitwise)
-{
-	share_bitwise->id_list = g_slist_append (share_bitwise->id_list, GUINT_TO_POINTER(id));
+	mb.builder = target;
+	_add_entry (&mb, id, record);
 
-	/* Make copy and set mlcl to NULL so real MLCL does not get changed */
-	struct DmapMlclBits mb_copy = share_bitwise->mb;
+	data = dmap_structure_builder_get_data (target) + offset;
+	length = dmap_structure_builder_get_length (target) - offset;
 
-	mb_copy.mlcl = dmap_structure_add (NULL, DMAP_CC_MLCL);;
+	dmap_mlit_cache_insert (priv->mlit_cache, priv->revision_number,
+	                        mb.parent.bits, id, data, length);
 
-	DMAP_SHARE_GET_CLASS (share_bitwise->mb.share)->add_entry_to_mlcl (id,
-	                                                                   record,
-	                                                                  &mb_copy);
-	share_bitwise->size += dmap_structure_get_size (mb_copy.mlcl);
+	if (target != builder) {
+		dmap_structure_builder_append (builder, data, length);
 
-	/* Minus eight because we do not want to add size of MLCL CC field + size field n times,
-	 * where n == number of records.
-	 */
-	share_bitwise->size -= 8;
+		if (dmap_structure_builder_get_length (target)
+		 >= DMAP_SHARE_MLIT_CHUNK_SIZE) {
+			dmap_structure_builder_free (target);
+			share_bitwise->scratch = NULL;
+		}
+	}
 
-	/* Destroy created structures as we go. */
-	dmap_structure_destroy (mb_copy.mlcl);
+done:
+	if (looked_up) {
+		g_object_unref (looked_up);
+	}
 }
 
-static void
-_accumulate_mlcl_size_and_ids_adapter (gpointer id,
-                                       DmapRecord * record,
+/* Called once the MLIT's of a listing are encoded, with the parts and
+ * their total size, to set up the response to message. */
+typedef void (*EncodeDoneFunc) (DmapShare * share,
+                                SoupServerMessage * message,
+                                GPtrArray * encoded, guint64 size,
+                                gpointer user_data);
+
+/* The MLIT's of one listing, encoded by the encoder threads while the
+ * main loop goes on. The IDs are cut into segments of consecutive
+ * records; each thread takes the next segment not yet taken until none
+ * are left, and the parts of each segment are kept apart so that they
+ * can be put back in order. The thread which encodes the last segment
+ * hands the parts to the main context. Every thread holds a
+ * reference. */
+typedef struct {
+	DmapShareMlclBits mb;
+	GArray *ids;
+	void *db;
+	ShareBitwiseLookupByIdFunc lookup_by_id;
+
+	guint n_segments;
+	guint segment_size;
+	gint next;
+	GPtrArray **parts;
+	gint remaining;
+
+	/* Used on the main context only. */
+	GMainContext *context;
+	DmapShare *share;
+	SoupServerMessage *message;
+	gboolean paused;
+	gulong finished_id;
+	gboolean finished;
+	EncodeDoneFunc done;
+	gpointer user_data;
+	GDestroyNotify destroy;
+} EncodeJob;
+
+static void
+_encode_job_clear (EncodeJob * job)
+{
+	guint i;
+
+	for (i = 0; i < job->n_segments; i++) {
+		if (job->parts[i]) {
+			g_ptr_array_unref (job->parts[i]);
+		}
+	}
+	g_free (job->parts);
+	g_main_context_unref (job->context);
+}
+
+static void
+_encode_job_release (EncodeJob * job)
+{
+	g_atomic_rc_box_release_full (job, (GDestroyNotify) _encode_job_clear);
+}
+
+static void
+_encode_job_abandon (G_GNUC_UNUSED SoupServerMessage * message,
+                     EncodeJob * job)
+{
+	job->finished = TRUE;
+}
+
+/* Runs on the main context once every segment is encoded. */
+static gboolean
+_encode_job_finish (EncodeJob * job)
+{
+	g_signal_handler_disconnect (job->message, job->finished_id);
+
+	if (job->finished) {
+		g_debug ("Message finished before its listing was encoded.");
+	} else {
+		GPtrArray *encoded;
+		guint64 size = 0;
+		guint i;
+
+		encoded = g_ptr_array_new_with_free_func
+			((GDestroyNotify) g_bytes_unref);
+		for (i = 0; i < job->n_segments; i++) {
+			guint j;
+
+			for (j = 0; j < job->parts[i]->len; j++) {
+				GBytes *part = g_ptr_array_index (job->parts[i],
+				                                  j);
+
+				g_ptr_array_add (encoded, g_bytes_ref (part));
+				size += g_bytes_get_size (part);
+			}
+		}
+
+		job->done (job->share, job->message, encoded, size,
+		           job->user_data);
+
+		if (job->paused) {
+			soup_server_message_unpause (job->message);
+		}
+	}
+
+	job->destroy (job->user_data);
+	g_object_unref (job->message);
+	g_object_unref (job->share);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* Encodes one segment into parts of about DMAP_SHARE_MLIT_CHUNK_SIZE,
+ * each ending on an MLIT. */
+static GPtrArray *
+_encode_segment (EncodeJob * job, guint segment)
+{
+	GPtrArray *parts;
+	DmapShareMlclBits mb = job->mb;
+	guint i, last;
+
+	parts = g_ptr_array_new_with_free_func ((GDestroyNotify) g_bytes_unref);
+	mb.builder = dmap_structure_builder_new (DMAP_SHARE_MLIT_CHUNK_SIZE);
+	/* Not the listing's own: other threads are encoding too. */
+	mb.parent.mlcl = dmap_structure_add (NULL, DMAP_CC_MLCL);
+
+	i = segment * job->segment_size;
+	last = MIN (i + job->segment_size, job->ids->len);
+
+	for (; i < last; i++) {
+		guint id = g_array_index (job->ids, guint, i);
+		DmapRecord *record;
+
+		record = job->lookup_by_id (job->db, id);
+		_add_entry (&mb, id, record);
+		g_object_unref (record);
+
+		if (dmap_structure_builder_get_length (mb.builder)
+		 >= DMAP_SHARE_MLIT_CHUNK_SIZE || i + 1 == last) {
+			gchar *data;
+			guint length;
+
+			data = dmap_structure_builder_finish (mb.builder,
+			                                      &length);
+			g_ptr_array_add (parts, g_bytes_new_take (data, length));
+			mb.builder = dmap_structure_builder_new
+				(DMAP_SHARE_MLIT_CHUNK_SIZE);
+		}
+	}
+
+	dmap_structure_builder_free (mb.builder);
+	dmap_structure_destroy (mb.parent.mlcl);
+
+	return parts;
+}
+
+static void
+_encode_segments (EncodeJob * job)
+{
+	for (;;) {
+		guint segment = g_atomic_int_add (&job->next, 1);
+
+		if (segment >= job->n_segments) {
+			break;
+		}
+
+		job->parts[segment] = _encode_segment (job, segment);
+
+		if (g_atomic_int_dec_and_test (&job->remaining)) {
+			GSource *source = g_idle_source_new ();
+
+			g_source_set_priority (source, G_PRIORITY_DEFAULT);
+			g_source_set_callback (source,
+			                       (GSourceFunc) _encode_job_finish,
+			                       g_atomic_rc_box_acquire (job),
+			                       (GDestroyNotify)
+			                       _encode_job_release);
+			g_source_attach (source, job->context);
+			g_source_unref (source);
+		}
+	}
+}
+
+/* Run by the encoder threads. A thread may get here only after the
+ * segments are gone, in which case it does nothing. */
+static void
+_encode_job_run (EncodeJob * job, G_GNUC_UNUSED gpointer user_data)
+{
+	_encode_segments (job);
+	_encode_job_release (job);
+}
+
+/* Returns the encoder threads, starting them if need be, or NULL if
+ * they can not be started. */
+static GThreadPool *
+_encoder_pool (DmapShare * share)
+{
+	DmapSharePrivate *priv = share->priv;
+
+	if (priv->encoder_pool == NULL) {
+		GError *error = NULL;
+
+		priv->encoder_pool = g_thread_pool_new
+			((GFunc) _encode_job_run, NULL,
+			 priv->encoder_threads, FALSE, &error);
+		if (priv->encoder_pool == NULL) {
+			g_warning ("Error creating encoder threads: %s",
+			           error->message);
+			g_error_free (error);
+		}
+	}
+
+	return priv->encoder_pool;
+}
+
+/* Whether a listing of count records from db should be encoded by the
+ * encoder threads. Records must come from a database which may be read
+ * from several threads, and the emitters must already be compiled,
+ * since the emitter cache is not shared safely. Every emitter table a
+ * subclass sets must therefore be reentrant. */
+static gboolean
+_encode_in_parallel (DmapShare * share, const DmapDb * db,
+                     const DmapShareMlclBits * mb, guint count)
+{
+	return share->priv->encoder_threads > 0
+	    && count >= DMAP_SHARE_PARALLEL_MIN_ITEMS
+	    && mb->emitters != NULL
+	    && dmap_db_is_thread_safe (db)
+	    && _encoder_pool (share) != NULL;
+}
+
+/* Starts the encoder threads on the MLIT's of the records with the given
+ * IDs, and holds back the response to message until they are done, so
+ * that the main loop goes on meanwhile; nothing may change the records
+ * until then. Once they are done, done is called on this thread's main
+ * context with the MLIT's in order, in parts of about
+ * DMAP_SHARE_MLIT_CHUNK_SIZE, and the response is sent; done is not
+ * called if the message finishes first. Either way, destroy is then
+ * called on user_data, which must keep ids and db until then. The MLIT
+ * cache is neither read nor filled, since it is not safe to share
+ * between threads. */
+static void
+_encode_mlits (DmapShare * share, SoupServerMessage * message,
+               const DmapShareMlclBits * mb, GArray * ids, void * db,
+               ShareBitwiseLookupByIdFunc lookup_by_id,
+               EncodeDoneFunc done, gpointer user_data,
+               GDestroyNotify destroy)
+{
+	DmapSharePrivate *priv = share->priv;
+	EncodeJob *job;
+	guint helpers, i;
+
+	job = g_atomic_rc_box_new0 (EncodeJob);
+	job->mb = *mb;
+	job->mb.builder = NULL;
+	job->ids = ids;
+	job->db = db;
+	job->lookup_by_id = lookup_by_id;
+
+	/* A few segments per thread, so that a thread which is slow to
+	 * start, or has slow records, does not hold up the rest. */
+	job->segment_size = MAX (DMAP_SHARE_PARALLEL_MIN_SEGMENT,
+	                         ids->len / (priv->encoder_threads * 4) + 1);
+	job->n_segments = (ids->len + job->segment_size - 1)
+	                / job->segment_size;
+	job->parts = g_new0 (GPtrArray *, job->n_segments);
+	job->remaining = job->n_segments;
+
+	job->context = g_main_context_ref_thread_default ();
+	job->share = g_object_ref (share);
+	job->message = g_object_ref (message);
+	job->finished_id = g_signal_connect (message, "finished",
+	                                     G_CALLBACK (_encode_job_abandon),
+	                                     job);
+	job->done = done;
+	job->user_data = user_data;
+	job->destroy = destroy;
+
+	/* A message which was not read from a connection has nothing to
+	 * hold back. */
+	job->paused = NULL != soup_server_message_get_socket (message);
+	if (job->paused) {
+		soup_server_message_pause (message);
+	}
+
+	helpers = MIN (priv->encoder_threads, job->n_segments);
+	for (i = 0; i < helpers; i++) {
+		g_thread_pool_push (priv->encoder_pool,
+		                    g_atomic_rc_box_acquire (job), NULL);
+	}
+
+	_encode_job_release (job);
+}
+
+/* Appends the parts given to an EncodeDoneFunc to builder, and frees
+ * them. */
+static void
+_append_encoded (DmapStructureBuilder * builder, GPtrArray * encoded)
+{
+	guint i;
+
+	for (i = 0; i < encoded->len; i++) {
+		gconstpointer data;
+		gsize length;
+
+		data = g_bytes_get_data (g_ptr_array_index (encoded, i),
+		                         &length);
+		dmap_structure_builder_append (builder, data, length);
+	}
+
+	g_ptr_array_unref (encoded);
+}
+
+static void
+_collect_id (guint id, G_GNUC_UNUSED DmapRecord * record, GArray * ids)
+{
+	g_array_append_val (ids, id);
+}
+
+static void
+_collect_id_adapter (gpointer id, DmapRecord * record, GArray * ids)
+{
+	_collect_id (GPOINTER_TO_UINT (id), record, ids);
+}
+
+/* A listing built whole, rather than streamed, whose MLIT's the encoder
+ * threads are encoding. */
+typedef struct {
+	DmapStructureBuilder *builder;
+	DmapShareMlclBits mb;
+	/* Holds mb.emitters while the MLIT's are encoded. */
+	GArray *emitters;
+	GArray *ids;
+	void *db;
+	ShareBitwiseDestroyFunc destroy;
+	gchar *cache_key;
+	guint revision;
+} PendingListing;
+
+static void
+_pending_listing_done (DmapShare * share, SoupServerMessage * message,
+                       GPtrArray * encoded, G_GNUC_UNUSED guint64 size,
+                       PendingListing * listing)
+{
+	_append_encoded (listing->builder, encoded);
+	dmap_structure_builder_end (listing->builder);
+	dmap_structure_builder_end (listing->builder);
+
+	dmap_share_message_set_from_dmap_builder (share, message,
+	                                          listing->builder);
+	listing->builder = NULL;
+
+	/* A listing begun before the revision changed is out of date. */
+	if (listing->cache_key != NULL
+	 && listing->revision == share->priv->revision_number) {
+		_response_cache_store (share, message, listing->cache_key,
+		                       listing->revision);
+	}
+}
+
+static void
+_pending_listing_free (PendingListing * listing)
+{
+	if (listing->builder) {
+		dmap_structure_builder_free (listing->builder);
+	}
+	dmap_structure_destroy (listing->mb.parent.mlcl);
+	g_array_unref (listing->emitters);
+	g_array_unref (listing->ids);
+	listing->destroy (listing->db);
+	g_free (listing->cache_key);
+	g_free (listing);
+}
+
+/* Has the encoder threads write the MLIT's of the records with the
+ * given IDs, then finishes the listing begun in mb->builder and sends
+ * it, storing it in the response cache under cache_key if that is not
+ * NULL. Takes mb, ids, and db, which destroy frees. */
+static void
+_finish_listing_async (DmapShare * share, SoupServerMessage * message,
+                       DmapShareMlclBits * mb, GArray * emitters,
+                       GArray * ids, void *db,
+                       ShareBitwiseLookupByIdFunc lookup_by_id,
+                       ShareBitwiseDestroyFunc destroy,
+                       const gchar * cache_key)
+{
+	PendingListing *listing;
+
+	listing = g_new0 (PendingListing, 1);
+	listing->builder = mb->builder;
+	listing->mb = *mb;
+	listing->emitters = g_array_ref (emitters);
+	listing->ids = ids;
+	listing->db = db;
+	listing->destroy = destroy;
+	listing->cache_key = g_strdup (cache_key);
+	listing->revision = share->priv->revision_number;
+
+	_encode_mlits (share, message, &listing->mb, ids, db, lookup_by_id,
+	               (EncodeDoneFunc) _pending_listing_done, listing,
+	               (GDestroyNotify) _pending_listing_free);
+}
+
+/* Writes the MLIT's of the count records in db to mb->builder, unless
+ * the listing is large enough for the encoder threads, which then
+ * finish it as _finish_listing_async does; returns TRUE if they do. */
+static gboolean
+_add_db_mlits (DmapShare * share, SoupServerMessage * message,
+               DmapShareMlclBits * mb, GArray * emitters, DmapDb * db,
+               guint count, const gchar * cache_key)
+{
+	gboolean pending = FALSE;
+
+	if (_encode_in_parallel (share, db, mb, count)) {
+		GArray *ids;
+
+		ids = g_array_sized_new (FALSE, FALSE, sizeof (guint), count);
+		dmap_db_foreach (db, (DmapIdRecordFunc) _collect_id, ids);
+		_finish_listing_async (share, message, mb, emitters, ids,
+		                       g_object_ref (db),
+		                       (ShareBitwiseLookupByIdFunc)
+		                       dmap_db_lookup_by_id,
+		                       (ShareBitwiseDestroyFunc) g_object_unref,
+		                       cache_key);
+		pending = TRUE;
+	} else {
+		dmap_db_foreach (db, (DmapIdRecordFunc) _add_entry_adapter, mb);
+	}
+
+	return pending;
+}
+
+static void
+_write_next_mlit (SoupServerMessage * message, struct share_bitwise_t *share_bitwise)
+{
+	guint count = share_bitwise->encoded ? share_bitwise->encoded->len
+	                                     : share_bitwise->ids->len;
+
+	if (share_bitwise->complete) {
+		/* Only the gzip trailer was left to write. */
+	} else if (share_bitwise->cursor >= count && share_bitwise->trailer) {
+		_append_part (message, share_bitwise, share_bitwise->trailer,
+		              G_CONVERTER_FLUSH);
+		g_clear_pointer (&share_bitwise->trailer, g_bytes_unref);
+	} else if (share_bitwise->cursor >= count) {
+		g_debug ("No more ID's, sending message complete.");
+		if (share_bitwise->compressor) {
+			GBytes *end = g_bytes_new_static (NULL, 0);
+
+			_append_part (message, share_bitwise, end,
+			              G_CONVERTER_INPUT_AT_END);
+			g_bytes_unref (end);
+		}
+		soup_message_body_complete (soup_server_message_get_response_body(message));
+		share_bitwise->complete = TRUE;
+	} else if (share_bitwise->encoded) {
+		/* Already a chunk's worth, ending on an MLIT. */
+		_append_part (message, share_bitwise,
+		              g_ptr_array_index (share_bitwise->encoded,
+		                                 share_bitwise->cursor++),
+		              G_CONVERTER_FLUSH);
+		g_debug ("Sent %u of %u parts.", share_bitwise->cursor, count);
+	} else {
+		gchar *data = NULL;
+		guint length;
+		GBytes *bytes;
+		DmapShareMlclBits mb = share_bitwise->mb;
+
+		mb.builder = dmap_structure_builder_new (DMAP_SHARE_MLIT_CHUNK_SIZE);
+
+		/* Fill the chunk with as many MLIT's as fit in
+		 * DMAP_SHARE_MLIT_CHUNK_SIZE (but always at least one), so
+		 * that the per-chunk cost is not paid once per record. */
+		do {
+			guint id;
+
+			id = g_array_index (share_bitwise->ids, guint,
+			                    share_bitwise->cursor++);
+
+			_add_mlit (share_bitwise, id, NULL, mb.builder);
+		} while (share_bitwise->cursor < share_bitwise->ids->len
+		      && dmap_structure_builder_get_length (mb.builder)
+		       < DMAP_SHARE_MLIT_CHUNK_SIZE);
+
+		data = dmap_structure_builder_finish (mb.builder, &length);
+		bytes = g_bytes_new_take (data, length);
+
+		_append_part (message, share_bitwise, bytes, G_CONVERTER_FLUSH);
+		g_bytes_unref (bytes);
+		g_debug ("Sent %u of %u ID's.", share_bitwise->cursor,
+		         share_bitwise->ids->len);
+	}
+
+	soup_server_message_unpause (message);
+}
+
+/* The groups of the records in the filter, or of every record when
+ * there is none: from the aggregates the database keeps, where it keeps
+ * them, or else aggregated here. */
+static GArray *
+_lookup_groups (DmapDb * db, DmapDbGroupType type, GSList * filter_def)
+{
+	GHashTable *records = NULL;
+	DmapDbGroups *aggregates;
+	GHashTableIter iter;
+	gpointer id, record;
+	GArray *groups;
+
+	if (filter_def != NULL) {
+		records = dmap_db_apply_filter (db, filter_def);
+	}
+
+	groups = dmap_db_lookup_groups (db, type, records);
+	if (groups != NULL) {
+		goto done;
+	}
+
+	if (records == NULL) {
+		records = dmap_db_apply_filter (db, NULL);
+	}
+
+	aggregates = dmap_db_groups_new ();
+	g_hash_table_iter_init (&iter, records);
+	while (g_hash_table_iter_next (&iter, &id, &record)) {
+		dmap_db_groups_add (aggregates, GPOINTER_TO_UINT (id), record);
+	}
+	groups = dmap_db_groups_lookup (aggregates, type, NULL);
+	dmap_db_groups_free (aggregates);
+
+done:
+	if (records != NULL) {
+		g_hash_table_destroy (records);
+	}
+
+	return groups;
+}
+
+static DmapRecord *
+_lookup_adapter (GHashTable * ht, guint id)
+{
+	/* NOTE: each time this is called by _write_next_mlit(), the
+	 * returned value will be unref'ed by _write_next_mlit(). We
+	 * also need to destroy the GHashTable, so bump up the reference
+	 * count so that both can happen. */
+	return g_object_ref (g_hash_table_lookup (ht, GUINT_TO_POINTER (id)));
+}
+
+static void
+_accumulate_mlcl_size_and_ids (guint id,
+                               DmapRecord * record,
+                               struct share_bitwise_t *share_bitwise)
+{
+	g_array_append_val (share_bitwise->ids, id);
+
+	/* The sizer only counts bytes: the MLIT is sent by _write_next_mlit(),
+	 * from the MLIT cache if it was cached here. */
+	_add_mlit (share_bitwise, id, record, share_bitwise->sizer);
+}
+
+static void
+_accumulate_mlcl_size_and_ids_adapter (gpointer id,
+                                       DmapRecord * record,
                                        struct share_bitwise_t *share_bitwise)
 {
 	_accumulate_mlcl_size_and_ids(GPOINTER_TO_UINT(id),
@@ -530,10 +1550,44 @@ static void
 _chunked_message_finished (G_GNUC_UNUSED SoupServerMessage * message,
                            struct share_bitwise_t *share_bitwise)
 {
+	DmapSharePrivate *priv = share_bitwise->share->priv;
+
 	g_debug ("Finished sending chunked data.");
+
+	/* A response begun before the revision changed is out of date. */
+	if (share_bitwise->parts && share_bitwise->complete
+	 && share_bitwise->revision == priv->revision_number) {
+		dmap_response_cache_insert (priv->response_cache,
+		                            share_bitwise->revision,
+		                            share_bitwise->cache_key,
+		                            share_bitwise->parts);
+	}
+
 	if (share_bitwise->destroy) {
 		share_bitwise->destroy (share_bitwise->db);
 	}
+	g_array_unref (share_bitwise->ids);
+	if (share_bitwise->encoded) {
+		g_ptr_array_unref (share_bitwise->encoded);
+	}
+	if (share_bitwise->emitters) {
+		g_array_unref (share_bitwise->emitters);
+	}
+	dmap_structure_destroy (share_bitwise->mb.parent.mlcl);
+	/* Not yet made if the encoder threads had not finished. */
+	if (share_bitwise->preamble) {
+		g_bytes_unref (share_bitwise->preamble);
+	}
+	if (share_bitwise->trailer) {
+		g_bytes_unref (share_bitwise->trailer);
+	}
+	if (share_bitwise->compressor) {
+		g_object_unref (share_bitwise->compressor);
+	}
+	if (share_bitwise->parts) {
+		g_ptr_array_unref (share_bitwise->parts);
+	}
+	g_free (share_bitwise->cache_key);
 	g_free (share_bitwise);
 }
 
@@ -574,9 +1628,11 @@ _parse_meta_str (const char *attrs, struct DmapMetaDataMap *mdm)
 }
 
 static DmapBits
-_parse_meta (GHashTable * query, struct DmapMetaDataMap * mdm)
+_parse_meta (DmapShare * share, GHashTable * query)
 {
+	DmapSharePrivate *priv = share->priv;
 	DmapBits bits = 0;
+	DmapBits *cached;
 	const gchar *attrs;
 
 	attrs = g_hash_table_lookup (query, "meta");
@@ -584,53 +1640,583 @@ _parse_meta (GHashTable * query, struct DmapMetaDataMap * mdm)
 		goto done;
 	}
 
-	bits = _parse_meta_str (attrs, mdm);
+	/* Clients send the same few meta strings with every request. */
+	cached = g_hash_table_lookup (priv->meta_bits, attrs);
+	if (cached) {
+		bits = *cached;
+		goto done;
+	}
+
+	bits = _parse_meta_str (attrs, DMAP_SHARE_GET_CLASS (share)->
+	                               get_meta_data_map (share));
+
+	if (g_hash_table_size (priv->meta_bits) >= DMAP_SHARE_META_CACHE_SIZE) {
+		g_hash_table_remove_all (priv->meta_bits);
+	}
+
+	cached = g_new (DmapBits, 1);
+	*cached = bits;
+	g_hash_table_insert (priv->meta_bits, g_strdup (attrs), cached);
 
 done:
 	return bits;
 }
 
-static void
-_databases (DmapShare * share,
-            SoupServer * server,
-            SoupServerMessage * message,
-            const char *path,
-            GHashTable * query)
+static GQuark
+_emitters_quark (void)
 {
-	const char *rest_of_path;
+	return g_quark_from_static_string ("dmap-share-emitters");
+}
 
-	g_debug ("Path is %s.", path);
-	g_hash_table_foreach (query, _debug_param, NULL);
+void
+dmap_share_class_set_emitters (DmapShareClass * klass,
+                               const DmapShareEmitter * table)
+{
+	g_type_set_qdata (G_TYPE_FROM_CLASS (klass), _emitters_quark (),
+	                  (gpointer) table);
+}
 
-	if (!dmap_share_session_id_validate
-	    (share, message, query, NULL)) {
-		soup_server_message_set_status (message, SOUP_STATUS_FORBIDDEN, NULL);
+static const DmapShareEmitter *
+_emitter_table (DmapShare * share)
+{
+	const DmapShareEmitter *table = NULL;
+	GType type;
+
+	/* Subclasses of a share inherit its table. */
+	for (type = G_OBJECT_TYPE (share);
+	     table == NULL && type != DMAP_TYPE_SHARE;
+	     type = g_type_parent (type)) {
+		table = g_type_get_qdata (type, _emitters_quark ());
+	}
+
+	return table;
+}
+
+GArray *
+dmap_share_get_emitters (DmapShare * share, DmapBits bits)
+{
+	DmapSharePrivate *priv = share->priv;
+	const DmapShareEmitter *table, *emitter;
+	GArray *emitters;
+	DmapBits *key;
+
+	emitters = g_hash_table_lookup (priv->emitters, &bits);
+	if (emitters) {
 		goto done;
 	}
 
-	rest_of_path = strchr (path + 1, '/');
+	table = _emitter_table (share);
+	if (table == NULL) {
+		goto done;
+	}
 
-	if (rest_of_path == NULL) {
-		/* AVDB server databases
-		 *      MSTT status
-		 *      MUTY update type
-		 *      MTCO specified total count
-		 *      MRCO returned count
-		 *      MLCL listing
-		 *              MLIT listing item
-		 *                      MIID item id
-		 *                      MPER persistent id
-		 *                      MINM item name
-		 *                      MIMC item count
-		 *                      MCTC container count
-		 */
-		GNode *avdb;
-		GNode *mlcl;
-		GNode *mlit;
+	emitters = g_array_new (FALSE, FALSE, sizeof (DmapShareEmitter));
+	for (emitter = table; emitter->emit; emitter++) {
+		if (emitter->field < 0
+		 || dmap_share_client_requested (bits, emitter->field)) {
+			g_array_append_val (emitters, *emitter);
+		}
+	}
+	/* The terminator. */
+	g_array_append_val (emitters, *emitter);
 
-		avdb = dmap_structure_add (NULL, DMAP_CC_AVDB);
-		dmap_structure_add (avdb, DMAP_CC_MSTT,
-				    (gint32) SOUP_STATUS_OK);
+	/* Listings still being sent hold references to their lists. */
+	if (g_hash_table_size (priv->emitters) >= DMAP_SHARE_META_CACHE_SIZE) {
+		g_hash_table_remove_all (priv->emitters);
+	}
+
+	key = g_new (DmapBits, 1);
+	*key = bits;
+	g_hash_table_insert (priv->emitters, key, emitters);
+
+done:
+	return emitters;
+}
+
+/* Sets up mb to write the fields which query asks for. Returns the
+ * emitter list in mb, if any. Free mb->parent.mlcl once done. */
+static GArray *
+_mlcl_bits_init (DmapShare * share, GHashTable * query,
+                 DmapShareMlclBits * mb)
+{
+	GArray *emitters;
+
+	mb->builder = NULL;
+	mb->parent.mlcl = dmap_structure_add (NULL, DMAP_CC_MLCL);
+	mb->parent.bits = _parse_meta (share, query);
+	mb->parent.share = share;
+
+	emitters = dmap_share_get_emitters (share, mb->parent.bits);
+	mb->emitters = emitters ? (const DmapShareEmitter *) emitters->data
+	                        : NULL;
+
+	return emitters;
+}
+
+/* Names a listing request for the response cache: its path, the fields
+ * it asks for, and the parameters which select and order the records.
+ * Values are escaped, so that no query can pose as another. */
+static gchar *
+_response_cache_key (DmapShare * share, const char *path, GHashTable * query)
+{
+	static const gchar *params[] = {
+		"query", "sort", "group-type", "include-sort-headers", "delta",
+		NULL
+	};
+	GString *key;
+	guint i;
+
+	key = g_string_new (path);
+	g_string_append_printf (key, "?meta=%" G_GINT64_MODIFIER "x",
+	                        _parse_meta (share, query));
+
+	for (i = 0; params[i] != NULL; i++) {
+		const gchar *value = g_hash_table_lookup (query, params[i]);
+
+		if (value != NULL) {
+			g_string_append_printf (key, "&%s=", params[i]);
+			g_string_append_uri_escaped (key, value, NULL, TRUE);
+		}
+	}
+
+	return g_string_free (key, FALSE);
+}
+
+/* Sets changed and deleted to the IDs which changed since the revision
+ * in the query's delta, if it has one and the journal knows. */
+static gboolean
+_changes_since (DmapShare * share, GHashTable * query, GArray ** changed,
+                GArray ** deleted)
+{
+	gboolean ok = FALSE;
+	const gchar *delta;
+	guint since;
+
+	delta = g_hash_table_lookup (query, "delta");
+	if (delta == NULL) {
+		goto done;
+	}
+
+	/* Clients with nothing yet ask for the changes since 0. */
+	since = strtoul (delta, NULL, 10);
+	if (since == 0) {
+		goto done;
+	}
+
+	ok = dmap_change_journal_lookup (share->priv->journal, since,
+	                                 share->priv->revision_number,
+	                                 changed, deleted);
+	if (!ok) {
+		g_debug ("No journal since revision %u, sending everything",
+		         since);
+	}
+
+done:
+	return ok;
+}
+
+/* Returns the records with the given IDs, from records if it is not
+ * NULL, which is destroyed, or else from the database. A changed record
+ * missing from records no longer matches the query, so to the client it
+ * is as good as deleted and its ID is appended to deleted. */
+static GHashTable *
+_changed_records (DmapShare * share, GHashTable * records, GArray * ids,
+                  GArray * deleted)
+{
+	GHashTable *changed;
+	guint i;
+
+	changed = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+	                                 g_object_unref);
+
+	for (i = 0; i < ids->len; i++) {
+		guint id = g_array_index (ids, guint, i);
+		DmapRecord *record;
+
+		if (records) {
+			record = g_hash_table_lookup (records,
+			                              GUINT_TO_POINTER (id));
+			if (record) {
+				g_object_ref (record);
+			} else {
+				g_array_append_val (deleted, id);
+			}
+		} else {
+			record = dmap_db_lookup_by_id (share->priv->db, id);
+		}
+
+		if (record) {
+			g_hash_table_insert (changed, GUINT_TO_POINTER (id),
+			                     record);
+		}
+	}
+
+	if (records) {
+		g_hash_table_destroy (records);
+	}
+
+	return changed;
+}
+
+/* MUDL deleted ID listing
+ *      MIID item id
+ *      ...
+ */
+static GBytes *
+_deleted_listing (GArray * deleted)
+{
+	GNode *mudl;
+	gchar *data;
+	guint length;
+	guint i;
+
+	mudl = dmap_structure_add (NULL, DMAP_CC_MUDL);
+	for (i = 0; i < deleted->len; i++) {
+		dmap_structure_add (mudl, DMAP_CC_MIID,
+		                    (gint32) g_array_index (deleted, guint, i));
+	}
+
+	data = dmap_structure_serialize (mudl, &length);
+	dmap_structure_destroy (mudl);
+
+	return g_bytes_new_take (data, length);
+}
+
+/* Steps 2 to 5 of _databases_items_listing, once the size of the
+ * MLIT's is known. */
+static void
+_items_listing_respond (DmapShare * share, SoupServerMessage * message,
+                        struct share_bitwise_t *share_bitwise,
+                        gint32 num_songs, gint32 num_returned,
+                        const gchar * cache_key)
+{
+	GNode *adbs, *mlcl;
+	gchar *preamble;
+	guint preamble_length;
+	guint64 length;
+	gboolean gzip;
+
+	/* 2: */
+	adbs = dmap_structure_add (NULL, DMAP_CC_ADBS);
+	dmap_structure_add (adbs, DMAP_CC_MSTT,
+			    (gint32) SOUP_STATUS_OK);
+	dmap_structure_add (adbs, DMAP_CC_MUTY,
+	                    share_bitwise->trailer ? 1 : 0);
+	dmap_structure_add (adbs, DMAP_CC_MTCO, (gint32) num_songs);
+	dmap_structure_add (adbs, DMAP_CC_MRCO, num_returned);
+	mlcl = dmap_structure_add (adbs, DMAP_CC_MLCL);
+	dmap_structure_increase_by_predicted_size (adbs,
+						   share_bitwise->
+						   size);
+	if (share_bitwise->trailer) {
+		dmap_structure_increase_by_predicted_size
+			(adbs, g_bytes_get_size (share_bitwise->trailer));
+	}
+	dmap_structure_increase_by_predicted_size (mlcl,
+						   share_bitwise->
+						   size);
+	preamble = dmap_structure_serialize (adbs, &preamble_length);
+	share_bitwise->preamble = g_bytes_new_take (preamble, preamble_length);
+	length = dmap_structure_get_size (adbs);
+	dmap_structure_destroy (adbs);
+
+	/* The gzipped length is not known until the end, so a gzipped
+	 * body goes out in HTTP chunks rather than with a Content-Length. */
+	gzip = _should_gzip (share, message, length);
+	if (gzip) {
+		share_bitwise->compressor = G_CONVERTER (g_zlib_compressor_new
+			(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+	}
+
+	if (cache_key != NULL
+	 && dmap_response_cache_get_budget (share->priv->response_cache) > 0) {
+		share_bitwise->cache_key = _response_cache_variant (cache_key,
+		                                                    gzip);
+		share_bitwise->parts = g_ptr_array_new_with_free_func
+			((GDestroyNotify) g_bytes_unref);
+	}
+
+	/* 3: */
+	/* Free memory after each chunk sent out over network. */
+	soup_message_body_set_accumulate (soup_server_message_get_response_body(message),
+					  FALSE);
+	soup_message_headers_append (soup_server_message_get_response_headers(message),
+				     "Content-Type",
+				     "application/x-dmap-tagged");
+	DMAP_SHARE_GET_CLASS (share)->
+		message_add_standard_headers (share, message);
+	if (gzip) {
+		_set_gzip_headers (message);
+		soup_message_headers_set_encoding (soup_server_message_get_response_headers(message),
+		                                   SOUP_ENCODING_CHUNKED);
+	} else {
+		soup_message_headers_set_content_length (soup_server_message_get_response_headers(message),
+		                                         length);
+	}
+	soup_server_message_set_status (message, SOUP_STATUS_OK, NULL);
+
+	/* 4: */
+	g_signal_connect (message, "wrote_headers",
+			  G_CALLBACK (_write_dmap_preamble), share_bitwise);
+
+	/* 5: */
+	g_signal_connect (message, "wrote_chunk",
+			  G_CALLBACK (_write_next_mlit),
+			  share_bitwise);
+	g_signal_connect (message, "finished",
+			  G_CALLBACK (_chunked_message_finished),
+			  share_bitwise);
+}
+
+/* A streamed listing whose MLIT's the encoder threads are encoding. */
+typedef struct {
+	struct share_bitwise_t *share_bitwise;
+	gint32 num_songs;
+	gint32 num_returned;
+	gchar *cache_key;
+} PendingItemsListing;
+
+static void
+_pending_items_listing_done (DmapShare * share, SoupServerMessage * message,
+                             GPtrArray * encoded, guint64 size,
+                             PendingItemsListing * listing)
+{
+	listing->share_bitwise->encoded = encoded;
+	listing->share_bitwise->size = size;
+
+	_items_listing_respond (share, message, listing->share_bitwise,
+	                        listing->num_songs, listing->num_returned,
+	                        listing->cache_key);
+
+	/* Now freed once the message is sent. */
+	listing->share_bitwise = NULL;
+}
+
+static void
+_pending_items_listing_free (PendingItemsListing * listing)
+{
+	if (listing->share_bitwise) {
+		_chunked_message_finished (NULL, listing->share_bitwise);
+	}
+	g_free (listing->cache_key);
+	g_free (listing);
+}
+
+/* If cache_key is not NULL, the response is stored under it in the
+ * response cache once it has been sent. */
+static void
+_databases_items_listing (DmapShare * share,
+                          SoupServerMessage * message,
+                          GHashTable * query,
+                          const gchar * cache_key)
+{
+	/* ADBS database songs
+	 *      MSTT status
+	 *      MUTY update type
+	 *      MTCO specified total count
+	 *      MRCO returned count
+	 *      MLCL listing
+	 *              MLIT
+	 *                      attrs
+	 *              MLIT
+	 *              ...
+	 *      MUDL deleted ID listing, for a delta
+	 */
+	gchar *record_query;
+	GHashTable *records = NULL;
+	GArray *changed, *deleted = NULL;
+	gint32 num_songs, num_returned;
+	DmapShareMlclBits mb = { { NULL, 0, NULL }, NULL, NULL };
+	GArray *emitters;
+	struct share_bitwise_t *share_bitwise;
+
+	record_query = g_hash_table_lookup (query, "query");
+	if (record_query) {
+		GSList *filter_def;
+
+		filter_def = dmap_share_build_filter (record_query);
+		records =
+			dmap_db_apply_filter (DMAP_DB
+					      (share->priv->db),
+					      filter_def);
+		num_songs = g_hash_table_size (records);
+		g_debug ("Found %d records", num_songs);
+		dmap_share_free_filter (filter_def);
+	} else {
+		num_songs = dmap_db_count (share->priv->db);
+	}
+
+	/* A client which has an earlier revision need only be sent what
+	 * has changed since. */
+	if (_changes_since (share, query, &changed, &deleted)) {
+		records = _changed_records (share, records, changed, deleted);
+		g_debug ("%u records changed, %u deleted", changed->len,
+		         deleted->len);
+		g_array_unref (changed);
+	}
+	num_returned = records ? (gint32) g_hash_table_size (records)
+	                       : num_songs;
+
+	emitters = _mlcl_bits_init (share, query, &mb);
+
+	/* NOTE:
+	 * We previously simply called foreach...add_entry_to_mlcl and later serialized the entire
+	 * structure. This has the disadvantage that the entire response must be in memory before
+	 * libsoup sends it to the client.
+	 *
+	 * Now, we go through the database in two passes:
+	 *
+	 * 1. Accumulate the eventual size of the MLCL by running each record through
+	 *    add_entry_to_mlcl with a sizer, which counts bytes but keeps none.
+	 * 2. Generate the DAAP preamble ending with the MLCL (with size fudged for ADBS and MLCL).
+	 * 3. Setup libsoup response headers, etc.
+	 * 4. Setup callback to transmit DAAP preamble (_write_dmap_preamble)
+	 * 5. Setup callback to encode and transmit batches of MLIT's (_write_next_mlit)
+	 *
+	 * A large listing from a database which may be read from several
+	 * threads is instead encoded in full in step 1, by the encoder
+	 * threads, while the message is held back; steps 2 to 4 follow once
+	 * they are done, and step 5 only sends the parts.
+	 */
+
+	/* 1: */
+	share_bitwise = g_new0 (struct share_bitwise_t, 1);
+
+	share_bitwise->share = share;
+	share_bitwise->mb = mb;
+	share_bitwise->emitters = emitters ? g_array_ref (emitters) : NULL;
+	share_bitwise->ids = g_array_sized_new (FALSE, FALSE, sizeof (guint),
+	                                        num_returned);
+	share_bitwise->cursor = 0;
+	share_bitwise->size = 0;
+	share_bitwise->sizer = dmap_structure_builder_new_sizer ();
+	share_bitwise->revision = share->priv->revision_number;
+	if (records) {
+		share_bitwise->db = records;
+		share_bitwise->lookup_by_id = (ShareBitwiseLookupByIdFunc)
+			_lookup_adapter;
+		share_bitwise->destroy = (ShareBitwiseDestroyFunc) g_hash_table_destroy;
+	} else {
+		share_bitwise->db = share->priv->db;
+		share_bitwise->lookup_by_id = (ShareBitwiseLookupByIdFunc) dmap_db_lookup_by_id;
+		share_bitwise->destroy = NULL;
+	}
+
+	if (deleted) {
+		share_bitwise->trailer = _deleted_listing (deleted);
+		g_array_unref (deleted);
+	}
+
+	if (_encode_in_parallel (share, share->priv->db, &mb, num_returned)) {
+		PendingItemsListing *listing;
+
+		if (records) {
+			g_hash_table_foreach (records, (GHFunc) _collect_id_adapter,
+			                      share_bitwise->ids);
+		} else {
+			dmap_db_foreach (share->priv->db,
+			                 (DmapIdRecordFunc) _collect_id,
+			                 share_bitwise->ids);
+		}
+
+		dmap_structure_builder_free (share_bitwise->sizer);
+		share_bitwise->sizer = NULL;
+
+		listing = g_new0 (PendingItemsListing, 1);
+		listing->share_bitwise = share_bitwise;
+		listing->num_songs = num_songs;
+		listing->num_returned = num_returned;
+		listing->cache_key = g_strdup (cache_key);
+
+		_encode_mlits (share, message, &mb, share_bitwise->ids,
+		               share_bitwise->db, share_bitwise->lookup_by_id,
+		               (EncodeDoneFunc) _pending_items_listing_done,
+		               listing,
+		               (GDestroyNotify) _pending_items_listing_free);
+		goto done;
+	}
+
+	if (records) {
+		g_hash_table_foreach (records,
+				     (GHFunc) _accumulate_mlcl_size_and_ids_adapter,
+				      share_bitwise);
+	} else {
+		dmap_db_foreach (share->priv->db,
+		                (DmapIdRecordFunc) _accumulate_mlcl_size_and_ids,
+				 share_bitwise);
+	}
+
+	share_bitwise->size = dmap_structure_builder_get_length
+		(share_bitwise->sizer);
+	dmap_structure_builder_free (share_bitwise->sizer);
+	share_bitwise->sizer = NULL;
+	dmap_structure_builder_free (share_bitwise->scratch);
+	share_bitwise->scratch = NULL;
+
+	_items_listing_respond (share, message, share_bitwise, num_songs,
+	                        num_returned, cache_key);
+
+done:
+	return;
+}
+
+static void
+_databases (DmapShare * share,
+            SoupServer * server,
+            SoupServerMessage * message,
+            const char *path,
+            GHashTable * query)
+{
+	const char *rest_of_path;
+	gchar *cache_key = NULL;
+	gboolean stores_itself = FALSE;
+	guint revision = share->priv->revision_number;
+
+	g_debug ("Path is %s.", path);
+	g_hash_table_foreach (query, _debug_param, NULL);
+
+	if (!dmap_share_session_id_validate
+	    (share, message, query, NULL)) {
+		soup_server_message_set_status (message, SOUP_STATUS_FORBIDDEN, NULL);
+		goto done;
+	}
+
+	rest_of_path = strchr (path + 1, '/');
+
+	/* Listings depend only on the request and the revision, so they
+	 * may be answered from the response cache. */
+	if (rest_of_path == NULL
+	 || g_ascii_strcasecmp ("/1/groups", rest_of_path) == 0
+	 || g_ascii_strcasecmp ("/1/items", rest_of_path) == 0
+	 || g_ascii_strcasecmp ("/1/containers", rest_of_path) == 0
+	 || g_ascii_strncasecmp ("/1/containers/", rest_of_path, 14) == 0) {
+		cache_key = _response_cache_key (share, path, query);
+		if (_response_cache_serve (share, message, cache_key)) {
+			goto done;
+		}
+	}
+
+	if (rest_of_path == NULL) {
+		/* AVDB server databases
+		 *      MSTT status
+		 *      MUTY update type
+		 *      MTCO specified total count
+		 *      MRCO returned count
+		 *      MLCL listing
+		 *              MLIT listing item
+		 *                      MIID item id
+		 *                      MPER persistent id
+		 *                      MINM item name
+		 *                      MIMC item count
+		 *                      MCTC container count
+		 */
+		GNode *avdb;
+		GNode *mlcl;
+		GNode *mlit;
+
+		avdb = dmap_structure_add (NULL, DMAP_CC_AVDB);
+		dmap_structure_add (avdb, DMAP_CC_MSTT,
+				    (gint32) SOUP_STATUS_OK);
 		dmap_structure_add (avdb, DMAP_CC_MUTY, 0);
 		dmap_structure_add (avdb, DMAP_CC_MTCO, (gint32) 1);
 		dmap_structure_add (avdb, DMAP_CC_MRCO, (gint32) 1);
@@ -660,205 +2246,82 @@ _databases (DmapShare * share,
 		 */
 
 		GSList *filter_def;
-		gchar *record_query;
-		GHashTable *records = NULL;
-		GHashTable *groups;
-		GList *values;
-		GList *value;
-		gchar *sort_by;
-		GroupInfo *group_info;
-		GNode *agal;
+		const gchar *group_type;
+		const gchar *sort_by;
+		DmapDbGroupType type;
+		DmapContentCode cc;
+		GArray *groups;
+		GNode *root;
 		GNode *mlcl;
 		GNode *mlit;
-		gint num;
-
-		if (g_strcmp0
-		    (g_hash_table_lookup (query, "group-type"),
-		     "albums") != 0) {
+		guint i;
+
+		group_type = g_hash_table_lookup (query, "group-type");
+		if (g_strcmp0 (group_type, "albums") == 0) {
+			type = DMAP_DB_GROUP_ALBUMS;
+			cc = DMAP_CC_AGAL;
+		} else if (g_strcmp0 (group_type, "artists") == 0) {
+			type = DMAP_DB_GROUP_ARTISTS;
+			cc = DMAP_CC_AGAR;
+		} else {
 			g_warning ("Unsupported grouping");
 			soup_server_message_set_status (message,
 						 SOUP_STATUS_INTERNAL_SERVER_ERROR, NULL);
 			goto done;
 		}
 
-		record_query = g_hash_table_lookup (query, "query");
-		filter_def = dmap_share_build_filter (record_query);
-		records =
-			dmap_db_apply_filter (DMAP_DB (share->priv->db),
-					      filter_def);
+		/* Groups always come sorted by name. */
+		sort_by = g_hash_table_lookup (query, "sort");
+		if (g_hash_table_lookup (query, "include-sort-headers")
+		 && g_strcmp0 (sort_by, "album") != 0
+		 && g_strcmp0 (sort_by, "artist") != 0) {
+			g_warning ("Unknown sort column: %s", sort_by);
+		}
 
-		groups = g_hash_table_new_full (g_str_hash, g_str_equal,
-						g_free, g_free);
-		g_hash_table_foreach (records, (GHFunc) _group_items, groups);
+		filter_def = dmap_share_build_filter
+			(g_hash_table_lookup (query, "query"));
+		groups = _lookup_groups (DMAP_DB (share->priv->db), type,
+		                         filter_def);
+		dmap_share_free_filter (filter_def);
 
-		agal = dmap_structure_add (NULL, DMAP_CC_AGAL);
-		dmap_structure_add (agal, DMAP_CC_MSTT,
+		root = dmap_structure_add (NULL, cc);
+		dmap_structure_add (root, DMAP_CC_MSTT,
 				    (gint32) SOUP_STATUS_OK);
-		dmap_structure_add (agal, DMAP_CC_MUTY, 0);
-
-		num = g_hash_table_size (groups);
-		dmap_structure_add (agal, DMAP_CC_MTCO, (gint32) num);
-		dmap_structure_add (agal, DMAP_CC_MRCO, (gint32) num);
+		dmap_structure_add (root, DMAP_CC_MUTY, 0);
+		dmap_structure_add (root, DMAP_CC_MTCO, (gint32) groups->len);
+		dmap_structure_add (root, DMAP_CC_MRCO, (gint32) groups->len);
 
-		mlcl = dmap_structure_add (agal, DMAP_CC_MLCL);
+		mlcl = dmap_structure_add (root, DMAP_CC_MLCL);
 
-		values = g_hash_table_get_values (groups);
-		if (g_hash_table_lookup (query, "include-sort-headers")) {
-			sort_by = g_hash_table_lookup (query, "sort");
-			if (g_strcmp0 (sort_by, "album") == 0) {
-				values = g_list_sort (values, _group_info_cmp);
-			} else {
-				g_warning ("Unknown sort column: %s",
-					   sort_by);
-			}
-		}
+		for (i = 0; i < groups->len; i++) {
+			DmapDbGroup *group = &g_array_index (groups,
+			                                     DmapDbGroup, i);
 
-		for (value = values; value; value = g_list_next (value)) {
-			group_info = (GroupInfo *) value->data;
 			mlit = dmap_structure_add (mlcl, DMAP_CC_MLIT);
 			dmap_structure_add (mlit, DMAP_CC_MIID,
-					    (gint) group_info->group_id);
+					    (gint) group->group_id);
 			dmap_structure_add (mlit, DMAP_CC_MPER,
-					    group_info->group_id);
-			dmap_structure_add (mlit, DMAP_CC_MINM,
-					    group_info->name);
-			dmap_structure_add (mlit, DMAP_CC_ASAA,
-					    group_info->artist);
+					    group->group_id);
+			dmap_structure_add (mlit, DMAP_CC_MINM, group->name);
+			if (type == DMAP_DB_GROUP_ARTISTS) {
+				dmap_structure_add (mlit, DMAP_CC_AGAC,
+						    (gint32) group->album_count);
+			} else if (group->artist) {
+				dmap_structure_add (mlit, DMAP_CC_ASAA,
+						    group->artist);
+			}
 			dmap_structure_add (mlit, DMAP_CC_MIMC,
-					    (gint32) group_info->count);
-
-			// Free this now, since the hash free func won't.
-			// Name will be freed when the hash table keys are freed.
-			g_free (group_info->artist);
+					    (gint32) group->count);
 		}
 
-		g_list_free (values);
-		dmap_share_free_filter (filter_def);
-
 		dmap_share_message_set_from_dmap_structure (share, message,
-							     agal);
+							     root);
 
-		g_hash_table_destroy (records);
-		g_hash_table_destroy (groups);
-		dmap_structure_destroy (agal);
+		g_array_unref (groups);
+		dmap_structure_destroy (root);
 	} else if (g_ascii_strcasecmp ("/1/items", rest_of_path) == 0) {
-		/* ADBS database songs
-		 *      MSTT status
-		 *      MUTY update type
-		 *      MTCO specified total count
-		 *      MRCO returned count
-		 *      MLCL listing
-		 *              MLIT
-		 *                      attrs
-		 *              MLIT
-		 *              ...
-		 */
-		GNode *adbs;
-		gchar *record_query;
-		GHashTable *records = NULL;
-		struct DmapMetaDataMap *map;
-		gint32 num_songs;
-		struct DmapMlclBits mb = { NULL, 0, NULL };
-		struct share_bitwise_t *share_bitwise;
-
-		record_query = g_hash_table_lookup (query, "query");
-		if (record_query) {
-			GSList *filter_def;
-
-			filter_def = dmap_share_build_filter (record_query);
-			records =
-				dmap_db_apply_filter (DMAP_DB
-						      (share->priv->db),
-						      filter_def);
-			num_songs = g_hash_table_size (records);
-			g_debug ("Found %d records", num_songs);
-			dmap_share_free_filter (filter_def);
-		} else {
-			num_songs = dmap_db_count (share->priv->db);
-		}
-
-		map = DMAP_SHARE_GET_CLASS (share)->get_meta_data_map (share);
-		mb.bits = _parse_meta (query, map);
-		mb.share = share;
-
-		/* NOTE:
-		 * We previously simply called foreach...add_entry_to_mlcl and later serialized the entire
-		 * structure. This has the disadvantage that the entire response must be in memory before
-		 * libsoup sends it to the client.
-		 *
-		 * Now, we go through the database in multiple passes (as an interim solution):
-		 *
-		 * 1. Accumulate the eventual size of the MLCL by creating and then free'ing each MLIT.
-		 * 2. Generate the DAAP preamble ending with the MLCL (with size fudged for ADBS and MLCL).
-		 * 3. Setup libsoup response headers, etc.
-		 * 4. Setup callback to transmit DAAP preamble (_write_dmap_preamble)
-		 * 5. Setup callback to transmit MLIT's (_write_next_mlit)
-		 */
-
-		/* 1: */
-		share_bitwise = g_new0 (struct share_bitwise_t, 1);
-
-		share_bitwise->share = share;
-		share_bitwise->mb = mb;
-		share_bitwise->id_list = NULL;
-		share_bitwise->size = 0;
-		if (record_query) {
-			share_bitwise->db = records;
-			share_bitwise->lookup_by_id = (ShareBitwiseLookupByIdFunc)
-				_lookup_adapter;
-			share_bitwise->destroy = (ShareBitwiseDestroyFunc) g_hash_table_destroy;
-			g_hash_table_foreach (records,
-					     (GHFunc) _accumulate_mlcl_size_and_ids_adapter,
-					      share_bitwise);
-		} else {
-			share_bitwise->db = share->priv->db;
-			share_bitwise->lookup_by_id = (ShareBitwiseLookupByIdFunc) dmap_db_lookup_by_id;
-			share_bitwise->destroy = NULL;
-			dmap_db_foreach (share->priv->db,
-			                (DmapIdRecordFunc) _accumulate_mlcl_size_and_ids,
-					 share_bitwise);
-		}
-
-		/* 2: */
-		adbs = dmap_structure_add (NULL, DMAP_CC_ADBS);
-		dmap_structure_add (adbs, DMAP_CC_MSTT,
-				    (gint32) SOUP_STATUS_OK);
-		dmap_structure_add (adbs, DMAP_CC_MUTY, 0);
-		dmap_structure_add (adbs, DMAP_CC_MTCO, (gint32) num_songs);
-		dmap_structure_add (adbs, DMAP_CC_MRCO, (gint32) num_songs);
-		mb.mlcl = dmap_structure_add (adbs, DMAP_CC_MLCL);
-		dmap_structure_increase_by_predicted_size (adbs,
-							   share_bitwise->
-							   size);
-		dmap_structure_increase_by_predicted_size (mb.mlcl,
-							   share_bitwise->
-							   size);
-
-		/* 3: */
-		/* Free memory after each chunk sent out over network. */
-		soup_message_body_set_accumulate (soup_server_message_get_response_body(message),
-						  FALSE);
-		soup_message_headers_append (soup_server_message_get_response_headers(message),
-					     "Content-Type",
-					     "application/x-dmap-tagged");
-		DMAP_SHARE_GET_CLASS (share)->
-			message_add_standard_headers (share, message);
-		soup_message_headers_set_content_length (soup_server_message_get_response_headers(message),
-							 dmap_structure_get_size(adbs));
-		soup_server_message_set_status (message, SOUP_STATUS_OK, NULL);
-
-		/* 4: */
-		g_signal_connect (message, "wrote_headers",
-				  G_CALLBACK (_write_dmap_preamble), adbs);
-
-		/* 5: */
-		g_signal_connect (message, "wrote_chunk",
-				  G_CALLBACK (_write_next_mlit),
-				  share_bitwise);
-		g_signal_connect (message, "finished",
-				  G_CALLBACK (_chunked_message_finished),
-				  share_bitwise);
-
+		_databases_items_listing (share, message, query, cache_key);
+		stores_itself = TRUE;
 	} else if (g_ascii_strcasecmp ("/1/containers", rest_of_path) == 0) {
 		/* APLY database playlists
 		 *      MSTT status
@@ -875,55 +2338,57 @@ _databases (DmapShare * share,
 		 *              MLIT
 		 *              ...
 		 */
-		GNode *aply;
-		GNode *mlit;
-		struct DmapMetaDataMap *map;
-		struct DmapMlclBits mb = { NULL, 0, NULL };
+		DmapStructureBuilder *builder;
+		DmapShareMlclBits mb = { { NULL, 0, NULL }, NULL, NULL };
+		gint32 num_containers;
 
-		map = DMAP_SHARE_GET_CLASS (share)->get_meta_data_map (share);
-		mb.bits = _parse_meta (query, map);
-		mb.share = share;
+		_mlcl_bits_init (share, query, &mb);
 
-		aply = dmap_structure_add (NULL, DMAP_CC_APLY);
-		dmap_structure_add (aply, DMAP_CC_MSTT,
-				    (gint32) SOUP_STATUS_OK);
-		dmap_structure_add (aply, DMAP_CC_MUTY, 0);
-		dmap_structure_add (aply, DMAP_CC_MTCO,
-				    (gint32) dmap_container_db_count (share->
-								      priv->
-								      container_db)
-				    + 1);
-		dmap_structure_add (aply, DMAP_CC_MRCO,
-				    (gint32) dmap_container_db_count (share->
-								      priv->
-								      container_db)
-				    + 1);
-		mb.mlcl = dmap_structure_add (aply, DMAP_CC_MLCL);
+		num_containers = dmap_container_db_count (share->priv->
+							  container_db) + 1;
 
-		/* Base playlist (playlist 1 contains all songs): */
-		mlit = dmap_structure_add (mb.mlcl, DMAP_CC_MLIT);
-		dmap_structure_add (mlit, DMAP_CC_MIID, (gint32) 1);
-		dmap_structure_add (mlit, DMAP_CC_MPER, (gint64) 1);
-		dmap_structure_add (mlit, DMAP_CC_MINM, share->priv->name);
-		dmap_structure_add (mlit, DMAP_CC_MIMC,
-				    dmap_db_count (share->priv->db));
-		dmap_structure_add (mlit, DMAP_CC_FQUESCH, 0);
-		dmap_structure_add (mlit, DMAP_CC_MPCO, 0);
-		dmap_structure_add (mlit, DMAP_CC_AESP, 0);
-		dmap_structure_add (mlit, DMAP_CC_AEPP, 0);
-		dmap_structure_add (mlit, DMAP_CC_AEPS, 0);
-		dmap_structure_add (mlit, DMAP_CC_AESG, 0);
+		builder = dmap_structure_builder_new (4096);
+		mb.builder = builder;
+
+		dmap_structure_builder_begin (builder, DMAP_CC_APLY);
+		dmap_structure_builder_add_int32 (builder, DMAP_CC_MSTT,
+						  SOUP_STATUS_OK);
+		dmap_structure_builder_add_int8 (builder, DMAP_CC_MUTY, 0);
+		dmap_structure_builder_add_int32 (builder, DMAP_CC_MTCO,
+						  num_containers);
+		dmap_structure_builder_add_int32 (builder, DMAP_CC_MRCO,
+						  num_containers);
+		dmap_structure_builder_begin (builder, DMAP_CC_MLCL);
 
-		dmap_structure_add (mlit, DMAP_CC_ABPL, (gchar) 1);
+		/* Base playlist (playlist 1 contains all songs): */
+		dmap_structure_builder_begin (builder, DMAP_CC_MLIT);
+		dmap_structure_builder_add_int32 (builder, DMAP_CC_MIID, 1);
+		dmap_structure_builder_add_int64 (builder, DMAP_CC_MPER, 1);
+		dmap_structure_builder_add_string (builder, DMAP_CC_MINM,
+						   share->priv->name);
+		dmap_structure_builder_add_int32 (builder, DMAP_CC_MIMC,
+						  dmap_db_count (share->priv->db));
+		dmap_structure_builder_add_int8 (builder, DMAP_CC_FQUESCH, 0);
+		dmap_structure_builder_add_int32 (builder, DMAP_CC_MPCO, 0);
+		dmap_structure_builder_add_int8 (builder, DMAP_CC_AESP, 0);
+		dmap_structure_builder_add_int8 (builder, DMAP_CC_AEPP, 0);
+		dmap_structure_builder_add_int8 (builder, DMAP_CC_AEPS, 0);
+		dmap_structure_builder_add_int8 (builder, DMAP_CC_AESG, 0);
+
+		dmap_structure_builder_add_int8 (builder, DMAP_CC_ABPL, 1);
+		dmap_structure_builder_end (builder);
 
 		dmap_container_db_foreach (share->priv->container_db,
 					   (DmapIdContainerRecordFunc)
 					   _add_playlist_to_mlcl,
 					   &mb);
 
-		dmap_share_message_set_from_dmap_structure (share, message,
-							     aply);
-		dmap_structure_destroy (aply);
+		dmap_structure_builder_end (builder);
+		dmap_structure_builder_end (builder);
+
+		dmap_share_message_set_from_dmap_builder (share, message,
+							  builder);
+		dmap_structure_destroy (mb.parent.mlcl);
 	} else if (g_ascii_strncasecmp ("/1/containers/", rest_of_path, 14) ==
 		   0) {
 		/* APSO playlist songs
@@ -939,22 +2404,24 @@ _databases (DmapShare * share,
 		 *              MLIT
 		 *              ...
 		 */
-		GNode *apso;
-		struct DmapMetaDataMap *map;
-		struct DmapMlclBits mb = { NULL, 0, NULL };
+		DmapStructureBuilder *builder;
+		DmapShareMlclBits mb = { { NULL, 0, NULL }, NULL, NULL };
 		guint pl_id;
 		gchar *record_query;
 		GSList *filter_def;
 		GHashTable *records;
+		GArray *emitters;
+		gboolean pending = FALSE;
 
-		map = DMAP_SHARE_GET_CLASS (share)->get_meta_data_map (share);
-		mb.bits = _parse_meta (query, map);
-		mb.share = share;
+		emitters = _mlcl_bits_init (share, query, &mb);
 
-		apso = dmap_structure_add (NULL, DMAP_CC_APSO);
-		dmap_structure_add (apso, DMAP_CC_MSTT,
-				    (gint32) SOUP_STATUS_OK);
-		dmap_structure_add (apso, DMAP_CC_MUTY, 0);
+		builder = dmap_structure_builder_new (DMAP_SHARE_MLIT_CHUNK_SIZE);
+		mb.builder = builder;
+
+		dmap_structure_builder_begin (builder, DMAP_CC_APSO);
+		dmap_structure_builder_add_int32 (builder, DMAP_CC_MSTT,
+						  SOUP_STATUS_OK);
+		dmap_structure_builder_add_int8 (builder, DMAP_CC_MUTY, 0);
 
 		if (g_ascii_strcasecmp ("/1/items", rest_of_path + 13) == 0) {
 			GList *id;
@@ -972,53 +2439,73 @@ _databases (DmapShare * share,
 			g_debug ("Found %d records", num_songs);
 			dmap_share_free_filter (filter_def);
 
-			dmap_structure_add (apso, DMAP_CC_MTCO,
-					    (gint32) num_songs);
-			dmap_structure_add (apso, DMAP_CC_MRCO,
-					    (gint32) num_songs);
-			mb.mlcl = dmap_structure_add (apso, DMAP_CC_MLCL);
+			dmap_structure_builder_add_int32 (builder, DMAP_CC_MTCO,
+							  num_songs);
+			dmap_structure_builder_add_int32 (builder, DMAP_CC_MRCO,
+							  num_songs);
+			dmap_structure_builder_begin (builder, DMAP_CC_MLCL);
 
 			sort_by = g_hash_table_lookup (query, "sort");
-			keys = g_hash_table_get_keys (records);
 			if (g_strcmp0 (sort_by, "album") == 0) {
-				keys = g_list_sort_with_data (keys,
-							      (GCompareDataFunc)
-							      dmap_av_record_cmp_by_album,
-							      share->priv->
-							      db);
-			} else if (sort_by != NULL) {
-				g_warning ("Unknown sort column: %s",
-					   sort_by);
+				keys = dmap_av_record_sort_by_album
+					(records, share->priv->collate_sort);
+			} else {
+				if (sort_by != NULL) {
+					g_warning ("Unknown sort column: %s",
+						   sort_by);
+				}
+				keys = g_hash_table_get_keys (records);
 			}
 
-			for (id = keys; id; id = id->next) {
-				(*
-				 (DMAP_SHARE_GET_CLASS (share)->
-				  add_entry_to_mlcl)) (GPOINTER_TO_UINT(id->data),
-						       g_hash_table_lookup
-						       (records, id->data),
-						       &mb);
+			if (_encode_in_parallel (share, share->priv->db, &mb,
+			                         num_songs)) {
+				GArray *ids;
+
+				ids = g_array_sized_new (FALSE, FALSE,
+				                         sizeof (guint),
+				                         num_songs);
+				for (id = keys; id; id = id->next) {
+					guint i = GPOINTER_TO_UINT (id->data);
+
+					g_array_append_val (ids, i);
+				}
+				_finish_listing_async (share, message, &mb,
+				                       emitters, ids, records,
+				                       (ShareBitwiseLookupByIdFunc)
+				                       _lookup_adapter,
+				                       (ShareBitwiseDestroyFunc)
+				                       g_hash_table_destroy,
+				                       cache_key);
+				pending = TRUE;
+			} else {
+				for (id = keys; id; id = id->next) {
+					_add_entry (&mb,
+					            GPOINTER_TO_UINT (id->data),
+					            g_hash_table_lookup
+					            (records, id->data));
+				}
+				g_hash_table_destroy (records);
 			}
 
 			g_list_free (keys);
-			g_hash_table_destroy (records);
 		} else {
 			pl_id = strtoul (rest_of_path + 14, NULL, 10);
 			if (pl_id == 1) {
 				gint32 num_songs =
 					dmap_db_count (share->priv->db);
-				dmap_structure_add (apso, DMAP_CC_MTCO,
-						    (gint32) num_songs);
-				dmap_structure_add (apso, DMAP_CC_MRCO,
-						    (gint32) num_songs);
-				mb.mlcl =
-					dmap_structure_add (apso,
-							    DMAP_CC_MLCL);
-
-				dmap_db_foreach (share->priv->db,
-						 DMAP_SHARE_GET_CLASS
-						 (share)->add_entry_to_mlcl,
-						 &mb);
+				dmap_structure_builder_add_int32 (builder,
+								  DMAP_CC_MTCO,
+								  num_songs);
+				dmap_structure_builder_add_int32 (builder,
+								  DMAP_CC_MRCO,
+								  num_songs);
+				dmap_structure_builder_begin (builder,
+							      DMAP_CC_MLCL);
+
+				pending = _add_db_mlits (share, message, &mb,
+				                         emitters,
+				                         share->priv->db,
+				                         num_songs, cache_key);
 			} else {
 				DmapContainerRecord *record;
 				DmapDb *entries;
@@ -1032,28 +2519,37 @@ _databases (DmapShare * share,
 				/* FIXME: what if entries is NULL (handled in dmapd but should be [also] handled here)? */
 				num_songs = dmap_db_count (entries);
 
-				dmap_structure_add (apso, DMAP_CC_MTCO,
-						    (gint32) num_songs);
-				dmap_structure_add (apso, DMAP_CC_MRCO,
-						    (gint32) num_songs);
-				mb.mlcl =
-					dmap_structure_add (apso,
-							    DMAP_CC_MLCL);
+				dmap_structure_builder_add_int32 (builder,
+								  DMAP_CC_MTCO,
+								  num_songs);
+				dmap_structure_builder_add_int32 (builder,
+								  DMAP_CC_MRCO,
+								  num_songs);
+				dmap_structure_builder_begin (builder,
+							      DMAP_CC_MLCL);
 
-				dmap_db_foreach (entries,
-						 DMAP_SHARE_GET_CLASS
-						 (share)->add_entry_to_mlcl,
-						 &mb);
+				pending = _add_db_mlits (share, message, &mb,
+				                         emitters, entries,
+				                         num_songs, cache_key);
 
 				g_object_unref (entries);
 				g_object_unref (record);
 			}
 		}
 
-		dmap_share_message_set_from_dmap_structure (share, message,
-							     apso);
-		dmap_structure_destroy (apso);
-	} else if (g_ascii_strncasecmp ("/1/browse/", rest_of_path, 9) == 0) {
+		if (pending) {
+			/* Finished once the encoder threads are done. */
+			stores_itself = TRUE;
+		} else {
+			dmap_structure_builder_end (builder);
+			dmap_structure_builder_end (builder);
+
+			dmap_share_message_set_from_dmap_builder (share,
+			                                          message,
+			                                          builder);
+			dmap_structure_destroy (mb.parent.mlcl);
+		}
+	} else if (g_ascii_strncasecmp ("/1/browse/", rest_of_path, 9) == 0) {
 		DMAP_SHARE_GET_CLASS (share)->databases_browse_xxx (share,
 								    message,
 								    path,
@@ -1073,7 +2569,14 @@ _databases (DmapShare * share,
 		g_warning ("Unhandled: %s", path);
 	}
 
+	/* A streamed listing stores itself once it has been sent, and one
+	 * the encoder threads finish once it has been finished. */
+	if (cache_key != NULL && !stores_itself) {
+		_response_cache_store (share, message, cache_key, revision);
+	}
+
 done:
+	g_free (cache_key);
 	return;
 }
 
@@ -1126,6 +2629,9 @@ _set_name (DmapShare * share, const char *name)
 	g_free (share->priv->name);
 	share->priv->name = g_strdup (name);
 
+	/* The server information and database listing name the share. */
+	dmap_response_cache_clear (share->priv->response_cache);
+
 	if (share->priv->published) {
 		error = NULL;
 		dmap_mdns_publisher_rename_at_port (share->priv->
@@ -1420,6 +2926,9 @@ _set_password (DmapShare * share, const char *password)
 		share->priv->auth_method = DMAP_SHARE_AUTH_METHOD_NONE;
 	}
 
+	/* The server information gives the authentication method. */
+	dmap_response_cache_clear (share->priv->response_cache);
+
 	_maybe_restart (share);
 
 done:
@@ -1460,6 +2969,41 @@ _set_property (GObject * object,
 		g_strfreev (share->priv->txt_records);
 		share->priv->txt_records = g_value_dup_boxed (value);
 		break;
+	case PROP_MLIT_CACHE_SIZE:
+		dmap_mlit_cache_set_budget (share->priv->mlit_cache,
+		                            g_value_get_uint64 (value));
+		break;
+	case PROP_RESPONSE_CACHE_SIZE:
+		dmap_response_cache_set_budget (share->priv->response_cache,
+		                                g_value_get_uint64 (value));
+		break;
+	case PROP_COMPRESS_RESPONSES:
+		share->priv->compress_responses = g_value_get_boolean (value);
+		break;
+	case PROP_ENCODER_THREADS:
+		share->priv->encoder_threads = g_value_get_uint (value);
+		if (share->priv->encoder_pool
+		 && share->priv->encoder_threads > 0) {
+			g_thread_pool_set_max_threads
+				(share->priv->encoder_pool,
+				 share->priv->encoder_threads, NULL);
+		}
+		break;
+	case PROP_COLLATE_SORT:
+		share->priv->collate_sort = g_value_get_boolean (value);
+		break;
+	case PROP_JOURNAL_SIZE:
+		dmap_change_journal_set_capacity (share->priv->journal,
+		                                  g_value_get_uint (value),
+		                                  share->priv->revision_number);
+		break;
+	case PROP_UPDATE_TIMEOUT:
+		/* Applies to waiters from now on. */
+		share->priv->update_timeout = g_value_get_uint (value);
+		break;
+	case PROP_MAX_UPDATE_WAITERS:
+		share->priv->max_update_waiters = g_value_get_uint (value);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -1504,6 +3048,46 @@ _get_property (GObject * object,
 	case PROP_TXT_RECORDS:
 		g_value_set_boxed (value, share->priv->txt_records);
 		break;
+	case PROP_MLIT_CACHE_SIZE:
+		g_value_set_uint64 (value,
+		                    dmap_mlit_cache_get_budget (share->priv->mlit_cache));
+		break;
+	case PROP_RESPONSE_CACHE_SIZE:
+		g_value_set_uint64 (value,
+		                    dmap_response_cache_get_budget (share->priv->response_cache));
+		break;
+	case PROP_COMPRESS_RESPONSES:
+		g_value_set_boolean (value, share->priv->compress_responses);
+		break;
+	case PROP_ENCODER_THREADS:
+		g_value_set_uint (value, share->priv->encoder_threads);
+		break;
+	case PROP_COLLATE_SORT:
+		g_value_set_boolean (value, share->priv->collate_sort);
+		break;
+	case PROP_JOURNAL_SIZE:
+		g_value_set_uint (value, dmap_change_journal_get_capacity
+		                         (share->priv->journal));
+		break;
+	case PROP_UPDATE_TIMEOUT:
+		g_value_set_uint (value, share->priv->update_timeout);
+		break;
+	case PROP_MAX_UPDATE_WAITERS:
+		g_value_set_uint (value, share->priv->max_update_waiters);
+		break;
+	case PROP_UPDATE_WAITERS:
+		g_value_set_uint (value, g_hash_table_size
+		                         (share->priv->update_waiters));
+		break;
+	case PROP_UPDATE_WAKEUPS:
+		g_value_set_uint (value, share->priv->update_wakeups);
+		break;
+	case PROP_UPDATE_TIMEOUTS:
+		g_value_set_uint (value, share->priv->update_timeouts);
+		break;
+	case PROP_UPDATE_REJECTIONS:
+		g_value_set_uint (value, share->priv->update_rejections);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
 		break;
@@ -1523,6 +3107,12 @@ _dispose (GObject * object)
 		_server_stop (share);
 	}
 
+	if (share->priv->update_timer_id != 0) {
+		g_source_remove (share->priv->update_timer_id);
+		share->priv->update_timer_id = 0;
+	}
+	g_hash_table_remove_all (share->priv->update_waiters);
+
 	g_clear_object (&share->priv->publisher);
 	g_clear_object (&share->priv->server);
 	g_clear_object (&share->priv->db);
@@ -1538,6 +3128,10 @@ _finalize (GObject * object)
 
 	g_debug ("Finalizing DmapShare");
 
+	if (share->priv->encoder_pool) {
+		g_thread_pool_free (share->priv->encoder_pool, FALSE, TRUE);
+	}
+
 	g_hash_table_destroy (share->priv->session_ids);
 	share->priv->session_ids = NULL;
 
@@ -1545,6 +3139,12 @@ _finalize (GObject * object)
 	g_free (share->priv->password);
 	g_free (share->priv->transcode_mimetype);
 	g_strfreev (share->priv->txt_records);
+	dmap_mlit_cache_free (share->priv->mlit_cache);
+	dmap_response_cache_free (share->priv->response_cache);
+	dmap_change_journal_free (share->priv->journal);
+	g_hash_table_destroy (share->priv->update_waiters);
+	g_hash_table_destroy (share->priv->meta_bits);
+	g_hash_table_destroy (share->priv->emitters);
 
 	G_OBJECT_CLASS (dmap_share_parent_class)->finalize (object);
 }
@@ -1656,6 +3256,122 @@ dmap_share_class_init (DmapShareClass * klass)
 							     G_TYPE_STRV,
 							     G_PARAM_READWRITE));
 
+	g_object_class_install_property (object_class,
+					 PROP_MLIT_CACHE_SIZE,
+					 g_param_spec_uint64 ("mlit-cache-size",
+							      "MLIT cache size",
+							      "Bytes of serialized MLIT's to keep for later listings; 0 disables the cache",
+							      0,
+							      G_MAXUINT64,
+							      0,
+							      G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class,
+					 PROP_RESPONSE_CACHE_SIZE,
+					 g_param_spec_uint64 ("response-cache-size",
+							      "Response cache size",
+							      "Bytes of listing responses to keep for repeated requests; 0 disables the cache",
+							      0,
+							      G_MAXUINT64,
+							      0,
+							      G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class,
+					 PROP_COMPRESS_RESPONSES,
+					 g_param_spec_boolean ("compress-responses",
+							       "Compress responses",
+							       "Gzip DMAP responses for clients which send Accept-Encoding: gzip",
+							       FALSE,
+							       G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class,
+					 PROP_ENCODER_THREADS,
+					 g_param_spec_uint ("encoder-threads",
+							    "Encoder threads",
+							    "Threads which encode large listings from databases which may be read from several threads, which must then not change, while the main loop goes on; 0 encodes on the main thread",
+							    0,
+							    256,
+							    0,
+							    G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class,
+					 PROP_COLLATE_SORT,
+					 g_param_spec_boolean ("collate-sort",
+							       "Collate sort",
+							       "Sort listings by album in the order of the current locale, rather than byte by byte",
+							       FALSE,
+							       G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class,
+					 PROP_JOURNAL_SIZE,
+					 g_param_spec_uint ("journal-size",
+							    "Journal size",
+							    "Record changes to keep, so that clients may be sent only what changed since their revision; 0 disables the journal",
+							    0,
+							    G_MAXUINT,
+							    0,
+							    G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class,
+					 PROP_UPDATE_TIMEOUT,
+					 g_param_spec_uint ("update-timeout",
+							    "Update timeout",
+							    "Seconds for which an update request waits for a new revision before it is answered with the current one; 0 waits indefinitely",
+							    0,
+							    G_MAXUINT,
+							    DMAP_SHARE_UPDATE_TIMEOUT,
+							    G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class,
+					 PROP_MAX_UPDATE_WAITERS,
+					 g_param_spec_uint ("max-update-waiters",
+							    "Maximum update waiters",
+							    "Update requests which may wait for a new revision at once; others are refused; 0 for no limit",
+							    0,
+							    G_MAXUINT,
+							    DMAP_SHARE_MAX_UPDATE_WAITERS,
+							    G_PARAM_READWRITE));
+
+	g_object_class_install_property (object_class,
+					 PROP_UPDATE_WAITERS,
+					 g_param_spec_uint ("update-waiters",
+							    "Update waiters",
+							    "Update requests now waiting for a new revision",
+							    0,
+							    G_MAXUINT,
+							    0,
+							    G_PARAM_READABLE));
+
+	g_object_class_install_property (object_class,
+					 PROP_UPDATE_WAKEUPS,
+					 g_param_spec_uint ("update-wakeups",
+							    "Update wakeups",
+							    "Waiting update requests answered by a new revision",
+							    0,
+							    G_MAXUINT,
+							    0,
+							    G_PARAM_READABLE));
+
+	g_object_class_install_property (object_class,
+					 PROP_UPDATE_TIMEOUTS,
+					 g_param_spec_uint ("update-timeouts",
+							    "Update timeouts",
+							    "Waiting update requests answered once update-timeout passed",
+							    0,
+							    G_MAXUINT,
+							    0,
+							    G_PARAM_READABLE));
+
+	g_object_class_install_property (object_class,
+					 PROP_UPDATE_REJECTIONS,
+					 g_param_spec_uint ("update-rejections",
+							    "Update rejections",
+							    "Update requests refused because max-update-waiters were already waiting",
+							    0,
+							    G_MAXUINT,
+							    0,
+							    G_PARAM_READABLE));
+
 	_signals[ERROR] =
 		g_signal_new ("error",
 		               G_TYPE_FROM_CLASS (object_class),
@@ -1671,6 +3387,23 @@ dmap_share_init (DmapShare * share)
 	share->priv = dmap_share_get_instance_private(share);
 
 	share->priv->revision_number = 5;
+	share->priv->mlit_cache = dmap_mlit_cache_new (0);
+	share->priv->response_cache = dmap_response_cache_new (0);
+	share->priv->journal = dmap_change_journal_new
+		(0, share->priv->revision_number);
+	share->priv->update_waiters = g_hash_table_new_full (g_direct_hash,
+	                                                     g_direct_equal,
+	                                                     g_object_unref,
+	                                                     NULL);
+	share->priv->update_timeout = DMAP_SHARE_UPDATE_TIMEOUT;
+	share->priv->max_update_waiters = DMAP_SHARE_MAX_UPDATE_WAITERS;
+	share->priv->compress_responses = FALSE;
+	share->priv->meta_bits = g_hash_table_new_full (g_str_hash, g_str_equal,
+	                                                g_free, g_free);
+	share->priv->emitters = g_hash_table_new_full (g_int64_hash,
+	                                               g_int64_equal, g_free,
+	                                               (GDestroyNotify)
+	                                               g_array_unref);
 	share->priv->auth_method = DMAP_SHARE_AUTH_METHOD_NONE;
 	share->priv->publisher = dmap_mdns_publisher_new ();
 	share->priv->server = soup_server_new (NULL, NULL);
@@ -1808,6 +3541,54 @@ _session_id_create (DmapShare *share, SoupServerMessage *message)
 	return id;
 }
 
+/* Sets the response body of message to resp, which it takes, gzipping
+ * it first if the client accepts that. */
+static void
+_message_set_response (DmapShare * share, SoupServerMessage * message,
+                       gchar * resp, guint length)
+{
+	GBytes *body;
+
+	body = g_bytes_new_take (resp, length);
+
+	if (_should_gzip (share, message, length)) {
+		GConverter *compressor;
+		GBytes *compressed;
+		GError *error = NULL;
+
+		compressor = G_CONVERTER (g_zlib_compressor_new
+			(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+		compressed = dmap_private_utils_convert (compressor, resp,
+		                                         length,
+		                                         G_CONVERTER_INPUT_AT_END,
+		                                         &error);
+		g_object_unref (compressor);
+
+		if (compressed == NULL) {
+			g_warning ("Error compressing response: %s",
+			           error->message);
+			g_error_free (error);
+		} else {
+			g_bytes_unref (body);
+			body = compressed;
+			_set_gzip_headers (message);
+		}
+	}
+
+	soup_message_headers_set_content_type
+		(soup_server_message_get_response_headers (message),
+		 "application/x-dmap-tagged", NULL);
+	soup_message_body_truncate (soup_server_message_get_response_body (message));
+	soup_message_body_append_bytes (soup_server_message_get_response_body (message),
+	                                body);
+	g_bytes_unref (body);
+
+	DMAP_SHARE_GET_CLASS (share)->message_add_standard_headers (share,
+								    message);
+
+	soup_server_message_set_status (message, SOUP_STATUS_OK, NULL);
+}
+
 void
 dmap_share_message_set_from_dmap_structure (DmapShare * share,
 					     SoupServerMessage * message,
@@ -1823,18 +3604,20 @@ dmap_share_message_set_from_dmap_structure (DmapShare * share,
 		return;
 	}
 
-	soup_server_message_set_response (
-		message,
-		"application/x-dmap-tagged",
-		SOUP_MEMORY_TAKE,
-		resp,
-		length
-	);
+	_message_set_response (share, message, resp, length);
+}
 
-	DMAP_SHARE_GET_CLASS (share)->message_add_standard_headers (share,
-								    message);
+void
+dmap_share_message_set_from_dmap_builder (DmapShare * share,
+					   SoupServerMessage * message,
+					   DmapStructureBuilder * builder)
+{
+	gchar *resp;
+	guint length;
 
-	soup_server_message_set_status (message, SOUP_STATUS_OK, NULL);
+	resp = dmap_structure_builder_finish (builder, &length);
+
+	_message_set_response (share, message, resp, length);
 }
 
 gboolean
@@ -2119,3 +3902,1072 @@ dmap_share_emit_error(DmapShare *share, gint code, const gchar *format, ...)
 
 	va_end(ap);
 }
+
+#ifdef HAVE_CHECK
+
+#include <check.h>
+#include <libdmapsharing/test-dmap-db.h>
+#include <libdmapsharing/test-dmap-av-record.h>
+#include <libdmapsharing/test-dmap-container-db.h>
+#include <libdmapsharing/test-dmap-container-record.h>
+
+/* Fills db, and hands it to the share. */
+static DmapShare *
+_build_share_with_db_test (char *name, DmapDb *db, guint num_records)
+{
+	DmapContainerRecord *container_record;
+	DmapContainerDb *container_db;
+	DmapShare *share;
+	guint i;
+
+	container_record = DMAP_CONTAINER_RECORD (test_dmap_container_record_new ());
+	container_db = DMAP_CONTAINER_DB (test_dmap_container_db_new (container_record));
+
+	for (i = 0; i < num_records; i++) {
+		DmapRecord *record;
+		gchar *title;
+
+		title = g_strdup_printf ("title%u", i);
+
+		record = DMAP_RECORD (test_dmap_av_record_new ());
+		g_object_set (record, "title", title,
+		                      "songgenre", i % 2 ? "genre1" : "genre2",
+		                      "songartist", "artist1",
+		                      "songalbum", "album1",
+		                      "track", i + 1, NULL);
+
+		dmap_db_add (db, record, NULL);
+
+		g_object_unref (record);
+		g_free (title);
+	}
+
+	share = DMAP_SHARE (dmap_av_share_new (name, NULL, db, container_db, NULL));
+
+	g_object_unref (db);
+	g_object_unref (container_record);
+	g_object_unref (container_db);
+
+	return share;
+}
+
+static DmapShare *
+_build_share_test (char *name, guint num_records)
+{
+	return _build_share_with_db_test (name, DMAP_DB (test_dmap_db_new ()),
+	                                  num_records);
+}
+
+/* Returns the body of the listing, which has at most num_records
+ * chunks of MLIT's. */
+static GBytes *
+_items_listing_body_test (DmapShare *share, GHashTable *query, guint num_records)
+{
+	SoupServerMessage *message;
+	SoupMessageBody *body;
+	GBytes *buffer;
+	goffset content_length;
+	guint i;
+
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+
+	_databases_items_listing (share, message, query, NULL);
+
+	/* The encoder threads finish on the main context. */
+	while (SOUP_STATUS_NONE == soup_server_message_get_status (message)) {
+		g_main_context_iteration (NULL, TRUE);
+	}
+
+	content_length = soup_message_headers_get_content_length (
+		soup_server_message_get_response_headers (message));
+
+	g_signal_emit_by_name (message, "wrote_headers", NULL);
+	/* At most one MLIT per chunk, then one more to complete the body. */
+	for (i = 0; i < num_records + 1; i++) {
+		g_signal_emit_by_name (message, "wrote_chunk", NULL);
+	}
+	g_signal_emit_by_name (message, "finished", NULL);
+
+	body = soup_server_message_get_response_body (message);
+	soup_message_body_set_accumulate (body, TRUE);
+	buffer = soup_message_body_flatten (body);
+
+	ck_assert_int_eq (content_length, g_bytes_get_size (buffer));
+
+	g_object_unref (message);
+
+	return buffer;
+}
+
+static GNode *
+_run_items_listing_test (DmapShare *share, GHashTable *query, guint num_records)
+{
+	GBytes *buffer;
+	const guint8 *data;
+	gsize length;
+	GNode *root;
+
+	buffer = _items_listing_body_test (share, query, num_records);
+	data = g_bytes_get_data (buffer, &length);
+
+	root = dmap_structure_parse (data, length, NULL);
+	ck_assert (NULL != root);
+
+	g_bytes_unref (buffer);
+
+	return root;
+}
+
+START_TEST(_databases_items_listing_test)
+{
+	DmapShare *share;
+	GHashTable *query;
+	GNode *root, *mlcl;
+	DmapStructureItem *item;
+
+	share = _build_share_test ("_databases_items_listing_test", 5);
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "dmap.itemid,dmap.itemname,daap.songalbum,daap.songartist,daap.songgenre,daap.songtracknumber");
+
+	root = _run_items_listing_test (share, query, 5);
+
+	item = dmap_structure_find_item (root, DMAP_CC_MTCO);
+	ck_assert_int_eq (5, item->content.data->v_int);
+
+	mlcl = dmap_structure_find_node (root, DMAP_CC_MLCL);
+	ck_assert (NULL != mlcl);
+	ck_assert_int_eq (5, g_node_n_children (mlcl));
+
+	item = dmap_structure_find_item (mlcl->children, DMAP_CC_ASAR);
+	ck_assert_str_eq ("artist1", item->content.data->v_pointer);
+
+	dmap_structure_destroy (root);
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+/* Adds an MLIT as subclasses did before DmapStructureBuilder. */
+static void
+_legacy_add_entry_test (guint id, G_GNUC_UNUSED DmapRecord *record,
+                        gpointer _mb)
+{
+	struct DmapMlclBits *mb = _mb;
+	GNode *mlit;
+
+	mlit = dmap_structure_add (mb->mlcl, DMAP_CC_MLIT);
+	dmap_structure_add (mlit, DMAP_CC_MIID, id);
+}
+
+START_TEST(_databases_items_listing_legacy_test)
+{
+	DmapShare *share;
+	DmapShareClass *klass;
+	void (*add_entry_to_mlcl) (guint id, DmapRecord *record, gpointer mb);
+	GHashTable *query;
+	GNode *root, *mlcl, *mlit;
+
+	share = _build_share_test ("_databases_items_listing_legacy_test", 5);
+	klass = DMAP_SHARE_GET_CLASS (share);
+	add_entry_to_mlcl = klass->add_entry_to_mlcl;
+	klass->add_entry_to_mlcl = _legacy_add_entry_test;
+
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "dmap.itemid");
+
+	root = _run_items_listing_test (share, query, 5);
+
+	mlcl = dmap_structure_find_node (root, DMAP_CC_MLCL);
+	ck_assert (NULL != mlcl);
+	ck_assert_int_eq (5, g_node_n_children (mlcl));
+	for (mlit = mlcl->children; mlit; mlit = mlit->next) {
+		ck_assert (NULL != dmap_structure_find_item (mlit, DMAP_CC_MIID));
+	}
+
+	klass->add_entry_to_mlcl = add_entry_to_mlcl;
+
+	dmap_structure_destroy (root);
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_databases_items_listing_filtered_test)
+{
+	DmapShare *share;
+	GHashTable *query;
+	GNode *root, *mlcl;
+
+	share = _build_share_test ("_databases_items_listing_filtered_test", 5);
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "all");
+	g_hash_table_insert (query, "query", "'daap.songgenre:genre1'");
+
+	root = _run_items_listing_test (share, query, 2);
+
+	mlcl = dmap_structure_find_node (root, DMAP_CC_MLCL);
+	ck_assert (NULL != mlcl);
+	ck_assert_int_eq (2, g_node_n_children (mlcl));
+
+	dmap_structure_destroy (root);
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+static void
+_lookup_groups_check_test (DmapDb *db)
+{
+	GSList *filter_def;
+	GArray *groups;
+	DmapDbGroup *group;
+
+	groups = _lookup_groups (db, DMAP_DB_GROUP_ALBUMS, NULL);
+	ck_assert_int_eq (1, groups->len);
+	group = &g_array_index (groups, DmapDbGroup, 0);
+	ck_assert_str_eq ("album1", group->name);
+	ck_assert_str_eq ("artist1", group->artist);
+	ck_assert_int_eq (5, group->count);
+	g_array_unref (groups);
+
+	filter_def = dmap_share_build_filter ("'daap.songgenre:genre1'");
+	groups = _lookup_groups (db, DMAP_DB_GROUP_ARTISTS, filter_def);
+	ck_assert_int_eq (1, groups->len);
+	group = &g_array_index (groups, DmapDbGroup, 0);
+	ck_assert_str_eq ("artist1", group->name);
+	ck_assert_int_eq (2, group->count);
+	ck_assert_int_eq (1, group->album_count);
+	g_array_unref (groups);
+	dmap_share_free_filter (filter_def);
+}
+
+START_TEST(_lookup_groups_test)
+{
+	DmapShare *share;
+
+	/* Aggregated here. */
+	share = _build_share_test ("_lookup_groups_test", 5);
+	_lookup_groups_check_test (DMAP_DB (share->priv->db));
+	g_object_unref (share);
+
+	/* Kept by the database. */
+	share = _build_share_with_db_test ("_lookup_groups_test",
+	                                   DMAP_DB (dmap_memory_db_new ()), 5);
+	_lookup_groups_check_test (DMAP_DB (share->priv->db));
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_databases_items_listing_delta_test)
+{
+	DmapShare *share;
+	GHashTable *query;
+	GNode *root, *mlcl, *mudl;
+	DmapStructureItem *item;
+	gchar *delta;
+
+	share = _build_share_test ("_databases_items_listing_delta_test", 5);
+	g_object_set (share, "journal-size", 16, NULL);
+	delta = g_strdup_printf ("%u", share->priv->revision_number);
+
+	dmap_share_record_changed (share, G_MAXINT - 1, DMAP_SHARE_CHANGE_MODIFIED);
+	dmap_share_record_changed (share, G_MAXINT - 3, DMAP_SHARE_CHANGE_DELETED);
+	dmap_share_bump_revision_number (share);
+
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "dmap.itemid");
+	g_hash_table_insert (query, "delta", delta);
+
+	/* One MLIT, then the MUDL. */
+	root = _run_items_listing_test (share, query, 2);
+
+	item = dmap_structure_find_item (root, DMAP_CC_MTCO);
+	ck_assert_int_eq (5, item->content.data->v_int);
+	item = dmap_structure_find_item (root, DMAP_CC_MRCO);
+	ck_assert_int_eq (1, item->content.data->v_int);
+
+	mlcl = dmap_structure_find_node (root, DMAP_CC_MLCL);
+	ck_assert_int_eq (1, g_node_n_children (mlcl));
+	item = dmap_structure_find_item (mlcl->children, DMAP_CC_MIID);
+	ck_assert_int_eq (G_MAXINT - 1, item->content.data->v_int);
+
+	mudl = dmap_structure_find_node (root, DMAP_CC_MUDL);
+	ck_assert (NULL != mudl);
+	ck_assert_int_eq (1, g_node_n_children (mudl));
+	item = dmap_structure_find_item (mudl, DMAP_CC_MIID);
+	ck_assert_int_eq (G_MAXINT - 3, item->content.data->v_int);
+	dmap_structure_destroy (root);
+
+	/* A revision whose changes were not reported needs everything. */
+	dmap_share_bump_revision_number (share);
+	root = _run_items_listing_test (share, query, 5);
+	ck_assert (NULL == dmap_structure_find_node (root, DMAP_CC_MUDL));
+	mlcl = dmap_structure_find_node (root, DMAP_CC_MLCL);
+	ck_assert_int_eq (5, g_node_n_children (mlcl));
+	dmap_structure_destroy (root);
+
+	g_hash_table_destroy (query);
+	g_free (delta);
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_databases_items_listing_delta_filtered_test)
+{
+	DmapShare *share;
+	DmapRecord *record;
+	GHashTable *query;
+	GNode *root, *mlcl, *mudl;
+	DmapStructureItem *item;
+	gchar *delta;
+
+	share = _build_share_test ("_databases_items_listing_delta_filtered_test", 5);
+	g_object_set (share, "journal-size", 16, NULL);
+	delta = g_strdup_printf ("%u", share->priv->revision_number);
+
+	/* The second and fourth records are in genre1; move one out. */
+	record = dmap_db_lookup_by_id (share->priv->db, G_MAXINT - 1);
+	g_object_set (record, "songgenre", "genre2", NULL);
+	g_object_unref (record);
+
+	dmap_share_record_changed (share, G_MAXINT - 1, DMAP_SHARE_CHANGE_MODIFIED);
+	dmap_share_record_changed (share, G_MAXINT - 3, DMAP_SHARE_CHANGE_MODIFIED);
+	dmap_share_bump_revision_number (share);
+
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "dmap.itemid");
+	g_hash_table_insert (query, "query", "'daap.songgenre:genre1'");
+	g_hash_table_insert (query, "delta", delta);
+
+	root = _run_items_listing_test (share, query, 2);
+
+	mlcl = dmap_structure_find_node (root, DMAP_CC_MLCL);
+	ck_assert_int_eq (1, g_node_n_children (mlcl));
+	item = dmap_structure_find_item (mlcl->children, DMAP_CC_MIID);
+	ck_assert_int_eq (G_MAXINT - 3, item->content.data->v_int);
+
+	/* The record which left the query must leave the client's view. */
+	mudl = dmap_structure_find_node (root, DMAP_CC_MUDL);
+	ck_assert (NULL != mudl);
+	ck_assert_int_eq (1, g_node_n_children (mudl));
+	item = dmap_structure_find_item (mudl, DMAP_CC_MIID);
+	ck_assert_int_eq (G_MAXINT - 1, item->content.data->v_int);
+	dmap_structure_destroy (root);
+
+	g_hash_table_destroy (query);
+	g_free (delta);
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_databases_items_listing_delta_cached_test)
+{
+	DmapShare *share;
+	SoupServerMessage *message;
+	GHashTable *query;
+	GNode *root, *mlcl;
+	gchar *delta, *delta_key, *full_key;
+	guint i;
+
+	share = _build_share_test ("_databases_items_listing_delta_cached_test", 5);
+	g_object_set (share, "journal-size", 16,
+	              "response-cache-size", (guint64) 1024 * 1024, NULL);
+	delta = g_strdup_printf ("%u", share->priv->revision_number);
+
+	dmap_share_record_changed (share, G_MAXINT - 1, DMAP_SHARE_CHANGE_MODIFIED);
+	dmap_share_bump_revision_number (share);
+
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "dmap.itemid");
+	full_key = _response_cache_key (share, "/databases/1/items", query);
+	g_hash_table_insert (query, "delta", delta);
+	delta_key = _response_cache_key (share, "/databases/1/items", query);
+
+	/* Send the delta, which stores itself once finished. */
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	_databases_items_listing (share, message, query, delta_key);
+	g_signal_emit_by_name (message, "wrote_headers", NULL);
+	for (i = 0; i < 1 + 1; i++) {
+		g_signal_emit_by_name (message, "wrote_chunk", NULL);
+	}
+	g_signal_emit_by_name (message, "finished", NULL);
+	g_object_unref (message);
+
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	ck_assert (_response_cache_serve (share, message, delta_key));
+	g_object_unref (message);
+
+	/* A full listing must not be answered with the delta. */
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	ck_assert (!_response_cache_serve (share, message, full_key));
+	g_object_unref (message);
+
+	g_hash_table_remove (query, "delta");
+	root = _run_items_listing_test (share, query, 5);
+	mlcl = dmap_structure_find_node (root, DMAP_CC_MLCL);
+	ck_assert_int_eq (5, g_node_n_children (mlcl));
+	dmap_structure_destroy (root);
+
+	g_hash_table_destroy (query);
+	g_free (delta);
+	g_free (delta_key);
+	g_free (full_key);
+	g_object_unref (share);
+}
+END_TEST
+
+/* Returns the revision in message's MUPD response. */
+static gint
+_update_revision_test (SoupServerMessage *message)
+{
+	SoupMessageBody *body;
+	GBytes *buffer;
+	const guint8 *data;
+	gsize length;
+	GNode *root;
+	gint revision;
+
+	body = soup_server_message_get_response_body (message);
+	buffer = soup_message_body_flatten (body);
+	data = g_bytes_get_data (buffer, &length);
+
+	root = dmap_structure_parse (data, length, NULL);
+	ck_assert (NULL != root);
+	revision = dmap_structure_find_item (root, DMAP_CC_MUSR)->content.data->v_int;
+
+	dmap_structure_destroy (root);
+	g_bytes_unref (buffer);
+
+	return revision;
+}
+
+static SoupServerMessage *
+_update_test (DmapShare *share, GHashTable *query)
+{
+	SoupServerMessage *message;
+
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	_update (share, message, "/update", query);
+
+	return message;
+}
+
+static guint
+_get_uint_test (DmapShare *share, const gchar *property)
+{
+	guint value;
+
+	g_object_get (share, property, &value, NULL);
+
+	return value;
+}
+
+START_TEST(_update_wake_test)
+{
+	DmapShare *share;
+	GHashTable *query;
+	SoupServerMessage *messages[3];
+	gchar *revision;
+	guint i;
+
+	share = _build_share_test ("_update_wake_test", 1);
+	g_object_set (share, "max-update-waiters", 2, NULL);
+
+	revision = g_strdup_printf ("%u", share->priv->revision_number);
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "revision-number", revision);
+
+	for (i = 0; i < G_N_ELEMENTS (messages); i++) {
+		messages[i] = _update_test (share, query);
+	}
+
+	/* Two wait; there is no room for the third. */
+	ck_assert_int_eq (2, _get_uint_test (share, "update-waiters"));
+	ck_assert_int_eq (1, _get_uint_test (share, "update-rejections"));
+	ck_assert_int_eq (SOUP_STATUS_SERVICE_UNAVAILABLE,
+	                  soup_server_message_get_status (messages[2]));
+
+	/* A new revision answers both at once. */
+	dmap_share_bump_revision_number (share);
+	ck_assert_int_eq (0, _get_uint_test (share, "update-waiters"));
+	ck_assert_int_eq (2, _get_uint_test (share, "update-wakeups"));
+	for (i = 0; i < 2; i++) {
+		ck_assert_int_eq (share->priv->revision_number,
+		                  _update_revision_test (messages[i]));
+	}
+
+	/* An old revision is answered straight away. */
+	g_object_unref (messages[0]);
+	messages[0] = _update_test (share, query);
+	ck_assert_int_eq (0, _get_uint_test (share, "update-waiters"));
+	ck_assert_int_eq (share->priv->revision_number,
+	                  _update_revision_test (messages[0]));
+
+	for (i = 0; i < G_N_ELEMENTS (messages); i++) {
+		g_object_unref (messages[i]);
+	}
+	g_hash_table_destroy (query);
+	g_free (revision);
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_update_timeout_test)
+{
+	DmapShare *share;
+	GHashTable *query;
+	SoupServerMessage *waiting, *forever;
+	gchar *revision;
+
+	share = _build_share_test ("_update_timeout_test", 1);
+
+	revision = g_strdup_printf ("%u", share->priv->revision_number);
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "revision-number", revision);
+
+	g_object_set (share, "update-timeout", 60, NULL);
+	waiting = _update_test (share, query);
+	ck_assert (0 != share->priv->update_timer_id);
+
+	g_object_set (share, "update-timeout", 0, NULL);
+	forever = _update_test (share, query);
+
+	/* Not yet. */
+	_update_waiters_expire (share, _now_seconds ());
+	ck_assert_int_eq (2, _get_uint_test (share, "update-waiters"));
+
+	/* Answered with the revision the client has, so it asks again. */
+	_update_waiters_expire (share, _now_seconds () + 60);
+	ck_assert_int_eq (1, _get_uint_test (share, "update-waiters"));
+	ck_assert_int_eq (1, _get_uint_test (share, "update-timeouts"));
+	ck_assert_int_eq (share->priv->revision_number,
+	                  _update_revision_test (waiting));
+
+	/* A client which goes away stops waiting. */
+	g_signal_emit_by_name (forever, "finished", NULL);
+	ck_assert_int_eq (0, _get_uint_test (share, "update-waiters"));
+
+	g_object_unref (waiting);
+	g_object_unref (forever);
+	g_hash_table_destroy (query);
+	g_free (revision);
+	g_object_unref (share);
+}
+END_TEST
+
+static gboolean
+_listing_has_title (GNode *root, const gchar *title)
+{
+	GNode *mlit;
+
+	mlit = dmap_structure_find_node (root, DMAP_CC_MLCL)->children;
+	for (; mlit != NULL; mlit = mlit->next) {
+		DmapStructureItem *item;
+
+		item = dmap_structure_find_item (mlit, DMAP_CC_MINM);
+		if (0 == g_strcmp0 (title, item->content.data->v_pointer)) {
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+START_TEST(_databases_items_listing_cached_test)
+{
+	DmapShare *share;
+	DmapDb *db = NULL;
+	DmapRecord *record;
+	GHashTable *query;
+	GNode *root;
+	gchar *first, *second;
+	guint first_length, second_length;
+
+	share = _build_share_test ("_databases_items_listing_cached_test", 5);
+	g_object_set (share, "mlit-cache-size", (guint64) 1024 * 1024, NULL);
+
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "dmap.itemid,dmap.itemname,daap.songartist");
+
+	root = _run_items_listing_test (share, query, 5);
+	first = dmap_structure_serialize (root, &first_length);
+	dmap_structure_destroy (root);
+
+	ck_assert (dmap_mlit_cache_get_size (share->priv->mlit_cache) > 0);
+
+	/* The second listing comes from the cache, and must not differ. */
+	root = _run_items_listing_test (share, query, 5);
+	second = dmap_structure_serialize (root, &second_length);
+	dmap_structure_destroy (root);
+
+	ck_assert_int_eq (first_length, second_length);
+	ck_assert (0 == memcmp (first, second, first_length));
+
+	/* A change is seen once the revision number moves on. */
+	g_object_get (share, "db", &db, NULL);
+	record = dmap_db_lookup_by_id (db, G_MAXINT);
+	g_object_set (record, "title", "changed", NULL);
+	dmap_share_bump_revision_number (share);
+
+	root = _run_items_listing_test (share, query, 5);
+	ck_assert (_listing_has_title (root, "changed"));
+	dmap_structure_destroy (root);
+
+	g_object_unref (record);
+	g_object_unref (db);
+	g_free (first);
+	g_free (second);
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_databases_items_listing_response_cache_test)
+{
+	DmapShare *share;
+	SoupServerMessage *message;
+	GHashTable *query;
+	GBytes *sent, *cached;
+	guint i;
+
+	share = _build_share_test ("_databases_items_listing_response_cache_test", 5);
+	g_object_set (share, "response-cache-size", (guint64) 1024 * 1024, NULL);
+
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "all");
+
+	/* Send the listing, which stores itself once finished. */
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	_databases_items_listing (share, message, query, "items");
+	g_signal_emit_by_name (message, "wrote_headers", NULL);
+	for (i = 0; i < 5 + 1; i++) {
+		g_signal_emit_by_name (message, "wrote_chunk", NULL);
+	}
+	g_signal_emit_by_name (message, "finished", NULL);
+
+	soup_message_body_set_accumulate (soup_server_message_get_response_body (message), TRUE);
+	sent = soup_message_body_flatten (soup_server_message_get_response_body (message));
+	g_object_unref (message);
+
+	/* Serve it again from the cache. */
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	ck_assert (_response_cache_serve (share, message, "items"));
+	cached = soup_message_body_flatten (soup_server_message_get_response_body (message));
+	g_object_unref (message);
+
+	ck_assert (g_bytes_equal (sent, cached));
+
+	/* But not once the revision has moved on. */
+	dmap_share_bump_revision_number (share);
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	ck_assert (!_response_cache_serve (share, message, "items"));
+	g_object_unref (message);
+
+	g_bytes_unref (sent);
+	g_bytes_unref (cached);
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+/* Returns the share's response to /server-info, through the cache. */
+static GNode *
+_server_info_test (DmapShare *share)
+{
+	SoupServerMessage *message;
+	GBytes *buffer;
+	const guint8 *data;
+	gsize length;
+	GNode *root;
+
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	_server_info_adapter (NULL, message, "/server-info", NULL, share);
+
+	buffer = soup_message_body_flatten
+		(soup_server_message_get_response_body (message));
+	data = g_bytes_get_data (buffer, &length);
+	root = dmap_structure_parse (data, length, NULL);
+	ck_assert (NULL != root);
+
+	g_bytes_unref (buffer);
+	g_object_unref (message);
+
+	return root;
+}
+
+START_TEST(_server_info_cached_rename_test)
+{
+	DmapShare *share;
+	GNode *root;
+	DmapStructureItem *item;
+
+	share = _build_share_test ("_server_info_cached_rename_test", 1);
+	g_object_set (share, "response-cache-size", (guint64) 1024 * 1024, NULL);
+
+	root = _server_info_test (share);
+	dmap_structure_destroy (root);
+
+	/* As after an mDNS name collision. */
+	g_object_set (share, "name", "renamed", NULL);
+	root = _server_info_test (share);
+	item = dmap_structure_find_item (root, DMAP_CC_MINM);
+	ck_assert_str_eq ("renamed", item->content.data->v_pointer);
+	item = dmap_structure_find_item (root, DMAP_CC_MSAU);
+	ck_assert_int_eq (DMAP_SHARE_AUTH_METHOD_NONE, item->content.data->v_int);
+	dmap_structure_destroy (root);
+
+	g_object_set (share, "password", "password", NULL);
+	root = _server_info_test (share);
+	item = dmap_structure_find_item (root, DMAP_CC_MSAU);
+	ck_assert_int_eq (DMAP_SHARE_AUTH_METHOD_PASSWORD, item->content.data->v_int);
+	dmap_structure_destroy (root);
+
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_response_cache_key_test)
+{
+	DmapShare *share;
+	GHashTable *query;
+	gchar *key1, *key2;
+
+	share = _build_share_test ("_response_cache_key_test", 1);
+
+	/* A filter which holds what looks like another parameter. */
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "dmap.itemid");
+	g_hash_table_insert (query, "query", "'daap.songgenre:a'&sort=album");
+	key1 = _response_cache_key (share, "/databases/1/items", query);
+
+	g_hash_table_insert (query, "query", "'daap.songgenre:a'");
+	g_hash_table_insert (query, "sort", "album");
+	key2 = _response_cache_key (share, "/databases/1/items", query);
+
+	ck_assert_str_ne (key1, key2);
+
+	g_free (key1);
+	g_free (key2);
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+static GBytes *
+_gunzip_test (GBytes *compressed)
+{
+	GConverter *decompressor;
+	GBytes *bytes;
+	gconstpointer data;
+	gsize length;
+
+	decompressor = G_CONVERTER (g_zlib_decompressor_new
+		(G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+	data = g_bytes_get_data (compressed, &length);
+	bytes = dmap_private_utils_convert (decompressor, data, length,
+	                                    G_CONVERTER_INPUT_AT_END, NULL);
+	ck_assert (NULL != bytes);
+
+	g_object_unref (decompressor);
+
+	return bytes;
+}
+
+START_TEST(_accepts_gzip_test)
+{
+	SoupServerMessage *message;
+	SoupMessageHeaders *headers;
+
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	headers = soup_server_message_get_request_headers (message);
+
+	ck_assert (!_accepts_gzip (message));
+
+	soup_message_headers_replace (headers, "Accept-Encoding", "deflate, gzip;q=0");
+	ck_assert (!_accepts_gzip (message));
+
+	soup_message_headers_replace (headers, "Accept-Encoding", "deflate, GZIP;q=0.5");
+	ck_assert (_accepts_gzip (message));
+
+	g_object_unref (message);
+}
+END_TEST
+
+START_TEST(_databases_items_listing_gzip_test)
+{
+	DmapShare *share;
+	SoupServerMessage *message;
+	SoupMessageHeaders *headers;
+	GHashTable *query;
+	GBytes *sent, *plain, *cached;
+	GNode *root;
+	const guint8 *data;
+	gsize length;
+	guint i;
+
+	share = _build_share_test ("_databases_items_listing_gzip_test", 100);
+	g_object_set (share, "response-cache-size", (guint64) 1024 * 1024,
+	              "compress-responses", TRUE, NULL);
+
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "all");
+
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	soup_message_headers_append (soup_server_message_get_request_headers (message),
+	                             "Accept-Encoding", "gzip, deflate");
+
+	_databases_items_listing (share, message, query, "items");
+
+	headers = soup_server_message_get_response_headers (message);
+	ck_assert_str_eq ("gzip", soup_message_headers_get_one (headers, "Content-Encoding"));
+	ck_assert_int_eq (SOUP_ENCODING_CHUNKED, soup_message_headers_get_encoding (headers));
+
+	/* One more chunk than usual carries the gzip trailer. */
+	g_signal_emit_by_name (message, "wrote_headers", NULL);
+	for (i = 0; i < 100 + 2; i++) {
+		g_signal_emit_by_name (message, "wrote_chunk", NULL);
+	}
+	g_signal_emit_by_name (message, "finished", NULL);
+
+	soup_message_body_set_accumulate (soup_server_message_get_response_body (message), TRUE);
+	sent = soup_message_body_flatten (soup_server_message_get_response_body (message));
+	g_object_unref (message);
+
+	plain = _gunzip_test (sent);
+	ck_assert (g_bytes_get_size (sent) < g_bytes_get_size (plain));
+
+	data = g_bytes_get_data (plain, &length);
+	root = dmap_structure_parse (data, length, NULL);
+	ck_assert (NULL != root);
+	ck_assert_int_eq (100, g_node_n_children (dmap_structure_find_node (root, DMAP_CC_MLCL)));
+	dmap_structure_destroy (root);
+
+	/* The gzipped body is cached, but only for clients which take it. */
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	ck_assert (!_response_cache_serve (share, message, "items"));
+	g_object_unref (message);
+
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	soup_message_headers_append (soup_server_message_get_request_headers (message),
+	                             "Accept-Encoding", "gzip");
+	ck_assert (_response_cache_serve (share, message, "items"));
+	ck_assert_str_eq ("gzip", soup_message_headers_get_one
+		(soup_server_message_get_response_headers (message), "Content-Encoding"));
+	cached = soup_message_body_flatten (soup_server_message_get_response_body (message));
+	ck_assert (g_bytes_equal (sent, cached));
+	g_object_unref (message);
+
+	g_bytes_unref (sent);
+	g_bytes_unref (plain);
+	g_bytes_unref (cached);
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_databases_items_listing_batch_test)
+{
+	DmapShare *share;
+	SoupServerMessage *message;
+	SoupMessageBody *body;
+	GHashTable *query;
+	GBytes *buffer;
+	goffset content_length;
+
+	share = _build_share_test ("_databases_items_listing_batch_test", 100);
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "all");
+
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+
+	_databases_items_listing (share, message, query, NULL);
+
+	content_length = soup_message_headers_get_content_length (
+		soup_server_message_get_response_headers (message));
+	ck_assert (content_length < DMAP_SHARE_MLIT_CHUNK_SIZE);
+
+	/* All 100 records fit in one chunk. */
+	g_signal_emit_by_name (message, "wrote_headers", NULL);
+	g_signal_emit_by_name (message, "wrote_chunk", NULL);
+
+	body = soup_server_message_get_response_body (message);
+	soup_message_body_set_accumulate (body, TRUE);
+	buffer = soup_message_body_flatten (body);
+
+	ck_assert_int_eq (content_length, g_bytes_get_size (buffer));
+
+	g_signal_emit_by_name (message, "finished", NULL);
+
+	g_bytes_unref (buffer);
+	g_object_unref (message);
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_parse_meta_cached_test)
+{
+	DmapShare *share;
+	GHashTable *query;
+	DmapBits bits;
+
+	share = _build_share_test ("_parse_meta_cached_test", 0);
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "dmap.itemid,daap.songartist");
+
+	bits = _parse_meta (share, query);
+	ck_assert_int_eq (1, g_hash_table_size (share->priv->meta_bits));
+	ck_assert (bits == _parse_meta (share, query));
+	ck_assert_int_eq (1, g_hash_table_size (share->priv->meta_bits));
+
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_get_emitters_test)
+{
+	DmapShare *share;
+	GHashTable *query;
+	GArray *emitters;
+	DmapBits bits;
+
+	share = _build_share_test ("_get_emitters_test", 0);
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "daap.songartist,dmap.itemid");
+
+	bits = _parse_meta (share, query);
+	emitters = dmap_share_get_emitters (share, bits);
+
+	/* Two fields and the terminator, compiled once. */
+	ck_assert_int_eq (3, emitters->len);
+	ck_assert (NULL == g_array_index (emitters, DmapShareEmitter, 2).emit);
+	ck_assert_ptr_eq (emitters, dmap_share_get_emitters (share, bits));
+
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_databases_items_listing_wire_order_test)
+{
+	DmapShare *share;
+	GHashTable *query;
+	GNode *root, *mlit;
+
+	share = _build_share_test ("_databases_items_listing_wire_order_test", 1);
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "daap.songartist,dmap.itemid");
+
+	root = _run_items_listing_test (share, query, 1);
+
+	/* Fields go out in the share's order, not the request's. */
+	mlit = dmap_structure_find_node (root, DMAP_CC_MLCL)->children;
+	ck_assert_int_eq (2, g_node_n_children (mlit));
+	ck_assert_int_eq (DMAP_CC_MIID, ((DmapStructureItem *)
+	                  g_node_nth_child (mlit, 0)->data)->content_code);
+	ck_assert_int_eq (DMAP_CC_ASAR, ((DmapStructureItem *)
+	                  g_node_nth_child (mlit, 1)->data)->content_code);
+
+	dmap_structure_destroy (root);
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_databases_items_listing_parallel_test)
+{
+	DmapShare *share;
+	GHashTable *query;
+	GBytes *serial, *parallel;
+	guint num_records = DMAP_SHARE_PARALLEL_MIN_ITEMS * 3;
+
+	share = _build_share_with_db_test ("_databases_items_listing_parallel_test",
+	                                   DMAP_DB (dmap_memory_db_new ()),
+	                                   num_records);
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "all");
+
+	serial = _items_listing_body_test (share, query, num_records);
+
+	g_object_set (share, "encoder-threads", 4, NULL);
+	parallel = _items_listing_body_test (share, query, num_records);
+	ck_assert (NULL != share->priv->encoder_pool);
+
+	/* The segments go back together in order. */
+	ck_assert (g_bytes_equal (serial, parallel));
+
+	g_bytes_unref (serial);
+	g_bytes_unref (parallel);
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_databases_items_listing_parallel_finished_test)
+{
+	DmapShare *share;
+	GHashTable *query;
+	SoupServerMessage *message;
+	guint num_records = DMAP_SHARE_PARALLEL_MIN_ITEMS;
+
+	share = _build_share_with_db_test ("_databases_items_listing_parallel_finished_test",
+	                                   DMAP_DB (dmap_memory_db_new ()),
+	                                   num_records);
+	g_object_set (share, "encoder-threads", 2, NULL);
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "all");
+
+	message = g_object_new (SOUP_TYPE_SERVER_MESSAGE, NULL);
+	_databases_items_listing (share, message, query, NULL);
+
+	/* The client goes away before the threads are done. */
+	g_signal_emit_by_name (message, "finished", NULL);
+
+	/* The listing watches for the end of the message until it is
+	 * dropped. */
+	while (g_signal_has_handler_pending (message,
+	                                     g_signal_lookup ("finished",
+	                                                      SOUP_TYPE_SERVER_MESSAGE),
+	                                     0, FALSE)) {
+		g_main_context_iteration (NULL, TRUE);
+	}
+
+	ck_assert_int_eq (SOUP_STATUS_NONE,
+	                  soup_server_message_get_status (message));
+
+	g_object_unref (message);
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+START_TEST(_databases_items_listing_parallel_unsafe_db_test)
+{
+	DmapShare *share;
+	GHashTable *query;
+	GNode *root;
+	guint num_records = DMAP_SHARE_PARALLEL_MIN_ITEMS;
+
+	share = _build_share_test ("_databases_items_listing_parallel_unsafe_db_test",
+	                           num_records);
+	g_object_set (share, "encoder-threads", 4, NULL);
+	query = g_hash_table_new (g_str_hash, g_str_equal);
+	g_hash_table_insert (query, "meta", "dmap.itemid");
+
+	root = _run_items_listing_test (share, query, num_records);
+
+	/* test_dmap_db makes no promise, so no threads were needed. */
+	ck_assert (NULL == share->priv->encoder_pool);
+	ck_assert_int_eq (num_records, g_node_n_children
+	                  (dmap_structure_find_node (root, DMAP_CC_MLCL)));
+
+	dmap_structure_destroy (root);
+	g_hash_table_destroy (query);
+	g_object_unref (share);
+}
+END_TEST
+
+#include "dmap-share-suite.c"
+
+#endif
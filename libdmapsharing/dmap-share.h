@@ -105,6 +105,21 @@ typedef enum {
 	DMAP_SHARE_AUTH_METHOD_PASSWORD = 2
 } DmapShareAuthMethod;
 
+/**
+ * DmapShareChange:
+ * @DMAP_SHARE_CHANGE_ADDED: the record was added.
+ * @DMAP_SHARE_CHANGE_MODIFIED: the record's properties changed.
+ * @DMAP_SHARE_CHANGE_DELETED: the record was deleted.
+ *
+ * How a record in a share's database changed; see
+ * dmap_share_record_changed().
+ */
+typedef enum {
+	DMAP_SHARE_CHANGE_ADDED,
+	DMAP_SHARE_CHANGE_MODIFIED,
+	DMAP_SHARE_CHANGE_DELETED
+} DmapShareChange;
+
 typedef struct {
 	GObjectClass parent;
 
@@ -206,6 +221,34 @@ gboolean dmap_share_serve(DmapShare *share, GError **error);
  */
 gboolean dmap_share_publish(DmapShare *share, GError **error);
 
+/**
+ * dmap_share_bump_revision_number:
+ * @share: a #DmapShare instance.
+ *
+ * Tell the share that its databases have changed. This moves the share
+ * on to a new revision number, so that clients and the share's own caches
+ * do not rely on what they obtained from earlier revisions.
+ */
+void dmap_share_bump_revision_number (DmapShare * share);
+
+/**
+ * dmap_share_record_changed:
+ * @share: a #DmapShare instance.
+ * @id: the ID of the record in the share's database.
+ * @change: how the record changed.
+ *
+ * Tell the share that a record has changed, before the call to
+ * dmap_share_bump_revision_number() which publishes the change. If the
+ * share's "journal-size" is not 0, clients which ask for the changes
+ * since an earlier revision are then sent only the records which changed
+ * and the IDs of those deleted. A revision in which no change was
+ * reported is taken to have changed in ways the share does not know,
+ * and clients which have seen only earlier revisions are sent
+ * everything.
+ */
+void dmap_share_record_changed (DmapShare * share, guint id,
+                                DmapShareChange change);
+
 /**
  * dmap_share_free_filter:
  * @filter: (element-type GSList): The filter list to free.
@@ -18,6 +18,8 @@
  * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA*
  */
 
+#include "config.h"
+
 #include "dmap-error.h"
 #include "dmap-structure.h"
 #include "dmap-private-utils.h"
@@ -369,6 +371,11 @@ static const DmapContentCodeDefinition _cc_defs[] = {
 	{DMAP_CC_CAVC, MAKE_CONTENT_CODE ('c', 'a', 'v', 'c'), "dacp.unknwon",
 	 "cavc", DMAP_TYPE_BYTE},
 
+	{DMAP_CC_AGAR, MAKE_CONTENT_CODE ('a', 'g', 'a', 'r'),
+	 "daap.artistgrouping", "agar", DMAP_TYPE_CONTAINER},
+	{DMAP_CC_AGAC, MAKE_CONTENT_CODE ('a', 'g', 'a', 'c'),
+	 "daap.groupalbumcount", "agac", DMAP_TYPE_INT},
+
 };
 
 static const gchar *
@@ -435,30 +442,295 @@ _cc_gtype (DmapContentCode code, GError **error)
 	return type;
 }
 
+struct _DmapStructureBuilder
+{
+	/* Arena holding the serialized structure, in wire format. */
+	GByteArray *array;
+	/* Offsets of the size fields of containers not yet ended. */
+	GArray *open;
+	/* A sizer only counts; array is then reused as scratch space. */
+	gboolean sizing;
+	gsize size;
+};
+
+DmapStructureBuilder *
+dmap_structure_builder_new (gsize reserve)
+{
+	DmapStructureBuilder *builder;
+
+	builder = g_new0 (DmapStructureBuilder, 1);
+	builder->array = g_byte_array_sized_new (reserve);
+	builder->open = g_array_sized_new (FALSE, FALSE, sizeof (guint), 8);
+
+	return builder;
+}
+
+DmapStructureBuilder *
+dmap_structure_builder_new_sizer (void)
+{
+	DmapStructureBuilder *builder;
+
+	builder = dmap_structure_builder_new (256);
+	builder->sizing = TRUE;
+
+	return builder;
+}
+
+static guint8 *
+_builder_reserve (DmapStructureBuilder * builder, gsize n)
+{
+	guint len = 0;
+
+	if (builder->sizing) {
+		builder->size += n;
+	} else {
+		len = builder->array->len;
+	}
+
+	g_byte_array_set_size (builder->array, len + n);
+
+	return builder->array->data + len;
+}
+
+static guint8 *
+_builder_tag (DmapStructureBuilder * builder, DmapContentCode cc,
+              guint32 size)
+{
+	guint8 *p;
+	guint32 be = GUINT32_TO_BE (size);
+
+	/* One reservation covers the header and the value. */
+	p = _builder_reserve (builder, 8 + size);
+	memcpy (p, _cc_string (cc), 4);
+	memcpy (p + 4, &be, 4);
+
+	return p + 8;
+}
+
+static void
+_builder_append (DmapStructureBuilder * builder, gconstpointer data, gsize n)
+{
+	memcpy (_builder_reserve (builder, n), data, n);
+}
+
+static void
+_builder_header (DmapStructureBuilder * builder, DmapContentCode cc,
+                 guint32 size)
+{
+	guint8 *p;
+
+	if (cc == DMAP_RAW) {
+		return;
+	}
+
+	size = GUINT32_TO_BE (size);
+
+	p = _builder_reserve (builder, 8);
+	memcpy (p, _cc_string (cc), 4);
+	memcpy (p + 4, &size, 4);
+}
+
+static void
+_builder_version (DmapStructureBuilder * builder, gdouble v)
+{
+	gint16 major;
+	gint8 minor;
+	gint8 patch = 0;
+
+	major = (gint16) v;
+	minor = (gint8) (v - ((gdouble) major));
+
+	major = GINT16_TO_BE (major);
+
+	_builder_append (builder, &major, 2);
+	_builder_append (builder, &minor, 1);
+	_builder_append (builder, &patch, 1);
+}
+
+static void
+_builder_begin (DmapStructureBuilder * builder, DmapContentCode cc)
+{
+	guint offset = builder->array->len + 4;
+
+	/* Size is back-patched by dmap_structure_builder_end(). */
+	_builder_header (builder, cc, 0);
+	g_array_append_val (builder->open, offset);
+}
+
+void
+dmap_structure_builder_begin (DmapStructureBuilder * builder,
+                              DmapContentCode cc)
+{
+	_builder_begin (builder, cc);
+}
+
+void
+dmap_structure_builder_add_int8 (DmapStructureBuilder * builder,
+                                 DmapContentCode cc, gint8 value)
+{
+	*_builder_tag (builder, cc, 1) = (guint8) value;
+}
+
+void
+dmap_structure_builder_add_int16 (DmapStructureBuilder * builder,
+                                  DmapContentCode cc, gint16 value)
+{
+	value = GINT16_TO_BE (value);
+	memcpy (_builder_tag (builder, cc, 2), &value, 2);
+}
+
+void
+dmap_structure_builder_add_int32 (DmapStructureBuilder * builder,
+                                  DmapContentCode cc, gint32 value)
+{
+	value = GINT32_TO_BE (value);
+	memcpy (_builder_tag (builder, cc, 4), &value, 4);
+}
+
+void
+dmap_structure_builder_add_int64 (DmapStructureBuilder * builder,
+                                  DmapContentCode cc, gint64 value)
+{
+	value = GINT64_TO_BE (value);
+	memcpy (_builder_tag (builder, cc, 8), &value, 8);
+}
+
+void
+dmap_structure_builder_add_string (DmapStructureBuilder * builder,
+                                   DmapContentCode cc, const gchar * value)
+{
+	gsize size = strlen (value);
+
+	memcpy (_builder_tag (builder, cc, size), value, size);
+}
+
+void
+dmap_structure_builder_add_data (DmapStructureBuilder * builder,
+                                 DmapContentCode cc, gconstpointer data,
+                                 gsize size)
+{
+	if (builder->sizing) {
+		/* Do not copy what may be a whole file just to count it. */
+		builder->size += 8 + size;
+	} else {
+		guint8 *p = _builder_tag (builder, cc, size);
+
+		/* data may be NULL if size is 0, as for a missing thumbnail. */
+		if (size > 0) {
+			memcpy (p, data, size);
+		}
+	}
+}
+
+void
+dmap_structure_builder_add (DmapStructureBuilder * builder,
+                            DmapContentCode cc, ...)
+{
+	va_list list;
+
+	va_start (list, cc);
+
+	/* NOTE: arguments are read just as G_VALUE_COLLECT reads them in
+	 * dmap_structure_add(), so the two are interchangeable. */
+	switch (_cc_dmap_type (cc, NULL)) {
+	case DMAP_TYPE_BYTE:
+	case DMAP_TYPE_SIGNED_INT:{
+			gchar c = (gchar) va_arg (list, gint);
+
+			_builder_header (builder, cc, 1);
+			_builder_append (builder, &c, 1);
+			break;
+		}
+	case DMAP_TYPE_SHORT:{
+			gint16 s = GINT16_TO_BE ((gint16) va_arg (list, gint));
+
+			_builder_header (builder, cc, 2);
+			_builder_append (builder, &s, 2);
+			break;
+		}
+	case DMAP_TYPE_DATE:
+	case DMAP_TYPE_INT:{
+			gint32 i = GINT32_TO_BE (va_arg (list, gint32));
+
+			_builder_header (builder, cc, 4);
+			_builder_append (builder, &i, 4);
+			break;
+		}
+	case DMAP_TYPE_INT64:{
+			gint64 i = GINT64_TO_BE (va_arg (list, gint64));
+
+			_builder_header (builder, cc, 8);
+			_builder_append (builder, &i, 8);
+			break;
+		}
+	case DMAP_TYPE_VERSION:{
+			gdouble v = va_arg (list, gdouble);
+
+			_builder_header (builder, cc, 4);
+			_builder_version (builder, v);
+			break;
+		}
+	case DMAP_TYPE_STRING:{
+			const gchar *s = va_arg (list, gchar *);
+			guint32 size = strlen (s);
+
+			_builder_header (builder, cc, size);
+			_builder_append (builder, s, size);
+			break;
+		}
+	case DMAP_TYPE_POINTER:{
+			gpointer p = va_arg (list, gpointer);
+			gint size = va_arg (list, gint);
+
+			_builder_header (builder, cc, size);
+			_builder_append (builder, p, size);
+			break;
+		}
+	case DMAP_TYPE_CONTAINER:
+		_builder_begin (builder, cc);
+		break;
+	case DMAP_TYPE_INVALID:
+	default:
+		g_warning ("Invalid content code: %d", cc);
+		break;
+	}
+
+	va_end (list);
+}
+
+void
+dmap_structure_builder_end (DmapStructureBuilder * builder)
+{
+	guint offset;
+	guint32 size;
+
+	g_assert (builder->open->len > 0);
+
+	offset = g_array_index (builder->open, guint, builder->open->len - 1);
+	g_array_set_size (builder->open, builder->open->len - 1);
+
+	if (builder->sizing) {
+		return;
+	}
+
+	size = GUINT32_TO_BE (builder->array->len - offset - 4);
+	memcpy (builder->array->data + offset, &size, 4);
+}
+
 static gboolean
-_node_serialize (GNode * node, GByteArray * array)
+_node_serialize (GNode * node, DmapStructureBuilder * builder)
 {
 	DmapStructureItem *item = node->data;
-	DmapType dmap_type;
-	guint32 size = GINT32_TO_BE (item->size);
-
-	if (item->content_code != DMAP_RAW) {
-		g_byte_array_append (array,
-				     (const guint8 *)
-				     _cc_string (item->
-							       content_code),
-				     4);
-		g_byte_array_append (array, (const guint8 *) &size, 4);
-	}
 
-	dmap_type = _cc_dmap_type (item->content_code, NULL);
+	/* Sizes are already known, so nothing needs back-patching. */
+	_builder_header (builder, item->content_code, item->size);
 
-	switch (dmap_type) {
+	switch (_cc_dmap_type (item->content_code, NULL)) {
 	case DMAP_TYPE_BYTE:
 	case DMAP_TYPE_SIGNED_INT:{
 			gchar c = g_value_get_schar (&(item->content));
 
-			g_byte_array_append (array, (const guint8 *) &c, 1);
+			_builder_append (builder, &c, 1);
 
 			break;
 		}
@@ -466,7 +738,7 @@ _node_serialize (GNode * node, GByteArray * array)
 			gint32 i = g_value_get_int (&(item->content));
 			gint16 s = GINT16_TO_BE ((gint16) i);
 
-			g_byte_array_append (array, (const guint8 *) &s, 2);
+			_builder_append (builder, &s, 2);
 
 			break;
 		}
@@ -475,27 +747,14 @@ _node_serialize (GNode * node, GByteArray * array)
 			gint32 i = g_value_get_int (&(item->content));
 			gint32 s = GINT32_TO_BE (i);
 
-			g_byte_array_append (array, (const guint8 *) &s, 4);
+			_builder_append (builder, &s, 4);
 
 			break;
 		}
 	case DMAP_TYPE_VERSION:{
 			gdouble v = g_value_get_double (&(item->content));
-			gint16 major;
-			gint8 minor;
-			gint8 patch = 0;
-
-			major = (gint16) v;
-			minor = (gint8) (v - ((gdouble) major));
 
-			major = GINT16_TO_BE (major);
-
-			g_byte_array_append (array, (const guint8 *) &major,
-					     2);
-			g_byte_array_append (array, (const guint8 *) &minor,
-					     1);
-			g_byte_array_append (array, (const guint8 *) &patch,
-					     1);
+			_builder_version (builder, v);
 
 			break;
 		}
@@ -503,7 +762,7 @@ _node_serialize (GNode * node, GByteArray * array)
 			gint64 i = g_value_get_int64 (&(item->content));
 			gint64 s = GINT64_TO_BE (i);
 
-			g_byte_array_append (array, (const guint8 *) &s, 8);
+			_builder_append (builder, &s, 8);
 
 			break;
 		}
@@ -511,8 +770,7 @@ _node_serialize (GNode * node, GByteArray * array)
 			const gchar *s =
 				g_value_get_string (&(item->content));
 
-			g_byte_array_append (array, (const guint8 *) s,
-					     strlen (s));
+			_builder_append (builder, s, strlen (s));
 
 			break;
 		}
@@ -520,8 +778,7 @@ _node_serialize (GNode * node, GByteArray * array)
 			const gpointer *data =
 				g_value_get_pointer (&(item->content));
 
-			g_byte_array_append (array, (const guint8 *) data,
-					     item->size);
+			_builder_append (builder, data, item->size);
 
 			break;
 		}
@@ -534,46 +791,157 @@ _node_serialize (GNode * node, GByteArray * array)
 	return FALSE;
 }
 
+void
+dmap_structure_builder_add_node (DmapStructureBuilder * builder,
+                                 GNode * structure)
+{
+	if (structure) {
+		g_node_traverse (structure, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
+				 (GNodeTraverseFunc)
+				 _node_serialize, builder);
+	}
+}
+
+void
+dmap_structure_builder_append (DmapStructureBuilder * builder,
+                               gconstpointer data, gsize size)
+{
+	if (builder->sizing) {
+		builder->size += size;
+	} else {
+		_builder_append (builder, data, size);
+	}
+}
+
+gsize
+dmap_structure_builder_get_length (DmapStructureBuilder * builder)
+{
+	return builder->sizing ? builder->size : builder->array->len;
+}
+
+const guint8 *
+dmap_structure_builder_get_data (DmapStructureBuilder * builder)
+{
+	g_assert (!builder->sizing);
+
+	return builder->array->data;
+}
+
 gchar *
-dmap_structure_serialize (GNode * structure, guint * length)
+dmap_structure_builder_finish (DmapStructureBuilder * builder,
+                               guint * length)
 {
-	GByteArray *array;
 	gchar *data;
 
-	array = g_byte_array_new ();
+	g_assert (0 == builder->open->len);
+	g_assert (!builder->sizing);
+
+	*length = builder->array->len;
+	data = (gchar *) g_byte_array_free (builder->array, FALSE);
+
+	g_array_unref (builder->open);
+	g_free (builder);
+
+	return data;
+}
+
+void
+dmap_structure_builder_free (DmapStructureBuilder * builder)
+{
+	if (builder) {
+		g_byte_array_unref (builder->array);
+		g_array_unref (builder->open);
+		g_free (builder);
+	}
+}
+
+gchar *
+dmap_structure_serialize (GNode * structure, guint * length)
+{
+	DmapStructureBuilder *builder;
+	gsize reserve = 0;
 
 	if (structure) {
-		g_node_traverse (structure, G_PRE_ORDER, G_TRAVERSE_ALL, -1,
-				 (GNodeTraverseFunc)
-				 _node_serialize, array);
+		reserve = ((DmapStructureItem *) structure->data)->size + 8;
 	}
 
-	data = (gchar *) array->data;
-	*length = array->len;
-	g_byte_array_free (array, FALSE);
+	builder = dmap_structure_builder_new (reserve);
+	dmap_structure_builder_add_node (builder, structure);
 
-	return data;
+	return dmap_structure_builder_finish (builder, length);
+}
+
+/* Open-addressed index from int_code to the _cc_defs entry, plus one, so
+ * that zero marks an empty slot. It is kept under half full, so a lookup
+ * almost always needs a single probe. */
+#define CC_INDEX_BITS 10
+
+static guint16 _cc_index[1 << CC_INDEX_BITS];
+
+static guint
+_cc_index_slot (gint32 int_code)
+{
+	/* Fibonacci hashing: the top bits of a multiplicative hash. */
+	return ((guint32) int_code * 2654435769u) >> (32 - CC_INDEX_BITS);
+}
+
+static void
+_cc_index_init (void)
+{
+	static gsize initialized = 0;
+
+	G_STATIC_ASSERT (G_N_ELEMENTS (_cc_defs) < G_N_ELEMENTS (_cc_index) / 2);
+
+	if (g_once_init_enter (&initialized)) {
+		guint i;
+
+		for (i = 0; i < G_N_ELEMENTS (_cc_defs); i++) {
+			guint slot = _cc_index_slot (_cc_defs[i].int_code);
+
+			while (0 != _cc_index[slot]) {
+				slot = (slot + 1) % G_N_ELEMENTS (_cc_index);
+			}
+
+			_cc_index[slot] = i + 1;
+		}
+
+		g_once_init_leave (&initialized, 1);
+	}
 }
 
 static DmapContentCode
-_cc_read_from_buffer (const gchar * buf, GError **error)
+_cc_lookup (gint32 c)
 {
 	DmapContentCode cc = DMAP_CC_INVALID;
+	guint slot;
 
-	gint32 c = MAKE_CONTENT_CODE (buf[0], buf[1], buf[2], buf[3]);
-	guint i;
+	_cc_index_init ();
 
-	for (i = 0; i < G_N_ELEMENTS (_cc_defs); i++) {
-		if (_cc_defs[i].int_code == c) {
-			cc = _cc_defs[i].code;
-			goto done;
+	for (slot = _cc_index_slot (c);
+	     0 != _cc_index[slot];
+	     slot = (slot + 1) % G_N_ELEMENTS (_cc_index)) {
+		const DmapContentCodeDefinition *def = &_cc_defs[_cc_index[slot] - 1];
+
+		if (def->int_code == c) {
+			cc = def->code;
+			break;
 		}
 	}
 
-	g_set_error(error, DMAP_ERROR, DMAP_STATUS_INVALID_CONTENT_CODE,
-		   "Invalid content code: %4s", buf);
+	return cc;
+}
+
+static DmapContentCode
+_cc_read_from_buffer (const gchar * buf, GError **error)
+{
+	DmapContentCode cc;
+
+	cc = _cc_lookup (MAKE_CONTENT_CODE (buf[0], buf[1], buf[2], buf[3]));
+	if (cc == DMAP_CC_INVALID) {
+		g_set_error(error, DMAP_ERROR, DMAP_STATUS_INVALID_CONTENT_CODE,
+			   "Invalid content code: %4s", buf);
+	}
 
-done:
 	return cc;
 }
 
@@ -796,6 +1164,120 @@ dmap_structure_parse (const guint8 * buf, gsize buf_length, GError **error)
 	return child;
 }
 
+void
+dmap_structure_cursor_init (DmapStructureCursor * cursor,
+                            const guint8 * buf, gsize length)
+{
+	cursor->pos = buf;
+	cursor->end = buf + length;
+	cursor->content_code = DMAP_CC_INVALID;
+	cursor->data = NULL;
+	cursor->size = 0;
+}
+
+gboolean
+dmap_structure_cursor_next (DmapStructureCursor * cursor, GError ** error)
+{
+	gboolean ok = FALSE;
+	gsize remaining = cursor->end - cursor->pos;
+	guint32 size;
+
+	if (0 == remaining) {
+		goto done;
+	}
+
+	if (remaining < 8) {
+		g_set_error(error, DMAP_ERROR, DMAP_STATUS_RESPONSE_TOO_SHORT,
+			   "Malformed response received");
+		goto done;
+	}
+
+	size = DMAP_READ_UINT32_BE (cursor->pos + 4);
+	if (size > remaining - 8) {
+		g_set_error(error, DMAP_ERROR,
+		            DMAP_STATUS_INVALID_CONTENT_CODE_SIZE,
+			   "Invalid codesize %u received in buffer of length "
+		           "%"G_GSIZE_FORMAT, size, remaining);
+		goto done;
+	}
+
+	/* Unknown tags are not an error; their size is known, so the
+	 * caller may simply skip them. */
+	cursor->content_code = _cc_lookup (MAKE_CONTENT_CODE (cursor->pos[0],
+	                                                      cursor->pos[1],
+	                                                      cursor->pos[2],
+	                                                      cursor->pos[3]));
+	cursor->data = cursor->pos + 8;
+	cursor->size = size;
+	cursor->pos = cursor->data + size;
+
+	ok = TRUE;
+
+done:
+	return ok;
+}
+
+void
+dmap_structure_cursor_enter (const DmapStructureCursor * cursor,
+                             DmapStructureCursor * child)
+{
+	dmap_structure_cursor_init (child, cursor->data, cursor->size);
+}
+
+gint32
+dmap_structure_cursor_get_int (const DmapStructureCursor * cursor)
+{
+	gint32 i = 0;
+
+	/* As in _parse_container_buffer(), a value of the wrong size
+	 * reads as zero. */
+	switch (cursor->size) {
+	case 1:
+		i = (gint8) DMAP_READ_UINT8 (cursor->data);
+		break;
+	case 2:
+		i = (gint16) DMAP_READ_UINT16_BE (cursor->data);
+		break;
+	case 4:
+		i = (gint32) DMAP_READ_UINT32_BE (cursor->data);
+		break;
+	default:
+		break;
+	}
+
+	return i;
+}
+
+gint64
+dmap_structure_cursor_get_int64 (const DmapStructureCursor * cursor)
+{
+	gint64 i = 0;
+
+	if (8 == cursor->size) {
+		i = (gint64) DMAP_READ_UINT64_BE (cursor->data);
+	} else {
+		i = dmap_structure_cursor_get_int (cursor);
+	}
+
+	return i;
+}
+
+const gchar *
+dmap_structure_cursor_get_string (const DmapStructureCursor * cursor,
+                                  gsize * length)
+{
+	const gchar *str = (const gchar *) cursor->data;
+
+	*length = cursor->size;
+
+	if (!g_utf8_validate (str, cursor->size, NULL)) {
+		str = "";
+		*length = 0;
+	}
+
+	return str;
+}
+
 struct NodeFinder
 {
 	DmapContentCode code;
@@ -925,6 +1407,8 @@ dmap_structure_add (GNode * parent, DmapContentCode cc, ...)
 		}
 	}
 
+	va_end (list);
+
 	return node;
 }
 
@@ -1058,3 +1542,256 @@ dmap_structure_increase_by_predicted_size (GNode * structure, guint size)
 {
 	((DmapStructureItem *) structure->data)->size += size;
 }
+
+#ifdef HAVE_CHECK
+
+#include <check.h>
+
+START_TEST(_builder_test)
+{
+	static const guint8 expected[] = {
+		'm', 'l', 'o', 'g', 0x00, 0x00, 0x00, 0x18,
+		'm', 's', 't', 't', 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0xc8,
+		'm', 'l', 'i', 'd', 0x00, 0x00, 0x00, 0x04, 0x00, 0x00, 0x00, 0x2a,
+	};
+	DmapStructureBuilder *builder;
+	gchar *data;
+	guint length;
+
+	builder = dmap_structure_builder_new (0);
+	dmap_structure_builder_add (builder, DMAP_CC_MLOG);
+	dmap_structure_builder_add (builder, DMAP_CC_MSTT, (gint32) 200);
+	dmap_structure_builder_add (builder, DMAP_CC_MLID, (gint32) 42);
+	dmap_structure_builder_end (builder);
+
+	data = dmap_structure_builder_finish (builder, &length);
+
+	ck_assert_int_eq (sizeof expected, length);
+	ck_assert (0 == memcmp (expected, data, length));
+
+	g_free (data);
+}
+END_TEST
+
+START_TEST(_builder_matches_gnode_test)
+{
+	DmapStructureBuilder *builder;
+	GNode *adbs, *mlcl, *mlit;
+	gchar *data1, *data2;
+	guint length1, length2;
+
+	adbs = dmap_structure_add (NULL, DMAP_CC_ADBS);
+	dmap_structure_add (adbs, DMAP_CC_MSTT, (gint32) 200);
+	mlcl = dmap_structure_add (adbs, DMAP_CC_MLCL);
+	mlit = dmap_structure_add (mlcl, DMAP_CC_MLIT);
+	dmap_structure_add (mlit, DMAP_CC_MIKD, (gchar) 2);
+	dmap_structure_add (mlit, DMAP_CC_MPER, (gint64) 1234);
+	dmap_structure_add (mlit, DMAP_CC_MINM, "title");
+	mlit = dmap_structure_add (mlcl, DMAP_CC_MLIT);
+	dmap_structure_add (mlit, DMAP_CC_ASAR, "artist");
+
+	data1 = dmap_structure_serialize (adbs, &length1);
+
+	builder = dmap_structure_builder_new (0);
+	dmap_structure_builder_add (builder, DMAP_CC_ADBS);
+	dmap_structure_builder_add (builder, DMAP_CC_MSTT, (gint32) 200);
+	dmap_structure_builder_add (builder, DMAP_CC_MLCL);
+	dmap_structure_builder_add (builder, DMAP_CC_MLIT);
+	dmap_structure_builder_add (builder, DMAP_CC_MIKD, (gchar) 2);
+	dmap_structure_builder_add (builder, DMAP_CC_MPER, (gint64) 1234);
+	dmap_structure_builder_add (builder, DMAP_CC_MINM, "title");
+	dmap_structure_builder_end (builder);
+	dmap_structure_builder_add (builder, DMAP_CC_MLIT);
+	dmap_structure_builder_add (builder, DMAP_CC_ASAR, "artist");
+	dmap_structure_builder_end (builder);
+	dmap_structure_builder_end (builder);
+	dmap_structure_builder_end (builder);
+
+	data2 = dmap_structure_builder_finish (builder, &length2);
+
+	ck_assert_int_eq (length1, length2);
+	ck_assert (0 == memcmp (data1, data2, length1));
+
+	g_free (data1);
+	g_free (data2);
+	dmap_structure_destroy (adbs);
+}
+END_TEST
+
+static void
+_add_typed (DmapStructureBuilder * builder, gconstpointer pfdt)
+{
+	dmap_structure_builder_begin (builder, DMAP_CC_MLIT);
+	dmap_structure_builder_add_int8 (builder, DMAP_CC_MIKD, 2);
+	dmap_structure_builder_add_int16 (builder, DMAP_CC_ASYR, 1999);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_MIID, -7);
+	dmap_structure_builder_add_int64 (builder, DMAP_CC_MPER, 1234);
+	dmap_structure_builder_add_string (builder, DMAP_CC_MINM, "title");
+	dmap_structure_builder_add_data (builder, DMAP_CC_PFDT, pfdt, 4);
+	dmap_structure_builder_end (builder);
+}
+
+START_TEST(_builder_typed_test)
+{
+	static const guint8 pfdt[] = { 0xde, 0xad, 0xbe, 0xef };
+	DmapStructureBuilder *builder, *sizer;
+	gchar *data1, *data2;
+	guint length1, length2;
+	gsize size;
+
+	builder = dmap_structure_builder_new (0);
+	dmap_structure_builder_add (builder, DMAP_CC_MLIT);
+	dmap_structure_builder_add (builder, DMAP_CC_MIKD, (gchar) 2);
+	dmap_structure_builder_add (builder, DMAP_CC_ASYR, 1999);
+	dmap_structure_builder_add (builder, DMAP_CC_MIID, (gint32) -7);
+	dmap_structure_builder_add (builder, DMAP_CC_MPER, (gint64) 1234);
+	dmap_structure_builder_add (builder, DMAP_CC_MINM, "title");
+	dmap_structure_builder_add (builder, DMAP_CC_PFDT, pfdt, 4);
+	dmap_structure_builder_end (builder);
+	data1 = dmap_structure_builder_finish (builder, &length1);
+
+	builder = dmap_structure_builder_new (0);
+	_add_typed (builder, pfdt);
+	data2 = dmap_structure_builder_finish (builder, &length2);
+
+	sizer = dmap_structure_builder_new_sizer ();
+	_add_typed (sizer, pfdt);
+	size = dmap_structure_builder_get_length (sizer);
+	dmap_structure_builder_free (sizer);
+
+	ck_assert_int_eq (length1, length2);
+	ck_assert_int_eq (length1, size);
+	ck_assert (0 == memcmp (data1, data2, length1));
+
+	g_free (data1);
+	g_free (data2);
+}
+END_TEST
+
+START_TEST(_cc_read_from_buffer_test)
+{
+	guint i;
+
+	for (i = 0; i < G_N_ELEMENTS (_cc_defs); i++) {
+		gchar buf[4];
+
+		buf[0] = _cc_defs[i].int_code & 0xff;
+		buf[1] = (_cc_defs[i].int_code >> 8) & 0xff;
+		buf[2] = (_cc_defs[i].int_code >> 16) & 0xff;
+		buf[3] = (_cc_defs[i].int_code >> 24) & 0xff;
+
+		ck_assert_int_eq (_cc_defs[i].code,
+		                  _cc_read_from_buffer (buf, NULL));
+	}
+}
+END_TEST
+
+START_TEST(_cc_read_from_buffer_invalid_test)
+{
+	GError *error = NULL;
+
+	ck_assert_int_eq (DMAP_CC_INVALID,
+	                  _cc_read_from_buffer ("zzzz", &error));
+	ck_assert (NULL != error);
+	ck_assert_int_eq (DMAP_STATUS_INVALID_CONTENT_CODE, error->code);
+
+	g_error_free (error);
+}
+END_TEST
+
+START_TEST(_cursor_test)
+{
+	DmapStructureBuilder *builder;
+	DmapStructureCursor cursor, adbs, mlcl, mlit;
+	const gchar *str;
+	gchar *data;
+	guint length;
+	gsize size;
+	GError *error = NULL;
+
+	builder = dmap_structure_builder_new (0);
+	dmap_structure_builder_begin (builder, DMAP_CC_ADBS);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_MSTT, 200);
+	dmap_structure_builder_begin (builder, DMAP_CC_MLCL);
+	dmap_structure_builder_begin (builder, DMAP_CC_MLIT);
+	dmap_structure_builder_add_int8 (builder, DMAP_CC_MIKD, -2);
+	dmap_structure_builder_add_int16 (builder, DMAP_CC_ASYR, 1999);
+	dmap_structure_builder_add_int64 (builder, DMAP_CC_MPER, G_MAXINT64);
+	dmap_structure_builder_add_string (builder, DMAP_CC_MINM, "title");
+	dmap_structure_builder_end (builder);
+	dmap_structure_builder_end (builder);
+	dmap_structure_builder_end (builder);
+	data = dmap_structure_builder_finish (builder, &length);
+
+	dmap_structure_cursor_init (&cursor, (guint8 *) data, length);
+	ck_assert (dmap_structure_cursor_next (&cursor, &error));
+	ck_assert_int_eq (DMAP_CC_ADBS, cursor.content_code);
+	ck_assert (!dmap_structure_cursor_next (&cursor, &error));
+	ck_assert (NULL == error);
+
+	dmap_structure_cursor_enter (&cursor, &adbs);
+	ck_assert (dmap_structure_cursor_next (&adbs, &error));
+	ck_assert_int_eq (DMAP_CC_MSTT, adbs.content_code);
+	ck_assert_int_eq (200, dmap_structure_cursor_get_int (&adbs));
+	ck_assert (dmap_structure_cursor_next (&adbs, &error));
+	ck_assert_int_eq (DMAP_CC_MLCL, adbs.content_code);
+
+	dmap_structure_cursor_enter (&adbs, &mlcl);
+	ck_assert (dmap_structure_cursor_next (&mlcl, &error));
+	ck_assert_int_eq (DMAP_CC_MLIT, mlcl.content_code);
+	ck_assert (!dmap_structure_cursor_next (&mlcl, &error));
+
+	dmap_structure_cursor_enter (&mlcl, &mlit);
+	ck_assert (dmap_structure_cursor_next (&mlit, &error));
+	ck_assert_int_eq (-2, dmap_structure_cursor_get_int (&mlit));
+	ck_assert (dmap_structure_cursor_next (&mlit, &error));
+	ck_assert_int_eq (1999, dmap_structure_cursor_get_int (&mlit));
+	ck_assert (dmap_structure_cursor_next (&mlit, &error));
+	ck_assert (G_MAXINT64 == dmap_structure_cursor_get_int64 (&mlit));
+	ck_assert (dmap_structure_cursor_next (&mlit, &error));
+	str = dmap_structure_cursor_get_string (&mlit, &size);
+	ck_assert_int_eq (5, size);
+	ck_assert (0 == strncmp ("title", str, size));
+	ck_assert (!dmap_structure_cursor_next (&mlit, &error));
+	ck_assert (NULL == error);
+
+	g_free (data);
+}
+END_TEST
+
+START_TEST(_cursor_bad_len_test)
+{
+	static const guint8 data[] = "minm\x00\x00\x00\x99Hello, world!";
+	DmapStructureCursor cursor;
+	GError *error = NULL;
+
+	dmap_structure_cursor_init (&cursor, data, sizeof data);
+	ck_assert (!dmap_structure_cursor_next (&cursor, &error));
+	ck_assert (NULL != error);
+	ck_assert_int_eq (DMAP_STATUS_INVALID_CONTENT_CODE_SIZE, error->code);
+
+	g_error_free (error);
+}
+END_TEST
+
+START_TEST(_cursor_unknown_code_test)
+{
+	static const guint8 data[] = "xxxx\x00\x00\x00\x01!"
+	                             "minm\x00\x00\x00\x02hi";
+	DmapStructureCursor cursor;
+	GError *error = NULL;
+
+	/* Exclude the terminating NUL. */
+	dmap_structure_cursor_init (&cursor, data, sizeof data - 1);
+	ck_assert (dmap_structure_cursor_next (&cursor, &error));
+	ck_assert_int_eq (DMAP_CC_INVALID, cursor.content_code);
+	ck_assert (dmap_structure_cursor_next (&cursor, &error));
+	ck_assert_int_eq (DMAP_CC_MINM, cursor.content_code);
+	ck_assert (!dmap_structure_cursor_next (&cursor, &error));
+	ck_assert (NULL == error);
+}
+END_TEST
+
+#include "dmap-structure-suite.c"
+
+#endif
@@ -47,6 +47,86 @@ guint dmap_structure_get_size (GNode * structure);
 void dmap_structure_increase_by_predicted_size (GNode * structure,
 						guint size);
 
+/* A DmapStructureBuilder serializes a structure as it is built: each tag
+ * is appended, in wire format, to a single growing buffer. Containers are
+ * opened by adding them and closed by dmap_structure_builder_end(), which
+ * back-patches their size. dmap_structure_builder_add() takes the same
+ * arguments as dmap_structure_add(). */
+typedef struct _DmapStructureBuilder DmapStructureBuilder;
+
+DmapStructureBuilder *dmap_structure_builder_new (gsize reserve);
+void dmap_structure_builder_add (DmapStructureBuilder * builder,
+                                 DmapContentCode cc, ...);
+void dmap_structure_builder_end (DmapStructureBuilder * builder);
+
+/* Typed helpers write a tag straight to the buffer without looking up the
+ * type of cc, which must match: int8 for BYTE and SIGNED_INT, int16 for
+ * SHORT, int32 for INT and DATE, int64 for INT64, data for POINTER.
+ * Containers are opened by dmap_structure_builder_begin(). */
+void dmap_structure_builder_begin (DmapStructureBuilder * builder,
+                                   DmapContentCode cc);
+void dmap_structure_builder_add_int8 (DmapStructureBuilder * builder,
+                                      DmapContentCode cc, gint8 value);
+void dmap_structure_builder_add_int16 (DmapStructureBuilder * builder,
+                                       DmapContentCode cc, gint16 value);
+void dmap_structure_builder_add_int32 (DmapStructureBuilder * builder,
+                                       DmapContentCode cc, gint32 value);
+void dmap_structure_builder_add_int64 (DmapStructureBuilder * builder,
+                                       DmapContentCode cc, gint64 value);
+void dmap_structure_builder_add_string (DmapStructureBuilder * builder,
+                                        DmapContentCode cc,
+                                        const gchar * value);
+void dmap_structure_builder_add_data (DmapStructureBuilder * builder,
+                                      DmapContentCode cc,
+                                      gconstpointer data, gsize size);
+
+void dmap_structure_builder_add_node (DmapStructureBuilder * builder,
+                                      GNode * structure);
+
+/* Appends bytes already in wire format, such as a cached MLIT. */
+void dmap_structure_builder_append (DmapStructureBuilder * builder,
+                                    gconstpointer data, gsize size);
+
+gsize dmap_structure_builder_get_length (DmapStructureBuilder * builder);
+/* The bytes written so far; not valid for a sizer, and only until the
+ * next call which adds to builder. */
+const guint8 *dmap_structure_builder_get_data (DmapStructureBuilder * builder);
+gchar *dmap_structure_builder_finish (DmapStructureBuilder * builder,
+                                      guint * length);
+void dmap_structure_builder_free (DmapStructureBuilder * builder);
+
+/* A sizer accepts the same calls as a builder but keeps nothing: it only
+ * counts the bytes that would have been written, as reported by
+ * dmap_structure_builder_get_length(). Free it with
+ * dmap_structure_builder_free(). */
+DmapStructureBuilder *dmap_structure_builder_new_sizer (void);
+
+/* A DmapStructureCursor walks serialized DMAP in place, one level at a
+ * time, without building a tree. After dmap_structure_cursor_next()
+ * returns TRUE, content_code, data and size describe the current tag;
+ * content_code is DMAP_CC_INVALID for tags this library does not know.
+ * Values are views into the buffer, which must outlive their use. Strings
+ * are not NUL-terminated. Unlike dmap_structure_parse(), the cursor does
+ * not recognize the untagged (DMAP_RAW) listings of /browse responses. */
+typedef struct {
+	const guint8 *pos;
+	const guint8 *end;
+	DmapContentCode content_code;
+	const guint8 *data;
+	guint32 size;
+} DmapStructureCursor;
+
+void dmap_structure_cursor_init (DmapStructureCursor * cursor,
+                                 const guint8 * buf, gsize length);
+gboolean dmap_structure_cursor_next (DmapStructureCursor * cursor,
+                                     GError ** error);
+void dmap_structure_cursor_enter (const DmapStructureCursor * cursor,
+                                  DmapStructureCursor * child);
+gint32 dmap_structure_cursor_get_int (const DmapStructureCursor * cursor);
+gint64 dmap_structure_cursor_get_int64 (const DmapStructureCursor * cursor);
+const gchar *dmap_structure_cursor_get_string (const DmapStructureCursor *
+                                               cursor, gsize * length);
+
 typedef enum {
 	DMAP_TYPE_BYTE = 0x0001,
 	DMAP_TYPE_SIGNED_INT = 0x0002,
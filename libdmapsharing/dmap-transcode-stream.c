@@ -32,13 +32,15 @@
 #include "gst-util.h"
 
 #define GST_APP_MAX_BUFFERS 1024
-#define DECODED_BUFFER_SIZE 1024 * 128
+#define DECODED_BUFFER_SIZE (1024 * 128)
 #define QUEUE_PUSH_WAIT_SECONDS 10
 #define QUEUE_POP_WAIT_SECONDS 1
 
 struct DmapTranscodeStreamPrivate
 {
-	GQueue *buffer;
+	guint8 *buffer;		/* Ring of DECODED_BUFFER_SIZE bytes */
+	gsize buffer_start;	/* Offset of the oldest byte in buffer */
+	gsize buffer_length;	/* Number of bytes in buffer */
 	gsize read_request;	/* Size of data asked for */
 	gsize write_request;	/* Number of bytes that must be read
 				 * to make room for write */
@@ -48,6 +50,37 @@ struct DmapTranscodeStreamPrivate
 	gboolean buffer_closed;	/* May close before decoding complete */
 };
 
+/* Appends size bytes, which must fit, to the ring. */
+static void
+_buffer_write (DmapTranscodeStreamPrivate * priv, const guint8 * data,
+               gsize size)
+{
+	gsize end, first;
+
+	end = (priv->buffer_start + priv->buffer_length) % DECODED_BUFFER_SIZE;
+	first = MIN (size, DECODED_BUFFER_SIZE - end);
+
+	memcpy (priv->buffer + end, data, first);
+	memcpy (priv->buffer, data + first, size - first);
+
+	priv->buffer_length += size;
+}
+
+/* Removes the oldest count bytes, which must be there, from the ring. */
+static void
+_buffer_read (DmapTranscodeStreamPrivate * priv, guint8 * data, gsize count)
+{
+	gsize first;
+
+	first = MIN (count, DECODED_BUFFER_SIZE - priv->buffer_start);
+
+	memcpy (data, priv->buffer + priv->buffer_start, first);
+	memcpy (data + first, priv->buffer, count - first);
+
+	priv->buffer_start = (priv->buffer_start + count) % DECODED_BUFFER_SIZE;
+	priv->buffer_length -= count;
+}
+
 static goffset
 _tell (G_GNUC_UNUSED GSeekable * seekable)
 {
@@ -158,8 +191,6 @@ void
 dmap_transcode_stream_private_new_buffer_cb (GstElement * element,
                                              DmapTranscodeStream * stream)
 {
-	gsize i;
-	guint8 *ptr;
 	gint64 end_time;
 	GstSample *sample = NULL;
 	GstBuffer *buffer = NULL;
@@ -172,7 +203,7 @@ dmap_transcode_stream_private_new_buffer_cb (GstElement * element,
 	 */
 	g_mutex_lock (&stream->priv->buffer_mutex);
 
-	if (stream->priv->buffer_closed) {
+	if (stream->priv->buffer_closed || NULL == stream->priv->buffer) {
 		g_warning ("Buffer is closed, but unread data remains");
 		goto _return;
 	}
@@ -202,15 +233,15 @@ dmap_transcode_stream_private_new_buffer_cb (GstElement * element,
 		goto _return;
 	}
 
-	/* FIXME: this actually allows buffer to grow larger than max. */
-	if (g_queue_get_length (stream->priv->buffer) + info.size > DECODED_BUFFER_SIZE) {
+	if (stream->priv->buffer_length + info.size > DECODED_BUFFER_SIZE) {
 		stream->priv->write_request = info.size;
 		if (!g_cond_wait_until (&stream->priv->buffer_write_ready,
 		                        &stream->priv->buffer_mutex, end_time)) {
 			g_warning ("Timeout waiting for buffer to empty; will drop");
 		}
 		/* Required again because g_cond_wait_until released mutex. */
-		if (stream->priv->buffer_closed) {
+		if (stream->priv->buffer_closed
+		    || NULL == stream->priv->buffer) {
 			g_warning ("Unread data");
 			goto _return;
 		}
@@ -218,16 +249,12 @@ dmap_transcode_stream_private_new_buffer_cb (GstElement * element,
 		stream->priv->write_request = 0;
 	}
 
-	if (g_queue_get_length (stream->priv->buffer) + info.size <= DECODED_BUFFER_SIZE) {
-		ptr = info.data;
-
-		for (i = 0; i < info.size; i++) {
-			g_queue_push_tail (stream->priv->buffer,
-					   GINT_TO_POINTER ((gint) * ptr++));
-		}
+	/* What still does not fit is dropped. */
+	if (stream->priv->buffer_length + info.size <= DECODED_BUFFER_SIZE) {
+		_buffer_write (stream->priv, info.data, info.size);
 	}
 
-	if (g_queue_get_length (stream->priv->buffer) >= stream->priv->read_request) {
+	if (stream->priv->buffer_length >= stream->priv->read_request) {
 		stream->priv->read_request = 0;
 		g_cond_signal (&stream->priv->buffer_read_ready);
 	}
@@ -284,7 +311,6 @@ _read (GInputStream * stream,
        G_GNUC_UNUSED GCancellable * cancellable,
        G_GNUC_UNUSED GError ** error)
 {
-	gsize i;
 	DmapTranscodeStream *gst_stream = DMAP_TRANSCODE_STREAM (stream);
 	gint64 end_time;
 
@@ -293,25 +319,31 @@ _read (GInputStream * stream,
 	g_mutex_lock (&gst_stream->priv->buffer_mutex);
 
 	gst_stream->priv->read_request = count;
-	if (g_queue_get_length (gst_stream->priv->buffer) < count
-	    && !g_cond_wait_until (&gst_stream->priv->buffer_read_ready,
-	                           &gst_stream->priv->buffer_mutex, end_time)) {
-		/* Timeout: Count is now what's remaining.  Let's hope
-		 * we have enough of a lead on encoding so that this one
-		 * second timeout will go unnoticed.
-		 */
-		g_warning ("Timeout waiting for converted data");
-		/* Depending on timing, more data may have been written
-		 * since check: do not pull more than count:
-		 */
-		count = _min (count, g_queue_get_length (gst_stream->priv->buffer));
+	while (gst_stream->priv->buffer_length < count
+	       && !gst_stream->priv->buffer_closed) {
+		if (!g_cond_wait_until (&gst_stream->priv->buffer_read_ready,
+		                        &gst_stream->priv->buffer_mutex,
+		                        end_time)) {
+			/* Timeout: Count is now what's remaining.  Let's
+			 * hope we have enough of a lead on encoding so that
+			 * this one second timeout will go unnoticed.
+			 */
+			g_warning ("Timeout waiting for converted data");
+			break;
+		}
 	}
 
-	for (i = 0; i < count; i++) {
-		((guint8 *) buffer)[i] =
-			GPOINTER_TO_INT (g_queue_pop_head (gst_stream->priv->buffer));
+	/* Timeouts, spurious wakeups and a close all leave less than was
+	 * asked for: do not pull more than the buffer holds.
+	 */
+	if (NULL == gst_stream->priv->buffer) {
+		count = 0;
+	} else {
+		count = _min (count, gst_stream->priv->buffer_length);
 	}
 
+	_buffer_read (gst_stream->priv, buffer, count);
+
 	if (gst_stream->priv->write_request > count) {
 		gst_stream->priv->write_request -= count;
 	} else {
@@ -354,9 +386,14 @@ _close (GInputStream * stream,
 
 	g_mutex_lock (&gst_stream->priv->buffer_mutex);
 
-	g_queue_free (gst_stream->priv->buffer);
+	g_clear_pointer (&gst_stream->priv->buffer, g_free);
+	gst_stream->priv->buffer_length = 0;
 	gst_stream->priv->buffer_closed = TRUE;
 
+	/* Nothing more will come: wake anyone still waiting. */
+	g_cond_broadcast (&gst_stream->priv->buffer_read_ready);
+	g_cond_broadcast (&gst_stream->priv->buffer_write_ready);
+
 	g_mutex_unlock (&gst_stream->priv->buffer_mutex);
 
 	return TRUE;
@@ -450,7 +487,9 @@ dmap_transcode_stream_init (DmapTranscodeStream * stream)
 {
 	stream->priv = dmap_transcode_stream_get_instance_private(stream);
 
-	stream->priv->buffer = g_queue_new ();
+	stream->priv->buffer = g_malloc (DECODED_BUFFER_SIZE);
+	stream->priv->buffer_start = 0;
+	stream->priv->buffer_length = 0;
 	stream->priv->read_request = 0;
 	stream->priv->write_request = 0;
 	stream->priv->buffer_closed = FALSE;
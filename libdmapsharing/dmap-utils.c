@@ -47,6 +47,110 @@ done:
 	return format;
 }
 
+/* An entry in the pool of interned strings, keyed by str. */
+typedef struct {
+	guint refs;
+	gchar str[];
+} InternedString;
+
+/* Strings longer than this are copied to the heap to be looked up. */
+#define DMAP_UTILS_INTERN_STACK_SIZE 256
+
+G_LOCK_DEFINE_STATIC (_interned);
+static GHashTable *_interned = NULL;
+
+/* Must be called with _interned locked. */
+static const gchar *
+_intern_ref_locked (const gchar * str)
+{
+	InternedString *interned;
+
+	if (NULL == _interned) {
+		_interned = g_hash_table_new_full (g_str_hash, g_str_equal,
+		                                   NULL, g_free);
+	}
+
+	interned = g_hash_table_lookup (_interned, str);
+	if (NULL == interned) {
+		gsize length = strlen (str);
+
+		interned = g_malloc (sizeof (InternedString) + length + 1);
+		interned->refs = 0;
+		memcpy (interned->str, str, length + 1);
+		g_hash_table_insert (_interned, interned->str, interned);
+	}
+
+	interned->refs++;
+
+	return interned->str;
+}
+
+const gchar *
+dmap_utils_intern_ref (const gchar * str)
+{
+	const gchar *interned = NULL;
+
+	if (NULL == str) {
+		goto done;
+	}
+
+	G_LOCK (_interned);
+	interned = _intern_ref_locked (str);
+	G_UNLOCK (_interned);
+
+done:
+	return interned;
+}
+
+const gchar *
+dmap_utils_intern_ref_len (const gchar * str, gsize length)
+{
+	const gchar *interned;
+	gchar buf[DMAP_UTILS_INTERN_STACK_SIZE];
+	gchar *key = buf;
+
+	if (length >= sizeof buf) {
+		key = g_malloc (length + 1);
+	}
+
+	memcpy (key, str, length);
+	key[length] = '\0';
+
+	G_LOCK (_interned);
+	interned = _intern_ref_locked (key);
+	G_UNLOCK (_interned);
+
+	if (key != buf) {
+		g_free (key);
+	}
+
+	return interned;
+}
+
+void
+dmap_utils_intern_unref (const gchar * str)
+{
+	InternedString *interned;
+
+	if (NULL == str) {
+		goto done;
+	}
+
+	G_LOCK (_interned);
+
+	interned = _interned ? g_hash_table_lookup (_interned, str) : NULL;
+	g_assert (NULL != interned && interned->refs > 0);
+
+	if (0 == --interned->refs) {
+		g_hash_table_remove (_interned, str);
+	}
+
+	G_UNLOCK (_interned);
+
+done:
+	return;
+}
+
 #ifdef HAVE_CHECK
 
 #include <check.h>
@@ -81,6 +185,113 @@ START_TEST(_mime_to_format_test_bad)
 }
 END_TEST
 
+static guint
+_intern_refs (const gchar *str)
+{
+	InternedString *interned;
+	guint refs = 0;
+
+	G_LOCK (_interned);
+	interned = _interned ? g_hash_table_lookup (_interned, str) : NULL;
+	if (interned) {
+		refs = interned->refs;
+	}
+	G_UNLOCK (_interned);
+
+	return refs;
+}
+
+START_TEST(_intern_ref_test)
+{
+	gchar *copy = g_strdup ("intern-ref-test");
+	const gchar *a, *b;
+
+	a = dmap_utils_intern_ref ("intern-ref-test");
+	b = dmap_utils_intern_ref (copy);
+
+	ck_assert_str_eq ("intern-ref-test", a);
+	ck_assert_ptr_eq (a, b);
+	ck_assert_ptr_ne (a, copy);
+	ck_assert_int_eq (2, _intern_refs ("intern-ref-test"));
+
+	dmap_utils_intern_unref (a);
+	ck_assert_int_eq (1, _intern_refs ("intern-ref-test"));
+	dmap_utils_intern_unref (b);
+	ck_assert_int_eq (0, _intern_refs ("intern-ref-test"));
+
+	g_free (copy);
+}
+END_TEST
+
+START_TEST(_intern_ref_null_test)
+{
+	ck_assert_ptr_eq (NULL, dmap_utils_intern_ref (NULL));
+	dmap_utils_intern_unref (NULL);
+}
+END_TEST
+
+START_TEST(_intern_ref_len_test)
+{
+	gchar long_str[DMAP_UTILS_INTERN_STACK_SIZE * 2 + 1];
+	const gchar *a, *b, *c, *d;
+
+	/* Not NUL-terminated after the first six bytes. */
+	a = dmap_utils_intern_ref_len ("artistXXX", 6);
+	b = dmap_utils_intern_ref ("artist");
+	ck_assert_str_eq ("artist", a);
+	ck_assert_ptr_eq (a, b);
+
+	memset (long_str, 'x', sizeof long_str - 1);
+	long_str[sizeof long_str - 1] = '\0';
+	c = dmap_utils_intern_ref_len (long_str, sizeof long_str - 1);
+	d = dmap_utils_intern_ref (long_str);
+	ck_assert_ptr_eq (c, d);
+
+	dmap_utils_intern_unref (a);
+	dmap_utils_intern_unref (b);
+	dmap_utils_intern_unref (c);
+	dmap_utils_intern_unref (d);
+	ck_assert_int_eq (0, _intern_refs ("artist"));
+}
+END_TEST
+
+static gpointer
+_intern_thread (gpointer data)
+{
+	guint i;
+
+	for (i = 0; i < 10000; i++) {
+		dmap_utils_intern_unref (dmap_utils_intern_ref (data));
+	}
+
+	return NULL;
+}
+
+START_TEST(_intern_threads_test)
+{
+	GThread *threads[4];
+	const gchar *held;
+	guint i;
+
+	held = dmap_utils_intern_ref ("intern-threads-test");
+
+	for (i = 0; i < G_N_ELEMENTS (threads); i++) {
+		threads[i] = g_thread_new ("intern", _intern_thread,
+		                           "intern-threads-test");
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (threads); i++) {
+		g_thread_join (threads[i]);
+	}
+
+	ck_assert_int_eq (1, _intern_refs ("intern-threads-test"));
+	ck_assert_ptr_eq (held, dmap_utils_intern_ref ("intern-threads-test"));
+
+	dmap_utils_intern_unref (held);
+	dmap_utils_intern_unref (held);
+}
+END_TEST
+
 #include "dmap-utils-suite.c"
 
 #endif
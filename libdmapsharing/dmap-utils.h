@@ -31,5 +31,43 @@
  */
 gchar * dmap_utils_mime_to_format (const gchar * transcode_mimetype);
 
+/**
+ * dmap_utils_intern_ref:
+ * @str: (nullable): a string.
+ *
+ * Looks up @str in libdmapsharing's pool of interned strings, adding a
+ * copy if it is not yet there, and takes a reference to the pooled copy.
+ * Media libraries repeat a few artists, albums, genres and formats
+ * across many records; a record implementation which stores the pooled
+ * copy keeps one copy of each, and two interned strings are equal if
+ * and only if they are the same pointer. The pool may be used from any
+ * thread.
+ *
+ * Returns: (transfer none) (nullable): the interned copy of @str, or
+ * %NULL if @str is %NULL. Release it with dmap_utils_intern_unref().
+ */
+const gchar *dmap_utils_intern_ref (const gchar * str);
+
+/**
+ * dmap_utils_intern_ref_len:
+ * @str: a string, which need not be NUL-terminated.
+ * @length: the length of @str in bytes.
+ *
+ * Like dmap_utils_intern_ref(), but interns the first @length bytes of
+ * @str.
+ *
+ * Returns: (transfer none): the interned copy of @str.
+ */
+const gchar *dmap_utils_intern_ref_len (const gchar * str, gsize length);
+
+/**
+ * dmap_utils_intern_unref:
+ * @str: (nullable): a string returned by dmap_utils_intern_ref().
+ *
+ * Releases a reference to an interned string. The string is removed from
+ * the pool, and freed, when its last reference is released.
+ */
+void dmap_utils_intern_unref (const gchar * str);
+
 G_END_DECLS
 #endif
@@ -14,6 +14,8 @@
 #include <libdmapsharing/dmap-mdns-browser.h>
 #include <libdmapsharing/dmap-mdns-publisher.h>
 #include <libdmapsharing/dmap-mdns-service.h>
+#include <libdmapsharing/dmap-memory-av-record.h>
+#include <libdmapsharing/dmap-memory-db.h>
 #include <libdmapsharing/dmap-record.h>
 #include <libdmapsharing/dmap-record-factory.h>
 #include <libdmapsharing/dmap-share.h>
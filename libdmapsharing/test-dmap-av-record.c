@@ -42,7 +42,7 @@ struct TestDmapAvRecordPrivate {
 	gint32 track;
 	gint32 year;
 	gint8 has_video;
-	guint64 songalbumid;
+	gint64 songalbumid;
 	DmapMediaKind mediakind;
 	GArray *hash;
 };
@@ -149,7 +149,7 @@ test_dmap_av_record_set_property (GObject *object,
                         record->priv->has_video = g_value_get_boolean (value);
                         break;
 		case PROP_SONGALBUMID:
-			record->priv->songalbumid = g_value_get_uint64 (value);
+			record->priv->songalbumid = g_value_get_int64 (value);
 			break;
 		case PROP_MEDIAKIND:
 			record->priv->mediakind = g_value_get_enum (value);
@@ -230,13 +230,13 @@ test_dmap_av_record_get_property (GObject *object,
                         g_value_set_boolean (value, record->priv->has_video);
                         break;
 		case PROP_SONGALBUMID:
-                        g_value_set_uint64 (value, record->priv->songalbumid);
+                        g_value_set_int64 (value, record->priv->songalbumid);
 			break;
 		case PROP_MEDIAKIND:
                         g_value_set_enum (value, record->priv->mediakind);
 			break;
 		case PROP_HASH:
-			g_value_set_boxed (value, g_array_ref(record->priv->hash));
+			g_value_set_boxed (value, record->priv->hash);
 			break;
                 default:
                         G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
@@ -24,9 +24,14 @@
 
 struct TestDmapDbPrivate {
 	GHashTable *db;
+	DmapDbIndex *index;
 	guint nextid;
 };
 
+static const gchar *_indexed[] = {
+	"songgenre", "songartist", "songalbum", "mediakind", NULL
+};
+
 static DmapRecord *
 test_dmap_db_lookup_by_id (const DmapDb *db, guint id)
 {
@@ -70,9 +75,18 @@ test_dmap_db_add (DmapDb *db, DmapRecord *record, G_GNUC_UNUSED GError **error)
 	id = TEST_DMAP_DB (db)->priv->nextid--;
 	g_object_ref (record);
 	g_hash_table_insert (TEST_DMAP_DB (db)->priv->db, GUINT_TO_POINTER (id), record);
+	dmap_db_index_add (TEST_DMAP_DB (db)->priv->index, id, record);
 	return id;
 }
 
+static GArray *
+test_dmap_db_lookup_ids (const DmapDb *db, const gchar *property,
+                         const gchar *value)
+{
+	return dmap_db_index_lookup (TEST_DMAP_DB (db)->priv->index,
+	                             property, value);
+}
+
 static void
 _dmap_db_iface_init (gpointer iface)
 {
@@ -84,6 +98,7 @@ _dmap_db_iface_init (gpointer iface)
 	dmap_db->lookup_by_id = test_dmap_db_lookup_by_id;
 	dmap_db->foreach = test_dmap_db_foreach;
 	dmap_db->count = test_dmap_db_count;
+	dmap_db->lookup_ids = test_dmap_db_lookup_ids;
 }
 
 G_DEFINE_TYPE_WITH_CODE (TestDmapDb, test_dmap_db, G_TYPE_OBJECT, 
@@ -97,6 +112,7 @@ test_dmap_db_init (TestDmapDb *db)
 	db->priv = test_dmap_db_get_instance_private(db);
 
 	db->priv->db = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_object_unref);
+	db->priv->index = dmap_db_index_new (_indexed);
 
 	/* Media ID's start at max and go down.
 	 * Container ID's start at 1 and go up.
@@ -109,6 +125,7 @@ _finalize(GObject *object)
 {
 	TestDmapDb *db = TEST_DMAP_DB(object);
 	g_hash_table_destroy(db->priv->db);
+	dmap_db_index_free(db->priv->index);
 
 	G_OBJECT_CLASS (test_dmap_db_parent_class)->finalize (object);
 }
@@ -0,0 +1,275 @@
+/*
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Measures how long a DAAP share takes to answer a full
+ * /databases/1/items request for libraries of increasing size. Both the
+ * time to the first byte of the body and the time to receive the whole
+ * body are reported, so that any step which does not scale linearly with
+ * the number of records stands out.
+ *
+ * Usage: benchmark-dmap-share [MAX-RECORDS]
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <libsoup/soup.h>
+
+#include <libdmapsharing/dmap.h>
+#include <libdmapsharing/dmap-structure.h>
+#include <libdmapsharing/test-dmap-av-record.h>
+#include <libdmapsharing/test-dmap-db.h>
+#include <libdmapsharing/test-dmap-container-record.h>
+#include <libdmapsharing/test-dmap-container-db.h>
+
+#define META "dmap.itemkind,dmap.itemid,dmap.itemname,dmap.persistentid," \
+             "daap.songalbum,daap.songartist,daap.songgenre,"           \
+             "daap.songformat,daap.songtime,daap.songtracknumber,"      \
+             "daap.songdiscnumber,daap.songyear,daap.songsize,"         \
+             "daap.sortartist,daap.sortalbum,com.apple.itunes.mediakind"
+
+static const guint _sizes[] = { 1000, 5000, 10000, 50000, 100000, 500000 };
+
+typedef struct {
+	GMainLoop *loop;
+	guint port;
+	gint64 first_byte;
+	gint64 complete;
+	gsize length;
+} Run;
+
+static DmapDb *
+_build_db (guint num_records)
+{
+	DmapDb *db;
+	guint i;
+
+	db = DMAP_DB (test_dmap_db_new ());
+
+	for (i = 0; i < num_records; i++) {
+		DmapRecord *record;
+		gchar *title, *artist, *album, *genre;
+
+		title  = g_strdup_printf ("Title %u", i);
+		artist = g_strdup_printf ("Artist %u", i % 500);
+		album  = g_strdup_printf ("Album %u", i % 2000);
+		genre  = g_strdup_printf ("Genre %u", i % 20);
+
+		record = DMAP_RECORD (test_dmap_av_record_new ());
+		g_object_set (record, "title", title,
+		                      "songartist", artist,
+		                      "songalbum", album,
+		                      "songgenre", genre,
+		                      "format", "mp3",
+		                      "duration", 240,
+		                      "track", i % 12 + 1,
+		                      "year", 1970 + i % 50,
+		                      NULL);
+
+		dmap_db_add (db, record, NULL);
+
+		g_object_unref (record);
+		g_free (title);
+		g_free (artist);
+		g_free (album);
+		g_free (genre);
+	}
+
+	return db;
+}
+
+static guint
+_get_port (DmapShare *share)
+{
+	SoupServer *server = NULL;
+	GSList *uris;
+	guint port;
+
+	g_object_get (share, "server", &server, NULL);
+
+	uris = soup_server_get_uris (server);
+	g_assert (NULL != uris);
+
+	port = g_uri_get_port (uris->data);
+
+	g_slist_free_full (uris, (GDestroyNotify) g_uri_unref);
+	g_object_unref (server);
+
+	return port;
+}
+
+static guint32
+_login (SoupSession *session, guint port)
+{
+	gchar *uri;
+	SoupMessage *message;
+	GBytes *body;
+	GNode *root;
+	DmapStructureItem *item;
+	const guint8 *data;
+	gsize length;
+	guint32 session_id;
+	GError *error = NULL;
+
+	uri = g_strdup_printf ("http://127.0.0.1:%u/login", port);
+	message = soup_message_new (SOUP_METHOD_GET, uri);
+
+	body = soup_session_send_and_read (session, message, NULL, &error);
+	if (NULL == body) {
+		g_error ("Login failed: %s", error->message);
+	}
+
+	data = g_bytes_get_data (body, &length);
+	root = dmap_structure_parse (data, length, NULL);
+	item = dmap_structure_find_item (root, DMAP_CC_MLID);
+	g_assert (NULL != item);
+	session_id = (guint32) item->content.data->v_int;
+
+	dmap_structure_destroy (root);
+	g_bytes_unref (body);
+	g_object_unref (message);
+	g_free (uri);
+
+	return session_id;
+}
+
+static gboolean
+_quit (gpointer user_data)
+{
+	g_main_loop_quit (user_data);
+	return FALSE;
+}
+
+static gpointer
+_client (gpointer user_data)
+{
+	Run *run = user_data;
+	SoupSession *session;
+	SoupMessage *message;
+	GInputStream *stream;
+	guint8 *buf;
+	gssize n;
+	guint32 session_id;
+	gchar *uri;
+	gint64 start;
+	GError *error = NULL;
+
+	session = soup_session_new ();
+	session_id = _login (session, run->port);
+
+	uri = g_strdup_printf ("http://127.0.0.1:%u/databases/1/items"
+	                       "?session-id=%u&meta=" META,
+	                        run->port, session_id);
+	message = soup_message_new (SOUP_METHOD_GET, uri);
+	buf = g_malloc (65536);
+
+	start = g_get_monotonic_time ();
+
+	stream = soup_session_send (session, message, NULL, &error);
+	if (NULL == stream) {
+		g_error ("Request failed: %s", error->message);
+	}
+
+	run->length = 0;
+	while ((n = g_input_stream_read (stream, buf, 65536, NULL, &error)) > 0) {
+		if (0 == run->length) {
+			run->first_byte = g_get_monotonic_time () - start;
+		}
+		run->length += n;
+	}
+
+	if (n < 0) {
+		g_error ("Read failed: %s", error->message);
+	}
+
+	run->complete = g_get_monotonic_time () - start;
+
+	g_input_stream_close (stream, NULL, NULL);
+	g_object_unref (stream);
+	g_object_unref (message);
+	g_object_unref (session);
+	g_free (buf);
+	g_free (uri);
+
+	g_idle_add (_quit, run->loop);
+
+	return NULL;
+}
+
+static void
+_run (guint num_records)
+{
+	Run run = { 0 };
+	DmapDb *db;
+	DmapContainerRecord *container_record;
+	DmapContainerDb *container_db;
+	DmapShare *share;
+	GThread *thread;
+	GError *error = NULL;
+
+	db = _build_db (num_records);
+	container_record = DMAP_CONTAINER_RECORD (test_dmap_container_record_new ());
+	container_db = DMAP_CONTAINER_DB (test_dmap_container_db_new (container_record));
+
+	share = DMAP_SHARE (dmap_av_share_new ("benchmark", NULL, db,
+	                                       container_db, NULL));
+	if (!dmap_share_serve (share, &error)) {
+		g_error ("Error starting server: %s", error->message);
+	}
+
+	run.loop = g_main_loop_new (NULL, FALSE);
+	run.port = _get_port (share);
+
+	thread = g_thread_new ("client", _client, &run);
+	g_main_loop_run (run.loop);
+	g_thread_join (thread);
+
+	g_print ("%8u records: first byte %10.3f ms, complete %10.3f ms, "
+	         "%10.3f us/record, %" G_GSIZE_FORMAT " bytes\n",
+	          num_records,
+	          run.first_byte / 1000.0,
+	          run.complete / 1000.0,
+	          (gdouble) run.complete / num_records,
+	          run.length);
+
+	g_main_loop_unref (run.loop);
+	g_object_unref (share);
+	g_object_unref (container_db);
+	g_object_unref (container_record);
+	g_object_unref (db);
+}
+
+int
+main (int argc, char *argv[])
+{
+	guint max = G_MAXUINT;
+	guint i;
+
+	if (argc == 2) {
+		max = strtoul (argv[1], NULL, 10);
+	}
+
+	for (i = 0; i < G_N_ELEMENTS (_sizes) && _sizes[i] <= max; i++) {
+		_run (_sizes[i]);
+	}
+
+	exit (EXIT_SUCCESS);
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Measures how long dmap_structure_parse() takes to parse a synthetic
+ * ADBS response, as a client receives from /databases/1/items, holding
+ * the tags that a typical DAAP client requests for each item.
+ *
+ * Usage: benchmark-dmap-structure [ITEMS [ITERATIONS]]
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <glib.h>
+
+#include <libdmapsharing/dmap.h>
+#include <libdmapsharing/dmap-structure.h>
+
+static gchar *
+_build_adbs (guint num_items, guint * length)
+{
+	DmapStructureBuilder *builder;
+	guint i;
+
+	builder = dmap_structure_builder_new (num_items * 256);
+
+	dmap_structure_builder_begin (builder, DMAP_CC_ADBS);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_MSTT, 200);
+	dmap_structure_builder_add_int8 (builder, DMAP_CC_MUTY, 0);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_MTCO, num_items);
+	dmap_structure_builder_add_int32 (builder, DMAP_CC_MRCO, num_items);
+	dmap_structure_builder_begin (builder, DMAP_CC_MLCL);
+
+	for (i = 0; i < num_items; i++) {
+		gchar *title, *artist, *album, *genre;
+
+		title  = g_strdup_printf ("Title %u", i);
+		artist = g_strdup_printf ("Artist %u", i % 500);
+		album  = g_strdup_printf ("Album %u", i % 2000);
+		genre  = g_strdup_printf ("Genre %u", i % 20);
+
+		dmap_structure_builder_begin (builder, DMAP_CC_MLIT);
+		dmap_structure_builder_add_int8 (builder, DMAP_CC_MIKD, 2);
+		dmap_structure_builder_add_int32 (builder, DMAP_CC_MIID, i + 1);
+		dmap_structure_builder_add_string (builder, DMAP_CC_MINM, title);
+		dmap_structure_builder_add_int64 (builder, DMAP_CC_MPER, i + 1);
+		dmap_structure_builder_add_string (builder, DMAP_CC_ASAL, album);
+		dmap_structure_builder_add_string (builder, DMAP_CC_ASAR, artist);
+		dmap_structure_builder_add_string (builder, DMAP_CC_ASGN, genre);
+		dmap_structure_builder_add_string (builder, DMAP_CC_ASFM, "mp3");
+		dmap_structure_builder_add_int32 (builder, DMAP_CC_ASTM, 240000);
+		dmap_structure_builder_add_int16 (builder, DMAP_CC_ASTN, i % 12 + 1);
+		dmap_structure_builder_add_int16 (builder, DMAP_CC_ASDN, 1);
+		dmap_structure_builder_add_int16 (builder, DMAP_CC_ASYR, 1970 + i % 50);
+		dmap_structure_builder_add_int32 (builder, DMAP_CC_ASSZ, 4000000);
+		dmap_structure_builder_add_string (builder, DMAP_CC_ASSA, artist);
+		dmap_structure_builder_add_string (builder, DMAP_CC_ASSU, album);
+		dmap_structure_builder_add_int8 (builder, DMAP_CC_AEMK, 1);
+		dmap_structure_builder_end (builder);
+
+		g_free (title);
+		g_free (artist);
+		g_free (album);
+		g_free (genre);
+	}
+
+	dmap_structure_builder_end (builder);
+	dmap_structure_builder_end (builder);
+
+	return dmap_structure_builder_finish (builder, length);
+}
+
+int
+main (int argc, char *argv[])
+{
+	guint num_items = 100000;
+	guint iterations = 5;
+	guint length, i;
+	gchar *data;
+	gint64 best = G_MAXINT64;
+
+	if (argc > 1) {
+		num_items = strtoul (argv[1], NULL, 10);
+	}
+
+	if (argc > 2) {
+		iterations = strtoul (argv[2], NULL, 10);
+	}
+
+	data = _build_adbs (num_items, &length);
+
+	for (i = 0; i < iterations; i++) {
+		GNode *root;
+		gint64 start, elapsed;
+		GError *error = NULL;
+
+		start = g_get_monotonic_time ();
+		root = dmap_structure_parse ((const guint8 *) data, length, &error);
+		elapsed = g_get_monotonic_time () - start;
+
+		if (NULL != error) {
+			g_error ("Parse failed: %s", error->message);
+		}
+
+		g_assert (num_items == g_node_n_children
+		          (dmap_structure_find_node (root, DMAP_CC_MLCL)));
+
+		dmap_structure_destroy (root);
+
+		g_print ("%8u items, %u bytes: parsed in %10.3f ms, "
+		         "%8.3f us/item\n",
+		          num_items, length, elapsed / 1000.0,
+		          (gdouble) elapsed / num_items);
+
+		best = MIN (best, elapsed);
+	}
+
+	g_print ("best: %10.3f ms\n", best / 1000.0);
+
+	g_free (data);
+
+	exit (EXIT_SUCCESS);
+}
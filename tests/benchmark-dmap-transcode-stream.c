@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2026 The libdmapsharing authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+/*
+ * Measures how fast decoded data passes through a DmapTranscodeStream:
+ * from the samples its appsink receives, through its buffer, to reads
+ * of the stream, as DmapShare makes when it serves a transcoded song.
+ * An appsrc stands in for the decoder and encoder, so that only the
+ * stream itself is measured.
+ *
+ * Usage: benchmark-dmap-transcode-stream [MEGABYTES [ITERATIONS]]
+ */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+
+#include <libdmapsharing/dmap.h>
+#include <libdmapsharing/dmap-transcode-stream.h>
+#include <libdmapsharing/dmap-transcode-stream-private.h>
+
+/* As an encoder hands them out, and as DmapShare reads them. */
+#define SAMPLE_SIZE 4096
+#define READ_SIZE (32 * 1024)
+
+typedef struct {
+	DmapTranscodeStream parent;
+	GstElement *pipeline;
+	GstElement *src;
+	/* Bytes for the appsrc to send. */
+	guint64 total;
+} BenchmarkStream;
+
+typedef struct {
+	DmapTranscodeStreamClass parent;
+} BenchmarkStreamClass;
+
+static GType benchmark_stream_get_type (void);
+
+G_DEFINE_TYPE (BenchmarkStream, benchmark_stream, DMAP_TYPE_TRANSCODE_STREAM);
+
+static void
+_kill_pipeline (DmapTranscodeStream * stream)
+{
+	BenchmarkStream *benchmark_stream = (BenchmarkStream *) stream;
+
+	gst_element_set_state (benchmark_stream->pipeline, GST_STATE_NULL);
+	gst_object_unref (benchmark_stream->pipeline);
+}
+
+static void
+benchmark_stream_class_init (BenchmarkStreamClass * klass)
+{
+	DMAP_TRANSCODE_STREAM_CLASS (klass)->kill_pipeline = _kill_pipeline;
+}
+
+static void
+benchmark_stream_init (G_GNUC_UNUSED BenchmarkStream * stream)
+{
+}
+
+static BenchmarkStream *
+_stream_new (guint64 total)
+{
+	BenchmarkStream *stream;
+	GstElement *sink;
+
+	stream = g_object_new (benchmark_stream_get_type (), NULL);
+	stream->total = total;
+
+	stream->pipeline = gst_pipeline_new ("pipeline");
+	stream->src = gst_element_factory_make ("appsrc", "src");
+	sink = gst_element_factory_make ("appsink", "sink");
+	g_assert (NULL != stream->src && NULL != sink);
+
+	g_object_set (stream->src, "format", GST_FORMAT_BYTES,
+	                           "block", TRUE, NULL);
+	g_object_set (sink, "emit-signals", TRUE, "sync", FALSE, NULL);
+
+	gst_bin_add_many (GST_BIN (stream->pipeline), stream->src, sink, NULL);
+	if (!gst_element_link (stream->src, sink)) {
+		g_error ("Could not link appsrc to appsink");
+	}
+
+	g_signal_connect (sink, "new-sample",
+	                  G_CALLBACK (dmap_transcode_stream_private_new_buffer_cb),
+	                  stream);
+
+	gst_element_set_state (stream->pipeline, GST_STATE_PLAYING);
+
+	return stream;
+}
+
+static gpointer
+_produce (BenchmarkStream * stream)
+{
+	guint64 sent;
+
+	for (sent = 0; sent < stream->total; sent += SAMPLE_SIZE) {
+		GstBuffer *buffer;
+
+		buffer = gst_buffer_new_allocate (NULL, SAMPLE_SIZE, NULL);
+		gst_buffer_memset (buffer, 0, sent & 0xff, SAMPLE_SIZE);
+
+		if (GST_FLOW_OK != gst_app_src_push_buffer
+		                   (GST_APP_SRC (stream->src), buffer)) {
+			g_error ("Could not push buffer");
+		}
+	}
+
+	gst_app_src_end_of_stream (GST_APP_SRC (stream->src));
+
+	return NULL;
+}
+
+int
+main (int argc, char *argv[])
+{
+	guint megabytes = 64;
+	guint iterations = 5;
+	guint64 total;
+	guint8 *data;
+	gint64 best = G_MAXINT64;
+	guint i;
+
+	gst_init (&argc, &argv);
+
+	if (argc > 1) {
+		megabytes = strtoul (argv[1], NULL, 10);
+	}
+
+	if (argc > 2) {
+		iterations = strtoul (argv[2], NULL, 10);
+	}
+
+	total = (guint64) megabytes * 1024 * 1024;
+	data = g_malloc (READ_SIZE);
+
+	for (i = 0; i < iterations; i++) {
+		BenchmarkStream *stream;
+		GThread *producer;
+		gint64 start, elapsed;
+		guint64 received = 0;
+
+		stream = _stream_new (total);
+
+		start = g_get_monotonic_time ();
+		producer = g_thread_new ("producer", (GThreadFunc) _produce,
+		                         stream);
+
+		while (received < total) {
+			gssize count;
+
+			count = g_input_stream_read (G_INPUT_STREAM (stream),
+			                             data,
+			                             MIN (READ_SIZE,
+			                                  total - received),
+			                             NULL, NULL);
+			if (count <= 0) {
+				g_error ("Stream ended after %" G_GUINT64_FORMAT
+				         " bytes", received);
+			}
+			received += count;
+		}
+
+		elapsed = g_get_monotonic_time () - start;
+		g_thread_join (producer);
+
+		g_input_stream_close (G_INPUT_STREAM (stream), NULL, NULL);
+		g_object_unref (stream);
+
+		g_print ("%8u MB: read in %10.3f ms, %8.3f MB/s\n",
+		         megabytes, elapsed / 1000.0,
+		         megabytes / (elapsed / (gdouble) G_USEC_PER_SEC));
+
+		best = MIN (best, elapsed);
+	}
+
+	g_print ("best: %10.3f ms\n", best / 1000.0);
+
+	g_free (data);
+
+	exit (EXIT_SUCCESS);
+}